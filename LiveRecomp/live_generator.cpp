@@ -2,25 +2,51 @@
 #include <fstream>
 #include <unordered_map>
 #include <cmath>
+#include <array>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <sstream>
+#include <cstring>
+#include <type_traits>
+#include <cstddef>
+#include <cstdlib>
 
 #include "fmt/format.h"
 #include "fmt/ostream.h"
 
 #include "recompiler/live_recompiler.h"
+#include "recompiler/hasher.h"
 #include "recomp.h"
 
 #include "sljitLir.h"
 
+#if defined(__APPLE__) && defined(__aarch64__)
+#include <pthread.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM64))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
 static_assert(sizeof(void*) >= sizeof(sljit_uw), "`void*` must be able to hold a `sljit_uw` value for rewritable jumps!");
 
 constexpr uint64_t rdram_offset = 0xFFFFFFFF80000000ULL;
 
 void N64Recomp::live_recompiler_init() {
-    RabbitizerConfig_Cfg.pseudos.pseudoMove = false;
-    RabbitizerConfig_Cfg.pseudos.pseudoBeqz = false;
-    RabbitizerConfig_Cfg.pseudos.pseudoBnez = false;
-    RabbitizerConfig_Cfg.pseudos.pseudoNot = false;
-    RabbitizerConfig_Cfg.pseudos.pseudoBal = false;
+    // Rabbitizer's config is global, so only write it once in case this gets called while other threads are recompiling.
+    static std::once_flag init_flag;
+    std::call_once(init_flag, [] {
+        RabbitizerConfig_Cfg.pseudos.pseudoMove = false;
+        RabbitizerConfig_Cfg.pseudos.pseudoBeqz = false;
+        RabbitizerConfig_Cfg.pseudos.pseudoBnez = false;
+        RabbitizerConfig_Cfg.pseudos.pseudoNot = false;
+        RabbitizerConfig_Cfg.pseudos.pseudoBal = false;
+    });
 }
 
 namespace Registers {
@@ -33,8 +59,50 @@ namespace Registers {
     constexpr int arithmetic_temp2 = SLJIT_R1;
     constexpr int arithmetic_temp3 = SLJIT_R2;
     constexpr int arithmetic_temp4 = SLJIT_R3;
+    // Address of the current base register in rdram (rdram + base), used to address aligned word and doubleword accesses without relocations.
+    // This stays valid across a run of accesses through the same base register (see N64Recomp::find_memory_runs), so it shares a register
+    // with arithmetic_temp4, which loads and stores that can be part of a run don't use.
+    constexpr int base_address = arithmetic_temp4;
+    // Number of scratch registers after the arithmetic temps that are used to cache GPRs. See GprCache for info.
+    constexpr int num_cached_gprs = std::min(7, SLJIT_NUMBER_OF_REGISTERS - 5 - 4);
+    constexpr int cached_gpr(int slot) {
+        return SLJIT_R(4 + slot);
+    }
 }
 
+// GPRs that get cached in registers, in order of priority (sp, a0, a1, v0, ra, a2, a3). Only the first Registers::num_cached_gprs are used.
+constexpr std::array<int, 7> cached_gpr_indices = { 29, 4, 5, 2, 31, 6, 7 };
+
+// How an operation accesses a GPR.
+enum class GprAccess {
+    Read,
+    Write,
+    ReadWrite,
+};
+
+// Basic block local cache of frequently used GPRs. Cached GPRs are loaded from the context the first time they're read in a block and
+// written back at the end of the block or before anything that may read the context, such as calls.
+// Nothing is cached across calls as the cache uses scratch registers, which also avoids having to reload registers the callee may have modified.
+struct GprCache {
+    enum class State : uint8_t {
+        Unloaded,
+        Clean,
+        Dirty,
+    };
+    sljit_compiler* compiler = nullptr;
+    std::array<State, Registers::num_cached_gprs> states{};
+
+    // Gets the operand for the given GPR, loading it into its cache register if needed. Inputs must be retrieved before outputs,
+    // as retrieving an output marks its register as holding the new value.
+    void get(int gpr, GprAccess access, sljit_sw& out, sljit_sw& outw);
+    // Writes all modified GPRs back to the context, but keeps them cached. Used before conditional branches.
+    void write_back();
+    // Writes all modified GPRs back to the context and clears the cache. Used at the end of a block.
+    void flush();
+    // Clears the cache without writing anything back. Used where code is unreachable, such as the end of a function.
+    void reset();
+};
+
 struct InnerCall {
     size_t target_func_index;
     sljit_jump* jump;
@@ -51,32 +119,99 @@ struct SwitchErrorJump {
     sljit_jump* jump;
 };
 
+struct PendingJump {
+    N64Recomp::Label target;
+    sljit_jump* jump;
+};
+
+// An absolute address in cacheable code, which is either a rewritable call or a constant.
+struct PendingAddressReloc {
+    N64Recomp::LiveAddressType type;
+    uint32_t index;
+    sljit_jump* jump;
+    sljit_const* constant;
+};
+
 struct N64Recomp::LiveGeneratorContext {
     std::string function_name;
-    std::unordered_map<std::string, sljit_label*> labels;
-    std::unordered_map<std::string, std::vector<sljit_jump*>> pending_jumps;
+    // Labels in the current function, indexed by label type (one vector per LabelType) and then by the label's index. Unemitted labels are null.
+    std::array<std::vector<sljit_label*>, 3> labels;
+    // Jumps to labels that hadn't been emitted yet when the jump was, which are resolved at the end of the function.
+    std::vector<PendingJump> pending_jumps;
     std::vector<sljit_label*> func_labels;
     std::vector<InnerCall> inner_calls;
-    std::vector<std::vector<std::string>> switch_jump_labels;
+    // Calls to functions that belong to a different compilation unit. See LiveGeneratorOutput::inner_call_jumps for info.
+    std::vector<InnerCall> external_calls;
+    // Whether each function belongs to this generator's compilation unit, indexed by function index. Empty if all functions do.
+    std::vector<uint8_t> unit_funcs;
+    // Target labels of each switch in the current function.
+    std::vector<std::vector<N64Recomp::Label>> switch_jump_labels;
     // See LiveGeneratorOutput::jump_tables for info. Contains sljit labels so they can be linked after recompilation.
-    std::vector<std::pair<std::vector<sljit_label*>, std::unique_ptr<void*[]>>> unlinked_jump_tables;
+    std::vector<std::pair<std::vector<sljit_label*>, void**>> unlinked_jump_tables;
     // Jump tables for the current function being recompiled.
-    std::vector<std::unique_ptr<void*[]>> pending_jump_tables;
+    std::vector<void**> pending_jump_tables;
     // See LiveGeneratorOutput::reference_symbol_jumps for info.
     std::vector<std::pair<ReferenceJumpDetails, sljit_jump*>> reference_symbol_jumps;
     // See LiveGeneratorOutput::import_jumps_by_index for info.
     std::unordered_multimap<size_t, sljit_jump*> import_jumps_by_index;
     std::vector<SwitchErrorJump> switch_error_jumps;
+    // See LiveGeneratorOutput::address_relocs for info.
+    std::vector<PendingAddressReloc> address_relocs;
+    // See LiveGeneratorOutput::lookup_caches for info.
+    std::vector<N64Recomp::LiveLookupCacheEntry*> lookup_caches;
+    // Number of entries used in the last block of lookup caches.
+    size_t lookup_cache_block_used = 0;
+    // The arena that the output's memory is allocated from. See LiveGeneratorOutput::arena for info.
+    N64Recomp::LiveOutputArena* arena;
+    // See LiveGeneratorOutput::owned_arena for info.
+    std::unique_ptr<N64Recomp::LiveOutputArena> owned_arena;
     sljit_jump* cur_branch_jump;
+    GprCache gprs;
 };
 
+// Number of lookup cache entries in each block of LiveGeneratorOutput::lookup_caches.
+constexpr size_t lookup_cache_block_size = 256;
+
+// Returns the storage for the given label in the current function, allocating it if it doesn't exist yet.
+static sljit_label*& get_label_slot(N64Recomp::LiveGeneratorContext& context, const N64Recomp::Label& label) {
+    std::vector<sljit_label*>& type_labels = context.labels[static_cast<size_t>(label.type)];
+    if (label.index >= type_labels.size()) {
+        type_labels.resize(label.index + 1, nullptr);
+    }
+    return type_labels[label.index];
+}
+
+// Returns the given label in the current function, or null if it hasn't been emitted.
+static sljit_label* find_label(const N64Recomp::LiveGeneratorContext& context, const N64Recomp::Label& label) {
+    const std::vector<sljit_label*>& type_labels = context.labels[static_cast<size_t>(label.type)];
+    if (label.index >= type_labels.size()) {
+        return nullptr;
+    }
+    return type_labels[label.index];
+}
+
 N64Recomp::LiveGenerator::LiveGenerator(size_t num_funcs, const LiveGeneratorInputs& inputs) : inputs(inputs) {
     compiler = sljit_create_compiler(nullptr);
     context = std::make_unique<LiveGeneratorContext>();
     context->func_labels.resize(num_funcs);
+    context->gprs.compiler = compiler;
+    if (inputs.arena != nullptr) {
+        context->arena = inputs.arena;
+    }
+    else {
+        context->owned_arena = std::make_unique<LiveOutputArena>(0);
+        context->arena = context->owned_arena.get();
+    }
     errored = false;
 }
 
+N64Recomp::LiveGenerator::LiveGenerator(size_t num_funcs, const LiveGeneratorInputs& inputs, std::span<const size_t> unit_functions) : LiveGenerator(num_funcs, inputs) {
+    context->unit_funcs.resize(num_funcs, false);
+    for (size_t func_index : unit_functions) {
+        context->unit_funcs[func_index] = true;
+    }
+}
+
 N64Recomp::LiveGenerator::~LiveGenerator() {
     if (compiler != nullptr) {
         sljit_free_compiler(compiler);
@@ -108,9 +243,10 @@ N64Recomp::LiveGeneratorOutput N64Recomp::LiveGenerator::finish() {
     // Generate the switch error jump targets and assign the jump labels.
     if (!context->switch_error_jumps.empty()) {
         // Allocate the function name and place it in the literals.
-        char* func_name = new char[context->function_name.size() + 1];
+        char* func_name = context->arena->allocate_data_array<char>(context->function_name.size() + 1);
         memcpy(func_name, context->function_name.c_str(), context->function_name.size());
         func_name[context->function_name.size()] = '\x00';
+        uint32_t func_name_index = static_cast<uint32_t>(ret.string_literals.size());
         ret.string_literals.emplace_back(func_name);
 
         std::vector<sljit_jump*> switch_error_return_jumps{};
@@ -124,12 +260,12 @@ N64Recomp::LiveGeneratorOutput N64Recomp::LiveGenerator::finish() {
             sljit_set_label(cur_error_jump.jump, sljit_emit_label(compiler));
 
             // Load the arguments (function name, vram, jump table address)
-            sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R0, 0, SLJIT_IMM, sljit_sw(func_name));
+            emit_absolute_address(SLJIT_R0, LiveAddressType::StringLiteral, func_name_index, reinterpret_cast<uintptr_t>(func_name));
             sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R1, 0, SLJIT_IMM, sljit_sw(cur_error_jump.instr_vram));
             sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R2, 0, SLJIT_IMM, sljit_sw(cur_error_jump.jtbl_vram));
             
             // Call switch_error.
-            sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS3V(P, 32, 32), SLJIT_IMM, sljit_sw(inputs.switch_error));
+            emit_callback_call(SLJIT_ARGS3V(P, 32, 32), LiveInputCallback::SwitchError);
 
             // Jump to the return statement.
             switch_error_return_jumps[i] = sljit_emit_jump(compiler, SLJIT_JUMP);
@@ -146,8 +282,8 @@ N64Recomp::LiveGeneratorOutput N64Recomp::LiveGenerator::finish() {
     }
     context->switch_error_jumps.clear();
 
-    // Generate the code.
-    ret.code = sljit_generate_code(compiler, 0, NULL);
+    // Generate the code into the arena.
+    ret.code = sljit_generate_code(compiler, 0, context->arena);
     ret.code_size = sljit_get_generated_code_size(compiler);
     ret.functions.resize(context->func_labels.size());
 
@@ -180,17 +316,44 @@ N64Recomp::LiveGeneratorOutput N64Recomp::LiveGenerator::finish() {
     }
     context->import_jumps_by_index.clear();
 
+    // Get the jump instruction addresses for calls to functions in other compilation units.
+    ret.inner_call_jumps.resize(context->external_calls.size());
+    for (size_t call_index = 0; call_index < context->external_calls.size(); call_index++) {
+        const InnerCall& call = context->external_calls[call_index];
+        ret.inner_call_jumps[call_index] = std::make_pair(call.target_func_index, reinterpret_cast<void*>(call.jump->addr));
+    }
+    context->external_calls.clear();
+
     // Populate label addresses for the jump tables and place them in the output.
     for (auto& [labels, jump_table] : context->unlinked_jump_tables) {
         for (size_t entry_index = 0; entry_index < labels.size(); entry_index++) {
             sljit_label* cur_label = labels[entry_index];
             jump_table[entry_index] = reinterpret_cast<void*>(sljit_get_label_addr(cur_label));
         }
-        ret.jump_tables.emplace_back(std::move(jump_table));
+        ret.jump_tables.emplace_back(jump_table);
+        ret.jump_table_sizes.emplace_back(labels.size());
     }
     context->unlinked_jump_tables.clear();
 
+    // Move the lookup caches into the output.
+    ret.lookup_caches = std::move(context->lookup_caches);
+    context->lookup_caches.clear();
+    context->lookup_cache_block_used = 0;
+
+    // Get the addresses that need to be patched if the output gets loaded from a cache.
+    ret.cacheable = inputs.cacheable_output;
+    ret.address_relocs.resize(context->address_relocs.size());
+    for (size_t reloc_index = 0; reloc_index < context->address_relocs.size(); reloc_index++) {
+        const PendingAddressReloc& reloc = context->address_relocs[reloc_index];
+        bool is_call = reloc.jump != nullptr;
+        void* addr = is_call ? reinterpret_cast<void*>(reloc.jump->addr) : reinterpret_cast<void*>(sljit_get_const_addr(reloc.constant));
+        ret.address_relocs[reloc_index] = LiveAddressReloc{ .type = reloc.type, .is_call = is_call, .index = reloc.index, .addr = addr };
+    }
+    context->address_relocs.clear();
+
     ret.executable_offset = sljit_get_executable_offset(compiler);
+    ret.arena = context->arena;
+    ret.owned_arena = std::move(context->owned_arena);
 
     sljit_free_compiler(compiler);
     compiler = nullptr;
@@ -199,10 +362,113 @@ N64Recomp::LiveGeneratorOutput N64Recomp::LiveGenerator::finish() {
     return ret;
 }
 
-N64Recomp::LiveGeneratorOutput::~LiveGeneratorOutput() {
-    if (code != nullptr) {
-        sljit_free_code(code, nullptr);
-        code = nullptr;
+// Code can only be packed with sljit's default allocator, as the others track the executable offset or page protection of each allocation.
+#if (defined SLJIT_PROT_EXECUTABLE_ALLOCATOR && SLJIT_PROT_EXECUTABLE_ALLOCATOR) || (defined SLJIT_WX_EXECUTABLE_ALLOCATOR && SLJIT_WX_EXECUTABLE_ALLOCATOR)
+constexpr bool live_arena_packs_code = false;
+#else
+constexpr bool live_arena_packs_code = true;
+#endif
+
+// Alignment of each output's code within a block, which keeps the start of the code on its own cache line.
+constexpr size_t live_arena_code_alignment = 64;
+
+N64Recomp::LiveOutputArena::LiveOutputArena(size_t block_size) : block_size(block_size), pack_code(live_arena_packs_code && block_size != 0) {}
+
+N64Recomp::LiveOutputArena::~LiveOutputArena() {
+    reset();
+}
+
+void N64Recomp::LiveOutputArena::reset() {
+    std::lock_guard lock{ mutex };
+    for (const Block& block : code_blocks) {
+        sljit_free_exec(block.memory);
+    }
+    for (const Block& block : data_blocks) {
+        delete[] static_cast<uint8_t*>(block.memory);
+    }
+    bool freed_shared_blocks = block_size != 0 && !code_blocks.empty();
+    code_blocks.clear();
+    data_blocks.clear();
+
+    // Give the freed blocks back to the system, as an arena that's being reset usually held a whole mod's worth of code.
+    if (freed_shared_blocks) {
+        sljit_free_unused_memory_exec();
+    }
+}
+
+N64Recomp::LiveOutputArenaStats N64Recomp::LiveOutputArena::get_stats() const {
+    std::lock_guard lock{ mutex };
+    LiveOutputArenaStats ret{};
+    for (const Block& block : code_blocks) {
+        ret.code_reserved += block.size;
+        ret.code_used += block.used;
+    }
+    for (const Block& block : data_blocks) {
+        ret.data_reserved += block.size;
+        ret.data_used += block.used;
+    }
+    ret.num_code_blocks = code_blocks.size();
+    ret.num_data_blocks = data_blocks.size();
+    return ret;
+}
+
+void* N64Recomp::LiveOutputArena::allocate_from_blocks(std::vector<Block>& blocks, size_t block_size, size_t size, size_t alignment, void* (*allocate_block)(size_t size)) {
+    if (!blocks.empty()) {
+        Block& last_block = blocks.back();
+        size_t offset = (last_block.used + alignment - 1) & ~(alignment - 1);
+        if (block_size != 0 && offset + size <= last_block.size) {
+            last_block.used = offset + size;
+            return static_cast<uint8_t*>(last_block.memory) + offset;
+        }
+    }
+
+    // Allocations that don't fit in a regular block get their own, which goes before the last block so that its remaining space can still be used.
+    bool dedicated = block_size == 0 || size > block_size;
+    size_t new_block_size = dedicated ? size : block_size;
+    void* memory = allocate_block(new_block_size);
+    if (memory == nullptr) {
+        return nullptr;
+    }
+    Block new_block{ .memory = memory, .size = new_block_size, .used = size };
+    if (dedicated && !blocks.empty()) {
+        blocks.insert(blocks.end() - 1, new_block);
+    }
+    else {
+        blocks.push_back(new_block);
+    }
+    return memory;
+}
+
+void* N64Recomp::LiveOutputArena::allocate_code(size_t size) {
+    std::lock_guard lock{ mutex };
+    void* ret = allocate_from_blocks(code_blocks, pack_code ? block_size : 0, size, live_arena_code_alignment,
+        [](size_t size) { return sljit_malloc_exec(size); });
+#if defined(__APPLE__) && defined(__aarch64__)
+    // sljit expects the memory to be writable by this thread, which it normally ensures while allocating.
+    pthread_jit_write_protect_np(0);
+#endif
+    return ret;
+}
+
+void* N64Recomp::LiveOutputArena::allocate_data(size_t size, size_t alignment) {
+    assert(alignment <= alignof(std::max_align_t));
+    std::lock_guard lock{ mutex };
+    return allocate_from_blocks(data_blocks, block_size, std::max<size_t>(size, 1), alignment,
+        [](size_t size) -> void* { return new uint8_t[size](); });
+}
+
+// Executable memory hooks for sljit, see sljitConfigPre.h.
+extern "C" void* live_recomp_malloc_exec(size_t size, void* exec_allocator_data) {
+    if (exec_allocator_data != nullptr) {
+        return static_cast<N64Recomp::LiveOutputArena*>(exec_allocator_data)->allocate_code(size);
+    }
+    return sljit_malloc_exec(size);
+}
+
+extern "C" void live_recomp_free_exec(void* ptr, void* exec_allocator_data) {
+    // Code that was allocated from an arena is only freed along with the arena.
+    if (exec_allocator_data == nullptr) {
+        sljit_free_exec(ptr);
     }
 }
 
@@ -226,6 +492,48 @@ void N64Recomp::LiveGeneratorOutput::populate_import_symbol_jumps(size_t import_
     }
 }
 
+bool N64Recomp::LiveGeneratorOutput::populate_inner_call_jumps(std::span<recomp_func_t* const> all_functions) {
+    for (const auto& [target_func_index, jump_addr] : inner_call_jumps) {
+        if (target_func_index >= all_functions.size() || all_functions[target_func_index] == nullptr) {
+            return false;
+        }
+        sljit_set_jump_addr(reinterpret_cast<sljit_uw>(jump_addr), reinterpret_cast<sljit_uw>(all_functions[target_func_index]), executable_offset);
+    }
+    return true;
+}
+
+size_t N64Recomp::LiveGeneratorBatchOutput::num_reference_symbol_jumps() const {
+    if (unit_reference_symbol_jump_starts.empty()) {
+        return 0;
+    }
+    return unit_reference_symbol_jump_starts.back();
+}
+
+// Finds the unit that contains the given batch-wide reference symbol jump index and converts the index to be relative to that unit.
+static size_t find_reference_symbol_jump_unit(const std::vector<size_t>& unit_starts, size_t& jump_index) {
+    // Find the first unit that starts after the jump, then step back to get the unit containing it.
+    auto find_it = std::upper_bound(unit_starts.begin(), unit_starts.end(), jump_index);
+    size_t unit_index = (find_it - unit_starts.begin()) - 1;
+    jump_index -= unit_starts[unit_index];
+    return unit_index;
+}
+
+void N64Recomp::LiveGeneratorBatchOutput::set_reference_symbol_jump(size_t jump_index, recomp_func_t* func) {
+    size_t unit_index = find_reference_symbol_jump_unit(unit_reference_symbol_jump_starts, jump_index);
+    unit_outputs[unit_index].set_reference_symbol_jump(jump_index, func);
+}
+
+N64Recomp::ReferenceJumpDetails N64Recomp::LiveGeneratorBatchOutput::get_reference_symbol_jump_details(size_t jump_index) {
+    size_t unit_index = find_reference_symbol_jump_unit(unit_reference_symbol_jump_starts, jump_index);
+    return unit_outputs[unit_index].get_reference_symbol_jump_details(jump_index);
+}
+
+void N64Recomp::LiveGeneratorBatchOutput::populate_import_symbol_jumps(size_t import_index, recomp_func_t* func) {
+    for (LiveGeneratorOutput& unit_output : unit_outputs) {
+        unit_output.populate_import_symbol_jumps(import_index, func);
+    }
+}
+
 constexpr int get_gpr_context_offset(int gpr_index) {
     return offsetof(recomp_context, r0) + sizeof(recomp_context::r0) * gpr_index;
 }
@@ -266,32 +574,75 @@ constexpr int get_fpr_u64_context_offset(int fpr_index) {
     return offsetof(recomp_context, f0.u64) + sizeof(recomp_context::f0) * fpr_index;
 }
 
-void get_gpr_values(int gpr, sljit_sw& out, sljit_sw& outw) {
+constexpr int get_gpr_cache_slot(int gpr) {
+    for (int slot = 0; slot < Registers::num_cached_gprs; slot++) {
+        if (cached_gpr_indices[slot] == gpr) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+void GprCache::get(int gpr, GprAccess access, sljit_sw& out, sljit_sw& outw) {
     if (gpr == 0) {
         out = SLJIT_IMM;
         outw = 0;
+        return;
     }
-    else {
+
+    int slot = get_gpr_cache_slot(gpr);
+    if (slot == -1) {
         out = SLJIT_MEM1(Registers::ctx);
         outw = get_gpr_context_offset(gpr);
+        return;
+    }
+
+    // Load the GPR if its current value is needed and it hasn't been loaded in this block yet.
+    if (access != GprAccess::Write && states[slot] == State::Unloaded) {
+        sljit_emit_op1(compiler, SLJIT_MOV, Registers::cached_gpr(slot), 0, SLJIT_MEM1(Registers::ctx), get_gpr_context_offset(gpr));
+        states[slot] = State::Clean;
+    }
+    if (access != GprAccess::Read) {
+        states[slot] = State::Dirty;
+    }
+
+    out = Registers::cached_gpr(slot);
+    outw = 0;
+}
+
+void GprCache::write_back() {
+    for (int slot = 0; slot < Registers::num_cached_gprs; slot++) {
+        if (states[slot] == State::Dirty) {
+            sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_MEM1(Registers::ctx), get_gpr_context_offset(cached_gpr_indices[slot]), Registers::cached_gpr(slot), 0);
+            states[slot] = State::Clean;
+        }
     }
 }
 
+void GprCache::flush() {
+    write_back();
+    reset();
+}
+
+void GprCache::reset() {
+    states.fill(State::Unloaded);
+}
+
 bool get_operand_values(N64Recomp::Operand operand, const N64Recomp::InstructionContext& context, sljit_sw& out, sljit_sw& outw,
-    sljit_compiler* compiler, int odd_float_address_register
+    sljit_compiler* compiler, int odd_float_address_register, GprCache& gprs, GprAccess access
 )
 {
     using namespace N64Recomp;
 
     switch (operand) {
         case Operand::Rd:
-            get_gpr_values(context.rd, out, outw);
+            gprs.get(context.rd, access, out, outw);
             break;
         case Operand::Rs:
-            get_gpr_values(context.rs, out, outw);
+            gprs.get(context.rs, access, out, outw);
             break;
         case Operand::Rt:
-            get_gpr_values(context.rt, out, outw);
+            gprs.get(context.rt, access, out, outw);
             break;
         case Operand::Fd:
             out = SLJIT_MEM1(Registers::ctx);
@@ -422,9 +773,13 @@ void N64Recomp::LiveGenerator::process_binary_op(const BinaryOp& op, const Instr
     sljit_sw src1w;
     sljit_sw src2;
     sljit_sw src2w;
-    bool output_good = get_operand_values(op.output, ctx, dst, dstw, compiler, Registers::arithmetic_temp2);
-    bool input0_good = get_operand_values(op.operands.operands[0], ctx, src1, src1w, nullptr, 0);
-    bool input1_good = get_operand_values(op.operands.operands[1], ctx, src2, src2w, nullptr, 0);
+    // Unaligned loads merge the loaded value into the output's existing value, so they also read the output.
+    bool reads_output =
+        op.type == BinaryOpType::LDL || op.type == BinaryOpType::LDR ||
+        op.type == BinaryOpType::LWL || op.type == BinaryOpType::LWR;
+    bool input0_good = get_operand_values(op.operands.operands[0], ctx, src1, src1w, nullptr, 0, context->gprs, GprAccess::Read);
+    bool input1_good = get_operand_values(op.operands.operands[1], ctx, src2, src2w, nullptr, 0, context->gprs, GprAccess::Read);
+    bool output_good = get_operand_values(op.output, ctx, dst, dstw, compiler, Registers::arithmetic_temp2, context->gprs, reads_output ? GprAccess::ReadWrite : GprAccess::Write);
 
     if (!output_good || !input0_good || !input1_good) {
         assert(false);
@@ -432,6 +787,35 @@ void N64Recomp::LiveGenerator::process_binary_op(const BinaryOp& op, const Instr
         return;
     }
 
+    // Aligned loads without relocations go through the base address register, which only needs to be calculated by the first load or store in a run.
+    bool base_address_load = ctx.reloc_type == RelocType::R_MIPS_NONE && src2 == SLJIT_IMM &&
+        (op.type == BinaryOpType::LD || op.type == BinaryOpType::LW || op.type == BinaryOpType::LWU);
+    if (base_address_load) {
+        if (!ctx.reuse_base_address) {
+            sljit_emit_op2(compiler, SLJIT_ADD, Registers::base_address, 0, Registers::rdram, 0, src1, src1w);
+        }
+        if (op.type == BinaryOpType::LD) {
+            // Rotate the loaded doubleword by 32 bits to swap the two words into the right order.
+            sljit_emit_op2(compiler, SLJIT_ROTL, dst, dstw, SLJIT_MEM1(Registers::base_address), src2w, SLJIT_IMM, 32);
+        }
+        else {
+            sljit_s32 load_op = op.type == BinaryOpType::LW ? SLJIT_MOV_S32 : SLJIT_MOV_U32;
+            if (is_fpr_u32l(op.output)) {
+                // lwc1 must only write the low word of the float register, as the high word is the odd register in FR=0 mode.
+                sljit_emit_op1(compiler, SLJIT_MOV32, dst, dstw, SLJIT_MEM1(Registers::base_address), src2w);
+            }
+            else if (dst & SLJIT_MEM) {
+                // A 32-bit move into memory would only write the low word of the destination, so load into a temp and write the full value from it.
+                sljit_emit_op1(compiler, load_op, Registers::arithmetic_temp1, 0, SLJIT_MEM1(Registers::base_address), src2w);
+                sljit_emit_op1(compiler, SLJIT_MOV, dst, dstw, Registers::arithmetic_temp1, 0);
+            }
+            else {
+                sljit_emit_op1(compiler, load_op, dst, dstw, SLJIT_MEM1(Registers::base_address), src2w);
+            }
+        }
+        return;
+    }
+
     // If a relocation is present, perform the relocation and change src1/src1w to use the relocated value.
     if (ctx.reloc_type != RelocType::R_MIPS_NONE) {
         // Only allow LO16 relocations.
@@ -521,7 +905,9 @@ void N64Recomp::LiveGenerator::process_binary_op(const BinaryOp& op, const Instr
         sljit_emit_fop2(this->compiler, op, dst, dstw, src1, src1w, src2, src2w);
     };
 
-    auto do_load_op = [dst, dstw, src1, src1w, src2, src2w, this](sljit_s32 op, int address_xor) {
+    // Only write 32 bits to the output if it's a float u32l operand.
+    sljit_s32 load_store_op = is_fpr_u32l(op.output) ? SLJIT_MOV32 : SLJIT_MOV;
+    auto do_load_op = [dst, dstw, src1, src1w, src2, src2w, load_store_op, this](sljit_s32 op, int address_xor) {
         // TODO 0 immediate optimization.
 
         // Add the base and immediate into the arithemtic temp.
@@ -536,7 +922,7 @@ void N64Recomp::LiveGenerator::process_binary_op(const BinaryOp& op, const Instr
         sljit_emit_op1(compiler, op, Registers::arithmetic_temp1, 0, SLJIT_MEM2(Registers::rdram, Registers::arithmetic_temp1), 0);
 
         // Move the arithmetic temp into the destination.
-        sljit_emit_op1(compiler, SLJIT_MOV, dst, dstw, Registers::arithmetic_temp1, 0);
+        sljit_emit_op1(compiler, load_store_op, dst, dstw, Registers::arithmetic_temp1, 0);
     };
 
     auto do_compare_op = [cmp_unsigned, dst, dstw, src1, src1w, src2, src2w, this](sljit_s32 op_unsigned, sljit_s32 op_signed) {
@@ -876,12 +1262,139 @@ int64_t do_floor_l_d(double num) {
     return (int64_t)floor(num);
 }
 
+// Reads the host's cycle counter for profiling, or a high resolution timestamp on hosts without one.
+uint64_t live_profile_timestamp() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    return __rdtsc();
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+    return _ReadStatusReg(ARM64_CNTVCT);
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ret;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ret));
+    return ret;
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Helper functions that recompiled code can call. Cacheable outputs refer to these by index, as their addresses can change between runs.
+static const uintptr_t runtime_helpers[] = {
+    reinterpret_cast<uintptr_t>(static_cast<float(*)(float)>(sqrtf)),
+    reinterpret_cast<uintptr_t>(static_cast<double(*)(double)>(sqrt)),
+    reinterpret_cast<uintptr_t>(do_cvt_w_s),
+    reinterpret_cast<uintptr_t>(do_cvt_w_d),
+    reinterpret_cast<uintptr_t>(do_cvt_l_s),
+    reinterpret_cast<uintptr_t>(do_cvt_l_d),
+    reinterpret_cast<uintptr_t>(do_round_w_s),
+    reinterpret_cast<uintptr_t>(do_round_w_d),
+    reinterpret_cast<uintptr_t>(do_round_l_s),
+    reinterpret_cast<uintptr_t>(do_round_l_d),
+    reinterpret_cast<uintptr_t>(do_ceil_w_s),
+    reinterpret_cast<uintptr_t>(do_ceil_w_d),
+    reinterpret_cast<uintptr_t>(do_ceil_l_s),
+    reinterpret_cast<uintptr_t>(do_ceil_l_d),
+    reinterpret_cast<uintptr_t>(do_floor_w_s),
+    reinterpret_cast<uintptr_t>(do_floor_w_d),
+    reinterpret_cast<uintptr_t>(do_floor_l_s),
+    reinterpret_cast<uintptr_t>(do_floor_l_d),
+    reinterpret_cast<uintptr_t>(get_cop1_cs),
+    reinterpret_cast<uintptr_t>(set_cop1_cs),
+    reinterpret_cast<uintptr_t>(live_profile_timestamp),
+};
+
+static uintptr_t get_live_runtime_helper(uint32_t helper_index) {
+    if (helper_index >= std::size(runtime_helpers)) {
+        return 0;
+    }
+    return runtime_helpers[helper_index];
+}
+
+static uintptr_t get_live_input_callback(const N64Recomp::LiveGeneratorInputs& inputs, N64Recomp::LiveInputCallback callback) {
+    switch (callback) {
+        case N64Recomp::LiveInputCallback::Cop0StatusWrite:
+            return reinterpret_cast<uintptr_t>(inputs.cop0_status_write);
+        case N64Recomp::LiveInputCallback::Cop0StatusRead:
+            return reinterpret_cast<uintptr_t>(inputs.cop0_status_read);
+        case N64Recomp::LiveInputCallback::SwitchError:
+            return reinterpret_cast<uintptr_t>(inputs.switch_error);
+        case N64Recomp::LiveInputCallback::DoBreak:
+            return reinterpret_cast<uintptr_t>(inputs.do_break);
+        case N64Recomp::LiveInputCallback::GetFunction:
+            return reinterpret_cast<uintptr_t>(inputs.get_function);
+        case N64Recomp::LiveInputCallback::SyscallHandler:
+            return reinterpret_cast<uintptr_t>(inputs.syscall_handler);
+        case N64Recomp::LiveInputCallback::PauseSelf:
+            return reinterpret_cast<uintptr_t>(inputs.pause_self);
+        case N64Recomp::LiveInputCallback::TriggerEvent:
+            return reinterpret_cast<uintptr_t>(inputs.trigger_event);
+        case N64Recomp::LiveInputCallback::RunHook:
+            return reinterpret_cast<uintptr_t>(inputs.run_hook);
+    }
+    return 0;
+}
+
+void N64Recomp::LiveGenerator::emit_absolute_call(int32_t arg_types, LiveAddressType type, uint32_t index, uintptr_t func) const {
+    // Flush the cached GPRs, as the call clobbers their registers and the callee may access the context. This doesn't
+    // touch the argument registers.
+    context->gprs.flush();
+
+    if (!inputs.cacheable_output) {
+        sljit_emit_icall(compiler, SLJIT_CALL, arg_types, SLJIT_IMM, sljit_sw(func));
+        return;
+    }
+
+    // Emit a rewritable call and record it so that it can be repointed when the output is loaded.
+    sljit_jump* call_jump = sljit_emit_call(compiler, SLJIT_CALL | SLJIT_REWRITABLE_JUMP, arg_types);
+    sljit_set_target(call_jump, sljit_uw(func));
+    context->address_relocs.emplace_back(PendingAddressReloc{ .type = type, .index = index, .jump = call_jump, .constant = nullptr });
+}
+
+void N64Recomp::LiveGenerator::emit_callback_call(int32_t arg_types, LiveInputCallback callback) const {
+    emit_absolute_call(arg_types, LiveAddressType::InputCallback, static_cast<uint32_t>(callback), get_live_input_callback(inputs, callback));
+}
+
+void N64Recomp::LiveGenerator::emit_helper_call(int32_t arg_types, uintptr_t func) const {
+    uint32_t helper_index = 0;
+    if (inputs.cacheable_output) {
+        const uintptr_t* find_it = std::find(std::begin(runtime_helpers), std::end(runtime_helpers), func);
+        if (find_it == std::end(runtime_helpers)) {
+            // Helper is missing from the table.
+            assert(false);
+            errored = true;
+            return;
+        }
+        helper_index = static_cast<uint32_t>(find_it - std::begin(runtime_helpers));
+    }
+    emit_absolute_call(arg_types, LiveAddressType::RuntimeHelper, helper_index, func);
+}
+
+void N64Recomp::LiveGenerator::emit_absolute_address(int reg, LiveAddressType type, uint32_t index, uintptr_t address) const {
+    if (!inputs.cacheable_output) {
+        sljit_emit_op1(compiler, SLJIT_MOV, reg, 0, SLJIT_IMM, sljit_sw(address));
+        return;
+    }
+
+    // Emit the address as a constant and record it so that it can be patched when the output is loaded.
+    sljit_const* constant = sljit_emit_const(compiler, reg, 0, sljit_sw(address));
+    context->address_relocs.emplace_back(PendingAddressReloc{ .type = type, .index = index, .jump = nullptr, .constant = constant });
+}
+
 void N64Recomp::LiveGenerator::load_relocated_address(const InstructionContext& ctx, int reg) const {
     // Get the pointer to the section address.
     int32_t* section_addr_ptr = (ctx.reloc_tag_as_reference ? inputs.reference_section_addresses : inputs.local_section_addresses) + ctx.reloc_section_index;
 
     // Load the section's address into the target register.
-    sljit_emit_op1(compiler, SLJIT_MOV_S32, reg, 0, SLJIT_MEM0(), sljit_sw(section_addr_ptr));
+    if (inputs.cacheable_output) {
+        // Load the pointer to the section address first so that it can be patched.
+        LiveAddressType type = ctx.reloc_tag_as_reference ? LiveAddressType::ReferenceSectionAddress : LiveAddressType::LocalSectionAddress;
+        emit_absolute_address(reg, type, ctx.reloc_section_index, reinterpret_cast<uintptr_t>(section_addr_ptr));
+        sljit_emit_op1(compiler, SLJIT_MOV_S32, reg, 0, SLJIT_MEM1(reg), 0);
+    }
+    else {
+        sljit_emit_op1(compiler, SLJIT_MOV_S32, reg, 0, SLJIT_MEM0(), sljit_sw(section_addr_ptr));
+    }
 
     // Don't emit the add if the offset is zero (small optimization).
     if (ctx.reloc_target_section_offset != 0) {
@@ -907,8 +1420,8 @@ void N64Recomp::LiveGenerator::process_unary_op(const UnaryOp& op, const Instruc
     sljit_sw dstw;
     sljit_sw src;
     sljit_sw srcw;
-    bool output_good = get_operand_values(op.output, ctx, dst, dstw, compiler, Registers::arithmetic_temp3);
-    bool input_good = get_operand_values(op.input, ctx, src, srcw, compiler, Registers::arithmetic_temp3);
+    bool input_good = get_operand_values(op.input, ctx, src, srcw, compiler, Registers::arithmetic_temp3, context->gprs, GprAccess::Read);
+    bool output_good = get_operand_values(op.output, ctx, dst, dstw, compiler, Registers::arithmetic_temp3, context->gprs, GprAccess::Write);
 
     if (!output_good || !input_good) {
         assert(false);
@@ -955,7 +1468,7 @@ void N64Recomp::LiveGenerator::process_unary_op(const UnaryOp& op, const Instruc
         func_float_op = true;
 
         sljit_emit_fop1(compiler, SLJIT_MOV_F32, SLJIT_FR0, 0, src, srcw);
-        sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1(F32, F32), SLJIT_IMM, sljit_sw(func));
+        emit_helper_call(SLJIT_ARGS1(F32, F32), reinterpret_cast<uintptr_t>(func));
         sljit_emit_fop1(compiler, SLJIT_MOV_F32, dst, dstw, SLJIT_RETURN_FREG, 0);
     };
 
@@ -963,7 +1476,7 @@ void N64Recomp::LiveGenerator::process_unary_op(const UnaryOp& op, const Instruc
         func_float_op = true;
 
         sljit_emit_fop1(compiler, SLJIT_MOV_F64, SLJIT_FR0, 0, src, srcw);
-        sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1(F64, F64), SLJIT_IMM, sljit_sw(func));
+        emit_helper_call(SLJIT_ARGS1(F64, F64), reinterpret_cast<uintptr_t>(func));
         sljit_emit_fop1(compiler, SLJIT_MOV_F64, dst, dstw, SLJIT_RETURN_FREG, 0);
     };
 
@@ -971,7 +1484,7 @@ void N64Recomp::LiveGenerator::process_unary_op(const UnaryOp& op, const Instruc
         func_float_op = true;
 
         sljit_emit_fop1(compiler, SLJIT_MOV_F32, SLJIT_FR0, 0, src, srcw);
-        sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1(P, F32), SLJIT_IMM, sljit_sw(func));
+        emit_helper_call(SLJIT_ARGS1(P, F32), reinterpret_cast<uintptr_t>(func));
         sljit_emit_op1(compiler, SLJIT_MOV, dst, dstw, SLJIT_RETURN_REG, 0);
     };
 
@@ -979,7 +1492,7 @@ void N64Recomp::LiveGenerator::process_unary_op(const UnaryOp& op, const Instruc
         func_float_op = true;
 
         sljit_emit_fop1(compiler, SLJIT_MOV_F32, SLJIT_FR0, 0, src, srcw);
-        sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1(32, F32), SLJIT_IMM, sljit_sw(func));
+        emit_helper_call(SLJIT_ARGS1(32, F32), reinterpret_cast<uintptr_t>(func));
         sljit_emit_op1(compiler, SLJIT_MOV_S32, dst, dstw, SLJIT_RETURN_REG, 0);
     };
 
@@ -987,7 +1500,7 @@ void N64Recomp::LiveGenerator::process_unary_op(const UnaryOp& op, const Instruc
         func_float_op = true;
 
         sljit_emit_fop1(compiler, SLJIT_MOV_F64, SLJIT_FR0, 0, src, srcw);
-        sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1(P, F64), SLJIT_IMM, sljit_sw(func));
+        emit_helper_call(SLJIT_ARGS1(P, F64), reinterpret_cast<uintptr_t>(func));
         sljit_emit_op1(compiler, SLJIT_MOV, dst, dstw, SLJIT_RETURN_REG, 0);
     };
 
@@ -995,7 +1508,7 @@ void N64Recomp::LiveGenerator::process_unary_op(const UnaryOp& op, const Instruc
         func_float_op = true;
 
         sljit_emit_fop1(compiler, SLJIT_MOV_F64, SLJIT_FR0, 0, src, srcw);
-        sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1(32, F64), SLJIT_IMM, sljit_sw(func));
+        emit_helper_call(SLJIT_ARGS1(32, F64), reinterpret_cast<uintptr_t>(func));
         sljit_emit_op1(compiler, SLJIT_MOV_S32, dst, dstw, SLJIT_RETURN_REG, 0);
     };
 
@@ -1171,7 +1684,11 @@ void N64Recomp::LiveGenerator::process_store_op(const StoreOp& op, const Instruc
     sljit_sw srcw;
     sljit_sw imm = (sljit_sw)(int16_t)ctx.imm16;
 
-    get_operand_values(op.value_input, ctx, src, srcw, compiler, Registers::arithmetic_temp2);
+    sljit_sw base;
+    sljit_sw basew;
+
+    get_operand_values(op.value_input, ctx, src, srcw, compiler, Registers::arithmetic_temp2, context->gprs, GprAccess::Read);
+    context->gprs.get(ctx.rs, GprAccess::Read, base, basew);
 
     // Only LO16 relocs are valid on stores.
     if (ctx.reloc_type != RelocType::R_MIPS_NONE && ctx.reloc_type != RelocType::R_MIPS_LO16) {
@@ -1180,19 +1697,34 @@ void N64Recomp::LiveGenerator::process_store_op(const StoreOp& op, const Instruc
         return;
     }
 
+    // Aligned stores without relocations go through the base address register, which only needs to be calculated by the first load or store in a run.
+    if (ctx.reloc_type == RelocType::R_MIPS_NONE && (op.type == StoreOpType::SW || op.type == StoreOpType::SD)) {
+        if (!ctx.reuse_base_address) {
+            sljit_emit_op2(compiler, SLJIT_ADD, Registers::base_address, 0, Registers::rdram, 0, base, basew);
+        }
+        if (op.type == StoreOpType::SD) {
+            // Rotate the value by 32 bits to swap the words into the order they're stored in.
+            sljit_emit_op2(compiler, SLJIT_ROTL, SLJIT_MEM1(Registers::base_address), imm, src, srcw, SLJIT_IMM, 32);
+        }
+        else {
+            sljit_emit_op1(compiler, SLJIT_MOV_U32, SLJIT_MEM1(Registers::base_address), imm, src, srcw);
+        }
+        return;
+    }
+
     if (ctx.reloc_type == RelocType::R_MIPS_LO16) {
         // Load the relocated address into temp1.
         load_relocated_address(ctx, Registers::arithmetic_temp1);
         // Extract the LO16 value from the full address (sign extended lower 16 bits).
         sljit_emit_op1(compiler, SLJIT_MOV_S16, Registers::arithmetic_temp1, 0, Registers::arithmetic_temp1, 0);
         // Add the base register (rs) to the LO16 immediate.
-        sljit_emit_op2(compiler, SLJIT_ADD, Registers::arithmetic_temp1, 0, Registers::arithmetic_temp1, 0, SLJIT_MEM1(Registers::ctx), get_gpr_context_offset(ctx.rs));
+        sljit_emit_op2(compiler, SLJIT_ADD, Registers::arithmetic_temp1, 0, Registers::arithmetic_temp1, 0, base, basew);
     }
     else {
         // TODO 0 immediate optimization.
 
         // Add the base register (rs) and the immediate to get the address and store it in the arithemtic temp.
-        sljit_emit_op2(compiler, SLJIT_ADD, Registers::arithmetic_temp1, 0, SLJIT_MEM1(Registers::ctx), get_gpr_context_offset(ctx.rs), SLJIT_IMM, imm);
+        sljit_emit_op2(compiler, SLJIT_ADD, Registers::arithmetic_temp1, 0, base, basew, SLJIT_IMM, imm);
     }
 
     auto do_unaligned_store_op = [src, srcw, this](bool left, bool doubleword) {
@@ -1307,8 +1839,11 @@ void N64Recomp::LiveGenerator::emit_function_start(const std::string& function_n
     context->function_name = function_name;
     context->func_labels[func_index] = sljit_emit_label(compiler);
     // sljit_emit_op0(compiler, SLJIT_BREAKPOINT);
-    sljit_emit_enter(compiler, 0, SLJIT_ARGS2V(P, P), 4 | SLJIT_ENTER_FLOAT(1), 5 | SLJIT_ENTER_FLOAT(0), 0);
+    // When sampling cycles for profiling, the function's start timestamp is kept in a stack local.
+    sljit_s32 local_size = inputs.profile_cycles ? sizeof(uint64_t) : 0;
+    sljit_emit_enter(compiler, 0, SLJIT_ARGS2V(P, P), (4 + Registers::num_cached_gprs) | SLJIT_ENTER_FLOAT(1), 5 | SLJIT_ENTER_FLOAT(0), local_size);
     sljit_emit_op2(compiler, SLJIT_SUB, Registers::rdram, 0, Registers::rdram, 0, SLJIT_IMM, rdram_offset);
+    context->gprs.reset();
     
     // Check if this function's entry is hooked and emit the hook call if so.
     auto find_hook_it = inputs.entry_func_hooks.find(func_index);
@@ -1318,13 +1853,45 @@ void N64Recomp::LiveGenerator::emit_function_start(const std::string& function_n
         sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R1, 0, Registers::ctx, 0);
         // Load the hook's index into R2.
         sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R2, 0, SLJIT_IMM, find_hook_it->second);
-        sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS3V(P, P, W), SLJIT_IMM, sljit_sw(inputs.run_hook));
+        emit_callback_call(SLJIT_ARGS3V(P, P, W), LiveInputCallback::RunHook);
+    }
+}
+
+void N64Recomp::LiveGenerator::emit_profile_entry(size_t func_index) const {
+    if (inputs.profile_counters == nullptr) {
+        // Profiling requires counters to be provided.
+        assert(false);
+        errored = true;
+        return;
+    }
+
+    // Increment the function's call count.
+    emit_absolute_address(SLJIT_R0, LiveAddressType::ProfileCounter, static_cast<uint32_t>(func_index), reinterpret_cast<uintptr_t>(inputs.profile_counters + func_index));
+    sljit_emit_op2(compiler, SLJIT_ADD, SLJIT_MEM1(SLJIT_R0), offsetof(LiveProfileCounter, calls), SLJIT_MEM1(SLJIT_R0), offsetof(LiveProfileCounter, calls), SLJIT_IMM, 1);
+
+    // Record the start timestamp, which gets subtracted from the timestamp at each return.
+    if (inputs.profile_cycles) {
+        emit_helper_call(SLJIT_ARGS0(W), reinterpret_cast<uintptr_t>(live_profile_timestamp));
+        sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_MEM1(SLJIT_SP), 0, SLJIT_RETURN_REG, 0);
     }
 }
 
 void N64Recomp::LiveGenerator::emit_function_end() const {
-    // Check that all jumps have been paired to a label.
-    if (!context->pending_jumps.empty()) {
+    // The end of the function is unreachable, so there's nothing to write back.
+    context->gprs.reset();
+
+    // Resolve the jumps that were emitted before their target labels and check that all of them have a label.
+    bool missing_label = false;
+    for (const PendingJump& pending : context->pending_jumps) {
+        sljit_label* label = find_label(*context, pending.target);
+        if (label == nullptr) {
+            missing_label = true;
+            continue;
+        }
+        sljit_set_label(pending.jump, label);
+    }
+    context->pending_jumps.clear();
+    if (missing_label) {
         assert(false);
         errored = true;
     }
@@ -1332,22 +1899,22 @@ void N64Recomp::LiveGenerator::emit_function_end() const {
     // Populate the labels for pending switches and move them into the unlinked jump tables.
     bool invalid_switch = false;
     for (size_t switch_index = 0; switch_index < context->switch_jump_labels.size(); switch_index++) {
-        const std::vector<std::string>& cur_labels = context->switch_jump_labels[switch_index];
+        const std::vector<Label>& cur_labels = context->switch_jump_labels[switch_index];
         std::vector<sljit_label*> cur_label_addrs{};
         cur_label_addrs.resize(cur_labels.size());
         for (size_t case_index = 0; case_index < cur_labels.size(); case_index++) {
             // Find the label.
-            auto find_it = context->labels.find(cur_labels[case_index]);
-            if (find_it == context->labels.end()) {
+            sljit_label* label = find_label(*context, cur_labels[case_index]);
+            if (label == nullptr) {
                 // Label not found, invalid switch.
                 // Track this in a variable instead of returning immediately so that the pending labels are still cleared.
                 invalid_switch = true;
                 break;
             }
-            cur_label_addrs[case_index] = find_it->second;
+            cur_label_addrs[case_index] = label;
         }
         context->unlinked_jump_tables.emplace_back(
-            std::make_pair<std::vector<sljit_label*>, std::unique_ptr<void*[]>>(
+            std::make_pair<std::vector<sljit_label*>, void**>(
                 std::move(cur_label_addrs),
                 std::move(context->pending_jump_tables[switch_index])
             )
@@ -1356,8 +1923,11 @@ void N64Recomp::LiveGenerator::emit_function_end() const {
     context->switch_jump_labels.clear();
     context->pending_jump_tables.clear();
 
-    // Clear the labels to prevent labels from one function being jumped to by another.
-    context->labels.clear();
+    // Clear the labels to prevent labels from one function being jumped to by another. The vectors keep their capacity
+    // so that later functions don't need to reallocate them.
+    for (std::vector<sljit_label*>& type_labels : context->labels) {
+        type_labels.clear();
+    }
 
     if (invalid_switch) {
         assert(false);
@@ -1365,15 +1935,60 @@ void N64Recomp::LiveGenerator::emit_function_end() const {
     }
 }
 
-void N64Recomp::LiveGenerator::emit_function_call_lookup(uint32_t addr) const {
-    // Load the address immediate into the first argument. 
-    sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R0, 0, SLJIT_IMM, int32_t(addr));
-    
-    // Call get_function.
-    sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1(P, 32), SLJIT_IMM, sljit_sw(inputs.get_function));
-    
-    // Copy the return value into R3 so that it can be used for icall
+void N64Recomp::LiveGenerator::emit_function_lookup(int32_t vram_src, intptr_t vram_srcw) const {
+    // Flush the cached GPRs before the lookup, as only one of the paths below calls get_function. This also makes sure that
+    // the address is up to date in the context if it's being read from a register.
+    context->gprs.flush();
+
+    // Load the address into the first argument.
+    sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R0, 0, vram_src, vram_srcw);
+
+    if (inputs.lookup_cache_generation == nullptr || inputs.cacheable_output) {
+        // Call get_function.
+        emit_callback_call(SLJIT_ARGS1(P, 32), LiveInputCallback::GetFunction);
+
+        // Copy the return value into R3 so that it can be used for icall
+        sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R3, 0, SLJIT_RETURN_REG, 0);
+        return;
+    }
+
+    // Allocate a cache entry for this call site. The address is initialized to an unaligned value so that the first lookup always misses.
+    if (context->lookup_caches.empty() || context->lookup_cache_block_used == lookup_cache_block_size) {
+        context->lookup_caches.emplace_back(context->arena->allocate_data_array<LiveLookupCacheEntry>(lookup_cache_block_size));
+        context->lookup_cache_block_used = 0;
+    }
+    LiveLookupCacheEntry* entry = &context->lookup_caches.back()[context->lookup_cache_block_used++];
+    *entry = LiveLookupCacheEntry{ .vram = 1, .generation = 0, .func = nullptr };
+
+    // Use the cached function if the address and generation both match.
+    sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R2, 0, SLJIT_IMM, sljit_sw(entry));
+    sljit_jump* vram_miss = sljit_emit_cmp(compiler, SLJIT_NOT_EQUAL | SLJIT_32, SLJIT_R0, 0, SLJIT_MEM1(SLJIT_R2), offsetof(LiveLookupCacheEntry, vram));
+    sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R1, 0, SLJIT_MEM0(), sljit_sw(inputs.lookup_cache_generation));
+    sljit_jump* generation_miss = sljit_emit_cmp(compiler, SLJIT_NOT_EQUAL | SLJIT_32, SLJIT_R1, 0, SLJIT_MEM1(SLJIT_R2), offsetof(LiveLookupCacheEntry, generation));
+    sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R3, 0, SLJIT_MEM1(SLJIT_R2), offsetof(LiveLookupCacheEntry, func));
+    sljit_jump* hit_jump = sljit_emit_jump(compiler, SLJIT_JUMP);
+
+    // Otherwise call get_function, which still has the address in the first argument.
+    sljit_label* miss_label = sljit_emit_label(compiler);
+    sljit_set_label(vram_miss, miss_label);
+    sljit_set_label(generation_miss, miss_label);
+    emit_callback_call(SLJIT_ARGS1(P, 32), LiveInputCallback::GetFunction);
     sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R3, 0, SLJIT_RETURN_REG, 0);
+
+    // Update the cache entry. The address is reloaded as the call clobbered the argument registers.
+    sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R2, 0, SLJIT_IMM, sljit_sw(entry));
+    sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_MEM1(SLJIT_R2), offsetof(LiveLookupCacheEntry, func), SLJIT_R3, 0);
+    sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R1, 0, vram_src, vram_srcw);
+    sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_MEM1(SLJIT_R2), offsetof(LiveLookupCacheEntry, vram), SLJIT_R1, 0);
+    sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R1, 0, SLJIT_MEM0(), sljit_sw(inputs.lookup_cache_generation));
+    sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_MEM1(SLJIT_R2), offsetof(LiveLookupCacheEntry, generation), SLJIT_R1, 0);
+
+    sljit_set_label(hit_jump, sljit_emit_label(compiler));
+}
+
+void N64Recomp::LiveGenerator::emit_function_call_lookup(uint32_t addr) const {
+    // Look up the function for the address immediate.
+    emit_function_lookup(SLJIT_IMM, int32_t(addr));
     
     // Load rdram and ctx into R0 and R1.
     sljit_emit_op2(compiler, SLJIT_ADD, SLJIT_R0, 0, Registers::rdram, 0, SLJIT_IMM, rdram_offset);
@@ -1384,14 +1999,8 @@ void N64Recomp::LiveGenerator::emit_function_call_lookup(uint32_t addr) const {
 }
 
 void N64Recomp::LiveGenerator::emit_function_call_by_register(int reg) const {
-    // Load the register's value into the first argument. 
-    sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R0, 0, SLJIT_MEM1(Registers::ctx), get_gpr_context_offset(reg));
-
-    // Call get_function.
-    sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1(P, 32), SLJIT_IMM, sljit_sw(inputs.get_function));
-
-    // Copy the return value into R3 so that it can be used for icall
-    sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R3, 0, SLJIT_RETURN_REG, 0);
+    // Look up the function for the register's value.
+    emit_function_lookup(SLJIT_MEM1(Registers::ctx), get_gpr_context_offset(reg));
 
     // Load rdram and ctx into R0 and R1.
     sljit_emit_op2(compiler, SLJIT_ADD, SLJIT_R0, 0, Registers::rdram, 0, SLJIT_IMM, rdram_offset);
@@ -1404,6 +2013,9 @@ void N64Recomp::LiveGenerator::emit_function_call_by_register(int reg) const {
 void N64Recomp::LiveGenerator::emit_function_call_reference_symbol(const Context&, uint16_t section_index, size_t symbol_index, uint32_t target_section_offset) const {
     (void)symbol_index;
 
+    // Flush the cached GPRs so the callee sees them in the context.
+    context->gprs.flush();
+
     // Load rdram and ctx into R0 and R1.
     sljit_emit_op2(compiler, SLJIT_ADD, SLJIT_R0, 0, Registers::rdram, 0, SLJIT_IMM, rdram_offset);
     sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R1, 0, Registers::ctx, 0);
@@ -1428,9 +2040,20 @@ void N64Recomp::LiveGenerator::emit_function_call_reference_symbol(const Context
 }
 
 void N64Recomp::LiveGenerator::emit_function_call(const Context&, size_t function_index) const {
+    // Flush the cached GPRs so the callee sees them in the context.
+    context->gprs.flush();
+
     // Load rdram and ctx into R0 and R1.
     sljit_emit_op2(compiler, SLJIT_ADD, SLJIT_R0, 0, Registers::rdram, 0, SLJIT_IMM, rdram_offset);
     sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R1, 0, Registers::ctx, 0);
+    // If the function is in a different compilation unit then its address isn't known yet, so emit a rewritable
+    // call with a dummy target that will be populated once all the units are done.
+    if (!context->unit_funcs.empty() && !context->unit_funcs[function_index]) {
+        sljit_jump* call_jump = sljit_emit_call(compiler, SLJIT_CALL | SLJIT_REWRITABLE_JUMP, SLJIT_ARGS2V(P, P));
+        sljit_set_target(call_jump, sljit_uw(-3));
+        context->external_calls.emplace_back(InnerCall{ .target_func_index = function_index, .jump = call_jump });
+        return;
+    }
     // Call the function and save the jump to set its label later on.
     sljit_jump* call_jump = sljit_emit_call(compiler, SLJIT_CALL, SLJIT_ARGS2V(P, P));
     context->inner_calls.emplace_back(InnerCall{ .target_func_index = function_index, .jump = call_jump });
@@ -1442,34 +2065,27 @@ void N64Recomp::LiveGenerator::emit_named_function_call(const std::string& funct
     errored = true;
 }
 
-void N64Recomp::LiveGenerator::emit_goto(const std::string& target) const {
+void N64Recomp::LiveGenerator::emit_goto(const Label& target) const {
+    // The target expects every GPR to be in the context.
+    context->gprs.flush();
+
     sljit_jump* jump = sljit_emit_jump(compiler, SLJIT_JUMP);
     // Check if the label already exists.
-    auto find_it = context->labels.find(target);
-    if (find_it != context->labels.end()) {
-        sljit_set_label(jump, find_it->second);
+    sljit_label* label = find_label(*context, target);
+    if (label != nullptr) {
+        sljit_set_label(jump, label);
     }
-    // It doesn't, so queue this as a pending jump to be resolved later.
+    // It doesn't, so queue this as a pending jump to be resolved at the end of the function.
     else {
-        context->pending_jumps[target].push_back(jump);
+        context->pending_jumps.emplace_back(PendingJump{ .target = target, .jump = jump });
     }
 }
 
-void N64Recomp::LiveGenerator::emit_label(const std::string& label_name) const {
-    sljit_label* label = sljit_emit_label(compiler);
-
-    // Check if there are any pending jumps for this label and assign them if so.
-    auto find_it = context->pending_jumps.find(label_name);
-    if (find_it != context->pending_jumps.end()) {
-        for (sljit_jump* jump : find_it->second) {
-            sljit_set_label(jump, label);
-        }
-
-        // Remove the pending jumps for this label.
-        context->pending_jumps.erase(find_it);
-    }
+void N64Recomp::LiveGenerator::emit_label(const Label& label) const {
+    // Labels start a new block, so flush the cached GPRs for the code that falls through into the label.
+    context->gprs.flush();
 
-    context->labels.emplace(label_name, label);
+    get_label_slot(*context, label) = sljit_emit_label(compiler);
 }
 
 void N64Recomp::LiveGenerator::emit_jtbl_addend_declaration(const JumpTable& jtbl, int reg) const {
@@ -1559,8 +2175,8 @@ void N64Recomp::LiveGenerator::emit_branch_condition(const ConditionalBranchOp&
     sljit_sw src2;
     sljit_sw src2w;
 
-    get_operand_values(op.operands.operands[0], ctx, src1, src1w, nullptr, 0);
-    get_operand_values(op.operands.operands[1], ctx, src2, src2w, nullptr, 0);
+    get_operand_values(op.operands.operands[0], ctx, src1, src1w, nullptr, 0, context->gprs, GprAccess::Read);
+    get_operand_values(op.operands.operands[1], ctx, src2, src2w, nullptr, 0, context->gprs, GprAccess::Read);
 
     // Relocations aren't valid on conditional branches.
     if(ctx.reloc_type != RelocType::R_MIPS_NONE) {
@@ -1569,6 +2185,9 @@ void N64Recomp::LiveGenerator::emit_branch_condition(const ConditionalBranchOp&
         return;
     }
 
+    // Write back any modified GPRs so that the context is up to date at the branch target. The cached GPRs stay loaded for the branch's body.
+    context->gprs.write_back();
+
     // Create a compare jump and track it as the pending branch jump.
     context->cur_branch_jump = sljit_emit_cmp(compiler, condition_type, src1, src1w, src2, src2w);
 }
@@ -1581,28 +2200,32 @@ void N64Recomp::LiveGenerator::emit_branch_close() const {
         return;
     }
 
+    // The branch's body and the branch target merge here, so flush the cached GPRs for the body.
+    context->gprs.flush();
+
     // Assign a label at this point to the pending branch jump and clear it.
     sljit_set_label(context->cur_branch_jump, sljit_emit_label(compiler));
     context->cur_branch_jump = nullptr;
 }
 
 void N64Recomp::LiveGenerator::emit_switch(const Context& recompiler_context, const JumpTable& jtbl, int reg) const {
-    // Populate the switch's labels.
-    std::vector<std::string> cur_labels{};
-    cur_labels.resize(jtbl.entries.size());
-    for (size_t i = 0; i < cur_labels.size(); i++) {
-        cur_labels[i] = fmt::format("L_{:08X}", jtbl.entries[i]);
-    }
-    context->switch_jump_labels.emplace_back(std::move(cur_labels));
+    // Start the switch's label list, which gets populated by the emit_case calls that follow.
+    context->switch_jump_labels.emplace_back().reserve(jtbl.entries.size());
 
     // Allocate the jump table.
-    std::unique_ptr<void* []> cur_jump_table = std::make_unique<void* []>(jtbl.entries.size());
+    void** cur_jump_table = context->arena->allocate_data_array<void*>(jtbl.entries.size());
 
     /// Codegen
 
     // Load the jump target register. The lw instruction was patched into an addiu, so this holds
     // the address of the jump table entry instead of the actual jump target.
-    sljit_emit_op1(compiler, SLJIT_MOV, Registers::arithmetic_temp1, 0, SLJIT_MEM1(Registers::ctx), get_gpr_context_offset(reg));
+    sljit_sw src;
+    sljit_sw srcw;
+    context->gprs.get(reg, GprAccess::Read, src, srcw);
+    sljit_emit_op1(compiler, SLJIT_MOV, Registers::arithmetic_temp1, 0, src, srcw);
+
+    // The switch ends the block, so flush the cached GPRs before jumping to any of the cases.
+    context->gprs.flush();
     // Subtract the jump table's address from the jump target to get the jump table addend.
     // Sign extend the jump table address to 64 bits so that the entire register's contents are used instead of just the lower 32 bits.
     const auto& jtbl_section = recompiler_context.sections[jtbl.section_index];
@@ -1638,20 +2261,23 @@ void N64Recomp::LiveGenerator::emit_switch(const Context& recompiler_context, co
     // Multiply the jump table addend by 2 to get the addend for the real jump table. (4 bytes per entry to 8 bytes per entry).
     sljit_emit_op2(compiler, SLJIT_ADD, Registers::arithmetic_temp1, 0, Registers::arithmetic_temp1, 0, Registers::arithmetic_temp1, 0);
     // Load the real jump table address.
-    sljit_emit_op1(compiler, SLJIT_MOV, Registers::arithmetic_temp2, 0, SLJIT_IMM, (sljit_sw)cur_jump_table.get());
+    uint32_t jump_table_index = static_cast<uint32_t>(context->unlinked_jump_tables.size() + context->pending_jump_tables.size());
+    emit_absolute_address(Registers::arithmetic_temp2, LiveAddressType::JumpTable, jump_table_index, reinterpret_cast<uintptr_t>(cur_jump_table));
     // Load the real jump entry.
     sljit_emit_op1(compiler, SLJIT_MOV, Registers::arithmetic_temp1, 0, SLJIT_MEM2(Registers::arithmetic_temp1, Registers::arithmetic_temp2), 0);
     // Jump to the loaded entry.
     sljit_emit_ijump(compiler, SLJIT_JUMP, Registers::arithmetic_temp1, 0);
 
     // Move the jump table into the pending jump tables.
-    context->pending_jump_tables.emplace_back(std::move(cur_jump_table));
+    context->pending_jump_tables.emplace_back(cur_jump_table);
 }
 
-void N64Recomp::LiveGenerator::emit_case(int case_index, const std::string& target_label) const {
+void N64Recomp::LiveGenerator::emit_case(int case_index, const Label& target_label) const {
+    // Record the case's target label. The jump table itself is built in emit_switch and populated once the labels are emitted.
+    std::vector<Label>& cur_labels = context->switch_jump_labels.back();
+    assert(static_cast<size_t>(case_index) == cur_labels.size());
     (void)case_index;
-    (void)target_label;
-    // Nothing to do here, the jump table is built in emit_switch.
+    cur_labels.emplace_back(target_label);
 }
 
 void N64Recomp::LiveGenerator::emit_switch_error(uint32_t instr_vram, uint32_t jtbl_vram) const {
@@ -1664,9 +2290,7 @@ void N64Recomp::LiveGenerator::emit_switch_close() const {
     // Nothing to do here, the jump table is built in emit_switch.
 }
 
-void N64Recomp::LiveGenerator::emit_return(const Context& context, size_t func_index) const {
-    (void)context;
-    
+void N64Recomp::LiveGenerator::emit_return(const Context& recompiler_context, size_t func_index) const {
     // Check if this function's return is hooked and emit the hook call if so.
     auto find_hook_it = inputs.return_func_hooks.find(func_index);
     if (find_hook_it != inputs.return_func_hooks.end()) {
@@ -1675,8 +2299,19 @@ void N64Recomp::LiveGenerator::emit_return(const Context& context, size_t func_i
         sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R1, 0, Registers::ctx, 0);
         // Load the return hook's index into R2.
         sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R2, 0, SLJIT_IMM, find_hook_it->second);
-        sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS3V(P, P, W), SLJIT_IMM, sljit_sw(inputs.run_hook));
+        emit_callback_call(SLJIT_ARGS3V(P, P, W), LiveInputCallback::RunHook);
     }
+
+    // Add the cycles since the function's start to its profile counter.
+    if (recompiler_context.profile_mode && inputs.profile_cycles && inputs.profile_counters != nullptr) {
+        emit_helper_call(SLJIT_ARGS0(W), reinterpret_cast<uintptr_t>(live_profile_timestamp));
+        sljit_emit_op2(compiler, SLJIT_SUB, SLJIT_R0, 0, SLJIT_RETURN_REG, 0, SLJIT_MEM1(SLJIT_SP), 0);
+        emit_absolute_address(SLJIT_R1, LiveAddressType::ProfileCounter, static_cast<uint32_t>(func_index), reinterpret_cast<uintptr_t>(inputs.profile_counters + func_index));
+        sljit_emit_op2(compiler, SLJIT_ADD, SLJIT_MEM1(SLJIT_R1), offsetof(LiveProfileCounter, cycles), SLJIT_MEM1(SLJIT_R1), offsetof(LiveProfileCounter, cycles), SLJIT_R0, 0);
+    }
+
+    // Flush the cached GPRs so that the caller sees them in the context.
+    context->gprs.flush();
     sljit_emit_return_void(compiler);
 }
 
@@ -1698,39 +2333,43 @@ void N64Recomp::LiveGenerator::emit_cop0_status_read(int reg) const {
         sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R0, 0, Registers::ctx, 0);
 
         // Call cop0_status_read.
-        sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1V(P), SLJIT_IMM, sljit_sw(inputs.cop0_status_read));
+        emit_callback_call(SLJIT_ARGS1V(P), LiveInputCallback::Cop0StatusRead);
 
         // Store the result in the output register.
-        sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_MEM1(Registers::ctx), get_gpr_context_offset(reg), SLJIT_R0, 0);
+        sljit_sw dst;
+        sljit_sw dstw;
+        context->gprs.get(reg, GprAccess::Write, dst, dstw);
+        sljit_emit_op1(compiler, SLJIT_MOV, dst, dstw, SLJIT_R0, 0);
     }
 }
 
 void N64Recomp::LiveGenerator::emit_cop0_status_write(int reg) const {
     sljit_sw src;
     sljit_sw srcw;
-    get_gpr_values(reg, src, srcw);
+    context->gprs.get(reg, GprAccess::Read, src, srcw);
     
     // Load ctx and the input register value into R0 and R1
     sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R0, 0, Registers::ctx, 0);
     sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R1, 0, src, srcw);
 
     // Call cop0_status_write.
-    sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS2V(P,32), SLJIT_IMM, sljit_sw(inputs.cop0_status_write));
+    emit_callback_call(SLJIT_ARGS2V(P,32), LiveInputCallback::Cop0StatusWrite);
 }
 
 void N64Recomp::LiveGenerator::emit_cop1_cs_read(int reg) const {
     // Skip the read if the target is the zero register.
     if (reg != 0) {
-        sljit_sw dst;
-        sljit_sw dstw;
-        get_gpr_values(reg, dst, dstw);
-
         // Call get_cop1_cs.
-        sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS0(32), SLJIT_IMM, sljit_sw(get_cop1_cs));
+        emit_helper_call(SLJIT_ARGS0(32), reinterpret_cast<uintptr_t>(get_cop1_cs));
 
         // Sign extend the result into a temp register.
         sljit_emit_op1(compiler, SLJIT_MOV_S32, Registers::arithmetic_temp1, 0, SLJIT_RETURN_REG, 0);
 
+        // Get the destination after the call, as calls flush the cached GPRs.
+        sljit_sw dst;
+        sljit_sw dstw;
+        context->gprs.get(reg, GprAccess::Write, dst, dstw);
+
         // Move the sign extended result into the destination.
         sljit_emit_op1(compiler, SLJIT_MOV, dst, dstw, Registers::arithmetic_temp1, 0);
     }
@@ -1739,13 +2378,13 @@ void N64Recomp::LiveGenerator::emit_cop1_cs_read(int reg) const {
 void N64Recomp::LiveGenerator::emit_cop1_cs_write(int reg) const {
     sljit_sw src;
     sljit_sw srcw;
-    get_gpr_values(reg, src, srcw);
+    context->gprs.get(reg, GprAccess::Read, src, srcw);
 
     // Load the input register value into R0.
     sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R0, 0, src, srcw);
 
     // Call set_cop1_cs.
-    sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1V(32), SLJIT_IMM, sljit_sw(set_cop1_cs));
+    emit_helper_call(SLJIT_ARGS1V(32), reinterpret_cast<uintptr_t>(set_cop1_cs));
 }
 
 void N64Recomp::LiveGenerator::emit_muldiv(InstrId instr_id, int reg1, int reg2) const {
@@ -1753,8 +2392,8 @@ void N64Recomp::LiveGenerator::emit_muldiv(InstrId instr_id, int reg1, int reg2)
     sljit_sw src1w;
     sljit_sw src2;
     sljit_sw src2w;
-    get_gpr_values(reg1, src1, src1w);
-    get_gpr_values(reg2, src2, src2w);
+    context->gprs.get(reg1, GprAccess::Read, src1, src1w);
+    context->gprs.get(reg2, GprAccess::Read, src2, src2w);
     
     auto do_mul32_op = [src1, src1w, src2, src2w, this](bool is_signed) {
         // Load the two inputs into the multiplication input registers (R0/R1).
@@ -1916,21 +2555,21 @@ void N64Recomp::LiveGenerator::emit_syscall(uint32_t instr_vram) const {
     // Load the vram into R2.
     sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R2, 0, SLJIT_IMM, instr_vram);
     // Call syscall_handler.
-    sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS3V(P, P, 32), SLJIT_IMM, sljit_sw(inputs.syscall_handler));
+    emit_callback_call(SLJIT_ARGS3V(P, P, 32), LiveInputCallback::SyscallHandler);
 }
 
 void N64Recomp::LiveGenerator::emit_do_break(uint32_t instr_vram) const {
     // Load the vram into R0.
     sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R0, 0, SLJIT_IMM, instr_vram);
     // Call do_break.
-    sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1V(32), SLJIT_IMM, sljit_sw(inputs.do_break));
+    emit_callback_call(SLJIT_ARGS1V(32), LiveInputCallback::DoBreak);
 }
 
 void N64Recomp::LiveGenerator::emit_pause_self() const {
     // Load rdram into R0.
     sljit_emit_op2(compiler, SLJIT_ADD, SLJIT_R0, 0, Registers::rdram, 0, SLJIT_IMM, rdram_offset);
     // Call pause_self.
-    sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS1V(P), SLJIT_IMM, sljit_sw(inputs.pause_self));
+    emit_callback_call(SLJIT_ARGS1V(P), LiveInputCallback::PauseSelf);
 }
 
 void N64Recomp::LiveGenerator::emit_trigger_event(uint32_t event_index) const {
@@ -1940,7 +2579,7 @@ void N64Recomp::LiveGenerator::emit_trigger_event(uint32_t event_index) const {
     // Load the global event index into R2.
     sljit_emit_op1(compiler, SLJIT_MOV32, SLJIT_R2, 0, SLJIT_IMM, event_index + inputs.base_event_index);
     // Call trigger_event.
-    sljit_emit_icall(compiler, SLJIT_CALL, SLJIT_ARGS3V(P,P,32), SLJIT_IMM, sljit_sw(inputs.trigger_event));
+    emit_callback_call(SLJIT_ARGS3V(P,P,32), LiveInputCallback::TriggerEvent);
 }
 
 void N64Recomp::LiveGenerator::emit_comment(const std::string& comment) const {
@@ -1948,10 +2587,278 @@ void N64Recomp::LiveGenerator::emit_comment(const std::string& comment) const {
     // Nothing to do here.
 }
 
+void N64Recomp::LiveGenerator::emit_load_constant(int reg, int32_t value) const {
+    sljit_sw dst;
+    sljit_sw dstw;
+    context->gprs.get(reg, GprAccess::Write, dst, dstw);
+    sljit_emit_op1(compiler, SLJIT_MOV, dst, dstw, SLJIT_IMM, sljit_sw(value));
+}
+
 bool N64Recomp::recompile_function_live(LiveGenerator& generator, const Context& context, size_t function_index, std::ostream& output_file, std::span<std::vector<uint32_t>> static_funcs_out, bool tag_reference_relocs) {
     return recompile_function_custom(generator, context, function_index, output_file, static_funcs_out, tag_reference_relocs);
 }
 
+N64Recomp::LiveGeneratorBatchOutput N64Recomp::recompile_functions_live_batch(const Context& context, const LiveGeneratorInputs& inputs, size_t num_threads, bool tag_reference_relocs) {
+    // Set up the Rabbitizer config before any worker threads start decoding instructions with it.
+    live_recompiler_init();
+
+    if (num_threads == 0) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+    size_t num_units = std::max<size_t>(std::min(num_threads, context.functions.size()), 1);
+
+    // Split the functions into contiguous compilation units with roughly the same number of instructions each. Keeping the units
+    // contiguous means that calls between nearby functions usually stay within a unit and don't need to be populated later.
+    size_t total_words = 0;
+    for (const Function& func : context.functions) {
+        total_words += func.words.size();
+    }
+    std::vector<std::vector<size_t>> unit_functions{};
+    unit_functions.resize(num_units);
+    size_t cur_words = 0;
+    for (size_t func_index = 0; func_index < context.functions.size(); func_index++) {
+        size_t unit_index = std::min(num_units - 1, total_words == 0 ? 0 : cur_words * num_units / total_words);
+        unit_functions[unit_index].emplace_back(func_index);
+        cur_words += context.functions[func_index].words.size();
+    }
+
+    LiveGeneratorBatchOutput ret{};
+    ret.unit_outputs.resize(num_units);
+    std::vector<uint8_t> unit_results{};
+    unit_results.resize(num_units, false);
+
+    auto compile_unit = [&](size_t unit_index) {
+        // Units can end up empty if a single function is larger than a unit's share, in which case there's nothing to generate.
+        if (unit_functions[unit_index].empty()) {
+            unit_results[unit_index] = true;
+            return;
+        }
+
+        LiveGenerator generator{ context.functions.size(), inputs, unit_functions[unit_index] };
+        std::vector<std::vector<uint32_t>> dummy_static_funcs{};
+        dummy_static_funcs.resize(context.sections.size());
+        std::ostringstream dummy_ostream{};
+
+        for (size_t func_index : unit_functions[unit_index]) {
+            if (!recompile_function_live(generator, context, func_index, dummy_ostream, dummy_static_funcs, tag_reference_relocs)) {
+                return;
+            }
+        }
+
+        ret.unit_outputs[unit_index] = generator.finish();
+        unit_results[unit_index] = ret.unit_outputs[unit_index].good;
+    };
+
+    // Compile the units, using the calling thread for the first one.
+    std::vector<std::thread> threads{};
+    threads.reserve(num_units - 1);
+    for (size_t unit_index = 1; unit_index < num_units; unit_index++) {
+        threads.emplace_back(compile_unit, unit_index);
+    }
+    compile_unit(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (uint8_t unit_result : unit_results) {
+        if (!unit_result) {
+            return {};
+        }
+    }
+
+    // Gather the function pointers from every unit.
+    ret.functions.resize(context.functions.size());
+    for (size_t unit_index = 0; unit_index < num_units; unit_index++) {
+        const LiveGeneratorOutput& unit_output = ret.unit_outputs[unit_index];
+        for (size_t func_index : unit_functions[unit_index]) {
+            ret.functions[func_index] = unit_output.functions[func_index];
+        }
+    }
+
+    // Populate the calls between units and index the reference symbol jumps across all units.
+    ret.unit_reference_symbol_jump_starts.resize(num_units + 1);
+    size_t cur_jump_start = 0;
+    for (size_t unit_index = 0; unit_index < num_units; unit_index++) {
+        LiveGeneratorOutput& unit_output = ret.unit_outputs[unit_index];
+        if (!unit_output.populate_inner_call_jumps(ret.functions)) {
+            return {};
+        }
+        ret.unit_reference_symbol_jump_starts[unit_index] = cur_jump_start;
+        cur_jump_start += unit_output.num_reference_symbol_jumps();
+    }
+    ret.unit_reference_symbol_jump_starts[num_units] = cur_jump_start;
+
+    ret.good = true;
+    return ret;
+}
+
+N64Recomp::LiveLazyOutput::LiveLazyOutput(const Context& context, const LiveGeneratorInputs& inputs, bool tag_reference_relocs) :
+    context(context), inputs(inputs), tag_reference_relocs(tag_reference_relocs) {
+    // Functions get recompiled on whichever thread first calls them, so set up the Rabbitizer config now.
+    live_recompiler_init();
+
+    // Recompile every function into the same arena so that their code gets packed together instead of each getting its own allocation.
+    if (inputs.arena != nullptr) {
+        arena = inputs.arena;
+    }
+    else {
+        owned_arena = std::make_unique<LiveOutputArena>();
+        arena = owned_arena.get();
+        this->inputs.arena = arena;
+    }
+
+    size_t num_funcs = context.functions.size();
+    functions.resize(num_funcs);
+    compiled_functions.resize(num_funcs);
+    stub_calls.resize(num_funcs);
+    stub_jumps.resize(num_funcs);
+    stub_args.resize(num_funcs);
+    if (num_funcs == 0) {
+        good = true;
+        return;
+    }
+
+    // Generate the stubs for every function in a single block of code. Each one tail calls compile_and_call with its argument through
+    // a rewritable call, which gets patched to tail call the recompiled function instead once it exists.
+    sljit_compiler* compiler = sljit_create_compiler(nullptr);
+    std::vector<sljit_label*> stub_labels{};
+    std::vector<sljit_jump*> stub_tail_calls{};
+    stub_labels.resize(num_funcs);
+    stub_tail_calls.resize(num_funcs);
+    for (size_t func_index = 0; func_index < num_funcs; func_index++) {
+        stub_args[func_index] = StubArg{ .output = this, .func_index = func_index };
+
+        stub_labels[func_index] = sljit_emit_label(compiler);
+        sljit_emit_enter(compiler, 0, SLJIT_ARGS2V(P_R, P_R), 3, 0, 0);
+
+        // Move the stub's argument into the third argument.
+        sljit_emit_op1(compiler, SLJIT_MOV, SLJIT_R2, 0, SLJIT_IMM, sljit_sw(&stub_args[func_index]));
+
+        // Tail call compile_and_call. The recompiled function ignores the extra argument after the call is patched.
+        stub_tail_calls[func_index] = sljit_emit_call(compiler, SLJIT_CALL | SLJIT_CALL_RETURN | SLJIT_REWRITABLE_JUMP, SLJIT_ARGS3V(P, P, W));
+        sljit_set_target(stub_tail_calls[func_index], reinterpret_cast<sljit_uw>(&compile_and_call));
+    }
+
+    void* stub_code = sljit_generate_code(compiler, 0, arena);
+    if (stub_code != nullptr) {
+        for (size_t func_index = 0; func_index < num_funcs; func_index++) {
+            functions[func_index] = reinterpret_cast<recomp_func_t*>(sljit_get_label_addr(stub_labels[func_index]));
+            stub_jumps[func_index] = reinterpret_cast<void*>(stub_tail_calls[func_index]->addr);
+        }
+        stub_executable_offset = sljit_get_executable_offset(compiler);
+        good = true;
+    }
+
+    sljit_free_compiler(compiler);
+}
+
+N64Recomp::LiveLazyOutput::~LiveLazyOutput() = default;
+
+void N64Recomp::LiveLazyOutput::set_reference_symbol_resolver(std::function<recomp_func_t*(const ReferenceJumpDetails& details)> resolver) {
+    std::lock_guard lock{ mutex };
+    reference_symbol_resolver = std::move(resolver);
+}
+
+void N64Recomp::LiveLazyOutput::populate_import_symbol_jumps(size_t import_index, recomp_func_t* func) {
+    std::lock_guard lock{ mutex };
+    import_funcs[import_index] = func;
+    for (LiveGeneratorOutput& unit_output : unit_outputs) {
+        unit_output.populate_import_symbol_jumps(import_index, func);
+    }
+}
+
+bool N64Recomp::LiveLazyOutput::compile_function(size_t func_index) {
+    std::lock_guard lock{ mutex };
+    return compile_function_locked(func_index);
+}
+
+size_t N64Recomp::LiveLazyOutput::num_compiled_functions() const {
+    std::lock_guard lock{ mutex };
+    return num_compiled;
+}
+
+bool N64Recomp::LiveLazyOutput::compile_function_locked(size_t func_index) {
+    if (!good || func_index >= compiled_functions.size()) {
+        return false;
+    }
+    if (compiled_functions[func_index] != nullptr) {
+        return true;
+    }
+
+    size_t unit_functions[] = { func_index };
+    LiveGenerator generator{ context.functions.size(), inputs, unit_functions };
+    std::vector<std::vector<uint32_t>> dummy_static_funcs{};
+    dummy_static_funcs.resize(context.sections.size());
+    std::ostringstream dummy_ostream{};
+
+    if (!recompile_function_live(generator, context, func_index, dummy_ostream, dummy_static_funcs, tag_reference_relocs)) {
+        return false;
+    }
+
+    LiveGeneratorOutput output = generator.finish();
+    if (!output.good) {
+        return false;
+    }
+
+    // Resolve the new code's reference symbol calls and populate its calls to any import symbols that were already provided.
+    for (size_t jump_index = 0; jump_index < output.num_reference_symbol_jumps(); jump_index++) {
+        recomp_func_t* target_func = reference_symbol_resolver ? reference_symbol_resolver(output.get_reference_symbol_jump_details(jump_index)) : nullptr;
+        if (target_func == nullptr) {
+            return false;
+        }
+        output.set_reference_symbol_jump(jump_index, target_func);
+    }
+    for (const auto& [import_index, import_func] : import_funcs) {
+        output.populate_import_symbol_jumps(import_index, import_func);
+    }
+
+    // Point the calls to other functions at their recompiled code, or at their stubs if they haven't been recompiled yet.
+    size_t unit_index = unit_outputs.size();
+    for (const auto& [target_func_index, jump_addr] : output.inner_call_jumps) {
+        recomp_func_t* target_func = compiled_functions[target_func_index];
+        if (target_func == nullptr) {
+            target_func = functions[target_func_index];
+            stub_calls[target_func_index].emplace_back(unit_index, jump_addr);
+        }
+        sljit_set_jump_addr(reinterpret_cast<sljit_uw>(jump_addr), reinterpret_cast<sljit_uw>(target_func), output.executable_offset);
+    }
+
+    recomp_func_t* compiled_func = output.functions[func_index];
+    compiled_functions[func_index] = compiled_func;
+    unit_outputs.emplace_back(std::move(output));
+    num_compiled++;
+
+    // Patch the stub and every call that was going through it to jump straight to the recompiled code.
+    sljit_set_jump_addr(reinterpret_cast<sljit_uw>(stub_jumps[func_index]), reinterpret_cast<sljit_uw>(compiled_func), stub_executable_offset);
+    for (const auto& [caller_unit_index, jump_addr] : stub_calls[func_index]) {
+        sljit_set_jump_addr(reinterpret_cast<sljit_uw>(jump_addr), reinterpret_cast<sljit_uw>(compiled_func), unit_outputs[caller_unit_index].executable_offset);
+    }
+    std::vector<std::pair<size_t, void*>>{}.swap(stub_calls[func_index]);
+
+    return true;
+}
+
+void N64Recomp::LiveLazyOutput::compile_and_call(uint8_t* rdram, recomp_context* ctx, uintptr_t arg) {
+    const StubArg* stub_arg = reinterpret_cast<const StubArg*>(arg);
+    LiveLazyOutput* output = stub_arg->output;
+    recomp_func_t* func = nullptr;
+    {
+        // Release the lock before running the function, as it may call other functions that haven't been recompiled yet.
+        std::lock_guard lock{ output->mutex };
+        if (output->compile_function_locked(stub_arg->func_index)) {
+            func = output->compiled_functions[stub_arg->func_index];
+        }
+    }
+
+    // There's no way to continue running the game's code if the function couldn't be recompiled.
+    if (func == nullptr) {
+        fmt::print(stderr, "Failed to recompile function {}\n", output->context.functions[stub_arg->func_index].name);
+        std::abort();
+    }
+
+    func(rdram, ctx);
+}
+
 N64Recomp::ShimFunction::ShimFunction(recomp_func_ext_t* to_shim, uintptr_t value) {
     sljit_compiler* compiler = sljit_create_compiler(nullptr);
 
@@ -1978,3 +2885,470 @@ N64Recomp::ShimFunction::~ShimFunction() {
     code = nullptr;
     func = nullptr;
 }
+
+// Bump this whenever a change to the live recompiler alters its output or the saved output format.
+constexpr uint32_t live_output_cache_version = 3;
+constexpr char live_output_cache_magic[8] = { 'N', '6', '4', 'R', 'L', 'I', 'V', 'E' };
+
+template <typename K, typename V>
+static void hash_sorted_map(N64Recomp::Hasher& hasher, const std::unordered_map<K, V>& map) {
+    std::vector<std::pair<K, V>> sorted{ map.begin(), map.end() };
+    std::sort(sorted.begin(), sorted.end());
+    hasher.add(sorted.size());
+    for (const auto& [key, value] : sorted) {
+        hasher.add(static_cast<uint64_t>(key));
+        if constexpr (std::is_same_v<V, std::string>) {
+            hasher.add_string(value);
+        }
+        else {
+            hasher.add(static_cast<uint64_t>(value));
+        }
+    }
+}
+
+uint64_t N64Recomp::get_live_output_key(const Context& context, const LiveGeneratorInputs& inputs) {
+    N64Recomp::Hasher hasher{};
+    hasher.add(live_output_cache_version);
+    hasher.add(sizeof(void*));
+    hasher.add_string(sljit_get_platform_name());
+
+    // Context contents. The ROM is hashed in full as jump tables are read from it.
+    hasher.add_bytes(context.rom.data(), context.rom.size());
+    hasher.add(context.use_lookup_for_all_function_calls);
+    hasher.add(context.trace_mode);
+    hasher.add(context.profile_mode);
+    hasher.add(context.optimize_codegen);
+    hash_sorted_map(hasher, context.bss_section_to_section);
+    hasher.add(context.sections.size());
+    for (const Section& section : context.sections) {
+        hasher.add(section.rom_addr);
+        hasher.add(section.ram_addr);
+        hasher.add(section.size);
+        hasher.add(section.bss_section_index);
+        hasher.add(section.relocatable);
+        hasher.add(section.got_ram_addr.value_or(0xFFFFFFFF));
+        hasher.add(section.relocs.size());
+        for (const Reloc& reloc : section.relocs) {
+            hasher.add(reloc.address);
+            hasher.add(reloc.target_section_offset);
+            hasher.add(reloc.symbol_index);
+            hasher.add(reloc.target_section);
+            hasher.add(static_cast<uint64_t>(reloc.type));
+            hasher.add(reloc.reference_symbol);
+        }
+    }
+    hasher.add(context.functions.size());
+    for (const Function& func : context.functions) {
+        hasher.add(func.vram);
+        hasher.add(func.rom);
+        hasher.add(func.section_index);
+        hasher.add(func.ignored);
+        hasher.add(func.reimplemented);
+        hasher.add(func.stubbed);
+        hasher.add_string(func.name);
+        hasher.add_bytes(func.words.data(), func.words.size() * sizeof(func.words[0]));
+        hash_sorted_map(hasher, func.function_hooks);
+    }
+
+    // Inputs that get baked into the code. Addresses are patched when loading, so they're not included.
+    hasher.add(inputs.base_event_index);
+    hasher.add(inputs.cacheable_output);
+    hasher.add(inputs.profile_cycles);
+    hash_sorted_map(hasher, inputs.entry_func_hooks);
+    hash_sorted_map(hasher, inputs.return_func_hooks);
+    hasher.add(inputs.original_section_indices.size());
+    for (size_t section_index : inputs.original_section_indices) {
+        hasher.add(section_index);
+    }
+
+    return hasher.get();
+}
+
+struct LiveCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pointer_size;
+    uint64_t key;
+    uint64_t code_size;
+    uint32_t num_functions;
+    uint32_t num_jump_tables;
+    uint32_t num_string_literals;
+    uint32_t num_reference_symbol_jumps;
+    uint32_t num_import_jumps;
+    uint32_t num_inner_call_jumps;
+    uint32_t num_address_relocs;
+    uint32_t padding;
+};
+
+struct LiveCacheReferenceJump {
+    uint16_t section;
+    uint16_t padding;
+    uint32_t section_offset;
+    uint64_t code_offset;
+};
+
+struct LiveCacheIndexedJump {
+    uint64_t index;
+    uint64_t code_offset;
+};
+
+struct LiveCacheAddressReloc {
+    uint8_t type;
+    uint8_t is_call;
+    uint16_t padding;
+    uint32_t index;
+    uint64_t code_offset;
+};
+
+// Marks a function that wasn't recompiled in the saved function offsets.
+constexpr uint64_t live_cache_missing_function = UINT64_MAX;
+
+template <typename T>
+static void write_cache_value(std::vector<char>& data, const T& value) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+// Reads values from a loaded cache file while checking that they're in bounds.
+class LiveCacheReader {
+public:
+    LiveCacheReader(std::span<const char> data) : data(data) {}
+    template <typename T>
+    bool read(T& value_out) {
+        return read_bytes(&value_out, sizeof(T));
+    }
+    bool read_bytes(void* out, size_t size) {
+        if (size > data.size() - offset) {
+            return false;
+        }
+        memcpy(out, data.data() + offset, size);
+        offset += size;
+        return true;
+    }
+private:
+    std::span<const char> data;
+    size_t offset = 0;
+};
+
+bool N64Recomp::save_live_output(const LiveGeneratorOutput& output, uint64_t key, const std::filesystem::path& path) {
+    // Outputs that weren't generated as cacheable have addresses that can't be patched. A nonzero executable offset
+    // means that the code is dual mapped, which load_live_output doesn't support.
+    if (!output.good || !output.cacheable || output.executable_offset != 0 || output.code == nullptr) {
+        return false;
+    }
+
+    uintptr_t code_start = reinterpret_cast<uintptr_t>(output.code);
+    auto get_code_offset = [code_start](const void* addr) {
+        return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(addr) - code_start);
+    };
+
+    std::vector<char> data{};
+    LiveCacheHeader header{};
+    memcpy(header.magic, live_output_cache_magic, sizeof(header.magic));
+    header.version = live_output_cache_version;
+    header.pointer_size = sizeof(void*);
+    header.key = key;
+    header.code_size = output.code_size;
+    header.num_functions = static_cast<uint32_t>(output.functions.size());
+    header.num_jump_tables = static_cast<uint32_t>(output.jump_tables.size());
+    header.num_string_literals = static_cast<uint32_t>(output.string_literals.size());
+    header.num_reference_symbol_jumps = static_cast<uint32_t>(output.reference_symbol_jumps.size());
+    header.num_import_jumps = static_cast<uint32_t>(output.import_jumps_by_index.size());
+    header.num_inner_call_jumps = static_cast<uint32_t>(output.inner_call_jumps.size());
+    header.num_address_relocs = static_cast<uint32_t>(output.address_relocs.size());
+    write_cache_value(data, header);
+
+    for (recomp_func_t* func : output.functions) {
+        write_cache_value(data, func == nullptr ? live_cache_missing_function : get_code_offset(reinterpret_cast<const void*>(func)));
+    }
+
+    for (size_t jump_table_index = 0; jump_table_index < output.jump_tables.size(); jump_table_index++) {
+        size_t num_entries = output.jump_table_sizes[jump_table_index];
+        write_cache_value(data, static_cast<uint64_t>(num_entries));
+        for (size_t entry_index = 0; entry_index < num_entries; entry_index++) {
+            write_cache_value(data, get_code_offset(output.jump_tables[jump_table_index][entry_index]));
+        }
+    }
+
+    for (const char* literal : output.string_literals) {
+        size_t length = strlen(literal);
+        write_cache_value(data, static_cast<uint64_t>(length));
+        data.insert(data.end(), literal, literal + length);
+    }
+
+    for (const auto& [details, jump_addr] : output.reference_symbol_jumps) {
+        write_cache_value(data, LiveCacheReferenceJump{ .section = details.section, .padding = 0, .section_offset = details.section_offset, .code_offset = get_code_offset(jump_addr) });
+    }
+
+    for (const auto& [import_index, jump_addr] : output.import_jumps_by_index) {
+        write_cache_value(data, LiveCacheIndexedJump{ .index = import_index, .code_offset = get_code_offset(jump_addr) });
+    }
+
+    for (const auto& [target_func_index, jump_addr] : output.inner_call_jumps) {
+        write_cache_value(data, LiveCacheIndexedJump{ .index = target_func_index, .code_offset = get_code_offset(jump_addr) });
+    }
+
+    for (const LiveAddressReloc& reloc : output.address_relocs) {
+        write_cache_value(data, LiveCacheAddressReloc{
+            .type = static_cast<uint8_t>(reloc.type),
+            .is_call = reloc.is_call,
+            .padding = 0,
+            .index = reloc.index,
+            .code_offset = get_code_offset(reloc.addr)
+        });
+    }
+
+    const char* code_bytes = reinterpret_cast<const char*>(output.code);
+    data.insert(data.end(), code_bytes, code_bytes + output.code_size);
+
+    // Write to a temporary file and then rename it so that an interrupted write doesn't leave a partial file behind.
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream output_file{ temp_path, std::ios::binary };
+        if (!output_file.good()) {
+            return false;
+        }
+        output_file.write(data.data(), data.size());
+        if (!output_file.good()) {
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool N64Recomp::load_live_output(const std::filesystem::path& path, uint64_t key, const LiveGeneratorInputs& inputs, LiveGeneratorOutput& output_out) {
+#if !(defined SLJIT_EXECUTABLE_ALLOCATOR && SLJIT_EXECUTABLE_ALLOCATOR) || (defined SLJIT_PROT_EXECUTABLE_ALLOCATOR && SLJIT_PROT_EXECUTABLE_ALLOCATOR) || (defined SLJIT_WX_EXECUTABLE_ALLOCATOR && SLJIT_WX_EXECUTABLE_ALLOCATOR)
+    // Loading needs sljit's default allocator, as the code gets copied into the allocated memory directly and has no executable offset.
+    (void)path;
+    (void)key;
+    (void)inputs;
+    (void)output_out;
+    return false;
+#else
+    std::ifstream input_file{ path, std::ios::binary | std::ios::ate };
+    if (!input_file.good()) {
+        return false;
+    }
+    std::vector<char> data{};
+    data.resize(input_file.tellg());
+    input_file.seekg(0, std::ios::beg);
+    if (!input_file.read(data.data(), data.size())) {
+        return false;
+    }
+
+    LiveCacheReader reader{ data };
+    LiveCacheHeader header{};
+    if (!reader.read(header) ||
+        memcmp(header.magic, live_output_cache_magic, sizeof(header.magic)) != 0 ||
+        header.version != live_output_cache_version ||
+        header.pointer_size != sizeof(void*) ||
+        header.key != key ||
+        header.code_size == 0) {
+        return false;
+    }
+
+    // Validates that an offset points within the code.
+    auto check_offset = [&header](uint64_t code_offset) {
+        return code_offset < header.code_size;
+    };
+
+    std::vector<uint64_t> function_offsets{};
+    function_offsets.resize(header.num_functions);
+    for (uint64_t& func_offset : function_offsets) {
+        if (!reader.read(func_offset) || (func_offset != live_cache_missing_function && !check_offset(func_offset))) {
+            return false;
+        }
+    }
+
+    std::vector<std::vector<uint64_t>> jump_table_offsets{};
+    jump_table_offsets.resize(header.num_jump_tables);
+    for (std::vector<uint64_t>& cur_offsets : jump_table_offsets) {
+        uint64_t num_entries;
+        // Each entry takes 8 bytes, so a table can't have more entries than there are bytes left in the file.
+        if (!reader.read(num_entries) || num_entries > data.size()) {
+            return false;
+        }
+        cur_offsets.resize(num_entries);
+        for (uint64_t& entry_offset : cur_offsets) {
+            if (!reader.read(entry_offset) || !check_offset(entry_offset)) {
+                return false;
+            }
+        }
+    }
+
+    LiveGeneratorOutput ret{};
+    if (inputs.arena != nullptr) {
+        ret.arena = inputs.arena;
+    }
+    else {
+        ret.owned_arena = std::make_unique<LiveOutputArena>(0);
+        ret.arena = ret.owned_arena.get();
+    }
+
+    for (uint32_t literal_index = 0; literal_index < header.num_string_literals; literal_index++) {
+        uint64_t length;
+        if (!reader.read(length) || length > data.size()) {
+            return false;
+        }
+        char* literal = ret.arena->allocate_data_array<char>(length + 1);
+        ret.string_literals.emplace_back(literal);
+        if (!reader.read_bytes(literal, length)) {
+            return false;
+        }
+        literal[length] = '\x00';
+    }
+
+    std::vector<LiveCacheReferenceJump> reference_jumps{};
+    reference_jumps.resize(header.num_reference_symbol_jumps);
+    for (LiveCacheReferenceJump& jump : reference_jumps) {
+        if (!reader.read(jump) || !check_offset(jump.code_offset)) {
+            return false;
+        }
+    }
+
+    std::vector<LiveCacheIndexedJump> import_jumps{};
+    import_jumps.resize(header.num_import_jumps);
+    for (LiveCacheIndexedJump& jump : import_jumps) {
+        if (!reader.read(jump) || !check_offset(jump.code_offset)) {
+            return false;
+        }
+    }
+
+    std::vector<LiveCacheIndexedJump> inner_call_jumps{};
+    inner_call_jumps.resize(header.num_inner_call_jumps);
+    for (LiveCacheIndexedJump& jump : inner_call_jumps) {
+        if (!reader.read(jump) || !check_offset(jump.code_offset)) {
+            return false;
+        }
+    }
+
+    std::vector<LiveCacheAddressReloc> address_relocs{};
+    address_relocs.resize(header.num_address_relocs);
+    for (LiveCacheAddressReloc& reloc : address_relocs) {
+        if (!reader.read(reloc) || !check_offset(reloc.code_offset)) {
+            return false;
+        }
+    }
+
+    // Allocate executable memory from the arena and copy the code into it.
+    void* code = ret.arena->allocate_code(header.code_size);
+    if (code == nullptr) {
+        return false;
+    }
+    ret.code = code;
+    ret.code_size = header.code_size;
+#if defined(__APPLE__) && defined(__aarch64__)
+    pthread_jit_write_protect_np(0);
+#endif
+    bool read_code = reader.read_bytes(code, header.code_size);
+#if defined(__APPLE__) && defined(__aarch64__)
+    pthread_jit_write_protect_np(1);
+#endif
+    if (!read_code) {
+        return false;
+    }
+    SLJIT_CACHE_FLUSH(reinterpret_cast<char*>(code), reinterpret_cast<char*>(code) + header.code_size);
+
+    uintptr_t code_start = reinterpret_cast<uintptr_t>(code);
+    ret.executable_offset = 0;
+    ret.cacheable = true;
+
+    ret.functions.resize(function_offsets.size());
+    for (size_t func_index = 0; func_index < function_offsets.size(); func_index++) {
+        if (function_offsets[func_index] != live_cache_missing_function) {
+            ret.functions[func_index] = reinterpret_cast<recomp_func_t*>(code_start + function_offsets[func_index]);
+        }
+    }
+
+    for (const std::vector<uint64_t>& cur_offsets : jump_table_offsets) {
+        void** jump_table = ret.arena->allocate_data_array<void*>(cur_offsets.size());
+        for (size_t entry_index = 0; entry_index < cur_offsets.size(); entry_index++) {
+            jump_table[entry_index] = reinterpret_cast<void*>(code_start + cur_offsets[entry_index]);
+        }
+        ret.jump_tables.emplace_back(jump_table);
+        ret.jump_table_sizes.emplace_back(cur_offsets.size());
+    }
+
+    for (const LiveCacheReferenceJump& jump : reference_jumps) {
+        ret.reference_symbol_jumps.emplace_back(std::make_pair(
+            ReferenceJumpDetails{ .section = jump.section, .section_offset = jump.section_offset },
+            reinterpret_cast<void*>(code_start + jump.code_offset)
+        ));
+    }
+
+    for (const LiveCacheIndexedJump& jump : import_jumps) {
+        ret.import_jumps_by_index.emplace(jump.index, reinterpret_cast<void*>(code_start + jump.code_offset));
+    }
+
+    for (const LiveCacheIndexedJump& jump : inner_call_jumps) {
+        ret.inner_call_jumps.emplace_back(jump.index, reinterpret_cast<void*>(code_start + jump.code_offset));
+    }
+
+    // Patch every absolute address in the code with its value for this run.
+    for (const LiveCacheAddressReloc& reloc : address_relocs) {
+        uintptr_t value = 0;
+        switch (static_cast<LiveAddressType>(reloc.type)) {
+            case LiveAddressType::InputCallback:
+                value = get_live_input_callback(inputs, static_cast<LiveInputCallback>(reloc.index));
+                break;
+            case LiveAddressType::RuntimeHelper:
+                value = get_live_runtime_helper(reloc.index);
+                break;
+            case LiveAddressType::ReferenceSectionAddress:
+                if (inputs.reference_section_addresses != nullptr) {
+                    value = reinterpret_cast<uintptr_t>(inputs.reference_section_addresses + reloc.index);
+                }
+                break;
+            case LiveAddressType::LocalSectionAddress:
+                if (inputs.local_section_addresses != nullptr) {
+                    value = reinterpret_cast<uintptr_t>(inputs.local_section_addresses + reloc.index);
+                }
+                break;
+            case LiveAddressType::StringLiteral:
+                if (reloc.index < ret.string_literals.size()) {
+                    value = reinterpret_cast<uintptr_t>(ret.string_literals[reloc.index]);
+                }
+                break;
+            case LiveAddressType::JumpTable:
+                if (reloc.index < ret.jump_tables.size()) {
+                    value = reinterpret_cast<uintptr_t>(ret.jump_tables[reloc.index]);
+                }
+                break;
+            case LiveAddressType::ProfileCounter:
+                if (inputs.profile_counters != nullptr) {
+                    value = reinterpret_cast<uintptr_t>(inputs.profile_counters + reloc.index);
+                }
+                break;
+        }
+
+        // Addresses that couldn't be resolved mean the file doesn't match the inputs.
+        if (value == 0) {
+            return false;
+        }
+
+        LiveAddressReloc& out_reloc = ret.address_relocs.emplace_back(LiveAddressReloc{
+            .type = static_cast<LiveAddressType>(reloc.type),
+            .is_call = reloc.is_call != 0,
+            .index = reloc.index,
+            .addr = reinterpret_cast<void*>(code_start + reloc.code_offset)
+        });
+        if (out_reloc.is_call) {
+            sljit_set_jump_addr(reinterpret_cast<sljit_uw>(out_reloc.addr), sljit_uw(value), 0);
+        }
+        else {
+            sljit_set_const(reinterpret_cast<sljit_uw>(out_reloc.addr), sljit_sw(value), 0);
+        }
+    }
+
+    ret.good = true;
+    output_out = std::move(ret);
+    return true;
+#endif
+}
@@ -0,0 +1,323 @@
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <cfenv>
+
+#include "fmt/format.h"
+
+#include "recompiler/live_recompiler.h"
+#include "recompiler/generator.h"
+#include "recompiler/json.h"
+#include "recomp.h"
+#include "live_test_data.h"
+
+// Benchmark for the live recompiler. Runs each test's functions through the live recompiler and the C generator repeatedly
+// and reports the distribution of codegen and execution times.
+
+std::vector<uint8_t> rdram;
+
+using BenchClock = std::chrono::steady_clock;
+
+struct TimingSummary {
+    double median_microseconds;
+    double p99_microseconds;
+    double min_microseconds;
+    double max_microseconds;
+};
+
+struct BenchResult {
+    std::string test_name;
+    bool good;
+    size_t num_functions;
+    size_t num_instructions;
+    uint64_t code_size;
+    uint64_t c_output_size;
+    TimingSummary live_codegen;
+    TimingSummary live_execution;
+    TimingSummary c_codegen;
+};
+
+struct BenchSettings {
+    size_t warmup_iterations = 3;
+    size_t iterations = 50;
+};
+
+static double to_microseconds(BenchClock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+// Sorts the samples and returns the median, 99th percentile (nearest rank), minimum and maximum.
+static TimingSummary summarize(std::vector<double>& samples) {
+    TimingSummary ret{};
+    if (samples.empty()) {
+        return ret;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    size_t count = samples.size();
+    if (count % 2 == 0) {
+        ret.median_microseconds = (samples[count / 2 - 1] + samples[count / 2]) / 2.0;
+    }
+    else {
+        ret.median_microseconds = samples[count / 2];
+    }
+    size_t p99_rank = (count * 99 + 99) / 100;
+    ret.p99_microseconds = samples[std::min(p99_rank, count) - 1];
+    ret.min_microseconds = samples.front();
+    ret.max_microseconds = samples.back();
+    return ret;
+}
+
+// Returns the number of instructions compiled per second for the given codegen time.
+static double instructions_per_second(size_t num_instructions, const TimingSummary& timing) {
+    if (timing.median_microseconds <= 0.0) {
+        return 0.0;
+    }
+    return num_instructions / (timing.median_microseconds / 1000000.0);
+}
+
+static bool run_live_iteration(const TestData& data, const N64Recomp::LiveGeneratorInputs& inputs, double& codegen_out, double& execution_out, uint64_t& code_size_out) {
+    const N64Recomp::Context& context = data.context;
+    std::vector<std::vector<uint32_t>> dummy_static_funcs{};
+
+    auto before_codegen = BenchClock::now();
+
+    N64Recomp::LiveGenerator generator{ context.functions.size(), inputs };
+
+    for (size_t func_index = 0; func_index < context.functions.size(); func_index++) {
+        std::ostringstream dummy_ostream{};
+
+        if (!N64Recomp::recompile_function_live(generator, context, func_index, dummy_ostream, dummy_static_funcs, true)) {
+            return false;
+        }
+    }
+
+    N64Recomp::LiveGeneratorOutput output = generator.finish();
+
+    auto after_codegen = BenchClock::now();
+
+    if (!output.good) {
+        return false;
+    }
+
+    // Reset the test's memory so that every iteration runs on the same input.
+    load_test_memory(data, rdram);
+    recomp_context ctx{};
+    ctx.r29 = 0xFFFFFFFF80000000 + rdram.size() - 0x10; // Set the stack pointer.
+
+    int old_rounding = fegetround();
+
+    auto before_execution = BenchClock::now();
+
+    output.functions[data.start_func_index](rdram.data(), &ctx);
+
+    auto after_execution = BenchClock::now();
+
+    fesetround(old_rounding);
+
+    codegen_out = to_microseconds(after_codegen - before_codegen);
+    execution_out = to_microseconds(after_execution - before_execution);
+    code_size_out = output.code_size;
+
+    return check_test_memory(data, rdram);
+}
+
+static bool run_c_iteration(const TestData& data, double& codegen_out, uint64_t& output_size_out) {
+    const N64Recomp::Context& context = data.context;
+    std::vector<std::vector<uint32_t>> dummy_static_funcs{};
+    fmt::memory_buffer output_buffer{};
+
+    auto before_codegen = BenchClock::now();
+
+    for (size_t func_index = 0; func_index < context.functions.size(); func_index++) {
+        if (!N64Recomp::recompile_function(context, func_index, output_buffer, dummy_static_funcs, true)) {
+            return false;
+        }
+    }
+
+    auto after_codegen = BenchClock::now();
+
+    codegen_out = to_microseconds(after_codegen - before_codegen);
+    output_size_out = output_buffer.size();
+
+    return true;
+}
+
+static bool run_bench(const std::filesystem::path& tests_dir, const std::string& test_name, const BenchSettings& settings, BenchResult& result) {
+    result.test_name = test_name;
+    result.good = false;
+
+    TestData data{};
+    if (load_test_data(tests_dir / (test_name + "_data.bin"), data) != TestDataError::Success) {
+        return false;
+    }
+
+    result.num_functions = data.context.functions.size();
+    result.num_instructions = count_test_instructions(data);
+
+    std::vector<int32_t> section_addresses{};
+    section_addresses.emplace_back(data.text_address);
+    section_addresses.emplace_back(data.data_address);
+
+    N64Recomp::LiveGeneratorInputs generator_inputs {
+        .switch_error = test_switch_error,
+        .get_function = test_get_function,
+        .reference_section_addresses = nullptr,
+        .local_section_addresses = section_addresses.data()
+    };
+
+    std::vector<double> live_codegen_samples{};
+    std::vector<double> live_execution_samples{};
+    std::vector<double> c_codegen_samples{};
+    live_codegen_samples.reserve(settings.iterations);
+    live_execution_samples.reserve(settings.iterations);
+    c_codegen_samples.reserve(settings.iterations);
+
+    // Warm-up iterations aren't recorded, they only make sure caches and allocations are in a steady state.
+    for (size_t iteration = 0; iteration < settings.warmup_iterations + settings.iterations; iteration++) {
+        double live_codegen;
+        double live_execution;
+        double c_codegen;
+        if (!run_live_iteration(data, generator_inputs, live_codegen, live_execution, result.code_size)) {
+            printf("  Live recompiler output failed on iteration %zu\n", iteration);
+            return false;
+        }
+        if (!run_c_iteration(data, c_codegen, result.c_output_size)) {
+            printf("  C generator failed on iteration %zu\n", iteration);
+            return false;
+        }
+
+        if (iteration >= settings.warmup_iterations) {
+            live_codegen_samples.push_back(live_codegen);
+            live_execution_samples.push_back(live_execution);
+            c_codegen_samples.push_back(c_codegen);
+        }
+    }
+
+    result.live_codegen = summarize(live_codegen_samples);
+    result.live_execution = summarize(live_execution_samples);
+    result.c_codegen = summarize(c_codegen_samples);
+    result.good = true;
+    return true;
+}
+
+static void print_timing(const char* name, const TimingSummary& timing) {
+    printf("  %-16s median %10.2f us  p99 %10.2f us  min %10.2f us  max %10.2f us\n", name,
+        timing.median_microseconds, timing.p99_microseconds, timing.min_microseconds, timing.max_microseconds);
+}
+
+static void write_timing_json(std::ofstream& output, const char* name, const TimingSummary& timing) {
+    output << fmt::format("      \"{}\": {{ \"median_us\": {:.3f}, \"p99_us\": {:.3f}, \"min_us\": {:.3f}, \"max_us\": {:.3f} }},\n", name,
+        timing.median_microseconds, timing.p99_microseconds, timing.min_microseconds, timing.max_microseconds);
+}
+
+static bool write_json(const std::filesystem::path& path, const BenchSettings& settings, const std::vector<BenchResult>& results) {
+    std::ofstream output{ path };
+    if (!output.good()) {
+        printf("Failed to open JSON output file: %s\n", path.string().c_str());
+        return false;
+    }
+
+    output << "{\n";
+    output << fmt::format("  \"warmup_iterations\": {},\n", settings.warmup_iterations);
+    output << fmt::format("  \"iterations\": {},\n", settings.iterations);
+    output << "  \"tests\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& result = results[i];
+        output << "    {\n";
+        output << fmt::format("      \"name\": \"{}\",\n", N64Recomp::escape_json_string(result.test_name));
+        if (!result.good) {
+            output << "      \"good\": false\n";
+        }
+        else {
+            output << "      \"good\": true,\n";
+            output << fmt::format("      \"functions\": {},\n", result.num_functions);
+            output << fmt::format("      \"instructions\": {},\n", result.num_instructions);
+            output << fmt::format("      \"live_code_size\": {},\n", result.code_size);
+            output << fmt::format("      \"c_output_size\": {},\n", result.c_output_size);
+            write_timing_json(output, "live_codegen", result.live_codegen);
+            write_timing_json(output, "live_execution", result.live_execution);
+            write_timing_json(output, "c_codegen", result.c_codegen);
+            output << fmt::format("      \"live_instructions_per_second\": {:.0f},\n", instructions_per_second(result.num_instructions, result.live_codegen));
+            output << fmt::format("      \"c_instructions_per_second\": {:.0f}\n", instructions_per_second(result.num_instructions, result.c_codegen));
+        }
+        output << (i + 1 == results.size() ? "    }\n" : "    },\n");
+    }
+    output << "  ]\n";
+    output << "}\n";
+
+    return output.good();
+}
+
+int main(int argc, const char** argv) {
+    if (argc < 3) {
+        printf("Usage: %s [test directory] [options] [test 1] ...\n", argv[0]);
+        printf("Options:\n");
+        printf("  --warmup <count>        Number of unrecorded warm-up iterations per test (default 3)\n");
+        printf("  --iterations <count>    Number of recorded iterations per test (default 50)\n");
+        printf("  --json <path>           Write the results to the given JSON file\n");
+        return EXIT_SUCCESS;
+    }
+
+    BenchSettings settings{};
+    std::filesystem::path json_path{};
+    std::vector<std::string> test_names{};
+
+    // Skip the first argument (program name) and second argument (test directory).
+    for (int arg_index = 2; arg_index < argc; arg_index++) {
+        const char* arg = argv[arg_index];
+        bool has_value = arg_index + 1 < argc;
+        if (strcmp(arg, "--warmup") == 0 && has_value) {
+            settings.warmup_iterations = strtoull(argv[++arg_index], nullptr, 10);
+        }
+        else if (strcmp(arg, "--iterations") == 0 && has_value) {
+            settings.iterations = std::max<size_t>(1, strtoull(argv[++arg_index], nullptr, 10));
+        }
+        else if (strcmp(arg, "--json") == 0 && has_value) {
+            json_path = argv[++arg_index];
+        }
+        else {
+            test_names.emplace_back(arg);
+        }
+    }
+
+    N64Recomp::live_recompiler_init();
+
+    rdram.resize(0x8000000);
+
+    std::vector<BenchResult> results{};
+    int failed_count = 0;
+    results.reserve(test_names.size());
+
+    for (const std::string& test_name : test_names) {
+        printf("Benchmarking test: %s\n", test_name.c_str());
+        BenchResult& result = results.emplace_back();
+
+        if (!run_bench(argv[1], test_name, settings, result)) {
+            printf("  Failed\n\n");
+            failed_count++;
+            continue;
+        }
+
+        printf("  %zu functions, %zu instructions, %" PRIu64 " bytes of code, %" PRIu64 " bytes of C\n",
+            result.num_functions, result.num_instructions, result.code_size, result.c_output_size);
+        print_timing("Live codegen", result.live_codegen);
+        print_timing("Live execution", result.live_execution);
+        print_timing("C codegen", result.c_codegen);
+        printf("  Live recompiler compiled %.0f instructions per second (C generator: %.0f)\n\n",
+            instructions_per_second(result.num_instructions, result.live_codegen),
+            instructions_per_second(result.num_instructions, result.c_codegen));
+    }
+
+    if (!json_path.empty() && !write_json(json_path, settings, results)) {
+        return EXIT_FAILURE;
+    }
+
+    printf("Benchmarked %zu/%zu tests\n", results.size() - failed_count, results.size());
+
+    return failed_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
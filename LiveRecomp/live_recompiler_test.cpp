@@ -6,57 +6,18 @@
 #include "sljitLir.h"
 #include "recompiler/live_recompiler.h"
 #include "recomp.h"
-
-static std::vector<uint8_t> read_file(const std::filesystem::path& path, bool& found) {
-    std::vector<uint8_t> ret;
-    found = false;
-
-    std::ifstream file{ path, std::ios::binary};
-
-    if (file.good()) {
-        file.seekg(0, std::ios::end);
-        ret.resize(file.tellg());
-        file.seekg(0, std::ios::beg);
-
-        file.read(reinterpret_cast<char*>(ret.data()), ret.size());
-        found = true;
-    }
-
-    return ret;
-}
-
-
-uint32_t read_u32_swap(const std::vector<uint8_t>& vec, size_t offset) {
-    return byteswap(*reinterpret_cast<const uint32_t*>(&vec[offset]));
-}
-
-uint32_t read_u32(const std::vector<uint8_t>& vec, size_t offset) {
-    return *reinterpret_cast<const uint32_t*>(&vec[offset]);
-}
+#include "live_test_data.h"
 
 std::vector<uint8_t> rdram;
 
-void byteswap_copy(uint8_t* dst, uint8_t* src, size_t count) {
-    for (size_t i = 0; i < count; i++) {
-        dst[i ^ 3] = src[i];
-    }
-}
-
-bool byteswap_compare(uint8_t* a, uint8_t* b, size_t count) {
-    for (size_t i = 0; i < count; i++) {
-        if (a[i ^ 3] != b[i]) {
-            return false;
-        }
-    }
-    return true;
-}
-
 enum class TestError {
     Success,
     FailedToOpenInput,
     FailedToRecompile,
     UnknownStructType,
-    DataDifference
+    DataDifference,
+    FailedToRecompileLazily,
+    LazyDataDifference
 };
 
 struct TestStats {
@@ -66,177 +27,189 @@ struct TestStats {
     uint64_t code_size;
 };
 
-void write1(uint8_t* rdram, recomp_context* ctx) {
-    MEM_B(0, ctx->r4) = 1;
-}
-
-recomp_func_t* test_get_function(int32_t vram) {
-    if (vram == 0x80100000) {
-        return write1;
-    }
-    assert(false);
-    return nullptr;
-}
-
-void test_switch_error(const char* func, uint32_t vram, uint32_t jtbl) {
-    printf("  Switch-case out of bounds in %s at 0x%08X for jump table at 0x%08X\n", func, vram, jtbl);
-}
+// A test that's built into the runner instead of being loaded from a test data file, for cases that are easier to write by hand.
+struct BuiltinTest {
+    const char* name;
+    // Instruction words of the test's only function, which end with a return.
+    std::vector<uint32_t> text;
+    // Initial and expected contents of the test's data.
+    std::vector<uint32_t> init_data;
+    std::vector<uint32_t> good_data;
+};
 
-TestStats run_test(const std::filesystem::path& tests_dir, const std::string& test_name) {
-    std::filesystem::path input_path = tests_dir / (test_name + "_data.bin");
-    std::filesystem::path data_dump_path = tests_dir / (test_name + "_data_out.bin");
+constexpr uint32_t builtin_text_address = 0x80000400;
+constexpr uint32_t builtin_data_address = 0x80200000;
+
+const std::vector<BuiltinTest> builtin_tests = {
+    // A load into $zero in the place where a run of accesses with the same base would start, followed by an access with that base.
+    // The load gets skipped, so the access after it must not reuse the base address of the earlier store.
+    {
+        .name = "builtin_zero_load_run",
+        .text = {
+            0x3C048020, // lui     $a0, 0x8020
+            0x3C058020, // lui     $a1, 0x8020
+            0x34A50100, // ori     $a1, $a1, 0x100
+            0x24081234, // addiu   $t0, $zero, 0x1234
+            0xACA80000, // sw      $t0, 0x0($a1)
+            0x8C800000, // lw      $zero, 0x0($a0)
+            0xAC880004, // sw      $t0, 0x4($a0)
+            0x03E00008, // jr      $ra
+            0x00000000, // nop
+        },
+        .init_data = std::vector<uint32_t>(0x80, 0),
+        .good_data = [] {
+            std::vector<uint32_t> ret(0x80, 0);
+            ret[0x4 / 4] = 0x1234;
+            ret[0x100 / 4] = 0x1234;
+            return ret;
+        }(),
+    },
+    // Word loads into registers that may be kept in the context instead of a host register must replace the upper half of the register too.
+    {
+        .name = "builtin_load_upper_half",
+        .text = {
+            0x3C048020, // lui     $a0, 0x8020
+            0x2410FFFF, // addiu   $s0, $zero, -0x1
+            0x2411FFFF, // addiu   $s1, $zero, -0x1
+            0x8C900000, // lw      $s0, 0x0($a0)
+            0x9C910000, // lwu     $s1, 0x0($a0)
+            0x0010483F, // dsra32  $t1, $s0, 0
+            0x0011503F, // dsra32  $t2, $s1, 0
+            0xAC890004, // sw      $t1, 0x4($a0)
+            0xAC8A0008, // sw      $t2, 0x8($a0)
+            0x03E00008, // jr      $ra
+            0x00000000, // nop
+        },
+        .init_data = [] {
+            std::vector<uint32_t> ret(0x80, 0);
+            ret[0] = 0x5;
+            return ret;
+        }(),
+        .good_data = [] {
+            std::vector<uint32_t> ret(0x80, 0);
+            ret[0] = 0x5;
+            return ret;
+        }(),
+    },
+    // Word loads of a negative value must sign extend it into the upper half of the register, while unsigned word loads must not.
+    {
+        .name = "builtin_load_negative_word",
+        .text = {
+            0x3C048020, // lui     $a0, 0x8020
+            0x8C900000, // lw      $s0, 0x0($a0)
+            0x8C850000, // lw      $a1, 0x0($a0)
+            0x9C910000, // lwu     $s1, 0x0($a0)
+            0x0010483F, // dsra32  $t1, $s0, 0
+            0x0005503F, // dsra32  $t2, $a1, 0
+            0x0011583F, // dsra32  $t3, $s1, 0
+            0xAC890004, // sw      $t1, 0x4($a0)
+            0xAC8A0008, // sw      $t2, 0x8($a0)
+            0xAC8B000C, // sw      $t3, 0xC($a0)
+            0x03E00008, // jr      $ra
+            0x00000000, // nop
+        },
+        .init_data = [] {
+            std::vector<uint32_t> ret(0x80, 0);
+            ret[0] = 0x80000005;
+            return ret;
+        }(),
+        .good_data = [] {
+            std::vector<uint32_t> ret(0x80, 0);
+            ret[0] = 0x80000005;
+            ret[0x4 / 4] = 0xFFFFFFFF;
+            ret[0x8 / 4] = 0xFFFFFFFF;
+            return ret;
+        }(),
+    },
+    // In FR=0 mode the odd float registers are the upper halves of the even ones, so lwc1 into $f0 must leave $f1 unchanged.
+    {
+        .name = "builtin_lwc1_fr0",
+        .text = {
+            0x3C048020, // lui     $a0, 0x8020
+            0x3C081234, // lui     $t0, 0x1234
+            0x35085678, // ori     $t0, $t0, 0x5678
+            0x44880800, // mtc1    $t0, $f1
+            0xC4800000, // lwc1    $f0, 0x0($a0)
+            0x44090800, // mfc1    $t1, $f1
+            0x440A0000, // mfc1    $t2, $f0
+            0xAC890004, // sw      $t1, 0x4($a0)
+            0xAC8A0008, // sw      $t2, 0x8($a0)
+            0x03E00008, // jr      $ra
+            0x00000000, // nop
+        },
+        .init_data = [] {
+            std::vector<uint32_t> ret(0x80, 0);
+            ret[0] = 0x3F800000;
+            return ret;
+        }(),
+        .good_data = [] {
+            std::vector<uint32_t> ret(0x80, 0);
+            ret[0] = 0x3F800000;
+            ret[0x4 / 4] = 0x12345678;
+            ret[0x8 / 4] = 0x3F800000;
+            return ret;
+        }(),
+    },
+};
 
-    bool found;
-    std::vector<uint8_t> file_data = read_file(input_path, found);
+// Builds the contents of a test data file for a built-in test.
+std::vector<uint8_t> build_test_file(const BuiltinTest& test) {
+    std::vector<uint8_t> ret{};
+    auto append_u32 = [&ret](uint32_t value) {
+        ret.emplace_back(static_cast<uint8_t>(value >> 24));
+        ret.emplace_back(static_cast<uint8_t>(value >> 16));
+        ret.emplace_back(static_cast<uint8_t>(value >> 8));
+        ret.emplace_back(static_cast<uint8_t>(value >> 0));
+    };
 
-    if (!found) {
-        printf("Failed to open file: %s\n", input_path.string().c_str());
-        return { TestError::FailedToOpenInput };
+    constexpr uint32_t header_size = 0x20;
+    uint32_t text_length = static_cast<uint32_t>(test.text.size() * sizeof(uint32_t));
+    uint32_t data_length = static_cast<uint32_t>(test.init_data.size() * sizeof(uint32_t));
+    append_u32(header_size); // Text offset
+    append_u32(text_length);
+    append_u32(header_size + text_length); // Initial data offset
+    append_u32(header_size + text_length + data_length); // Expected data offset
+    append_u32(data_length);
+    append_u32(builtin_text_address);
+    append_u32(builtin_data_address);
+    append_u32(0); // No extra structs
+    for (uint32_t word : test.text) {
+        append_u32(word);
     }
-
-    // Parse the test file.
-    uint32_t text_offset = read_u32_swap(file_data, 0x00);
-    uint32_t text_length = read_u32_swap(file_data, 0x04);
-    uint32_t init_data_offset = read_u32_swap(file_data, 0x08);
-    uint32_t good_data_offset = read_u32_swap(file_data, 0x0C);
-    uint32_t data_length = read_u32_swap(file_data, 0x10);
-    uint32_t text_address = read_u32_swap(file_data, 0x14);
-    uint32_t data_address = read_u32_swap(file_data, 0x18);
-    uint32_t next_struct_address = read_u32_swap(file_data, 0x1C);
-
-    recomp_context ctx{};
-
-    byteswap_copy(&rdram[text_address - 0x80000000], &file_data[text_offset], text_length);
-    byteswap_copy(&rdram[data_address - 0x80000000], &file_data[init_data_offset], data_length);
-
-    // Build recompiler context.
-    N64Recomp::Context context{};
-
-    // Move the file data into the context.
-    context.rom = std::move(file_data);
-
-    context.sections.resize(2);
-    // Create a section for the function to exist in.
-    context.sections[0].ram_addr = text_address;
-    context.sections[0].rom_addr = text_offset;
-    context.sections[0].size = text_length;
-    context.sections[0].name = ".text";
-    context.sections[0].executable = true;
-    context.sections[0].relocatable = true;
-    context.section_functions.resize(context.sections.size());
-    // Create a section for .data (used for relocations)
-    context.sections[1].ram_addr = data_address;
-    context.sections[1].rom_addr = init_data_offset;
-    context.sections[1].size = data_length;
-    context.sections[1].name = ".data";
-    context.sections[1].executable = false;
-    context.sections[1].relocatable = true;
-
-    size_t start_func_index;
-    uint32_t function_desc_address = 0;
-    uint32_t reloc_desc_address = 0;
-
-    // Read any extra structs.
-    while (next_struct_address != 0) {
-        uint32_t cur_struct_address = next_struct_address;
-        uint32_t struct_type = read_u32_swap(context.rom, next_struct_address + 0x00);
-        next_struct_address = read_u32_swap(context.rom, next_struct_address + 0x04);
-
-        switch (struct_type) {
-            case 1: // Function desc
-                function_desc_address = cur_struct_address;
-                break;
-            case 2: // Relocation
-                reloc_desc_address = cur_struct_address;
-                break;
-            default:
-                printf("Unknown struct type %u\n", struct_type);
-                return { TestError::UnknownStructType };
-        }
+    for (uint32_t word : test.init_data) {
+        append_u32(word);
     }
+    for (uint32_t word : test.good_data) {
+        append_u32(word);
+    }
+    return ret;
+}
 
-    // Check if a function description exists.
-    if (function_desc_address == 0) {
-        // No function description, so treat the whole thing as one function.
-
-        // Get the function's instruction words.
-        std::vector<uint32_t> text_words{};
-        text_words.resize(text_length / sizeof(uint32_t));
-        for (size_t i = 0; i < text_words.size(); i++) {
-            text_words[i] = read_u32(context.rom, text_offset + i * sizeof(uint32_t));
-        }
+// Clears the context and sets it up for running a test in FR=0 mode.
+void reset_test_context(recomp_context& ctx) {
+    ctx = {};
+    ctx.r29 = 0xFFFFFFFF80000000 + rdram.size() - 0x10; // Set the stack pointer.
+    ctx.f_odd = &ctx.f0.u32h;
+    ctx.mips3_float_mode = 0;
+}
 
-        // Add the function to the context.
-        context.functions_by_vram[text_address].emplace_back(context.functions.size());
-        context.section_functions.emplace_back(context.functions.size());
-        context.sections[0].function_addrs.emplace_back(text_address);
-        context.functions.emplace_back(
-            text_address,
-            text_offset,
-            text_words,
-            "test_func",
-            0
-        );
-        start_func_index = 0;
-    }
-    else {
-        // Use the function description.
-        uint32_t num_funcs = read_u32_swap(context.rom, function_desc_address + 0x08);
-        start_func_index = read_u32_swap(context.rom, function_desc_address + 0x0C);
-
-        for (size_t func_index = 0; func_index < num_funcs; func_index++) {
-            uint32_t cur_func_address = read_u32_swap(context.rom, function_desc_address + 0x10 + 0x00 + 0x08 * func_index);
-            uint32_t cur_func_length = read_u32_swap(context.rom, function_desc_address + 0x10 + 0x04 + 0x08 * func_index);
-            uint32_t cur_func_offset = cur_func_address - text_address + text_offset;
-
-            // Get the function's instruction words.
-            std::vector<uint32_t> text_words{};
-            text_words.resize(cur_func_length / sizeof(uint32_t));
-            for (size_t i = 0; i < text_words.size(); i++) {
-                text_words[i] = read_u32(context.rom, cur_func_offset + i * sizeof(uint32_t));
-            }
+TestStats run_test(TestData& data, const std::filesystem::path& data_dump_path) {
+    N64Recomp::Context& context = data.context;
+    uint32_t text_address = data.text_address;
+    uint32_t data_address = data.data_address;
+    uint32_t data_length = data.data_length;
+    size_t start_func_index = data.start_func_index;
 
-            // Add the function to the context.
-            context.functions_by_vram[cur_func_address].emplace_back(context.functions.size());
-            context.section_functions.emplace_back(context.functions.size());
-            context.sections[0].function_addrs.emplace_back(cur_func_address);
-            context.functions.emplace_back(
-                cur_func_address,
-                cur_func_offset,
-                std::move(text_words),
-                "test_func_" + std::to_string(func_index),
-                0
-            );
-        }
-    }
+    recomp_context ctx{};
 
-    // Check if a relocation description exists.
-    if (reloc_desc_address != 0) {
-        uint32_t num_relocs = read_u32_swap(context.rom, reloc_desc_address + 0x08);
-        for (uint32_t reloc_index = 0; reloc_index < num_relocs; reloc_index++) {
-            uint32_t cur_desc_address = reloc_desc_address + 0x0C + reloc_index * 4 * sizeof(uint32_t);
-            uint32_t reloc_type = read_u32_swap(context.rom, cur_desc_address + 0x00);
-            uint32_t reloc_section = read_u32_swap(context.rom, cur_desc_address + 0x04);
-            uint32_t reloc_address = read_u32_swap(context.rom, cur_desc_address + 0x08);
-            uint32_t reloc_target_offset = read_u32_swap(context.rom, cur_desc_address + 0x0C);
-
-            context.sections[0].relocs.emplace_back(N64Recomp::Reloc{
-                .address = reloc_address,
-                .target_section_offset = reloc_target_offset,
-                .symbol_index = 0,
-                .target_section = static_cast<uint16_t>(reloc_section),
-                .type = static_cast<N64Recomp::RelocType>(reloc_type),
-                .reference_symbol = false
-            });
-        }
-    }
+    load_test_memory(data, rdram);
 
     std::vector<std::vector<uint32_t>> dummy_static_funcs{};
     std::vector<int32_t> section_addresses{};
     section_addresses.emplace_back(text_address);
     section_addresses.emplace_back(data_address);
 
-    auto before_codegen = std::chrono::system_clock::now();
+    auto before_codegen = std::chrono::steady_clock::now();
 
     N64Recomp::LiveGeneratorInputs generator_inputs {
         .switch_error = test_switch_error,
@@ -261,22 +234,22 @@ TestStats run_test(const std::filesystem::path& tests_dir, const std::string& te
     // Generate the code.
     N64Recomp::LiveGeneratorOutput output = generator.finish();
 
-    auto after_codegen = std::chrono::system_clock::now();
+    auto after_codegen = std::chrono::steady_clock::now();
 
-    auto before_execution = std::chrono::system_clock::now();
+    auto before_execution = std::chrono::steady_clock::now();
 
     int old_rounding = fegetround();
 
     // Run the generated code.
-    ctx.r29 = 0xFFFFFFFF80000000 + rdram.size() - 0x10; // Set the stack pointer.
+    reset_test_context(ctx);
     output.functions[start_func_index](rdram.data(), &ctx);
 
     fesetround(old_rounding);
 
-    auto after_execution = std::chrono::system_clock::now();
+    auto after_execution = std::chrono::steady_clock::now();
 
     // Check the result of running the code.
-    bool good = byteswap_compare(&rdram[data_address - 0x80000000], &context.rom[good_data_offset], data_length);
+    bool good = check_test_memory(data, rdram);
 
     // Dump the data if the results don't match.
     if (!good) {
@@ -288,6 +261,22 @@ TestStats run_test(const std::filesystem::path& tests_dir, const std::string& te
         return { TestError::DataDifference };
     }
 
+    // Run the test again with the functions recompiled on their first call, which should produce the same results.
+    load_test_memory(data, rdram);
+    N64Recomp::LiveLazyOutput lazy_output{ context, generator_inputs, true };
+    if (!lazy_output.good || !lazy_output.compile_function(start_func_index)) {
+        return { TestError::FailedToRecompileLazily };
+    }
+
+    old_rounding = fegetround();
+    reset_test_context(ctx);
+    lazy_output.functions[start_func_index](rdram.data(), &ctx);
+    fesetround(old_rounding);
+
+    if (!check_test_memory(data, rdram)) {
+        return { TestError::LazyDataDifference };
+    }
+
     // Return the test's stats.
     TestStats ret{};
     ret.error = TestError::Success;
@@ -298,6 +287,66 @@ TestStats run_test(const std::filesystem::path& tests_dir, const std::string& te
     return ret;
 }
 
+TestStats run_file_test(const std::filesystem::path& tests_dir, const std::string& test_name) {
+    std::filesystem::path input_path = tests_dir / (test_name + "_data.bin");
+    std::filesystem::path data_dump_path = tests_dir / (test_name + "_data_out.bin");
+
+    TestData data{};
+    switch (load_test_data(input_path, data)) {
+        case TestDataError::Success:
+            break;
+        case TestDataError::FailedToOpenInput:
+            return { TestError::FailedToOpenInput };
+        case TestDataError::UnknownStructType:
+            return { TestError::UnknownStructType };
+    }
+
+    return run_test(data, data_dump_path);
+}
+
+TestStats run_builtin_test(const std::filesystem::path& tests_dir, const BuiltinTest& test) {
+    std::filesystem::path data_dump_path = tests_dir / (std::string{test.name} + "_data_out.bin");
+
+    TestData data{};
+    if (parse_test_data(build_test_file(test), data) != TestDataError::Success) {
+        return { TestError::UnknownStructType };
+    }
+
+    return run_test(data, data_dump_path);
+}
+
+// Prints the result of a test and returns whether it passed.
+bool print_test_result(const TestStats& stats) {
+    switch (stats.error) {
+    case TestError::Success:
+        printf("  Success\n");
+        printf("  Generated %" PRIu64 " bytes in %" PRIu64 " microseconds and ran in %" PRIu64 " microseconds\n",
+            stats.code_size, stats.codegen_microseconds, stats.execution_microseconds);
+        break;
+    case TestError::FailedToOpenInput:
+        printf("  Failed to open input data file\n");
+        break;
+    case TestError::FailedToRecompile:
+        printf("  Failed to recompile\n");
+        break;
+    case TestError::UnknownStructType:
+        printf("  Unknown additional data struct type in test data\n");
+        break;
+    case TestError::DataDifference:
+        printf("  Output data did not match, dumped to file\n");
+        break;
+    case TestError::FailedToRecompileLazily:
+        printf("  Failed to recompile lazily\n");
+        break;
+    case TestError::LazyDataDifference:
+        printf("  Output data did not match when recompiling lazily\n");
+        break;
+    }
+
+    printf("\n");
+    return stats.error == TestError::Success;
+}
+
 int main(int argc, const char** argv) {
     if (argc < 3) {
         printf("Usage: %s [test directory] [test 1] ...\n", argv[0]);
@@ -308,52 +357,40 @@ int main(int argc, const char** argv) {
 
     rdram.resize(0x8000000);
 
-    // Skip the first argument (program name) and second argument (test directory).
-    int count = argc - 1 - 1;
+    int count = 0;
     int passed_count = 0;
 
-    std::vector<size_t> failed_tests{};
+    std::vector<std::string> failed_tests{};
 
-    for (size_t test_index = 0; test_index < count; test_index++) {
-        const char* cur_test_name = argv[2 + test_index];
-        printf("Running test: %s\n", cur_test_name);
-        TestStats stats = run_test(argv[1], cur_test_name);
-
-        switch (stats.error) {
-        case TestError::Success:
-            printf("  Success\n");
-            printf("  Generated %" PRIu64 " bytes in %" PRIu64 " microseconds and ran in %" PRIu64 " microseconds\n",
-                stats.code_size, stats.codegen_microseconds, stats.execution_microseconds);
+    for (const BuiltinTest& test : builtin_tests) {
+        printf("Running test: %s\n", test.name);
+        count++;
+        if (print_test_result(run_builtin_test(argv[1], test))) {
             passed_count++;
-            break;
-        case TestError::FailedToOpenInput:
-            printf("  Failed to open input data file\n");
-            break;
-        case TestError::FailedToRecompile:
-            printf("  Failed to recompile\n");
-            break;
-        case TestError::UnknownStructType:
-            printf("  Unknown additional data struct type in test data\n");
-            break;
-        case TestError::DataDifference:
-            printf("  Output data did not match, dumped to file\n");
-            break;
         }
-
-        if (stats.error != TestError::Success) {
-            failed_tests.emplace_back(test_index);
+        else {
+            failed_tests.emplace_back(test.name);
         }
+    }
 
-        printf("\n");
+    // Skip the first argument (program name) and second argument (test directory).
+    for (int arg_index = 2; arg_index < argc; arg_index++) {
+        const char* cur_test_name = argv[arg_index];
+        printf("Running test: %s\n", cur_test_name);
+        count++;
+        if (print_test_result(run_file_test(argv[1], cur_test_name))) {
+            passed_count++;
+        }
+        else {
+            failed_tests.emplace_back(cur_test_name);
+        }
     }
 
     printf("Passed %d/%d tests\n", passed_count, count);
     if (!failed_tests.empty()) {
         printf("  Failed: ");
         for (size_t i = 0; i < failed_tests.size(); i++) {
-            size_t test_index = failed_tests[i];
-
-            printf("%s", argv[2 + test_index]);
+            printf("%s", failed_tests[i].c_str());
             if (i != failed_tests.size() - 1) {
                 printf(", ");
             }
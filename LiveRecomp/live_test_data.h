@@ -0,0 +1,269 @@
+#ifndef __LIVE_TEST_DATA_H__
+#define __LIVE_TEST_DATA_H__
+
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cassert>
+
+#include "recompiler/context.h"
+#include "recomp.h"
+
+// Shared loading of the live recompiler test data files, used by both the test runner and the benchmark.
+
+enum class TestDataError {
+    Success,
+    FailedToOpenInput,
+    UnknownStructType,
+};
+
+struct TestData {
+    N64Recomp::Context context;
+    uint32_t text_offset;
+    uint32_t text_length;
+    uint32_t init_data_offset;
+    uint32_t good_data_offset;
+    uint32_t data_length;
+    uint32_t text_address;
+    uint32_t data_address;
+    size_t start_func_index;
+};
+
+inline std::vector<uint8_t> read_file(const std::filesystem::path& path, bool& found) {
+    std::vector<uint8_t> ret;
+    found = false;
+
+    std::ifstream file{ path, std::ios::binary};
+
+    if (file.good()) {
+        file.seekg(0, std::ios::end);
+        ret.resize(file.tellg());
+        file.seekg(0, std::ios::beg);
+
+        file.read(reinterpret_cast<char*>(ret.data()), ret.size());
+        found = true;
+    }
+
+    return ret;
+}
+
+inline uint32_t read_u32_swap(std::span<const uint8_t> vec, size_t offset) {
+    return byteswap(*reinterpret_cast<const uint32_t*>(&vec[offset]));
+}
+
+inline uint32_t read_u32(std::span<const uint8_t> vec, size_t offset) {
+    return *reinterpret_cast<const uint32_t*>(&vec[offset]);
+}
+
+inline void byteswap_copy(uint8_t* dst, const uint8_t* src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i ^ 3] = src[i];
+    }
+}
+
+inline bool byteswap_compare(const uint8_t* a, const uint8_t* b, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (a[i ^ 3] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Copies the test's code and initial data into rdram.
+inline void load_test_memory(const TestData& data, std::vector<uint8_t>& rdram) {
+    byteswap_copy(&rdram[data.text_address - 0x80000000], &data.context.rom[data.text_offset], data.text_length);
+    byteswap_copy(&rdram[data.data_address - 0x80000000], &data.context.rom[data.init_data_offset], data.data_length);
+}
+
+// Checks if the data in rdram matches the test's expected output.
+inline bool check_test_memory(const TestData& data, const std::vector<uint8_t>& rdram) {
+    return byteswap_compare(&rdram[data.data_address - 0x80000000], &data.context.rom[data.good_data_offset], data.data_length);
+}
+
+// Parses the contents of a test data file and builds a recompiler context for its functions.
+inline TestDataError parse_test_data(std::vector<uint8_t>&& file_data, TestData& out) {
+    // Parse the test file.
+    uint32_t text_offset = read_u32_swap(file_data, 0x00);
+    uint32_t text_length = read_u32_swap(file_data, 0x04);
+    uint32_t init_data_offset = read_u32_swap(file_data, 0x08);
+    uint32_t good_data_offset = read_u32_swap(file_data, 0x0C);
+    uint32_t data_length = read_u32_swap(file_data, 0x10);
+    uint32_t text_address = read_u32_swap(file_data, 0x14);
+    uint32_t data_address = read_u32_swap(file_data, 0x18);
+    uint32_t next_struct_address = read_u32_swap(file_data, 0x1C);
+
+    out.text_offset = text_offset;
+    out.text_length = text_length;
+    out.init_data_offset = init_data_offset;
+    out.good_data_offset = good_data_offset;
+    out.data_length = data_length;
+    out.text_address = text_address;
+    out.data_address = data_address;
+
+    // Build recompiler context.
+    N64Recomp::Context& context = out.context;
+
+    // Move the file data into the context.
+    context.rom = std::move(file_data);
+
+    context.sections.resize(2);
+    // Create a section for the function to exist in.
+    context.sections[0].ram_addr = text_address;
+    context.sections[0].rom_addr = text_offset;
+    context.sections[0].size = text_length;
+    context.sections[0].name = ".text";
+    context.sections[0].executable = true;
+    context.sections[0].relocatable = true;
+    context.section_functions.resize(context.sections.size());
+    // Create a section for .data (used for relocations)
+    context.sections[1].ram_addr = data_address;
+    context.sections[1].rom_addr = init_data_offset;
+    context.sections[1].size = data_length;
+    context.sections[1].name = ".data";
+    context.sections[1].executable = false;
+    context.sections[1].relocatable = true;
+
+    uint32_t function_desc_address = 0;
+    uint32_t reloc_desc_address = 0;
+
+    // Read any extra structs.
+    while (next_struct_address != 0) {
+        uint32_t cur_struct_address = next_struct_address;
+        uint32_t struct_type = read_u32_swap(context.rom, next_struct_address + 0x00);
+        next_struct_address = read_u32_swap(context.rom, next_struct_address + 0x04);
+
+        switch (struct_type) {
+            case 1: // Function desc
+                function_desc_address = cur_struct_address;
+                break;
+            case 2: // Relocation
+                reloc_desc_address = cur_struct_address;
+                break;
+            default:
+                printf("Unknown struct type %u\n", struct_type);
+                return TestDataError::UnknownStructType;
+        }
+    }
+
+    // Check if a function description exists.
+    if (function_desc_address == 0) {
+        // No function description, so treat the whole thing as one function.
+
+        // Get the function's instruction words.
+        std::vector<uint32_t> text_words{};
+        text_words.resize(text_length / sizeof(uint32_t));
+        for (size_t i = 0; i < text_words.size(); i++) {
+            text_words[i] = read_u32(context.rom, text_offset + i * sizeof(uint32_t));
+        }
+
+        // Add the function to the context.
+        context.functions_by_vram[text_address].emplace_back(context.functions.size());
+        context.section_functions.emplace_back(context.functions.size());
+        context.sections[0].function_addrs.emplace_back(text_address);
+        context.functions.emplace_back(
+            text_address,
+            text_offset,
+            text_words,
+            "test_func",
+            0
+        );
+        out.start_func_index = 0;
+    }
+    else {
+        // Use the function description.
+        uint32_t num_funcs = read_u32_swap(context.rom, function_desc_address + 0x08);
+        out.start_func_index = read_u32_swap(context.rom, function_desc_address + 0x0C);
+
+        for (size_t func_index = 0; func_index < num_funcs; func_index++) {
+            uint32_t cur_func_address = read_u32_swap(context.rom, function_desc_address + 0x10 + 0x00 + 0x08 * func_index);
+            uint32_t cur_func_length = read_u32_swap(context.rom, function_desc_address + 0x10 + 0x04 + 0x08 * func_index);
+            uint32_t cur_func_offset = cur_func_address - text_address + text_offset;
+
+            // Get the function's instruction words.
+            std::vector<uint32_t> text_words{};
+            text_words.resize(cur_func_length / sizeof(uint32_t));
+            for (size_t i = 0; i < text_words.size(); i++) {
+                text_words[i] = read_u32(context.rom, cur_func_offset + i * sizeof(uint32_t));
+            }
+
+            // Add the function to the context.
+            context.functions_by_vram[cur_func_address].emplace_back(context.functions.size());
+            context.section_functions.emplace_back(context.functions.size());
+            context.sections[0].function_addrs.emplace_back(cur_func_address);
+            context.functions.emplace_back(
+                cur_func_address,
+                cur_func_offset,
+                std::move(text_words),
+                "test_func_" + std::to_string(func_index),
+                0
+            );
+        }
+    }
+
+    // Check if a relocation description exists.
+    if (reloc_desc_address != 0) {
+        uint32_t num_relocs = read_u32_swap(context.rom, reloc_desc_address + 0x08);
+        for (uint32_t reloc_index = 0; reloc_index < num_relocs; reloc_index++) {
+            uint32_t cur_desc_address = reloc_desc_address + 0x0C + reloc_index * 4 * sizeof(uint32_t);
+            uint32_t reloc_type = read_u32_swap(context.rom, cur_desc_address + 0x00);
+            uint32_t reloc_section = read_u32_swap(context.rom, cur_desc_address + 0x04);
+            uint32_t reloc_address = read_u32_swap(context.rom, cur_desc_address + 0x08);
+            uint32_t reloc_target_offset = read_u32_swap(context.rom, cur_desc_address + 0x0C);
+
+            context.sections[0].relocs.emplace_back(N64Recomp::Reloc{
+                .address = reloc_address,
+                .target_section_offset = reloc_target_offset,
+                .symbol_index = 0,
+                .target_section = static_cast<uint16_t>(reloc_section),
+                .type = static_cast<N64Recomp::RelocType>(reloc_type),
+                .reference_symbol = false
+            });
+        }
+    }
+
+    return TestDataError::Success;
+}
+
+// Reads and parses a test data file.
+inline TestDataError load_test_data(const std::filesystem::path& input_path, TestData& out) {
+    bool found;
+    std::vector<uint8_t> file_data = read_file(input_path, found);
+
+    if (!found) {
+        printf("Failed to open file: %s\n", input_path.string().c_str());
+        return TestDataError::FailedToOpenInput;
+    }
+
+    return parse_test_data(std::move(file_data), out);
+}
+
+inline void write1(uint8_t* rdram, recomp_context* ctx) {
+    MEM_B(0, ctx->r4) = 1;
+}
+
+// Function lookup for the test data, which only calls out to a single function at a fixed address.
+inline recomp_func_t* test_get_function(int32_t vram) {
+    if (vram == 0x80100000) {
+        return write1;
+    }
+    assert(false);
+    return nullptr;
+}
+
+inline void test_switch_error(const char* func, uint32_t vram, uint32_t jtbl) {
+    printf("  Switch-case out of bounds in %s at 0x%08X for jump table at 0x%08X\n", func, vram, jtbl);
+}
+
+// Returns the total number of instructions across every function in the test.
+inline size_t count_test_instructions(const TestData& data) {
+    size_t ret = 0;
+    for (const N64Recomp::Function& func : data.context.functions) {
+        ret += func.words.size();
+    }
+    return ret;
+}
+
+#endif
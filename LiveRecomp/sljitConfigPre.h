@@ -0,0 +1,23 @@
+#ifndef __LIVE_RECOMP_SLJIT_CONFIG_PRE_H__
+#define __LIVE_RECOMP_SLJIT_CONFIG_PRE_H__
+
+#include <stddef.h>
+
+// Included by sljit's own config when SLJIT_HAVE_CONFIG_PRE is defined. Executable memory for generated code gets allocated from the
+// LiveOutputArena passed to sljit_generate_code as the allocator data, or from sljit's own allocator if no arena was passed.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void* live_recomp_malloc_exec(size_t size, void* exec_allocator_data);
+void live_recomp_free_exec(void* ptr, void* exec_allocator_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define SLJIT_MALLOC_EXEC(size, exec_allocator_data) live_recomp_malloc_exec((size), (exec_allocator_data))
+#define SLJIT_FREE_EXEC(ptr, exec_allocator_data) live_recomp_free_exec((ptr), (exec_allocator_data))
+
+#endif
@@ -2,9 +2,15 @@
 #include <fstream>
 #include <vector>
 #include <span>
+#include <atomic>
+#include <thread>
+#include <charconv>
+#include <string_view>
+#include <iostream>
 
 #include "recompiler/context.h"
 #include "rabbitizer.hpp"
+#include <toml++/toml.hpp>
 
 static std::vector<uint8_t> read_file(const std::filesystem::path& path, bool& found) {
     std::vector<uint8_t> ret;
@@ -24,31 +30,19 @@ static std::vector<uint8_t> read_file(const std::filesystem::path& path, bool& f
     return ret;
 }
 
-int main(int argc, const char** argv) {
-    if (argc != 5) {
-        printf("Usage: %s [mod symbol file] [mod binary file] [recomp symbols file] [output C file]\n", argv[0]);
-        return EXIT_SUCCESS;
-    }
-    bool found;
-    std::vector<uint8_t> symbol_data = read_file(argv[1], found);
-    if (!found) {
-        fprintf(stderr, "Failed to open symbol file\n");
-        return EXIT_FAILURE;
-    }
-
-    std::vector<uint8_t> rom_data = read_file(argv[2], found);
-    if (!found) {
-        fprintf(stderr, "Failed to open ROM\n");
-        return EXIT_FAILURE;
-    }
-
-    std::span<const char> symbol_data_span { reinterpret_cast<const char*>(symbol_data.data()), symbol_data.size() };
+// Data from the recomp symbols file that's shared between every mod being recompiled.
+struct ReferenceData {
+    N64Recomp::Context reference_context;
+    std::unordered_map<uint32_t, uint16_t> sections_by_vrom;
+    // Map of vram address to matching reference symbols, used to populate R_MIPS_26 reloc symbol indices.
+    std::unordered_map<uint32_t, std::vector<size_t>> reference_symbols_by_vram;
+};
 
+static bool load_reference_data(const std::filesystem::path& recomp_symbols_path, ReferenceData& out) {
     std::vector<uint8_t> dummy_rom{};
-    N64Recomp::Context reference_context{};
-    if (!N64Recomp::Context::from_symbol_file(argv[3], std::move(dummy_rom), reference_context, false)) {
+    if (!N64Recomp::Context::from_symbol_file(recomp_symbols_path, std::move(dummy_rom), out.reference_context, false)) {
         printf("Failed to load provided function reference symbol file\n");
-        return EXIT_FAILURE;
+        return false;
     }
 
     //for (const std::filesystem::path& cur_data_sym_path : data_reference_syms_file_paths) {
@@ -58,33 +52,58 @@ int main(int argc, const char** argv) {
     //    }
     //}
 
-    std::unordered_map<uint32_t, uint16_t> sections_by_vrom{};
-    for (uint16_t section_index = 0; section_index < reference_context.sections.size(); section_index++) {
-        sections_by_vrom[reference_context.sections[section_index].rom_addr] = section_index;
+    for (uint16_t section_index = 0; section_index < out.reference_context.sections.size(); section_index++) {
+        out.sections_by_vrom[out.reference_context.sections[section_index].rom_addr] = section_index;
+    }
+
+    // Every mod imports the same reference symbols in the same order, so the symbol indices can be found once with a context that only
+    // has the reference symbols imported.
+    N64Recomp::Context imported_context{};
+    if (!imported_context.import_reference_context(out.reference_context)) {
+        fprintf(stderr, "Failed to import reference symbols\n");
+        return false;
+    }
+    for (size_t reference_symbol_index = 0; reference_symbol_index < imported_context.num_regular_reference_symbols(); reference_symbol_index++) {
+        const auto& sym = imported_context.get_regular_reference_symbol(reference_symbol_index);
+        uint16_t section_index = sym.section_index;
+        if (section_index != N64Recomp::SectionAbsolute) {
+            uint32_t section_vram = imported_context.get_reference_section_vram(section_index);
+            out.reference_symbols_by_vram[section_vram + sym.section_offset].push_back(reference_symbol_index);
+        }
+    }
+
+    return true;
+}
+
+// Recompiles a single mod into a C file. Returns false and removes any partial output on failure.
+static bool recompile_mod(const ReferenceData& reference, const std::filesystem::path& symbol_path, const std::filesystem::path& binary_path, const std::filesystem::path& output_file_path) {
+    bool found;
+    std::vector<uint8_t> symbol_data = read_file(symbol_path, found);
+    if (!found) {
+        fprintf(stderr, "Failed to open symbol file: %s\n", symbol_path.string().c_str());
+        return false;
     }
 
+    // Map the mod binary instead of reading it, as it only gets read from and is kept in the context afterwards.
+    N64Recomp::RomBuffer rom_data{};
+    if (!N64Recomp::map_file(binary_path, rom_data)) {
+        fprintf(stderr, "Failed to open ROM: %s\n", binary_path.string().c_str());
+        return false;
+    }
+
+    std::span<const char> symbol_data_span { reinterpret_cast<const char*>(symbol_data.data()), symbol_data.size() };
+
     N64Recomp::Context mod_context;
 
-	N64Recomp::ModSymbolsError error = N64Recomp::parse_mod_symbols(symbol_data_span, rom_data, sections_by_vrom, mod_context);
+    N64Recomp::ModSymbolsError error = N64Recomp::parse_mod_symbols(symbol_data_span, rom_data, reference.sections_by_vrom, mod_context);
     if (error != N64Recomp::ModSymbolsError::Good) {
-        fprintf(stderr, "Error parsing mod symbols: %d\n", (int)error);
-        return EXIT_FAILURE;
+        fprintf(stderr, "Error parsing mod symbols in %s: %d\n", symbol_path.string().c_str(), (int)error);
+        return false;
     }
 
-    mod_context.import_reference_context(reference_context);
+    mod_context.import_reference_context(reference.reference_context);
 
-    // Populate R_MIPS_26 reloc symbol indices. Start by building a map of vram address to matching reference symbols.
-    std::unordered_map<uint32_t, std::vector<size_t>> reference_symbols_by_vram{};
-    for (size_t reference_symbol_index = 0; reference_symbol_index < mod_context.num_regular_reference_symbols(); reference_symbol_index++) {
-        const auto& sym = mod_context.get_regular_reference_symbol(reference_symbol_index);
-        uint16_t section_index = sym.section_index;
-        if (section_index != N64Recomp::SectionAbsolute) {
-            uint32_t section_vram = mod_context.get_reference_section_vram(section_index);
-            reference_symbols_by_vram[section_vram + sym.section_offset].push_back(reference_symbol_index);
-        }
-    }
-    
-    // Use the mapping to populate the symbol index for every R_MIPS_26 reference symbol reloc. 
+    // Use the vram mapping to populate the symbol index for every R_MIPS_26 reference symbol reloc. 
     for (auto& section : mod_context.sections) {
         for (auto& reloc : section.relocs) {
             if (reloc.type == N64Recomp::RelocType::R_MIPS_26 && reloc.reference_symbol) {
@@ -92,9 +111,9 @@ int main(int argc, const char** argv) {
                     uint32_t section_vram = mod_context.get_reference_section_vram(reloc.target_section);
                     uint32_t target_vram = section_vram + reloc.target_section_offset;
 
-                    auto find_funcs_it = reference_symbols_by_vram.find(target_vram);
+                    auto find_funcs_it = reference.reference_symbols_by_vram.find(target_vram);
                     bool found = false;
-                    if (find_funcs_it != reference_symbols_by_vram.end()) {
+                    if (find_funcs_it != reference.reference_symbols_by_vram.end()) {
                         for (size_t symbol_index : find_funcs_it->second) {
                             const auto& cur_symbol = mod_context.get_reference_symbol(reloc.target_section, symbol_index);
                             if (cur_symbol.section_index == reloc.target_section) {
@@ -106,7 +125,7 @@ int main(int argc, const char** argv) {
                     }
                     if (!found) {
                         fprintf(stderr, "Failed to find R_MIPS_26 relocation target in section %d with vram 0x%08X\n", reloc.target_section, target_vram);
-                        return EXIT_FAILURE;
+                        return false;
                     }
                 }
             }
@@ -118,15 +137,8 @@ int main(int argc, const char** argv) {
     std::vector<std::vector<uint32_t>> static_funcs_by_section{};
     static_funcs_by_section.resize(mod_context.sections.size());
 
-    const char* output_file_path = argv[4];
     std::ofstream output_file { output_file_path };
 
-    RabbitizerConfig_Cfg.pseudos.pseudoMove = false;
-    RabbitizerConfig_Cfg.pseudos.pseudoBeqz = false;
-    RabbitizerConfig_Cfg.pseudos.pseudoBnez = false;
-    RabbitizerConfig_Cfg.pseudos.pseudoNot = false;
-    RabbitizerConfig_Cfg.pseudos.pseudoBal = false;
-
     output_file << "#include \"mod_recomp.h\"\n\n";
 
     // Write the API version.
@@ -225,8 +237,168 @@ int main(int argc, const char** argv) {
             output_file.close();
             std::error_code ec;
             std::filesystem::remove(output_file_path, ec);
-            return EXIT_FAILURE;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct BatchMod {
+    std::filesystem::path symbol_path;
+    std::filesystem::path binary_path;
+    std::filesystem::path output_path;
+};
+
+// Reads a batch manifest, which lists the recomp symbols file and every mod to recompile with it:
+//
+//     recomp_symbols = "recomp_symbols.toml"
+//
+//     [[mods]]
+//     symbols = "mod_syms.bin"
+//     binary = "mod_binary.bin"
+//     output = "mod.c"
+//
+// Paths are relative to the manifest's folder.
+static bool read_batch_manifest(const std::filesystem::path& manifest_path, std::filesystem::path& recomp_symbols_out, std::vector<BatchMod>& mods_out) {
+    std::filesystem::path basedir = manifest_path.parent_path();
+    try {
+        const toml::table manifest_data = toml::parse_file(manifest_path.u8string());
+
+        std::optional<std::string> recomp_symbols = manifest_data["recomp_symbols"].value<std::string>();
+        if (!recomp_symbols.has_value()) {
+            throw toml::parse_error("Missing recomp_symbols in batch manifest", manifest_data.source());
+        }
+        recomp_symbols_out = basedir / recomp_symbols.value();
+
+        const toml::node_view mods_data = manifest_data["mods"];
+        if (!mods_data.is_array()) {
+            throw toml::parse_error("Missing mods array in batch manifest", manifest_data.source());
         }
+
+        const toml::array* mods_array = mods_data.as_array();
+        size_t mod_index = 0;
+        mods_array->for_each([&](const toml::table& mod_data) {
+            std::optional<std::string> symbols = mod_data["symbols"].value<std::string>();
+            std::optional<std::string> binary = mod_data["binary"].value<std::string>();
+            std::optional<std::string> output = mod_data["output"].value<std::string>();
+            if (!symbols.has_value() || !binary.has_value() || !output.has_value()) {
+                throw toml::parse_error(("Mod " + std::to_string(mod_index) + " in batch manifest must have symbols, binary and output").c_str(), mod_data.source());
+            }
+
+            mods_out.emplace_back(BatchMod{
+                .symbol_path = basedir / symbols.value(),
+                .binary_path = basedir / binary.value(),
+                .output_path = basedir / output.value()
+            });
+            mod_index++;
+        });
+    }
+    catch (const toml::parse_error& err) {
+        std::cerr << "Syntax error parsing batch manifest: " << *err.source().path << " (" << err.source().begin <<  "):\n" << err.description() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static void configure_rabbitizer() {
+    RabbitizerConfig_Cfg.pseudos.pseudoMove = false;
+    RabbitizerConfig_Cfg.pseudos.pseudoBeqz = false;
+    RabbitizerConfig_Cfg.pseudos.pseudoBnez = false;
+    RabbitizerConfig_Cfg.pseudos.pseudoNot = false;
+    RabbitizerConfig_Cfg.pseudos.pseudoBal = false;
+}
+
+// Recompiles every mod in a batch manifest, loading the recomp symbols file once and sharing it between all of them.
+static int run_batch(const std::filesystem::path& manifest_path, size_t num_jobs) {
+    std::filesystem::path recomp_symbols_path{};
+    std::vector<BatchMod> mods{};
+    if (!read_batch_manifest(manifest_path, recomp_symbols_path, mods)) {
+        return EXIT_FAILURE;
+    }
+
+    ReferenceData reference{};
+    if (!load_reference_data(recomp_symbols_path, reference)) {
+        return EXIT_FAILURE;
+    }
+
+    configure_rabbitizer();
+
+    // Mods are handed out one at a time so that threads that finish small mods move on to the next one.
+    std::atomic<size_t> next_index = 0;
+    std::atomic<size_t> failed_count = 0;
+    auto worker = [&]() {
+        while (true) {
+            size_t mod_index = next_index.fetch_add(1, std::memory_order_relaxed);
+            if (mod_index >= mods.size()) {
+                break;
+            }
+            const BatchMod& mod = mods[mod_index];
+            if (!recompile_mod(reference, mod.symbol_path, mod.binary_path, mod.output_path)) {
+                fprintf(stderr, "Failed to recompile mod %s\n", mod.symbol_path.string().c_str());
+                failed_count.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    // The calling thread acts as the first worker.
+    num_jobs = std::min(std::max<size_t>(num_jobs, 1), std::max<size_t>(mods.size(), 1));
+    std::vector<std::thread> threads{};
+    threads.reserve(num_jobs - 1);
+    for (size_t thread_index = 1; thread_index < num_jobs; thread_index++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    printf("Recompiled %zu/%zu mods\n", mods.size() - failed_count.load(), mods.size());
+    return failed_count.load() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, const char** argv) {
+    if (argc >= 3 && std::string_view{ argv[1] } == "--batch") {
+        // A job count of 0 means one job per hardware thread.
+        size_t num_jobs = 0;
+        for (int i = 3; i < argc; i++) {
+            std::string_view cur_arg = argv[i];
+            if (cur_arg == "--jobs" && i + 1 < argc) {
+                std::string_view jobs_arg = argv[++i];
+                auto parse_result = std::from_chars(jobs_arg.data(), jobs_arg.data() + jobs_arg.size(), num_jobs);
+                if (parse_result.ec != std::errc{} || parse_result.ptr != jobs_arg.data() + jobs_arg.size()) {
+                    printf("Invalid job count \"%s\"\n", argv[i]);
+                    return EXIT_FAILURE;
+                }
+            }
+            else {
+                printf("Unknown argument \"%s\"\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        if (num_jobs == 0) {
+            num_jobs = std::max(1U, std::thread::hardware_concurrency());
+        }
+        return run_batch(argv[2], num_jobs);
+    }
+
+    if (argc != 5) {
+        printf("Usage: %s [mod symbol file] [mod binary file] [recomp symbols file] [output C file]\n", argv[0]);
+        printf("       %s --batch [batch manifest] [--jobs <count>]\n", argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    ReferenceData reference{};
+    if (!load_reference_data(argv[3], reference)) {
+        return EXIT_FAILURE;
+    }
+
+    configure_rabbitizer();
+
+    if (!recompile_mod(reference, argv[1], argv[2], argv[4])) {
+        return EXIT_FAILURE;
     }
 
 	return EXIT_SUCCESS;
@@ -7,6 +7,9 @@
 #include <cassert>
 #include <iostream>
 #include <filesystem>
+#include <algorithm>
+#include <span>
+#include <string_view>
 #include "rabbitizer.hpp"
 #include "fmt/format.h"
 #include "fmt/ostream.h"
@@ -222,7 +225,60 @@ void get_overlay_swap_resume_targets(const std::vector<rabbitizer::InstructionRs
     }
 }
 
-bool process_instruction(size_t instr_index, const std::vector<rabbitizer::InstructionRsp>& instructions, std::ofstream& output_file, const BranchTargets& branch_targets, const std::unordered_set<uint32_t>& unsupported_instructions, const ResumeTargets& resume_targets, bool has_overlays, bool indent, bool in_delay_slot) {
+// Range of IMEM addresses contained in the function being recompiled. Functions normally contain all of IMEM, but each region gets its own
+// function when overlay slots are recompiled separately. Jumps to addresses outside of the region exit the function, which lets the
+// dispatcher run the function for the region containing the target.
+struct RegionBounds {
+    uint32_t start;
+    uint32_t end;
+
+    bool contains(uint32_t vram) const {
+        return vram >= start && vram < end;
+    }
+};
+
+constexpr RegionBounds full_imem_bounds{ 0, 0xFFFFFFFF };
+
+// Returns the resume targets that have labels in a function with the given instructions and bounds. An overlay swap can resume in a different
+// variant of the code than the one that started it, so each function gets labels for the resume targets of every variant. Every instruction
+// gets a regular resume label, but delay slot resume labels only exist for instructions that are in a delay slot in this function's code.
+ResumeTargets filter_resume_targets(const ResumeTargets& all_targets, const std::vector<rabbitizer::InstructionRsp>& instrs, const RegionBounds& bounds) {
+    std::unordered_set<uint32_t> instr_vrams{};
+    std::unordered_set<uint32_t> delay_slot_vrams{};
+    for (size_t instr_index = 0; instr_index < instrs.size(); instr_index++) {
+        uint32_t vram = instrs[instr_index].getVram();
+        if (!bounds.contains(vram)) {
+            continue;
+        }
+        instr_vrams.insert(vram);
+        if (instr_index > 0 && instrs[instr_index - 1].hasDelaySlot()) {
+            delay_slot_vrams.insert(vram);
+        }
+    }
+
+    ResumeTargets ret{};
+    for (uint32_t target : all_targets.non_delay_targets) {
+        if (instr_vrams.contains(target)) {
+            ret.non_delay_targets.insert(target);
+        }
+    }
+    for (uint32_t target : all_targets.delay_targets) {
+        if (delay_slot_vrams.contains(target)) {
+            ret.delay_targets.insert(target);
+        }
+    }
+    return ret;
+}
+
+// Returns the code to jump to the given target, which exits the function for the dispatcher to handle if the target is outside the region.
+std::string jump_to_target(const RegionBounds& bounds, uint32_t target) {
+    if (bounds.contains(target)) {
+        return fmt::format("goto L_{:04X}", target);
+    }
+    return fmt::format("{{ ctx->resume_address = 0x{:04X}; ctx->resume_delay = false; goto do_region_exit; }}", target);
+}
+
+bool process_instruction(size_t instr_index, const std::vector<rabbitizer::InstructionRsp>& instructions, std::ofstream& output_file, const BranchTargets& branch_targets, const std::unordered_set<uint32_t>& unsupported_instructions, const ResumeTargets& resume_targets, const RegionBounds& bounds, bool has_overlays, bool indent, bool in_delay_slot) {
     const auto& instr = instructions[instr_index];
 
     uint32_t instr_vram = instr.getVram();
@@ -265,7 +321,7 @@ bool process_instruction(size_t instr_index, const std::vector<rabbitizer::Instr
     auto print_unconditional_branch = [&]<typename... Ts>(fmt::format_string<Ts...> fmt_str, Ts&& ...args) {
         if (instr_index < instructions.size() - 1) {
             uint32_t next_vram = instr_vram + 4;
-            process_instruction(instr_index + 1, instructions, output_file, branch_targets, unsupported_instructions, resume_targets, has_overlays, false, true);
+            process_instruction(instr_index + 1, instructions, output_file, branch_targets, unsupported_instructions, resume_targets, bounds, has_overlays, false, true);
         }
         print_indent();
         fmt::print(output_file, fmt_str, std::forward<Ts>(args)...);
@@ -276,7 +332,7 @@ bool process_instruction(size_t instr_index, const std::vector<rabbitizer::Instr
         fmt::print(output_file, "{{\n    ");
         if (instr_index < instructions.size() - 1) {
             uint32_t next_vram = instr_vram + 4;
-            process_instruction(instr_index + 1, instructions, output_file, branch_targets, unsupported_instructions, resume_targets, has_overlays, true, true);
+            process_instruction(instr_index + 1, instructions, output_file, branch_targets, unsupported_instructions, resume_targets, bounds, has_overlays, true, true);
         }
         fmt::print(output_file, "        ");
         fmt::print(output_file, fmt_str, std::forward<Ts>(args)...);
@@ -482,11 +538,11 @@ bool process_instruction(size_t instr_index, const std::vector<rabbitizer::Instr
             // Branches
         case InstrId::rsp_j:
         case InstrId::rsp_b:
-            print_unconditional_branch("goto L_{:04X}", branch_target);
+            print_unconditional_branch("{}", jump_to_target(bounds, branch_target));
             break;
         case InstrId::rsp_jal:
             print_line("{}{} = 0x{:04X}", ctx_gpr_prefix(31), 31, instr_vram + 2 * instr_size);
-            print_unconditional_branch("goto L_{:04X}", branch_target);
+            print_unconditional_branch("{}", jump_to_target(bounds, branch_target));
             break;
         case InstrId::rsp_jr:
             print_line("jump_target = {}{}", ctx_gpr_prefix(rs), rs);
@@ -501,32 +557,32 @@ bool process_instruction(size_t instr_index, const std::vector<rabbitizer::Instr
         case InstrId::rsp_bne:
             print_indent();
             print_branch_condition("if ({}{} != {}{})", ctx_gpr_prefix(rs), rs, ctx_gpr_prefix(rt), rt);
-            print_branch("goto L_{:04X}", branch_target);
+            print_branch("{}", jump_to_target(bounds, branch_target));
             break;
         case InstrId::rsp_beq:
             print_indent();
             print_branch_condition("if ({}{} == {}{})", ctx_gpr_prefix(rs), rs, ctx_gpr_prefix(rt), rt);
-            print_branch("goto L_{:04X}", branch_target);
+            print_branch("{}", jump_to_target(bounds, branch_target));
             break;
         case InstrId::rsp_bgez:
             print_indent();
             print_branch_condition("if (RSP_SIGNED({}{}) >= 0)", ctx_gpr_prefix(rs), rs);
-            print_branch("goto L_{:04X}", branch_target);
+            print_branch("{}", jump_to_target(bounds, branch_target));
             break;
         case InstrId::rsp_bgtz:
             print_indent();
             print_branch_condition("if (RSP_SIGNED({}{}) > 0)", ctx_gpr_prefix(rs), rs);
-            print_branch("goto L_{:04X}", branch_target);
+            print_branch("{}", jump_to_target(bounds, branch_target));
             break;
         case InstrId::rsp_blez:
             print_indent();
             print_branch_condition("if (RSP_SIGNED({}{}) <= 0)", ctx_gpr_prefix(rs), rs);
-            print_branch("goto L_{:04X}", branch_target);
+            print_branch("{}", jump_to_target(bounds, branch_target));
             break;
         case InstrId::rsp_bltz:
             print_indent();
             print_branch_condition("if (RSP_SIGNED({}{}) < 0)", ctx_gpr_prefix(rs), rs);
-            print_branch("goto L_{:04X}", branch_target);
+            print_branch("{}", jump_to_target(bounds, branch_target));
             break;
         case InstrId::rsp_break:
             print_line("return RspExitReason::Broke", instr_vram);
@@ -573,7 +629,7 @@ bool process_instruction(size_t instr_index, const std::vector<rabbitizer::Instr
     return true;
 }
 
-void write_indirect_jumps(std::ofstream& output_file, const BranchTargets& branch_targets, const std::string& output_function_name) {
+void write_indirect_jumps(std::ofstream& output_file, const BranchTargets& branch_targets, const std::string& output_function_name, bool is_region) {
     fmt::print(output_file,
         "do_indirect_jump:\n"
         "    switch ((jump_target | 0x1000) & {:#X}) {{ \n", rsp_mem_mask);
@@ -581,7 +637,16 @@ void write_indirect_jumps(std::ofstream& output_file, const BranchTargets& branc
         fmt::print(output_file, "        case 0x{0:04X}: goto L_{0:04X};\n", branch_target);
     }
     fmt::print(output_file,
-        "    }}\n"
+        "    }}\n");
+    // Targets outside of a region are left for the dispatcher to find.
+    if (is_region) {
+        fmt::print(output_file,
+            "    ctx->resume_address = (jump_target | 0x1000) & {:#X};\n"
+            "    ctx->resume_delay = false;\n"
+            "    goto do_region_exit;\n", rsp_mem_mask);
+        return;
+    }
+    fmt::print(output_file,
         "    printf(\"Unhandled jump target 0x%04X in microcode {}, coming from [%s:%d]\\n\", jump_target, debug_file, debug_line);\n"
         "    printf(\"Register dump: r0  = %08X r1  = %08X r2  = %08X r3  = %08X r4  = %08X r5  = %08X r6  = %08X r7  = %08X\\n\"\n"
         "           \"               r8  = %08X r9  = %08X r10 = %08X r11 = %08X r12 = %08X r13 = %08X r14 = %08X r15 = %08X\\n\"\n"
@@ -592,7 +657,13 @@ void write_indirect_jumps(std::ofstream& output_file, const BranchTargets& branc
         "    return RspExitReason::UnhandledJumpTarget;\n", output_function_name);
 }
 
-void write_overlay_swap_return(std::ofstream& output_file) {
+void write_overlay_swap_return(std::ofstream& output_file, bool is_region) {
+    // Leaving a region saves the same state as an overlay swap, the dispatcher just doesn't change any slots.
+    if (is_region) {
+        fmt::print(output_file,
+            "do_region_exit:\n"
+            "    region_exit = true;\n");
+    }
     fmt::print(output_file,
         "do_overlay_swap:\n"
         "                    ctx->r1 = r1;   ctx->r2 = r2;   ctx->r3 = r3;   ctx->r4 = r4;   ctx->r5 = r5;   ctx->r6 = r6;   ctx->r7 = r7;\n"
@@ -626,6 +697,23 @@ struct RSPRecompilerOverlaySlotConfig {
     std::vector<RSPRecompilerOverlayConfig> overlays;
 };
 
+// Instruction set that the generated microcode functions get compiled for. This only sets the compiler's target for those functions so that it
+// can vectorize the vector unit code inlined into them with the chosen instructions, and no separate scalar code gets generated, so the output
+// can only run on hosts that support the instruction set. Defining RSP_VECTOR_ISA_BASELINE when compiling the output ignores the choice.
+enum class RSPVectorIsa {
+    Default,
+    SSE4_1,
+    AVX2,
+};
+
+// How overlay slots get recompiled.
+enum class RSPOverlayMode {
+    // One function for every combination of overlays.
+    Permutations,
+    // One function for every overlay in each slot, plus one for each range of code outside of the slots.
+    Slots,
+};
+
 struct RSPRecompilerConfig {
     size_t text_offset;
     size_t text_size;
@@ -636,6 +724,10 @@ struct RSPRecompilerConfig {
     std::vector<uint32_t> extra_indirect_branch_targets;
     std::unordered_set<uint32_t> unsupported_instructions;
     std::vector<RSPRecompilerOverlaySlotConfig> overlay_slots;
+    RSPVectorIsa vector_isa = RSPVectorIsa::Default;
+    RSPOverlayMode overlay_mode = RSPOverlayMode::Permutations;
+    // Combinations of overlays that still get a complete function in slots mode, with one overlay index per slot.
+    std::vector<std::vector<uint32_t>> hot_permutations;
 };
 
 std::filesystem::path concat_if_not_empty(const std::filesystem::path& parent, const std::filesystem::path& child) {
@@ -673,6 +765,53 @@ std::unordered_set<T> toml_to_set(const toml::array* array) {
     return ret;
 }
 
+// Writes the definition of RSP_VECTOR_ISA_TARGET, which gets put on every generated microcode function so that it's compiled for the configured
+// instruction set. Only those functions get the target and the vector unit implementation is included without it, so the inline helpers that
+// are shared with other translation units keep the compiler's default target. Helpers that get inlined into a microcode function are compiled
+// with its target, which lets the per-lane loops and element broadcasts use 128/256-bit registers. The target only applies to compilers and
+// architectures that support the instruction set, and defining RSP_VECTOR_ISA_BASELINE when building the output file keeps the compiler's
+// default target for the microcode functions as well.
+void write_vector_isa_target(std::ofstream& output_file, RSPVectorIsa isa, const std::string& function_name) {
+    const char* target;
+    switch (isa) {
+        case RSPVectorIsa::Default:
+        default:
+            return;
+        case RSPVectorIsa::SSE4_1:
+            target = "sse4.1";
+            break;
+        case RSPVectorIsa::AVX2:
+            target = "avx2";
+            break;
+    }
+
+    // The startup check is compiled for the default target and runs before any of the microcode functions can be called, which turns what
+    // would otherwise be an illegal instruction on a host without the instruction set into an error explaining the problem.
+    fmt::print(output_file,
+        "#if !defined(RSP_VECTOR_ISA_BASELINE) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || defined(__GNUC__))\n"
+        "#include <cstdio>\n"
+        "#include <cstdlib>\n"
+        "static const bool {1}_vector_isa_supported = [] {{\n"
+        "    __builtin_cpu_init();\n"
+        "    if (!__builtin_cpu_supports(\"{0}\")) {{\n"
+        "        fprintf(stderr, \"The RSP microcode {1} was compiled for {0}, which this CPU doesn't support. Compile it with RSP_VECTOR_ISA_BASELINE defined to run it on this CPU.\\n\");\n"
+        "        abort();\n"
+        "    }}\n"
+        "    return true;\n"
+        "}}();\n"
+        "#define RSP_VECTOR_ISA_TARGET __attribute__((target(\"{0}\")))\n"
+        "#else\n"
+        "#define RSP_VECTOR_ISA_TARGET\n"
+        "#endif\n"
+        "\n",
+        target, function_name);
+}
+
+// Returns the prefix for the definitions of generated microcode functions, see write_vector_isa_target.
+const char* vector_isa_target_prefix(const RSPRecompilerConfig& config) {
+    return config.vector_isa == RSPVectorIsa::Default ? "" : "RSP_VECTOR_ISA_TARGET ";
+}
+
 bool read_config(const std::filesystem::path& config_path, RSPRecompilerConfig& out) {
     RSPRecompilerConfig ret{};
 
@@ -742,6 +881,26 @@ bool read_config(const std::filesystem::path& config_path, RSPRecompilerConfig&
             ret.unsupported_instructions = toml_to_set<uint32_t>(unsupported_instructions_array);
         }
 
+        // Vector instruction set (optional)
+        std::optional<std::string> vector_isa = config_data["vector_isa"].value<std::string>();
+        if (vector_isa.has_value()) {
+            const std::string& isa_name = vector_isa.value();
+            if (isa_name == "default") {
+                ret.vector_isa = RSPVectorIsa::Default;
+            }
+            else if (isa_name == "sse4.1") {
+                ret.vector_isa = RSPVectorIsa::SSE4_1;
+            }
+            else if (isa_name == "avx2") {
+                ret.vector_isa = RSPVectorIsa::AVX2;
+            }
+            else {
+                throw toml::parse_error(
+                    fmt::format("Invalid vector_isa \"{}\" in config file (must be \"default\", \"sse4.1\" or \"avx2\")", isa_name).c_str(),
+                    config_data.source());
+            }
+        }
+
         // Overlay slots (optional)
         const toml::node_view overlay_slots = config_data["overlay_slots"];
         if (overlay_slots.is_array()) {
@@ -811,6 +970,53 @@ bool read_config(const std::filesystem::path& config_path, RSPRecompilerConfig&
             });
         }
 
+        // Overlay mode (optional)
+        std::optional<std::string> overlay_mode = config_data["overlay_mode"].value<std::string>();
+        if (overlay_mode.has_value()) {
+            if (overlay_mode.value() == "permutations") {
+                ret.overlay_mode = RSPOverlayMode::Permutations;
+            }
+            else if (overlay_mode.value() == "slots") {
+                ret.overlay_mode = RSPOverlayMode::Slots;
+            }
+            else {
+                throw toml::parse_error(
+                    fmt::format("Invalid overlay_mode \"{}\" in config file (must be \"permutations\" or \"slots\")", overlay_mode.value()).c_str(),
+                    config_data.source());
+            }
+        }
+
+        // Hot permutations (optional)
+        const toml::node_view hot_permutations = config_data["hot_permutations"];
+        if (hot_permutations.is_array()) {
+            const toml::array* hot_permutations_array = hot_permutations.as_array();
+
+            int permutation_idx = 0;
+            hot_permutations_array->for_each([&](auto&& el) {
+                std::vector<uint32_t> permutation{};
+                if constexpr (toml::is_array<decltype(el)>) {
+                    permutation = toml_to_vec<uint32_t>(&el);
+                }
+
+                if (permutation.size() != ret.overlay_slots.size()) {
+                    throw toml::parse_error(
+                        fmt::format("Hot permutation {} in config file must have one overlay index per overlay slot", permutation_idx).c_str(),
+                        config_data.source());
+                }
+
+                for (size_t slot_idx = 0; slot_idx < permutation.size(); slot_idx++) {
+                    if (permutation[slot_idx] >= ret.overlay_slots[slot_idx].overlays.size()) {
+                        throw toml::parse_error(
+                            fmt::format("Hot permutation {} in config file has an invalid overlay index for overlay slot {}", permutation_idx, slot_idx).c_str(),
+                            config_data.source());
+                    }
+                }
+
+                ret.hot_permutations.emplace_back(std::move(permutation));
+                permutation_idx++;
+            });
+        }
+
     }
     catch (const toml::parse_error& err) {
         std::cerr << "Syntax error parsing toml: " << *err.source().path << " (" << err.source().begin <<  "):\n" << err.description() << std::endl;
@@ -857,6 +1063,29 @@ bool next_permutation(const std::vector<uint32_t>& option_lengths, std::vector<u
     return true;
 }
 
+Permutation make_permutation(const std::vector<uint32_t>& base_words, const std::vector<OverlaySlot>& overlay_slots, const std::vector<uint32_t>& current) {
+    Permutation permutation = {
+        .instr_words = std::vector<uint32_t>(base_words),
+        .permutation = std::vector<uint32_t>(current)
+    };
+
+    for (size_t i = 0; i < overlay_slots.size(); i++) {
+        const OverlaySlot &slot = overlay_slots[i];
+        const Overlay &overlay = slot.overlays[current[i]];
+
+        uint32_t word_offset = slot.offset / sizeof(uint32_t);
+
+        size_t size_needed = word_offset + overlay.instr_words.size();
+        if (permutation.instr_words.size() < size_needed) {
+            permutation.instr_words.reserve(size_needed);
+        }
+
+        std::copy(overlay.instr_words.begin(), overlay.instr_words.end(), permutation.instr_words.data() + word_offset);
+    }
+
+    return permutation;
+}
+
 void permute(const std::vector<uint32_t>& base_words, const std::vector<OverlaySlot>& overlay_slots, std::vector<Permutation>& permutations) {
     auto current = std::vector<uint32_t>(overlay_slots.size(), 0);
     auto slot_options = std::vector<uint32_t>(overlay_slots.size(), 0);
@@ -866,27 +1095,102 @@ void permute(const std::vector<uint32_t>& base_words, const std::vector<OverlayS
     }
 
     do {
-        Permutation permutation = {
-            .instr_words = std::vector<uint32_t>(base_words),
-            .permutation = std::vector<uint32_t>(current)
-        };
+        permutations.push_back(make_permutation(base_words, overlay_slots, current));
+    } while (next_permutation(slot_options, current));
+}
 
-        for (size_t i = 0; i < overlay_slots.size(); i++) {
-            const OverlaySlot &slot = overlay_slots[i];
-            const Overlay &overlay = slot.overlays[current[i]];
+std::vector<rabbitizer::InstructionRsp> decode_instructions(std::span<const uint32_t> instr_words, uint32_t vram) {
+    std::vector<rabbitizer::InstructionRsp> instrs{};
+    instrs.reserve(instr_words.size());
+    for (uint32_t instr_word : instr_words) {
+        instrs.emplace_back(byteswap(instr_word), vram);
+        vram += instr_size;
+    }
+    return instrs;
+}
 
-            uint32_t word_offset = slot.offset / sizeof(uint32_t);
+// A contiguous range of IMEM that gets its own function when overlay slots are recompiled separately.
+struct CodeRegion {
+    RegionBounds bounds;
+    // Index of the overlay slot that the region covers, or -1 for code outside of the overlay slots.
+    int slot_index;
+    // The region's instructions for each overlay in the slot, or a single set for code outside of the overlay slots.
+    std::vector<std::vector<rabbitizer::InstructionRsp>> variants;
+};
 
-            size_t size_needed = word_offset + overlay.instr_words.size();
-            if (permutation.instr_words.size() < size_needed) {
-                permutation.instr_words.reserve(size_needed);
-            }
+// Splits IMEM into the ranges covered by each overlay slot and the ranges of code between them. Each slot's range is as large as its largest
+// overlay, with any smaller overlays padded out with the code that they would leave in place.
+bool build_code_regions(const std::vector<uint32_t>& base_words, const std::vector<OverlaySlot>& overlay_slots, const RSPRecompilerConfig& config, std::vector<CodeRegion>& regions) {
+    uint32_t text_vram = config.text_address & rsp_mem_mask;
 
-            std::copy(overlay.instr_words.begin(), overlay.instr_words.end(), permutation.instr_words.data() + word_offset);
+    std::vector<size_t> slot_order(overlay_slots.size());
+    for (size_t i = 0; i < slot_order.size(); i++) {
+        slot_order[i] = i;
+    }
+    std::sort(slot_order.begin(), slot_order.end(), [&](size_t a, size_t b) {
+        return overlay_slots[a].offset < overlay_slots[b].offset;
+    });
+
+    auto add_base_region = [&](size_t start_word, size_t end_word) {
+        CodeRegion& region = regions.emplace_back();
+        region.bounds = { text_vram + static_cast<uint32_t>(start_word * instr_size), text_vram + static_cast<uint32_t>(end_word * instr_size) };
+        region.slot_index = -1;
+        region.variants.emplace_back(decode_instructions(std::span{ base_words }.subspan(start_word, end_word - start_word), region.bounds.start));
+    };
+
+    size_t cur_word = 0;
+    for (size_t slot_index : slot_order) {
+        const OverlaySlot& slot = overlay_slots[slot_index];
+        size_t start_word = slot.offset / sizeof(uint32_t);
+        size_t slot_words = 0;
+        for (const Overlay& overlay : slot.overlays) {
+            slot_words = std::max(slot_words, overlay.instr_words.size());
         }
+        size_t end_word = start_word + slot_words;
 
-        permutations.push_back(permutation);
-    } while (next_permutation(slot_options, current));
+        if (start_word < cur_word || end_word > base_words.size()) {
+            fmt::print(stderr, "Overlay slot {} overlaps another slot or extends past the end of the text section, which isn't supported with overlay_mode = \"slots\"\n", slot_index);
+            return false;
+        }
+
+        if (start_word > cur_word) {
+            add_base_region(cur_word, start_word);
+        }
+
+        CodeRegion& region = regions.emplace_back();
+        region.bounds = { text_vram + static_cast<uint32_t>(start_word * instr_size), text_vram + static_cast<uint32_t>(end_word * instr_size) };
+        region.slot_index = static_cast<int>(slot_index);
+        for (const Overlay& overlay : slot.overlays) {
+            std::vector<uint32_t> words(base_words.begin() + start_word, base_words.begin() + end_word);
+            std::copy(overlay.instr_words.begin(), overlay.instr_words.end(), words.begin());
+            region.variants.emplace_back(decode_instructions(words, region.bounds.start));
+        }
+
+        cur_word = end_word;
+    }
+
+    if (cur_word < base_words.size()) {
+        add_base_region(cur_word, base_words.size());
+    }
+
+    // A delay slot can't be split from its branch, so make sure no region ends in the middle of one.
+    for (size_t region_index = 0; region_index + 1 < regions.size(); region_index++) {
+        for (const auto& instrs : regions[region_index].variants) {
+            if (!instrs.empty() && instrs.back().hasDelaySlot()) {
+                fmt::print(stderr, "Instruction at 0x{:04X} has its delay slot in another region, which isn't supported with overlay_mode = \"slots\"\n", instrs.back().getVram());
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+std::string make_region_function_name(const RSPRecompilerConfig& config, const CodeRegion& region, size_t variant_index) {
+    if (region.slot_index < 0) {
+        return fmt::format("{}_region_{:04X}", config.output_function_name, region.bounds.start);
+    }
+    return fmt::format("{}_slot{}_{}", config.output_function_name, region.slot_index, variant_index);
 }
 
 std::string make_permutation_string(const std::vector<uint32_t> permutation) {
@@ -899,21 +1203,7 @@ std::string make_permutation_string(const std::vector<uint32_t> permutation) {
     return str;
 }
 
-void create_overlay_swap_function(const std::string& function_name, std::ofstream& output_file, const std::vector<FunctionPermutation>& permutations, const RSPRecompilerConfig& config) {
-    // Includes and permutation protos
-    fmt::print(output_file, 
-        "#include <map>\n"
-        "#include <vector>\n\n"
-        "using RspUcodePermutationFunc = RspExitReason(uint8_t* rdram, RspContext* ctx);\n\n"
-        "RspExitReason {}(uint8_t* rdram, RspContext* ctx);\n",
-        config.output_function_name + "_initial");
-
-    for (const auto& permutation : permutations) {
-        fmt::print(output_file, "RspExitReason {}(uint8_t* rdram, RspContext* ctx);\n",
-            config.output_function_name + make_permutation_string(permutation.permutation));
-    }
-    fmt::print(output_file, "\n");
-
+void write_overlay_slot_maps(std::ofstream& output_file, const RSPRecompilerConfig& config) {
     // IMEM -> slot index mapping
     fmt::print(output_file, 
         "static const std::map<uint32_t, uint32_t> imemToSlot = {{\n");
@@ -940,22 +1230,9 @@ void create_overlay_swap_function(const std::string& function_name, std::ofstrea
         fmt::print(output_file, "    }},\n");
     }
     fmt::print(output_file, "}};\n\n");
+}
 
-    // Permutation function pointers
-    fmt::print(output_file, 
-        "static RspUcodePermutationFunc* permutations[] = {{\n");
-    for (const auto& permutation : permutations) {
-        fmt::print(output_file, "    {},\n",
-            config.output_function_name + make_permutation_string(permutation.permutation));
-    }
-    fmt::print(output_file, "}};\n\n");
-
-    // Main function
-    fmt::print(output_file,
-        "RspExitReason {}(uint8_t* rdram, uint32_t ucode_addr) {{\n"
-        "    RspContext ctx{{}};\n",
-        config.output_function_name);
-    
+std::string make_slots_init_string(const RSPRecompilerConfig& config) {
     std::string slots_init_str = "";
     for (size_t i = 0; i < config.overlay_slots.size(); i++) {
         if (i > 0) {
@@ -965,14 +1242,11 @@ void create_overlay_swap_function(const std::string& function_name, std::ofstrea
         slots_init_str += "0";
     }
 
-    fmt::print(output_file, "    uint32_t slots[] = {{{}}};\n\n",
-        slots_init_str);
-
-    fmt::print(output_file, "    RspExitReason exitReason = {}(rdram, &ctx);\n\n",
-        config.output_function_name + "_initial");
-    
-    fmt::print(output_file, "");
+    return slots_init_str;
+}
 
+// Returns the expression for the index of the current permutation, given the overlay index of each slot in the slots array.
+std::string make_permutation_index_string(const RSPRecompilerConfig& config) {
     std::string perm_index_str = "";
     for (size_t i = 0; i < config.overlay_slots.size(); i++) {
         if (i > 0) {
@@ -986,7 +1260,52 @@ void create_overlay_swap_function(const std::string& function_name, std::ofstrea
 
         perm_index_str += fmt::format("slots[{}] * {}", i, multiplier);
     }
+
+    return perm_index_str;
+}
+
+void create_overlay_swap_function(const std::string& function_name, std::ofstream& output_file, const std::vector<FunctionPermutation>& permutations, const RSPRecompilerConfig& config) {
+    // Includes and permutation protos
+    fmt::print(output_file, 
+        "#include <map>\n"
+        "#include <vector>\n\n"
+        "using RspUcodePermutationFunc = RspExitReason(uint8_t* rdram, RspContext* ctx);\n\n"
+        "{}RspExitReason {}(uint8_t* rdram, RspContext* ctx);\n",
+        vector_isa_target_prefix(config), config.output_function_name + "_initial");
+
+    for (const auto& permutation : permutations) {
+        fmt::print(output_file, "{}RspExitReason {}(uint8_t* rdram, RspContext* ctx);\n",
+            vector_isa_target_prefix(config), config.output_function_name + make_permutation_string(permutation.permutation));
+    }
+    fmt::print(output_file, "\n");
+
+    write_overlay_slot_maps(output_file, config);
+
+    // Permutation function pointers
+    fmt::print(output_file, 
+        "static RspUcodePermutationFunc* permutations[] = {{\n");
+    for (const auto& permutation : permutations) {
+        fmt::print(output_file, "    {},\n",
+            config.output_function_name + make_permutation_string(permutation.permutation));
+    }
+    fmt::print(output_file, "}};\n\n");
+
+    // Main function
+    fmt::print(output_file,
+        "RspExitReason {}(uint8_t* rdram, uint32_t ucode_addr) {{\n"
+        "    RspContext ctx{{}};\n",
+        config.output_function_name);
     
+    fmt::print(output_file, "    uint32_t slots[] = {{{}}};\n\n",
+        make_slots_init_string(config));
+
+    fmt::print(output_file, "    RspExitReason exitReason = {}(rdram, &ctx);\n\n",
+        config.output_function_name + "_initial");
+    
+    fmt::print(output_file, "");
+
+    std::string perm_index_str = make_permutation_index_string(config);
+
     fmt::print(output_file,
         "    while (exitReason == RspExitReason::SwapOverlay) {{\n"
         "        uint32_t slot = imemToSlot.at(ctx.dma_mem_address);\n"
@@ -1001,7 +1320,139 @@ void create_overlay_swap_function(const std::string& function_name, std::ofstrea
         perm_index_str);
 }
 
-void create_function(const std::string& function_name, std::ofstream& output_file, const std::vector<rabbitizer::InstructionRsp>& instrs, const RSPRecompilerConfig& config, const ResumeTargets& resume_targets, bool is_permutation, bool is_initial) {
+void create_slot_dispatch_function(std::ofstream& output_file, const std::vector<CodeRegion>& regions, const RSPRecompilerConfig& config) {
+    // Includes and function protos
+    fmt::print(output_file, 
+        "#include <map>\n"
+        "#include <vector>\n\n"
+        "using RspUcodePermutationFunc = RspExitReason(uint8_t* rdram, RspContext* ctx);\n"
+        "using RspUcodeRegionFunc = RspExitReason(uint8_t* rdram, RspContext* ctx, bool& region_exit);\n\n"
+        "struct RspUcodeRegion {{\n"
+        "    uint32_t start;\n"
+        "    uint32_t end;\n"
+        "    int slot;\n"
+        "    RspUcodeRegionFunc* const* funcs;\n"
+        "}};\n\n"
+        "{}RspExitReason {}(uint8_t* rdram, RspContext* ctx);\n",
+        vector_isa_target_prefix(config), config.output_function_name + "_initial");
+
+    for (const auto& permutation : config.hot_permutations) {
+        fmt::print(output_file, "{}RspExitReason {}(uint8_t* rdram, RspContext* ctx);\n",
+            vector_isa_target_prefix(config), config.output_function_name + make_permutation_string(permutation));
+    }
+    for (const CodeRegion& region : regions) {
+        for (size_t variant_index = 0; variant_index < region.variants.size(); variant_index++) {
+            fmt::print(output_file, "static {}RspExitReason {}(uint8_t* rdram, RspContext* ctx, bool& region_exit);\n",
+                vector_isa_target_prefix(config), make_region_function_name(config, region, variant_index));
+        }
+    }
+    fmt::print(output_file, "\n");
+
+    write_overlay_slot_maps(output_file, config);
+
+    // Region function pointers, indexed by the overlay in the region's slot
+    for (size_t region_index = 0; region_index < regions.size(); region_index++) {
+        const CodeRegion& region = regions[region_index];
+        fmt::print(output_file, "static RspUcodeRegionFunc* const region{}Funcs[] = {{\n", region_index);
+        for (size_t variant_index = 0; variant_index < region.variants.size(); variant_index++) {
+            fmt::print(output_file, "    {},\n", make_region_function_name(config, region, variant_index));
+        }
+        fmt::print(output_file, "}};\n");
+    }
+    fmt::print(output_file, "\n");
+
+    // IMEM range -> region mapping
+    fmt::print(output_file,
+        "static const RspUcodeRegion regions[] = {{\n");
+    for (size_t region_index = 0; region_index < regions.size(); region_index++) {
+        const CodeRegion& region = regions[region_index];
+        fmt::print(output_file, "    {{ 0x{:04X}, 0x{:04X}, {}, region{}Funcs }},\n",
+            region.bounds.start, region.bounds.end, region.slot_index, region_index);
+    }
+    fmt::print(output_file, "}};\n\n");
+
+    // Main function
+    fmt::print(output_file,
+        "RspExitReason {}(uint8_t* rdram, uint32_t ucode_addr) {{\n"
+        "    RspContext ctx{{}};\n",
+        config.output_function_name);
+
+    fmt::print(output_file, "    uint32_t slots[] = {{{}}};\n"
+        "    bool region_exit = false;\n\n",
+        make_slots_init_string(config));
+
+    fmt::print(output_file, "    RspExitReason exitReason = {}(rdram, &ctx);\n\n",
+        config.output_function_name + "_initial");
+
+    fmt::print(output_file,
+        "    while (exitReason == RspExitReason::SwapOverlay) {{\n"
+        "        if (!region_exit) {{\n"
+        "            uint32_t slot = imemToSlot.at(ctx.dma_mem_address);\n"
+        "            uint32_t overlay = offsetToOverlay.at(slot).at(ctx.dma_dram_address - ucode_addr);\n"
+        "            slots[slot] = overlay;\n");
+
+    // Hot permutations run their complete function until the next overlay swap.
+    if (!config.hot_permutations.empty()) {
+        fmt::print(output_file,
+            "\n"
+            "            RspUcodePermutationFunc* permutationFunc = nullptr;\n"
+            "            switch ({}) {{\n",
+            make_permutation_index_string(config));
+
+        for (const auto& permutation : config.hot_permutations) {
+            uint32_t permutation_index = 0;
+            for (size_t i = 0; i < permutation.size(); i++) {
+                permutation_index = permutation_index * config.overlay_slots[i].overlays.size() + permutation[i];
+            }
+            fmt::print(output_file, "                case {}: permutationFunc = {}; break;\n",
+                permutation_index, config.output_function_name + make_permutation_string(permutation));
+        }
+
+        fmt::print(output_file,
+            "            }}\n"
+            "            if (permutationFunc != nullptr) {{\n"
+            "                exitReason = permutationFunc(rdram, &ctx);\n"
+            "                continue;\n"
+            "            }}\n");
+    }
+
+    fmt::print(output_file,
+        "        }}\n"
+        "\n"
+        "        const RspUcodeRegion* region = nullptr;\n"
+        "        for (const RspUcodeRegion& cur_region : regions) {{\n"
+        "            if (ctx.resume_address >= cur_region.start && ctx.resume_address < cur_region.end) {{\n"
+        "                region = &cur_region;\n"
+        "                break;\n"
+        "            }}\n"
+        "        }}\n"
+        "        if (region == nullptr) {{\n"
+        "            printf(\"Unhandled jump target 0x%04X in microcode {}\\n\", ctx.resume_address);\n"
+        "            return RspExitReason::UnhandledJumpTarget;\n"
+        "        }}\n"
+        "\n"
+        "        RspUcodeRegionFunc* regionFunc = region->funcs[region->slot >= 0 ? slots[region->slot] : 0];\n"
+        "        exitReason = regionFunc(rdram, &ctx, region_exit);\n"
+        "    }}\n\n"
+        "    return exitReason;\n"
+        "}}\n\n",
+        config.output_function_name);
+}
+
+void write_context_load(std::ofstream& output_file) {
+    fmt::print(output_file,
+        "    uint32_t                 r1 = ctx->r1,   r2 = ctx->r2,   r3 = ctx->r3,   r4 = ctx->r4,   r5 = ctx->r5,   r6 = ctx->r6,   r7 = ctx->r7;\n"
+        "    uint32_t  r8 = ctx->r8,  r9 = ctx->r9,   r10 = ctx->r10, r11 = ctx->r11, r12 = ctx->r12, r13 = ctx->r13, r14 = ctx->r14, r15 = ctx->r15;\n"
+        "    uint32_t r16 = ctx->r16, r17 = ctx->r17, r18 = ctx->r18, r19 = ctx->r19, r20 = ctx->r20, r21 = ctx->r21, r22 = ctx->r22, r23 = ctx->r23;\n"
+        "    uint32_t r24 = ctx->r24, r25 = ctx->r25, r26 = ctx->r26, r27 = ctx->r27, r28 = ctx->r28, r29 = ctx->r29, r30 = ctx->r30, r31 = ctx->r31;\n"
+        "    uint32_t dma_mem_address = ctx->dma_mem_address, dma_dram_address = ctx->dma_dram_address, jump_target = ctx->jump_target;\n"
+        "    const char * debug_file = NULL; int debug_line = 0;\n"
+        "    RSP rsp = ctx->rsp;\n");
+}
+
+void create_function(const std::string& function_name, std::ofstream& output_file, const std::vector<rabbitizer::InstructionRsp>& instrs, const RSPRecompilerConfig& config, const ResumeTargets& all_resume_targets, bool is_permutation, bool is_initial) {
+    ResumeTargets resume_targets = filter_resume_targets(all_resume_targets, instrs, full_imem_bounds);
+
     // Collect indirect jump targets (return addresses for linked jumps)
     BranchTargets branch_targets = get_branch_targets(instrs);
 
@@ -1013,14 +1464,8 @@ void create_function(const std::string& function_name, std::ofstream& output_fil
     // Write function
     if (is_permutation) {
         fmt::print(output_file,
-            "RspExitReason {}(uint8_t* rdram, RspContext* ctx) {{\n"
-            "    uint32_t                 r1 = ctx->r1,   r2 = ctx->r2,   r3 = ctx->r3,   r4 = ctx->r4,   r5 = ctx->r5,   r6 = ctx->r6,   r7 = ctx->r7;\n"
-            "    uint32_t  r8 = ctx->r8,  r9 = ctx->r9,   r10 = ctx->r10, r11 = ctx->r11, r12 = ctx->r12, r13 = ctx->r13, r14 = ctx->r14, r15 = ctx->r15;\n"
-            "    uint32_t r16 = ctx->r16, r17 = ctx->r17, r18 = ctx->r18, r19 = ctx->r19, r20 = ctx->r20, r21 = ctx->r21, r22 = ctx->r22, r23 = ctx->r23;\n"
-            "    uint32_t r24 = ctx->r24, r25 = ctx->r25, r26 = ctx->r26, r27 = ctx->r27, r28 = ctx->r28, r29 = ctx->r29, r30 = ctx->r30, r31 = ctx->r31;\n"
-            "    uint32_t dma_mem_address = ctx->dma_mem_address, dma_dram_address = ctx->dma_dram_address, jump_target = ctx->jump_target;\n"
-            "    const char * debug_file = NULL; int debug_line = 0;\n"
-            "    RSP rsp = ctx->rsp;\n", function_name);
+            "{}RspExitReason {}(uint8_t* rdram, RspContext* ctx) {{\n", vector_isa_target_prefix(config), function_name);
+        write_context_load(output_file);
 
         // Write jumps to resume targets
         if (!is_initial) {
@@ -1054,7 +1499,7 @@ void create_function(const std::string& function_name, std::ofstream& output_fil
         fmt::print(output_file, "    r1 = 0xFC0;\n");
     } else {
         fmt::print(output_file,
-            "RspExitReason {}(uint8_t* rdram, [[maybe_unused]] uint32_t ucode_addr) {{\n"
+            "{}RspExitReason {}(uint8_t* rdram, [[maybe_unused]] uint32_t ucode_addr) {{\n"
             "    uint32_t           r1 = 0,  r2 = 0,  r3 = 0,  r4 = 0,  r5 = 0,  r6 = 0,  r7 = 0;\n"
             "    uint32_t  r8 = 0,  r9 = 0, r10 = 0, r11 = 0, r12 = 0, r13 = 0, r14 = 0, r15 = 0;\n"
             "    uint32_t r16 = 0, r17 = 0, r18 = 0, r19 = 0, r20 = 0, r21 = 0, r22 = 0, r23 = 0;\n"
@@ -1062,28 +1507,113 @@ void create_function(const std::string& function_name, std::ofstream& output_fil
             "    uint32_t dma_mem_address = 0, dma_dram_address = 0, jump_target = 0;\n"
             "    const char * debug_file = NULL; int debug_line = 0;\n"
             "    RSP rsp{{}};\n"
-            "    r1 = 0xFC0;\n", function_name);
+            "    r1 = 0xFC0;\n", vector_isa_target_prefix(config), function_name);
     }
     // Write each instruction
     for (size_t instr_index = 0; instr_index < instrs.size(); instr_index++) {
-        process_instruction(instr_index, instrs, output_file, branch_targets, config.unsupported_instructions, resume_targets, is_permutation, false, false);
+        process_instruction(instr_index, instrs, output_file, branch_targets, config.unsupported_instructions, resume_targets, full_imem_bounds, is_permutation, false, false);
     }
 
     // Terminate instruction code with a return to indicate that the microcode has run past its end
     fmt::print(output_file, "    return RspExitReason::ImemOverrun;\n");
 
     // Write the section containing the indirect jump table
-    write_indirect_jumps(output_file, branch_targets, config.output_function_name);
+    write_indirect_jumps(output_file, branch_targets, config.output_function_name, false);
 
     // Write routine for returning for an overlay swap
     if (is_permutation) {
-        write_overlay_swap_return(output_file);
+        write_overlay_swap_return(output_file, false);
     }
 
     // End the file
     fmt::print(output_file, "}}\n");
 }
 
+void write_resume_switch(std::ofstream& output_file, const std::vector<uint32_t>& addresses, std::string_view label_prefix, std::string_view label_suffix) {
+    fmt::print(output_file, "        switch (ctx->resume_address) {{\n");
+    for (uint32_t address : addresses) {
+        fmt::print(output_file, "            case 0x{0:04X}: goto {1}{0:04X}{2};\n", address, label_prefix, label_suffix);
+    }
+    fmt::print(output_file, "        }}\n");
+}
+
+template <typename T>
+std::vector<uint32_t> sorted_addresses(const T& addresses) {
+    std::vector<uint32_t> ret(addresses.begin(), addresses.end());
+    std::sort(ret.begin(), ret.end());
+    ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+    return ret;
+}
+
+// Writes the function for one overlay (or the code between overlay slots) in a region. The function is entered either at one of its labels
+// after another region jumped into it, or at a resume target after an overlay swap, and exits through the dispatcher whenever execution
+// leaves the region.
+void create_region_function(const std::string& function_name, std::ofstream& output_file, const std::vector<rabbitizer::InstructionRsp>& instrs, const RSPRecompilerConfig& config,
+    const RegionBounds& bounds, const BranchTargets& all_branch_targets, const ResumeTargets& all_resume_targets, bool is_last_region)
+{
+    // Only the targets within the region can be jumped to directly. The start of the region also gets a label so that execution can
+    // continue into it from the previous region.
+    BranchTargets branch_targets{};
+    branch_targets.direct_targets.insert(bounds.start);
+    for (uint32_t target : all_branch_targets.direct_targets) {
+        if (bounds.contains(target)) {
+            branch_targets.direct_targets.insert(target);
+        }
+    }
+    for (uint32_t target : all_branch_targets.indirect_targets) {
+        if (bounds.contains(target)) {
+            branch_targets.indirect_targets.insert(target);
+        }
+    }
+
+    ResumeTargets resume_targets = filter_resume_targets(all_resume_targets, instrs, bounds);
+
+    std::vector<uint32_t> entry_targets = sorted_addresses(branch_targets.direct_targets);
+    entry_targets.insert(entry_targets.end(), branch_targets.indirect_targets.begin(), branch_targets.indirect_targets.end());
+    entry_targets = sorted_addresses(entry_targets);
+
+    fmt::print(output_file,
+        "static {}RspExitReason {}(uint8_t* rdram, RspContext* ctx, bool& region_exit) {{\n", vector_isa_target_prefix(config), function_name);
+    write_context_load(output_file);
+
+    // Write jumps to entry and resume targets
+    fmt::print(output_file,
+        "    if (region_exit) {{\n"
+        "        region_exit = false;\n");
+    write_resume_switch(output_file, entry_targets, "L_", "");
+    fmt::print(output_file,
+        "    }} else if (ctx->resume_delay) {{\n");
+    write_resume_switch(output_file, sorted_addresses(resume_targets.delay_targets), "R_", "_delay");
+    fmt::print(output_file,
+        "    }} else {{\n");
+    write_resume_switch(output_file, sorted_addresses(resume_targets.non_delay_targets), "R_", "");
+    fmt::print(output_file,
+        "    }}\n"
+        "    printf(\"Unhandled resume target 0x%04X (delay slot: %d) in microcode {}\\n\", ctx->resume_address, ctx->resume_delay);\n"
+        "    return RspExitReason::UnhandledResumeTarget;\n",
+        config.output_function_name);
+
+    // Write each instruction
+    for (size_t instr_index = 0; instr_index < instrs.size(); instr_index++) {
+        process_instruction(instr_index, instrs, output_file, branch_targets, config.unsupported_instructions, resume_targets, bounds, true, false, false);
+    }
+
+    // Continue into the next region, or return if this is the end of the microcode
+    if (is_last_region) {
+        fmt::print(output_file, "    return RspExitReason::ImemOverrun;\n");
+    } else {
+        fmt::print(output_file, "    {};\n", jump_to_target(bounds, bounds.end));
+    }
+
+    // Write the section containing the indirect jump table
+    write_indirect_jumps(output_file, branch_targets, config.output_function_name, true);
+
+    // Write routine for leaving the region or returning for an overlay swap
+    write_overlay_swap_return(output_file, true);
+
+    fmt::print(output_file, "}}\n");
+}
+
 int main(int argc, const char** argv) {
     if (argc != 2) {
         fmt::print("Usage: {} [config file]\n", argv[0]);
@@ -1128,9 +1658,15 @@ int main(int argc, const char** argv) {
         }
     }
 
-    // Create overlay permutations
+    // Create overlay permutations. In slots mode only the hot permutations get their own function.
+    bool slots_mode = !overlay_slots.empty() && config.overlay_mode == RSPOverlayMode::Slots;
     std::vector<Permutation> permutations{};
-    if (!overlay_slots.empty()) {
+    if (slots_mode) {
+        for (const std::vector<uint32_t>& permutation : config.hot_permutations) {
+            permutations.push_back(make_permutation(instr_words, overlay_slots, permutation));
+        }
+    }
+    else if (!overlay_slots.empty()) {
         permute(instr_words, overlay_slots, permutations);
     }
 
@@ -1141,36 +1677,51 @@ int main(int argc, const char** argv) {
     RabbitizerConfig_Cfg.pseudos.pseudoNot = false;
 
     // Decode the instruction words into instructions
-    std::vector<rabbitizer::InstructionRsp> instrs{};
-    instrs.reserve(instr_words.size());
-    uint32_t vram = config.text_address & rsp_mem_mask;
-    for (uint32_t instr_word : instr_words) {
-        const rabbitizer::InstructionRsp& instr = instrs.emplace_back(byteswap(instr_word), vram);
-        vram += instr_size;
-    }
+    std::vector<rabbitizer::InstructionRsp> instrs = decode_instructions(instr_words, config.text_address & rsp_mem_mask);
 
     std::vector<FunctionPermutation> func_permutations{};
     func_permutations.reserve(permutations.size());
     for (const Permutation& permutation : permutations) {
         FunctionPermutation func = {
+            .instrs = decode_instructions(permutation.instr_words, config.text_address & rsp_mem_mask),
             .permutation = std::vector<uint32_t>(permutation.permutation)
         };
 
-        func.instrs.reserve(permutation.instr_words.size());
-        uint32_t vram = config.text_address & rsp_mem_mask;
-        for (uint32_t instr_word : permutation.instr_words) {
-            const rabbitizer::InstructionRsp& instr = func.instrs.emplace_back(byteswap(instr_word), vram);
-            vram += instr_size;
+        func_permutations.emplace_back(func);
+    }
+
+    // Split IMEM into regions for slots mode and collect the branch targets across every region, since any region can jump into another.
+    std::vector<CodeRegion> regions{};
+    BranchTargets region_branch_targets{};
+    if (slots_mode) {
+        if (!build_code_regions(instr_words, overlay_slots, config, regions)) {
+            return EXIT_FAILURE;
         }
 
-        func_permutations.emplace_back(func);
+        for (const CodeRegion& region : regions) {
+            for (const auto& region_instrs : region.variants) {
+                BranchTargets cur_targets = get_branch_targets(region_instrs);
+                region_branch_targets.direct_targets.insert(cur_targets.direct_targets.begin(), cur_targets.direct_targets.end());
+                region_branch_targets.indirect_targets.insert(cur_targets.indirect_targets.begin(), cur_targets.indirect_targets.end());
+            }
+        }
+
+        for (uint32_t target : config.extra_indirect_branch_targets) {
+            region_branch_targets.indirect_targets.insert(target);
+        }
     }
 
-    // Determine all possible overlay swap resume targets
+    // Determine all possible overlay swap resume targets. In slots mode a swap can resume in any region or hot permutation function, so the
+    // targets of every region variant are included as well as those of the hot permutations.
     ResumeTargets resume_targets{};
     for (const FunctionPermutation& permutation : func_permutations) {
         get_overlay_swap_resume_targets(permutation.instrs, resume_targets);
     }
+    for (const CodeRegion& region : regions) {
+        for (const auto& region_instrs : region.variants) {
+            get_overlay_swap_resume_targets(region_instrs, resume_targets);
+        }
+    }
 
     // Open output file and write beginning
     std::filesystem::create_directories(std::filesystem::path{ config.output_file_path }.parent_path());
@@ -1178,10 +1729,27 @@ int main(int argc, const char** argv) {
     fmt::print(output_file,
         "#include \"librecomp/rsp.hpp\"\n"
         "#include \"librecomp/rsp_vu_impl.hpp\"\n");
+    write_vector_isa_target(output_file, config.vector_isa, config.output_function_name);
     
     // Write function(s)
     if (overlay_slots.empty()) {
         create_function(config.output_function_name, output_file, instrs, config, resume_targets, false, false);
+    } else if (slots_mode) {
+        create_slot_dispatch_function(output_file, regions, config);
+        create_function(config.output_function_name + "_initial", output_file, instrs, config, ResumeTargets{}, true, true);
+
+        for (const auto& permutation : func_permutations) {
+            create_function(config.output_function_name + make_permutation_string(permutation.permutation), 
+                output_file, permutation.instrs, config, resume_targets, true, false);
+        }
+
+        for (size_t region_index = 0; region_index < regions.size(); region_index++) {
+            const CodeRegion& region = regions[region_index];
+            for (size_t variant_index = 0; variant_index < region.variants.size(); variant_index++) {
+                create_region_function(make_region_function_name(config, region, variant_index), output_file, region.variants[variant_index], config,
+                    region.bounds, region_branch_targets, resume_targets, region_index + 1 == regions.size());
+            }
+        }
     } else {
         create_overlay_swap_function(config.output_function_name, output_file, func_permutations, config);
         create_function(config.output_function_name + "_initial", output_file, instrs, config, ResumeTargets{}, true, true);
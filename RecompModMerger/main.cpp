@@ -1,5 +1,7 @@
 #include <cstdio>
 #include <fstream>
+#include <string_view>
+#include <unordered_set>
 
 #include "recompiler/context.h"
 
@@ -24,7 +26,7 @@ bool read_file(const std::filesystem::path& p, std::vector<T>& out) {
     return true;
 }
 
-bool write_file(const std::filesystem::path& p, std::span<char> in) {
+bool write_file(const std::filesystem::path& p, std::span<const char> in) {
     std::ofstream out{ p, std::ios::binary };
     if (!out.good()) {
         return false;
@@ -38,214 +40,220 @@ std::span<uint8_t> reinterpret_span_u8(std::span<char> s) {
     return std::span(reinterpret_cast<uint8_t*>(s.data()), s.size());
 }
 
-std::span<char> reinterpret_span_char(std::span<uint8_t> s) {
-    return std::span(reinterpret_cast<char*>(s.data()), s.size());
+std::span<const char> reinterpret_span_char(std::span<const uint8_t> s) {
+    return std::span(reinterpret_cast<const char*>(s.data()), s.size());
 }
 
-bool copy_into_context(N64Recomp::Context& out, const N64Recomp::Context& in) {
-    size_t rom_offset = out.rom.size();
-    size_t section_offset = out.sections.size();
-    size_t function_offset = out.functions.size();
-    size_t event_offset = out.event_symbols.size();
-    
-    // Append the input rom to the end of the output rom.
-    out.rom.insert(out.rom.end(), in.rom.begin(), in.rom.end());
-
-    // Merge dependencies from the input. Copy new ones and remap existing ones.
-    std::vector<size_t> new_dependency_indices(in.dependencies.size());
-    for (size_t dep_index = 0; dep_index < in.dependencies.size(); dep_index++) {
-        const std::string& dep = in.dependencies[dep_index];
-        auto find_dep_it = out.dependencies_by_name.find(dep);
-        if (find_dep_it != out.dependencies_by_name.end()) {
-            new_dependency_indices[dep_index] = find_dep_it->second;
+// Merges mod contexts into a single output context one at a time. The output's dependencies, imports and dependency events are deduplicated
+// through the context's own hashed lookups, and exports, events and replacements are checked for conflicts through indexes kept here, so
+// merging each input only costs time proportional to that input instead of to everything merged so far. Each input's binary is written
+// straight to the output binary stream, which means inputs can be released as soon as they've been merged.
+class ContextMerger {
+public:
+    ContextMerger(N64Recomp::Context& out, std::ostream& binary_out) : out(out), binary_out(binary_out) {}
+
+    bool add(const N64Recomp::Context& in, const char* input_name) {
+        size_t section_offset = out.sections.size();
+        size_t function_offset = out.functions.size();
+        size_t event_offset = out.event_symbols.size();
+
+        // Grow the output and the indexes up front so they don't get reallocated repeatedly while copying.
+        out.sections.reserve(out.sections.size() + in.sections.size());
+        out.functions.reserve(out.functions.size() + in.functions.size());
+        out.dependencies_by_name.reserve(out.dependencies_by_name.size() + in.dependencies.size());
+        exported_names.reserve(exported_names.size() + in.exported_funcs.size());
+        event_names.reserve(event_names.size() + in.event_symbols.size());
+        replaced_funcs.reserve(replaced_funcs.size() + in.replacements.size());
+
+        // Check the input for conflicts with what's been merged so far before modifying the output.
+        for (size_t exported_func : in.exported_funcs) {
+            if (exported_names.contains(in.functions[exported_func].name)) {
+                fprintf(stderr, "Function %s exported by %s is already exported by another mod\n", in.functions[exported_func].name.c_str(), input_name);
+                return false;
+            }
         }
-        else {
-            out.dependencies_by_name[dep] = out.dependencies.size();
-            new_dependency_indices[dep_index] = out.dependencies.size();
-            out.dependencies.emplace_back(dep);
+        for (const N64Recomp::EventSymbol& event_sym : in.event_symbols) {
+            if (event_names.contains(event_sym.base.name)) {
+                fprintf(stderr, "Event %s provided by %s is already provided by another mod\n", event_sym.base.name.c_str(), input_name);
+                return false;
+            }
         }
-    }
-
-    // Merge imports from the input. Copy new ones and remap existing ones.
-    std::vector<size_t> new_import_indices(in.import_symbols.size());
-    for (size_t import_index = 0; import_index < in.import_symbols.size(); import_index++) {
-        const N64Recomp::ImportSymbol& sym = in.import_symbols[import_index];
-        size_t dependency_index = new_dependency_indices[sym.dependency_index];
-
-        size_t original_import_index = (size_t)-1;
-        
-        // Check if any import symbols have the same dependency index and symbol name.
-        for (size_t i = 0; i < out.import_symbols.size(); i++) {
-            const N64Recomp::ImportSymbol& sym_out = out.import_symbols[i];
-            if (sym_out.dependency_index == dependency_index && sym_out.base.name == sym.base.name) {
-                original_import_index = i;
-                break;
+        for (const N64Recomp::FunctionReplacement& replacement : in.replacements) {
+            if (replaced_funcs.contains(replacement_key(replacement))) {
+                fprintf(stderr, "Function 0x%08X in section 0x%08X replaced by %s is already replaced by another mod\n",
+                    replacement.original_vram, replacement.original_section_vrom, input_name);
+                return false;
             }
         }
 
-        if (original_import_index != (size_t)-1) {
-            new_import_indices[import_index] = original_import_index;
+        // Merge dependencies from the input. Copy new ones and remap existing ones.
+        std::vector<size_t> new_dependency_indices(in.dependencies.size());
+        for (size_t dep_index = 0; dep_index < in.dependencies.size(); dep_index++) {
+            const std::string& dep = in.dependencies[dep_index];
+            out.add_dependency(dep);
+            new_dependency_indices[dep_index] = out.dependencies_by_name[dep];
         }
-        else {
-            new_import_indices[import_index] = out.import_symbols.size();
-            N64Recomp::ImportSymbol new_sym{};
-            new_sym.dependency_index = dependency_index;
-            new_sym.base.name = sym.base.name;
-            out.import_symbols.emplace_back(std::move(new_sym));
-        }
-    }
 
-    // Merge dependency events from the input. Copy new ones and remap existing ones.
-    std::vector<size_t> new_dependency_event_indices(in.dependency_events.size());
-    for (size_t dependency_event_index = 0; dependency_event_index < in.dependency_events.size(); dependency_event_index++) {
-        const N64Recomp::DependencyEvent& event = in.dependency_events[dependency_event_index];
-        size_t dependency_index = new_dependency_indices[event.dependency_index];
+        // Merge imports from the input. Copy new ones and remap existing ones.
+        std::vector<size_t> new_import_indices(in.import_symbols.size());
+        for (size_t import_index = 0; import_index < in.import_symbols.size(); import_index++) {
+            const N64Recomp::ImportSymbol& sym = in.import_symbols[import_index];
+            size_t dependency_index = new_dependency_indices[sym.dependency_index];
 
-        size_t original_event_index = (size_t)-1;
-
-        // Check if any dependency events have the same dependency index and event name.
-        for (size_t i = 0; i < out.dependency_events.size(); i++) {
-            const N64Recomp::DependencyEvent& event_out = out.dependency_events[i];
-            if (event_out.dependency_index == dependency_index && event_out.event_name == event.event_name) {
-                original_event_index = i;
-                break;
+            N64Recomp::SymbolReference existing_import;
+            if (out.find_import_symbol(sym.base.name, dependency_index, existing_import)) {
+                new_import_indices[import_index] = existing_import.symbol_index;
+            }
+            else {
+                new_import_indices[import_index] = out.import_symbols.size();
+                out.add_import_symbol(sym.base.name, dependency_index);
             }
         }
 
-        if (original_event_index != (size_t)-1) {
-            new_dependency_event_indices[dependency_event_index] = original_event_index;
-        }
-        else {
-            new_dependency_event_indices[dependency_event_index] = out.dependency_events.size();
-            out.dependency_events.emplace_back(N64Recomp::DependencyEvent{ .dependency_index = dependency_index, .event_name = event.event_name });
+        // Merge dependency events from the input. Copy new ones and remap existing ones.
+        std::vector<size_t> new_dependency_event_indices(in.dependency_events.size());
+        for (size_t dependency_event_index = 0; dependency_event_index < in.dependency_events.size(); dependency_event_index++) {
+            const N64Recomp::DependencyEvent& event = in.dependency_events[dependency_event_index];
+            size_t dependency_index = new_dependency_indices[event.dependency_index];
+            out.add_dependency_event(event.event_name, dependency_index, new_dependency_event_indices[dependency_event_index]);
         }
-    }
 
-    // Copy every section from the input.
-    for (size_t section_index = 0; section_index < in.sections.size(); section_index++) {
-        const N64Recomp::Section& section = in.sections[section_index];
-
-        size_t out_section_index = section_offset + section_index;
-        N64Recomp::Section& section_out = out.sections.emplace_back(section);
-        section_out.rom_addr += rom_offset;
-        section_out.name = "";
-
-        // Adjust the section index of all the section's relocs.
-        for (N64Recomp::Reloc& reloc : section_out.relocs) {
-            if (reloc.target_section == N64Recomp::SectionAbsolute) {
-                printf("Internal error: reloc in section %zu references an absolute symbol and should have been relocated already. Please report this issue.\n",
-                    section_index);
-                // Nothing to do for absolute relocs.
-            }
-            else if (reloc.target_section == N64Recomp::SectionImport) {
-                // symbol_index indexes context.import_symbols
-                reloc.symbol_index = new_import_indices[reloc.symbol_index];
-            }
-            else if (reloc.target_section == N64Recomp::SectionEvent) {
-                // symbol_index indexes context.event_symbols
-                reloc.symbol_index += event_offset;
-            }
-            else if (reloc.reference_symbol) {
-                // symbol_index indexes context.reference_symbols
-                // Nothing to do here, reference section indices will remain unchanged.
-            }
-            else {
-                reloc.target_section += section_offset;
+        // Copy every section from the input.
+        for (size_t section_index = 0; section_index < in.sections.size(); section_index++) {
+            const N64Recomp::Section& section = in.sections[section_index];
+
+            N64Recomp::Section& section_out = out.sections.emplace_back(section);
+            section_out.rom_addr += rom_offset;
+            section_out.name = "";
+
+            // Adjust the section index of all the section's relocs.
+            for (N64Recomp::Reloc& reloc : section_out.relocs) {
+                if (reloc.target_section == N64Recomp::SectionAbsolute) {
+                    printf("Internal error: reloc in section %zu references an absolute symbol and should have been relocated already. Please report this issue.\n",
+                        section_index);
+                    // Nothing to do for absolute relocs.
+                }
+                else if (reloc.target_section == N64Recomp::SectionImport) {
+                    // symbol_index indexes context.import_symbols
+                    reloc.symbol_index = new_import_indices[reloc.symbol_index];
+                }
+                else if (reloc.target_section == N64Recomp::SectionEvent) {
+                    // symbol_index indexes context.event_symbols
+                    reloc.symbol_index += event_offset;
+                }
+                else if (reloc.reference_symbol) {
+                    // symbol_index indexes context.reference_symbols
+                    // Nothing to do here, reference section indices will remain unchanged.
+                }
+                else {
+                    reloc.target_section += section_offset;
+                }
             }
         }
-    }
 
-    out.section_functions.resize(out.sections.size());
+        out.section_functions.resize(out.sections.size());
 
-    // Copy every function from the input.
-    for (size_t func_index = 0; func_index < in.functions.size(); func_index++) {
-        const N64Recomp::Function& func = in.functions[func_index];
+        // Copy every function from the input. The symbol output doesn't use functions_by_vram, so it's left alone to avoid hashing every function.
+        for (size_t func_index = 0; func_index < in.functions.size(); func_index++) {
+            const N64Recomp::Function& func = in.functions[func_index];
 
-        size_t out_func_index = function_offset + func_index;
-        N64Recomp::Function& function_out = out.functions.emplace_back(func);
+            size_t out_func_index = function_offset + func_index;
+            N64Recomp::Function& function_out = out.functions.emplace_back(func);
 
-        function_out.section_index += section_offset;
-        function_out.rom += rom_offset;
-        // functions_by_name unused
-        out.functions_by_vram[function_out.vram].push_back(out_func_index);
+            function_out.section_index += section_offset;
+            function_out.rom += rom_offset;
 
-        out.section_functions[function_out.section_index].push_back(out_func_index);
-    }
+            out.section_functions[function_out.section_index].push_back(out_func_index);
+        }
 
-    // Copy replacements from the input.
-    for (size_t replacement_index = 0; replacement_index < in.replacements.size(); replacement_index++) {
-        const N64Recomp::FunctionReplacement& replacement = in.replacements[replacement_index];
-        N64Recomp::FunctionReplacement& replacement_out = out.replacements.emplace_back(replacement);
-        replacement_out.func_index += function_offset;
-    }
+        // Copy replacements from the input.
+        for (const N64Recomp::FunctionReplacement& replacement : in.replacements) {
+            N64Recomp::FunctionReplacement& replacement_out = out.replacements.emplace_back(replacement);
+            replacement_out.func_index += function_offset;
+            replaced_funcs.emplace(replacement_key(replacement));
+        }
 
-    // Copy hooks from the input.
-    for (size_t hook_index = 0; hook_index < in.hooks.size(); hook_index++) {
-        const N64Recomp::FunctionHook& hook = in.hooks[hook_index];
-        N64Recomp::FunctionHook& hook_out = out.hooks.emplace_back(hook);
-        hook_out.func_index += function_offset;
-    }
+        // Copy hooks from the input.
+        for (const N64Recomp::FunctionHook& hook : in.hooks) {
+            N64Recomp::FunctionHook& hook_out = out.hooks.emplace_back(hook);
+            hook_out.func_index += function_offset;
+        }
 
-    // Copy callbacks from the input.
-    for (size_t callback_index = 0; callback_index < in.callbacks.size(); callback_index++) {
-        const N64Recomp::Callback& callback = in.callbacks[callback_index];
-        N64Recomp::Callback callback_out = out.callbacks.emplace_back(callback);
-        callback_out.dependency_event_index = new_dependency_event_indices[callback_out.dependency_event_index];
-    }
+        // Copy callbacks from the input.
+        for (const N64Recomp::Callback& callback : in.callbacks) {
+            N64Recomp::Callback& callback_out = out.callbacks.emplace_back(callback);
+            callback_out.function_index += function_offset;
+            callback_out.dependency_event_index = new_dependency_event_indices[callback_out.dependency_event_index];
+        }
 
-    // Copy exports from the input.
-    for (size_t exported_func : in.exported_funcs) {
-        out.exported_funcs.push_back(exported_func + function_offset);
-    }
+        // Copy exports from the input.
+        for (size_t exported_func : in.exported_funcs) {
+            out.exported_funcs.push_back(exported_func + function_offset);
+            exported_names.emplace(in.functions[exported_func].name);
+        }
 
-    // Copy events from the input.
-    for (const N64Recomp::EventSymbol& event_sym : in.event_symbols) {
-        out.event_symbols.emplace_back(event_sym);
-    }
+        // Copy events from the input.
+        for (const N64Recomp::EventSymbol& event_sym : in.event_symbols) {
+            out.event_symbols.emplace_back(event_sym);
+            event_names.emplace(event_sym.base.name);
+        }
 
-    return true;
-}
+        // Append the input's binary to the output binary.
+        binary_out.write(reinterpret_cast<const char*>(in.rom.data()), in.rom.size());
+        if (!binary_out.good()) {
+            fprintf(stderr, "Failed to write the binary of %s to the output\n", input_name);
+            return false;
+        }
+        rom_offset += in.rom.size();
 
-int main(int argc, const char** argv) {
-    if (argc != 8) {
-        printf("Usage: %s <function symbol toml> <symbol file 1> <binary 1> <symbol file 2> <binary 2> <output symbol file> <output binary file>\n", argv[0]);
-        return EXIT_SUCCESS;
+        return true;
     }
-
-    const char* function_symbol_toml_path = argv[1];
-    const char* sym_file_path_1 = argv[2];
-    const char* binary_path_1 = argv[3];
-    const char* sym_file_path_2 = argv[4];
-    const char* binary_path_2 = argv[5];
-    const char* output_sym_path = argv[6];
-    const char* output_binary_path = argv[7];
-
-    // Load the symbol and binary files.
-    std::vector<char> sym_file_1;
-    if (!read_file(sym_file_path_1, sym_file_1)) {
-        fprintf(stderr, "Error reading file %s\n", sym_file_path_1);
-        return EXIT_FAILURE;
+private:
+    static uint64_t replacement_key(const N64Recomp::FunctionReplacement& replacement) {
+        return (uint64_t{replacement.original_section_vrom} << 32) | replacement.original_vram;
     }
 
-    std::vector<uint8_t> binary_1;
-    if (!read_file(binary_path_1, binary_1)) {
-        fprintf(stderr, "Error reading file %s\n", binary_path_1);
-        return EXIT_FAILURE;
-    }
+    N64Recomp::Context& out;
+    std::ostream& binary_out;
+    // Size of the output binary so far.
+    size_t rom_offset = 0;
+    std::unordered_set<std::string> exported_names;
+    std::unordered_set<std::string> event_names;
+    std::unordered_set<uint64_t> replaced_funcs;
+};
 
-    std::vector<char> sym_file_2;
-    if (!read_file(sym_file_path_2, sym_file_2)) {
-        fprintf(stderr, "Error reading file %s\n", sym_file_path_2);
-        return EXIT_FAILURE;
+int main(int argc, const char** argv) {
+    auto print_usage = [argv]() {
+        printf("Usage: %s <function symbol toml> <symbol file 1> <binary 1> <symbol file 2> <binary 2> <output symbol file> <output binary file>\n"
+               "       %s --mods <function symbol toml> <output symbol file> <output binary file> <symbol file 1> <binary 1> [<symbol file 2> <binary 2> ...]\n",
+            argv[0], argv[0]);
+    };
+
+    const char* function_symbol_toml_path;
+    const char* output_sym_path;
+    const char* output_binary_path;
+    // Symbol file and binary path pairs of the mods to merge, in order.
+    std::vector<std::pair<const char*, const char*>> input_paths{};
+
+    if (argc >= 7 && std::string_view{argv[1]} == "--mods" && (argc - 5) % 2 == 0) {
+        function_symbol_toml_path = argv[2];
+        output_sym_path = argv[3];
+        output_binary_path = argv[4];
+        for (int i = 5; i < argc; i += 2) {
+            input_paths.emplace_back(argv[i], argv[i + 1]);
+        }
     }
-
-    std::vector<uint8_t> binary_2;
-    if (!read_file(binary_path_2, binary_2)) {
-        fprintf(stderr, "Error reading file %s\n", binary_path_2);
-        return EXIT_FAILURE;
+    else if (argc == 8) {
+        function_symbol_toml_path = argv[1];
+        input_paths.emplace_back(argv[2], argv[3]);
+        input_paths.emplace_back(argv[4], argv[5]);
+        output_sym_path = argv[6];
+        output_binary_path = argv[7];
+    }
+    else {
+        print_usage();
+        return EXIT_SUCCESS;
     }
-    
-    N64Recomp::ModSymbolsError err;
 
     // Parse the symbol toml.
     std::vector<uint8_t> dummy_rom{};
@@ -261,32 +269,54 @@ int main(int argc, const char** argv) {
         sections_by_rom[reference_context.sections[section_index].rom_addr] = section_index;
     }
 
-    // Parse the two contexts.
-    N64Recomp::Context context1{};
-    err = N64Recomp::parse_mod_symbols(sym_file_1, binary_1, sections_by_rom, context1);
-    if (err != N64Recomp::ModSymbolsError::Good) {
-        fprintf(stderr, "Error parsing mod symbols %s\n", sym_file_path_1);
-        return EXIT_FAILURE;
-    }
-    context1.rom = std::move(binary_1);
+    N64Recomp::Context merged{};
+    merged.import_reference_context(reference_context);
 
-    N64Recomp::Context context2{};
-    err = N64Recomp::parse_mod_symbols(sym_file_2, binary_2, sections_by_rom, context2);
-    if (err != N64Recomp::ModSymbolsError::Good) {
-        fprintf(stderr, "Error parsing mod symbols %s\n", sym_file_path_2);
+    std::ofstream output_binary{ output_binary_path, std::ios::binary };
+    if (!output_binary.good()) {
+        fprintf(stderr, "Failed to open binary file %s for writing\n", output_binary_path);
         return EXIT_FAILURE;
     }
-    context2.rom = std::move(binary_2);
 
-    N64Recomp::Context merged{};
-    merged.import_reference_context(reference_context);
+    ContextMerger merger{ merged, output_binary };
 
-    if (!copy_into_context(merged, context1)) {
-        fprintf(stderr, "Failed to merge first mod into output\n");
-        return EXIT_FAILURE;
+    // Load and merge the mods one at a time, so only one mod's symbols and binary are held in memory at once besides the merged symbols.
+    for (const auto& [sym_file_path, binary_path] : input_paths) {
+        std::vector<char> sym_file;
+        if (!read_file(sym_file_path, sym_file)) {
+            fprintf(stderr, "Error reading file %s\n", sym_file_path);
+            return EXIT_FAILURE;
+        }
+
+        // Map the binary instead of reading it, as it only gets read while parsing and copying it to the output.
+        N64Recomp::RomBuffer binary{};
+        if (!N64Recomp::map_file(binary_path, binary)) {
+            // Mapping fails for empty files, so fall back to reading the file normally.
+            std::vector<uint8_t> binary_data;
+            if (!read_file(binary_path, binary_data)) {
+                fprintf(stderr, "Error reading file %s\n", binary_path);
+                return EXIT_FAILURE;
+            }
+            binary = std::move(binary_data);
+        }
+
+        N64Recomp::Context mod_context{};
+        N64Recomp::ModSymbolsError err = N64Recomp::parse_mod_symbols(sym_file, binary.span(), sections_by_rom, mod_context);
+        if (err != N64Recomp::ModSymbolsError::Good) {
+            fprintf(stderr, "Error parsing mod symbols %s\n", sym_file_path);
+            return EXIT_FAILURE;
+        }
+        mod_context.rom = std::move(binary);
+
+        if (!merger.add(mod_context, sym_file_path)) {
+            fprintf(stderr, "Failed to merge %s into output\n", sym_file_path);
+            return EXIT_FAILURE;
+        }
     }
-    if (!copy_into_context(merged, context2)) {
-        fprintf(stderr, "Failed to merge second mod into output\n");
+
+    output_binary.close();
+    if (output_binary.fail()) {
+        fprintf(stderr, "Failed to write binary file to %s\n", output_binary_path);
         return EXIT_FAILURE;
     }
 
@@ -297,10 +327,5 @@ int main(int argc, const char** argv) {
         return EXIT_FAILURE;
     }
 
-    if (!write_file(output_binary_path, reinterpret_span_char(std::span{ merged.rom }))) {
-        fprintf(stderr, "Failed to write binary file to %s\n", output_binary_path);
-        return EXIT_FAILURE;
-    }
-
     return EXIT_SUCCESS;
 }
@@ -5,19 +5,15 @@
 #include <numeric>
 #include <cctype>
 #include <cstdlib>
+#include <charconv>
+#include <sstream>
+#include <thread>
 #include "fmt/format.h"
 #include "fmt/ostream.h"
 #include "recompiler/context.h"
+#include "zip_writer.h"
 #include <toml++/toml.hpp>
 
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-#else
-#include <unistd.h>
-#include <sys/wait.h>
-#endif
-
 constexpr std::string_view symbol_filename = "mod_syms.bin";
 constexpr std::string_view binary_filename = "mod_binary.bin";
 constexpr std::string_view manifest_filename = "mod.json";
@@ -503,7 +499,7 @@ toml::array string_vector_to_toml(const std::vector<std::string>& input) {
     return ret;
 }
 
-void write_manifest(const std::filesystem::path& path, const ModManifest& manifest) {
+std::string write_manifest(const ModManifest& manifest) {
     toml::table output_data{};
 
     output_data.emplace("game_id", manifest.game_id);
@@ -555,9 +551,10 @@ void write_manifest(const std::filesystem::path& path, const ModManifest& manife
     }
 
     toml::json_formatter formatter{output_data, toml::format_flags::indentation | toml::format_flags::indentation};
-    std::ofstream output_file(path);
+    std::ostringstream output_stream{};
 
-    output_file << formatter << std::endl;
+    output_stream << formatter << std::endl;
+    return output_stream.str();
 }
 
 N64Recomp::Context build_mod_context(const N64Recomp::Context& input_context, bool& good) {
@@ -832,7 +829,7 @@ N64Recomp::Context build_mod_context(const N64Recomp::Context& input_context, bo
                         uint32_t reloc_target_address = section_vram + cur_reloc.target_section_offset;
                         uint32_t reloc_rom_address = cur_reloc.address - cur_section.ram_addr + cur_section.rom_addr;
                         
-                        uint32_t* reloc_word_ptr = reinterpret_cast<uint32_t*>(ret.rom.data() + reloc_rom_address);
+                        uint32_t* reloc_word_ptr = reinterpret_cast<uint32_t*>(ret.rom.mutable_data() + reloc_rom_address);
                         uint32_t reloc_word = byteswap(*reloc_word_ptr);
                         switch (cur_reloc.type) {
                             case N64Recomp::RelocType::R_MIPS_32:
@@ -1007,128 +1004,88 @@ N64Recomp::Context build_mod_context(const N64Recomp::Context& input_context, bo
     return ret;
 }
 
-bool create_mod_zip(const std::filesystem::path& output_dir, const ModConfig& config) {
+bool create_mod_zip(const std::filesystem::path& output_dir, const ModConfig& config, std::span<const uint8_t> symbols_bin, std::span<const uint8_t> binary, std::string_view manifest, size_t num_threads) {
     std::filesystem::path output_path = output_dir / (config.inputs.mod_filename + ".nrm");
 
-#ifdef _WIN32
-    std::filesystem::path temp_zip_path = output_path;
-    temp_zip_path.replace_extension(".zip");
-    std::string command_string = fmt::format("powershell -command Compress-Archive -Force -CompressionLevel Optimal -DestinationPath '{}' -Path '{}','{}','{}'",
-        temp_zip_path.string(), (output_dir / symbol_filename).string(), (output_dir / binary_filename).string(), (output_dir / manifest_filename).string());
+    std::vector<ZipEntry> entries{};
+    entries.emplace_back(ZipEntry{ std::string{ symbol_filename }, symbols_bin });
+    entries.emplace_back(ZipEntry{ std::string{ binary_filename }, binary });
+    entries.emplace_back(ZipEntry{ std::string{ manifest_filename }, std::span{ reinterpret_cast<const uint8_t*>(manifest.data()), manifest.size() } });
 
+    // Read every additional file into memory. Like the generated files, these are stored in the archive with just their filename.
+    std::vector<std::vector<uint8_t>> additional_file_data{};
+    additional_file_data.reserve(config.inputs.additional_files.size());
     for (const auto& cur_file : config.inputs.additional_files) {
-        command_string += fmt::format(",'{}'", cur_file.string());
-    }
-
-    STARTUPINFOA si{};
-    PROCESS_INFORMATION pi{};
-    
-    ZeroMemory( &si, sizeof(si) );
-    si.cb = sizeof(si);
-    ZeroMemory( &pi, sizeof(pi) );
-
-    std::vector<char> command_string_buffer;
-    command_string_buffer.resize(command_string.size() + 1);
-    std::copy(command_string.begin(), command_string.end(), command_string_buffer.begin());
-    command_string_buffer[command_string.size()] = '\x00';
-
-    if (!CreateProcessA(NULL, command_string_buffer.data(), NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
-        fmt::print(stderr, "Process creation failed {}\n", GetLastError());
-        return false;
-    }
-
-    WaitForSingleObject(pi.hProcess, INFINITE);
-
-    DWORD ec;
-    GetExitCodeProcess(pi.hProcess, &ec);
+        std::ifstream input_file{ cur_file, std::ios::binary };
+        if (!input_file.good()) {
+            fmt::print(stderr, "Failed to open additional file: {}\n", cur_file.string());
+            return false;
+        }
 
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
+        std::vector<uint8_t>& cur_data = additional_file_data.emplace_back();
+        input_file.seekg(0, std::ios::end);
+        cur_data.resize(input_file.tellg());
+        input_file.seekg(0, std::ios::beg);
+        input_file.read(reinterpret_cast<char*>(cur_data.data()), cur_data.size());
 
-    if (ec != EXIT_SUCCESS) {
-        fmt::print(stderr, "Compress-Archive failed with exit code {}\n", ec);
-        return false;
+        entries.emplace_back(ZipEntry{ cur_file.filename().string(), cur_data });
     }
 
-    std::error_code rename_ec;
-    std::filesystem::rename(temp_zip_path, output_path, rename_ec);
-    if (rename_ec != std::error_code{}) {
-        fmt::print(stderr, "Failed to rename temporary zip to output path\n");
+    if (!write_zip_file(output_path, entries, num_threads)) {
+        // Don't leave a partially written mod file behind.
+        std::error_code remove_ec;
+        std::filesystem::remove(output_path, remove_ec);
         return false;
     }
-#else
-    std::string args_string{};
-    std::vector<size_t> arg_positions{};
 
-    // Adds an argument with a null terminator to args_string, which is used as a buffer to hold null terminated arguments.
-    // Also adds the argument's offset into the string into arg_positions for creating the array of character pointers for the exec.
-    auto add_arg = [&args_string, &arg_positions](const std::string& arg){
-        arg_positions.emplace_back(args_string.size());
-        args_string += (arg + '\x00');
-    };
+    return true;
+}
 
-    add_arg("zip"); // The program name (argv[0]).
-    add_arg("-q"); // Quiet mode.
-    add_arg("-9"); // Maximum compression level.
-    add_arg("-MM"); // Error if any files aren't found.
-    add_arg("-j"); // Junk the paths (store just as the provided filename).
-    add_arg("-T"); // Test zip integrity.
-    add_arg(output_path.string());
-    add_arg((output_dir / symbol_filename).string());
-    add_arg((output_dir / binary_filename).string());
-    add_arg((output_dir / manifest_filename).string());
-
-    // Add arguments for every additional file in the archive.
-    for (const auto& cur_file : config.inputs.additional_files) {
-        add_arg(cur_file.string());
+// Writes the data to a file in the output folder. Returns false if the file couldn't be written.
+bool write_output_file(const std::filesystem::path& path, std::span<const char> data) {
+    std::ofstream output_file{ path, std::ios::binary };
+    output_file.write(data.data(), data.size());
+    if (!output_file.good()) {
+        fmt::print(stderr, "Failed to write file: {}\n", path.string());
+        return false;
     }
+    return true;
+}
 
-    // Build the argument char* array in a vector.
-    std::vector<char*> arg_pointers{};
-    for (size_t arg_index = 0; arg_index < arg_positions.size(); arg_index++) {
-        arg_pointers.emplace_back(args_string.data() + arg_positions[arg_index]);
+int main(int argc, const char** argv) {
+    if (argc < 3) {
+        fmt::print("Usage: {} [mod toml] [output folder] [--jobs <count>] [--nrm-only]\n", argv[0]);
+        return EXIT_SUCCESS;
     }
 
-    // Termimate the argument list with a null pointer.
-    arg_pointers.emplace_back(nullptr);
-
-    // Delete the output file if it exists already.
-    std::filesystem::remove(output_path);
-
-    // Fork-exec to run zip.
-    pid_t pid = fork();
-    if (pid == -1) {
-        fmt::print(stderr, "Failed to run \"zip\"\n");
-        return false;
-    }
-    else if (pid == 0) {
-        // This is the child process, so exec zip with the arguments.
-        if (execvp(arg_pointers[0], arg_pointers.data()) == -1) {
-            fmt::print(stderr, "Failed to run \"zip\" ({})\n", errno);
-            exit(-1);
+    // Number of threads to compress the mod file with. A job count of 0 means one job per hardware thread.
+    size_t num_jobs = 0;
+    // Whether to skip writing the symbol file, binary and manifest to the output folder next to the mod file.
+    bool nrm_only = false;
+    for (int i = 3; i < argc; i++) {
+        std::string_view cur_arg = argv[i];
+        if (cur_arg == "--nrm-only") {
+            nrm_only = true;
         }
-    }
-    else {
-        // This is the parent process, so wait for the child process to complete and check its exit code.
-        int status;
-        if (waitpid(pid, &status, 0) == (pid_t)-1) {
-            fmt::print(stderr, "Waiting for \"zip\" failed\n");
-            return false;
+        else if (cur_arg == "--jobs") {
+            if (i + 1 >= argc) {
+                fmt::print("Missing value for argument \"{}\"\n", cur_arg);
+                return EXIT_FAILURE;
+            }
+            std::string_view jobs_arg = argv[++i];
+            auto parse_result = std::from_chars(jobs_arg.data(), jobs_arg.data() + jobs_arg.size(), num_jobs);
+            if (parse_result.ec != std::errc{} || parse_result.ptr != jobs_arg.data() + jobs_arg.size()) {
+                fmt::print("Invalid job count \"{}\"\n", jobs_arg);
+                return EXIT_FAILURE;
+            }
         }
-        if (status != EXIT_SUCCESS) {
-            fmt::print(stderr, "\"zip\" failed with exit code {}\n", status);
-            return false;
+        else {
+            fmt::print("Unknown argument \"{}\"\n", cur_arg);
+            return EXIT_FAILURE;
         }
     }
-#endif
-
-    return true;
-}
-
-int main(int argc, const char** argv) {
-    if (argc != 3) {
-        fmt::print("Usage: {} [mod toml] [output folder]\n", argv[0]);
-        return EXIT_SUCCESS;
+    if (num_jobs == 0) {
+        num_jobs = std::max(1U, std::thread::hardware_concurrency());
     }
 
     bool config_good;
@@ -1219,27 +1176,23 @@ int main(int argc, const char** argv) {
         return EXIT_FAILURE;
     }
 
-    std::filesystem::path output_syms_path = output_dir / symbol_filename;
-    std::filesystem::path output_binary_path = output_dir / binary_filename;
-    std::filesystem::path output_manifest_path = output_dir / manifest_filename;
+    std::string manifest = write_manifest(config.manifest);
 
-    // Write the symbol file.
-    {
-       std::ofstream output_syms_file{ output_syms_path, std::ios::binary };
-       output_syms_file.write(reinterpret_cast<const char*>(symbols_bin.data()), symbols_bin.size());
-    }
-
-    // Write the binary file.
-    {
-       std::ofstream output_binary_file{ output_binary_path, std::ios::binary };
-       output_binary_file.write(reinterpret_cast<const char*>(mod_context.rom.data()), mod_context.rom.size());
+    // Write the symbol file, binary and manifest to the output folder as well, as they're the inputs for offline mod recompilation.
+    if (!nrm_only) {
+        auto as_chars = [](std::span<const uint8_t> data) {
+            return std::span<const char>{ reinterpret_cast<const char*>(data.data()), data.size() };
+        };
+        if (!write_output_file(output_dir / symbol_filename, as_chars(symbols_bin)) ||
+            !write_output_file(output_dir / binary_filename, as_chars(mod_context.rom)) ||
+            !write_output_file(output_dir / manifest_filename, manifest))
+        {
+            return EXIT_FAILURE;
+        }
     }
 
-    // Write the manifest.
-    write_manifest(output_manifest_path, config.manifest);
-
-    // Create the zip.
-    if (!create_mod_zip(output_dir, config)) {
+    // Create the mod file, with the symbol file, binary and manifest written into it directly from memory.
+    if (!create_mod_zip(output_dir, config, symbols_bin, mod_context.rom, manifest, num_jobs)) {
         fmt::print(stderr, "Failed to create mod file.\n");
         return EXIT_FAILURE;
     }
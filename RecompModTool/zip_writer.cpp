@@ -0,0 +1,699 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "fmt/format.h"
+#include "zip_writer.h"
+
+namespace {
+    // Deflate (RFC 1951) parameters.
+    constexpr size_t window_size = 32768;
+    constexpr size_t min_match = 3;
+    constexpr size_t max_match = 258;
+    // Matches at least this long are taken right away instead of checking whether the next position has a longer one.
+    constexpr size_t nice_match = 128;
+    constexpr size_t max_chain_length = 256;
+    constexpr uint32_t hash_bits = 15;
+    constexpr size_t block_token_count = 32768;
+    constexpr size_t max_stored_block_size = 65535;
+    constexpr size_t chunk_size = 128 * 1024;
+
+    constexpr size_t num_litlen_symbols = 286;
+    constexpr size_t num_dist_symbols = 30;
+    constexpr size_t num_code_length_symbols = 19;
+    constexpr uint16_t end_of_block = 256;
+
+    constexpr std::array<uint16_t, 29> length_base = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    constexpr std::array<uint8_t, 29> length_extra_bits = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    constexpr std::array<uint16_t, 30> dist_base = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+    constexpr std::array<uint8_t, 30> dist_extra_bits = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+    // The order that code length code lengths are written in.
+    constexpr std::array<uint8_t, num_code_length_symbols> code_length_order = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+
+    // A literal (dist of 0) or a match of the given length and distance.
+    struct Token {
+        uint16_t litlen;
+        uint16_t dist;
+    };
+
+    size_t length_code_index(size_t length) {
+        return std::upper_bound(length_base.begin(), length_base.end(), length) - length_base.begin() - 1;
+    }
+
+    size_t dist_code_index(size_t dist) {
+        return std::upper_bound(dist_base.begin(), dist_base.end(), dist) - dist_base.begin() - 1;
+    }
+
+    class BitWriter {
+    public:
+        BitWriter(std::vector<uint8_t>& output) : output(output) {}
+
+        void write(uint32_t bits, uint32_t count) {
+            bit_buffer |= static_cast<uint64_t>(bits) << bit_count;
+            bit_count += count;
+            while (bit_count >= 8) {
+                output.push_back(static_cast<uint8_t>(bit_buffer));
+                bit_buffer >>= 8;
+                bit_count -= 8;
+            }
+        }
+
+        void align() {
+            if (bit_count != 0) {
+                output.push_back(static_cast<uint8_t>(bit_buffer));
+                bit_buffer = 0;
+                bit_count = 0;
+            }
+        }
+
+        std::vector<uint8_t>& output;
+    private:
+        uint64_t bit_buffer = 0;
+        uint32_t bit_count = 0;
+    };
+
+    // Builds Huffman code lengths for the given symbol frequencies that are no longer than max_bits. If the code would be too long,
+    // the frequencies get flattened and the code is rebuilt until it fits. At least two symbols always get a code so the result
+    // is a complete prefix code, which every inflater accepts.
+    void build_code_lengths(std::span<const uint32_t> freqs, uint32_t max_bits, std::span<uint8_t> lengths) {
+        std::vector<uint32_t> cur_freqs(freqs.begin(), freqs.end());
+        size_t used_count = std::count_if(cur_freqs.begin(), cur_freqs.end(), [](uint32_t freq) { return freq != 0; });
+        for (size_t symbol = 0; used_count < 2 && symbol < cur_freqs.size(); symbol++) {
+            if (cur_freqs[symbol] == 0) {
+                cur_freqs[symbol] = 1;
+                used_count++;
+            }
+        }
+
+        struct Node {
+            uint32_t freq;
+            int32_t left;
+            int32_t right;
+        };
+        std::vector<Node> nodes{};
+        std::vector<uint32_t> depths{};
+
+        while (true) {
+            nodes.clear();
+            using QueueEntry = std::pair<uint32_t, int32_t>;
+            std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> queue{};
+            for (size_t symbol = 0; symbol < cur_freqs.size(); symbol++) {
+                if (cur_freqs[symbol] != 0) {
+                    queue.emplace(cur_freqs[symbol], static_cast<int32_t>(nodes.size()));
+                    nodes.push_back(Node{ cur_freqs[symbol], -1, static_cast<int32_t>(symbol) });
+                }
+            }
+
+            while (queue.size() > 1) {
+                QueueEntry a = queue.top();
+                queue.pop();
+                QueueEntry b = queue.top();
+                queue.pop();
+                queue.emplace(a.first + b.first, static_cast<int32_t>(nodes.size()));
+                nodes.push_back(Node{ a.first + b.first, a.second, b.second });
+            }
+
+            // Walk the tree from the root to find the depth of every leaf. Leaves have a left index of -1 and their symbol in right.
+            std::fill(lengths.begin(), lengths.end(), 0);
+            depths.assign(nodes.size(), 0);
+            uint32_t max_depth = 0;
+            for (int32_t node_index = static_cast<int32_t>(nodes.size()) - 1; node_index >= 0; node_index--) {
+                const Node& node = nodes[node_index];
+                if (node.left == -1) {
+                    lengths[node.right] = static_cast<uint8_t>(depths[node_index]);
+                    max_depth = std::max(max_depth, depths[node_index]);
+                }
+                else {
+                    depths[node.left] = depths[node_index] + 1;
+                    depths[node.right] = depths[node_index] + 1;
+                }
+            }
+
+            if (max_depth <= max_bits) {
+                return;
+            }
+
+            for (uint32_t& freq : cur_freqs) {
+                if (freq != 0) {
+                    freq = (freq + 1) / 2;
+                }
+            }
+        }
+    }
+
+    // Assigns canonical codes to the given code lengths, bit reversed so they can be written least significant bit first.
+    void build_codes(std::span<const uint8_t> lengths, std::span<uint16_t> codes) {
+        std::array<uint16_t, 16> length_counts{};
+        for (uint8_t length : lengths) {
+            length_counts[length]++;
+        }
+        length_counts[0] = 0;
+
+        std::array<uint16_t, 16> next_code{};
+        uint16_t code = 0;
+        for (size_t bits = 1; bits < next_code.size(); bits++) {
+            code = (code + length_counts[bits - 1]) << 1;
+            next_code[bits] = code;
+        }
+
+        for (size_t symbol = 0; symbol < lengths.size(); symbol++) {
+            uint8_t length = lengths[symbol];
+            if (length == 0) {
+                codes[symbol] = 0;
+                continue;
+            }
+            uint16_t cur_code = next_code[length]++;
+            uint16_t reversed = 0;
+            for (uint8_t bit = 0; bit < length; bit++) {
+                reversed = (reversed << 1) | ((cur_code >> bit) & 1);
+            }
+            codes[symbol] = reversed;
+        }
+    }
+
+    // Finds matches in data[start, end) using the preceding window as a dictionary.
+    class MatchFinder {
+    public:
+        MatchFinder(std::span<const uint8_t> data, size_t start, size_t end) : data(data), dict_start(start > window_size ? start - window_size : 0), end(end) {
+            head.assign(size_t{1} << hash_bits, -1);
+            prev.assign(end - dict_start, -1);
+            for (size_t pos = dict_start; pos < start; pos++) {
+                insert(pos);
+            }
+        }
+
+        void insert(size_t pos) {
+            if (pos + min_match > end) {
+                return;
+            }
+            uint32_t hash = hash_at(pos);
+            prev[pos - dict_start] = head[hash];
+            head[hash] = static_cast<int32_t>(pos);
+        }
+
+        // Returns the length of the longest match at pos (0 if there isn't one) and its distance. Must be called before inserting pos.
+        size_t find(size_t pos, size_t& dist_out) const {
+            if (pos + min_match > end) {
+                return 0;
+            }
+
+            size_t max_length = std::min(max_match, end - pos);
+            size_t best_length = min_match - 1;
+            int32_t candidate = head[hash_at(pos)];
+            for (size_t chain = 0; candidate >= 0 && chain < max_chain_length; chain++) {
+                size_t candidate_pos = static_cast<size_t>(candidate);
+                if (pos - candidate_pos > window_size) {
+                    break;
+                }
+
+                // Check the byte past the current best length first, since a candidate that misses it can't be any better.
+                if (data[candidate_pos + best_length] == data[pos + best_length]) {
+                    size_t length = 0;
+                    while (length < max_length && data[candidate_pos + length] == data[pos + length]) {
+                        length++;
+                    }
+                    if (length > best_length) {
+                        best_length = length;
+                        dist_out = pos - candidate_pos;
+                        if (length == max_length) {
+                            break;
+                        }
+                    }
+                }
+
+                candidate = prev[candidate_pos - dict_start];
+            }
+
+            return best_length >= min_match ? best_length : 0;
+        }
+    private:
+        uint32_t hash_at(size_t pos) const {
+            uint32_t value = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16);
+            return (value * 2654435761U) >> (32 - hash_bits);
+        }
+
+        std::span<const uint8_t> data;
+        size_t dict_start;
+        size_t end;
+        std::vector<int32_t> head;
+        std::vector<int32_t> prev;
+    };
+
+    // Writes the tokens for data[raw_start, raw_end) as one block, using whichever of a dynamic Huffman block or stored blocks is smaller.
+    void write_block(BitWriter& writer, std::span<const uint8_t> data, size_t raw_start, size_t raw_end, std::span<const Token> tokens, bool final) {
+        std::array<uint32_t, num_litlen_symbols> litlen_freqs{};
+        std::array<uint32_t, num_dist_symbols> dist_freqs{};
+        for (const Token& token : tokens) {
+            if (token.dist == 0) {
+                litlen_freqs[token.litlen]++;
+            }
+            else {
+                litlen_freqs[257 + length_code_index(token.litlen)]++;
+                dist_freqs[dist_code_index(token.dist)]++;
+            }
+        }
+        litlen_freqs[end_of_block]++;
+
+        std::array<uint8_t, num_litlen_symbols> litlen_lengths{};
+        std::array<uint8_t, num_dist_symbols> dist_lengths{};
+        build_code_lengths(litlen_freqs, 15, litlen_lengths);
+        build_code_lengths(dist_freqs, 15, dist_lengths);
+
+        size_t num_litlen = num_litlen_symbols;
+        while (num_litlen > 257 && litlen_lengths[num_litlen - 1] == 0) {
+            num_litlen--;
+        }
+        size_t num_dist = num_dist_symbols;
+        while (num_dist > 1 && dist_lengths[num_dist - 1] == 0) {
+            num_dist--;
+        }
+
+        // Run length encode the code lengths of both trees as one sequence. Each entry holds the symbol and its extra bits value.
+        std::vector<uint8_t> all_lengths{};
+        all_lengths.insert(all_lengths.end(), litlen_lengths.begin(), litlen_lengths.begin() + num_litlen);
+        all_lengths.insert(all_lengths.end(), dist_lengths.begin(), dist_lengths.begin() + num_dist);
+        std::vector<std::pair<uint8_t, uint8_t>> length_symbols{};
+        for (size_t i = 0; i < all_lengths.size();) {
+            uint8_t length = all_lengths[i];
+            size_t run = 1;
+            while (i + run < all_lengths.size() && all_lengths[i + run] == length) {
+                run++;
+            }
+
+            if (length == 0 && run >= 11) {
+                run = std::min<size_t>(run, 138);
+                length_symbols.emplace_back(18, static_cast<uint8_t>(run - 11));
+            }
+            else if (length == 0 && run >= 3) {
+                length_symbols.emplace_back(17, static_cast<uint8_t>(run - 3));
+            }
+            else if (length != 0 && run >= 4) {
+                // The first length is written as is and the rest are repeats of it.
+                run = std::min<size_t>(run, 7);
+                length_symbols.emplace_back(length, 0);
+                length_symbols.emplace_back(16, static_cast<uint8_t>(run - 4));
+            }
+            else {
+                run = 1;
+                length_symbols.emplace_back(length, 0);
+            }
+            i += run;
+        }
+
+        std::array<uint32_t, num_code_length_symbols> code_length_freqs{};
+        for (const auto& [symbol, extra] : length_symbols) {
+            code_length_freqs[symbol]++;
+        }
+        std::array<uint8_t, num_code_length_symbols> code_length_lengths{};
+        build_code_lengths(code_length_freqs, 7, code_length_lengths);
+
+        size_t num_code_lengths = num_code_length_symbols;
+        while (num_code_lengths > 4 && code_length_lengths[code_length_order[num_code_lengths - 1]] == 0) {
+            num_code_lengths--;
+        }
+
+        // Compare the size of the dynamic block against storing the data.
+        size_t dynamic_bits = 3 + 5 + 5 + 4 + 3 * num_code_lengths;
+        constexpr std::array<uint8_t, 3> repeat_extra_bits = { 2, 3, 7 };
+        for (const auto& [symbol, extra] : length_symbols) {
+            dynamic_bits += code_length_lengths[symbol] + (symbol >= 16 ? repeat_extra_bits[symbol - 16] : 0);
+        }
+        for (size_t symbol = 0; symbol < num_litlen_symbols; symbol++) {
+            dynamic_bits += static_cast<size_t>(litlen_freqs[symbol]) *
+                (litlen_lengths[symbol] + (symbol > end_of_block ? length_extra_bits[symbol - 257] : 0));
+        }
+        for (size_t symbol = 0; symbol < num_dist_symbols; symbol++) {
+            dynamic_bits += static_cast<size_t>(dist_freqs[symbol]) * (dist_lengths[symbol] + dist_extra_bits[symbol]);
+        }
+
+        size_t raw_size = raw_end - raw_start;
+        size_t num_stored_blocks = std::max<size_t>(1, (raw_size + max_stored_block_size - 1) / max_stored_block_size);
+        size_t stored_bits = raw_size * 8 + num_stored_blocks * (3 + 7 + 32);
+
+        if (stored_bits <= dynamic_bits) {
+            size_t offset = raw_start;
+            for (size_t block_index = 0; block_index < num_stored_blocks; block_index++) {
+                size_t cur_size = std::min(max_stored_block_size, raw_end - offset);
+                bool cur_final = final && block_index == num_stored_blocks - 1;
+                writer.write(cur_final ? 1 : 0, 1);
+                writer.write(0b00, 2);
+                writer.align();
+                writer.write(static_cast<uint32_t>(cur_size), 16);
+                writer.write(static_cast<uint32_t>(~cur_size & 0xFFFF), 16);
+                writer.output.insert(writer.output.end(), data.begin() + offset, data.begin() + offset + cur_size);
+                offset += cur_size;
+            }
+            return;
+        }
+
+        std::array<uint16_t, num_litlen_symbols> litlen_codes{};
+        std::array<uint16_t, num_dist_symbols> dist_codes{};
+        std::array<uint16_t, num_code_length_symbols> code_length_codes{};
+        build_codes(litlen_lengths, litlen_codes);
+        build_codes(dist_lengths, dist_codes);
+        build_codes(code_length_lengths, code_length_codes);
+
+        writer.write(final ? 1 : 0, 1);
+        writer.write(0b10, 2);
+        writer.write(static_cast<uint32_t>(num_litlen - 257), 5);
+        writer.write(static_cast<uint32_t>(num_dist - 1), 5);
+        writer.write(static_cast<uint32_t>(num_code_lengths - 4), 4);
+        for (size_t i = 0; i < num_code_lengths; i++) {
+            writer.write(code_length_lengths[code_length_order[i]], 3);
+        }
+        for (const auto& [symbol, extra] : length_symbols) {
+            writer.write(code_length_codes[symbol], code_length_lengths[symbol]);
+            if (symbol >= 16) {
+                writer.write(extra, repeat_extra_bits[symbol - 16]);
+            }
+        }
+
+        for (const Token& token : tokens) {
+            if (token.dist == 0) {
+                writer.write(litlen_codes[token.litlen], litlen_lengths[token.litlen]);
+            }
+            else {
+                size_t length_index = length_code_index(token.litlen);
+                size_t dist_index = dist_code_index(token.dist);
+                writer.write(litlen_codes[257 + length_index], litlen_lengths[257 + length_index]);
+                writer.write(token.litlen - length_base[length_index], length_extra_bits[length_index]);
+                writer.write(dist_codes[dist_index], dist_lengths[dist_index]);
+                writer.write(token.dist - dist_base[dist_index], dist_extra_bits[dist_index]);
+            }
+        }
+        writer.write(litlen_codes[end_of_block], litlen_lengths[end_of_block]);
+    }
+
+    // Compresses data[start, end) into a sequence of deflate blocks. The preceding window of data is used as a dictionary, which lets
+    // chunks of the same input be compressed independently and then concatenated. Chunks other than the final one end on a byte boundary
+    // with an empty stored block.
+    std::vector<uint8_t> deflate_chunk(std::span<const uint8_t> data, size_t start, size_t end, bool final) {
+        std::vector<uint8_t> output{};
+        output.reserve((end - start) / 2);
+        BitWriter writer{ output };
+        MatchFinder finder{ data, start, end };
+
+        std::vector<Token> tokens{};
+        tokens.reserve(block_token_count);
+        size_t block_start = start;
+
+        auto flush_block = [&](size_t block_end, bool final_block) {
+            write_block(writer, data, block_start, block_end, tokens, final_block);
+            tokens.clear();
+            block_start = block_end;
+        };
+
+        // Greedy matching with one step of lazy evaluation: a match is only taken if the next position doesn't start a longer one.
+        size_t pos = start;
+        size_t pending_length = 0;
+        size_t pending_dist = 0;
+        while (pos < end) {
+            size_t dist = 0;
+            size_t length = finder.find(pos, dist);
+            finder.insert(pos);
+
+            if (pending_length != 0) {
+                if (length > pending_length) {
+                    // The match at this position is better, so the previous position becomes a literal.
+                    tokens.push_back(Token{ data[pos - 1], 0 });
+                    pending_length = length;
+                    pending_dist = dist;
+                    pos++;
+                }
+                else {
+                    size_t match_start = pos - 1;
+                    tokens.push_back(Token{ static_cast<uint16_t>(pending_length), static_cast<uint16_t>(pending_dist) });
+                    for (size_t insert_pos = pos + 1; insert_pos < match_start + pending_length; insert_pos++) {
+                        finder.insert(insert_pos);
+                    }
+                    pos = match_start + pending_length;
+                    pending_length = 0;
+                }
+            }
+            else if (length >= nice_match) {
+                tokens.push_back(Token{ static_cast<uint16_t>(length), static_cast<uint16_t>(dist) });
+                for (size_t insert_pos = pos + 1; insert_pos < pos + length; insert_pos++) {
+                    finder.insert(insert_pos);
+                }
+                pos += length;
+            }
+            else if (length != 0) {
+                pending_length = length;
+                pending_dist = dist;
+                pos++;
+            }
+            else {
+                tokens.push_back(Token{ data[pos], 0 });
+                pos++;
+            }
+
+            // Only end a block between tokens, once any pending match has been resolved.
+            if (pending_length == 0 && tokens.size() >= block_token_count) {
+                flush_block(pos, false);
+            }
+        }
+
+        if (pending_length != 0) {
+            tokens.push_back(Token{ static_cast<uint16_t>(pending_length), static_cast<uint16_t>(pending_dist) });
+            pos = pos - 1 + pending_length;
+        }
+
+        flush_block(end, final);
+
+        if (!final) {
+            writer.write(0, 1);
+            writer.write(0b00, 2);
+            writer.align();
+            writer.write(0x0000, 16);
+            writer.write(0xFFFF, 16);
+        }
+        writer.align();
+
+        return output;
+    }
+
+    constexpr std::array<uint32_t, 256> make_crc32_table() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? (0xEDB88320U ^ (value >> 1)) : (value >> 1);
+            }
+            table[i] = value;
+        }
+        return table;
+    }
+
+    constexpr std::array<uint32_t, 256> crc32_table = make_crc32_table();
+
+    uint32_t crc32(std::span<const uint8_t> data) {
+        uint32_t crc = 0xFFFFFFFFU;
+        for (uint8_t byte : data) {
+            crc = crc32_table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void write_u16(std::vector<uint8_t>& output, uint16_t value) {
+        output.push_back(static_cast<uint8_t>(value));
+        output.push_back(static_cast<uint8_t>(value >> 8));
+    }
+
+    void write_u32(std::vector<uint8_t>& output, uint32_t value) {
+        write_u16(output, static_cast<uint16_t>(value));
+        write_u16(output, static_cast<uint16_t>(value >> 16));
+    }
+
+    // See APPNOTE.TXT from PKWARE for the zip format.
+    constexpr uint32_t local_header_signature = 0x04034B50;
+    constexpr uint32_t central_header_signature = 0x02014B50;
+    constexpr uint32_t end_of_central_directory_signature = 0x06054B50;
+    constexpr uint16_t zip_version = 20;
+    constexpr uint16_t method_stored = 0;
+    constexpr uint16_t method_deflate = 8;
+    constexpr uint16_t flag_utf8_name = 1 << 11;
+    // MS-DOS date for 1980-01-01, the earliest one that zip files can represent.
+    constexpr uint16_t fixed_dos_date = (0 << 9) | (1 << 5) | 1;
+    constexpr uint16_t fixed_dos_time = 0;
+
+    struct CompressedEntry {
+        uint32_t crc;
+        uint16_t method;
+        uint16_t flags;
+        uint32_t local_header_offset;
+        std::vector<std::vector<uint8_t>> chunks;
+        size_t compressed_size;
+    };
+
+    void write_entry_header(std::vector<uint8_t>& output, const ZipEntry& entry, const CompressedEntry& compressed, bool central) {
+        if (central) {
+            write_u32(output, central_header_signature);
+            write_u16(output, zip_version); // Version made by
+        }
+        else {
+            write_u32(output, local_header_signature);
+        }
+        write_u16(output, zip_version); // Version needed to extract
+        write_u16(output, compressed.flags);
+        write_u16(output, compressed.method);
+        write_u16(output, fixed_dos_time);
+        write_u16(output, fixed_dos_date);
+        write_u32(output, compressed.crc);
+        write_u32(output, static_cast<uint32_t>(compressed.compressed_size));
+        write_u32(output, static_cast<uint32_t>(entry.data.size()));
+        write_u16(output, static_cast<uint16_t>(entry.name.size()));
+        write_u16(output, 0); // Extra field length
+        if (central) {
+            write_u16(output, 0); // Comment length
+            write_u16(output, 0); // Disk number
+            write_u16(output, 0); // Internal attributes
+            write_u32(output, 0); // External attributes
+            write_u32(output, compressed.local_header_offset);
+        }
+        output.insert(output.end(), entry.name.begin(), entry.name.end());
+    }
+}
+
+bool write_zip_file(const std::filesystem::path& output_path, std::span<const ZipEntry> entries, size_t num_threads) {
+    // Zip64 isn't supported, so every size and offset has to fit in 32 bits.
+    size_t total_size = 0;
+    for (const ZipEntry& entry : entries) {
+        if (entry.name.size() > 0xFFFF) {
+            fmt::print(stderr, "Zip entry name too long: {}\n", entry.name);
+            return false;
+        }
+        total_size += entry.data.size();
+    }
+    if (total_size > 0xFFFFFFFFU || entries.size() > 0xFFFF) {
+        fmt::print(stderr, "Zip file contents are too large\n");
+        return false;
+    }
+
+    // Split every entry into chunks and compress them all in parallel.
+    struct ChunkTask {
+        size_t entry_index;
+        size_t chunk_index;
+        size_t start;
+        size_t end;
+        bool final;
+    };
+    std::vector<CompressedEntry> compressed_entries(entries.size());
+    std::vector<ChunkTask> tasks{};
+    for (size_t entry_index = 0; entry_index < entries.size(); entry_index++) {
+        size_t size = entries[entry_index].data.size();
+        size_t num_chunks = std::max<size_t>(1, (size + chunk_size - 1) / chunk_size);
+        compressed_entries[entry_index].chunks.resize(num_chunks);
+        for (size_t chunk_index = 0; chunk_index < num_chunks; chunk_index++) {
+            size_t start = chunk_index * chunk_size;
+            tasks.push_back(ChunkTask{ entry_index, chunk_index, start, std::min(start + chunk_size, size), chunk_index == num_chunks - 1 });
+        }
+    }
+
+    std::atomic<size_t> next_task = 0;
+    auto worker = [&]() {
+        while (true) {
+            size_t task_index = next_task.fetch_add(1, std::memory_order_relaxed);
+            if (task_index >= tasks.size()) {
+                break;
+            }
+            const ChunkTask& task = tasks[task_index];
+            compressed_entries[task.entry_index].chunks[task.chunk_index] = deflate_chunk(entries[task.entry_index].data, task.start, task.end, task.final);
+        }
+    };
+
+    // The calling thread acts as the first worker.
+    num_threads = std::min(std::max<size_t>(num_threads, 1), std::max<size_t>(tasks.size(), 1));
+    std::vector<std::thread> threads{};
+    threads.reserve(num_threads - 1);
+    for (size_t thread_index = 1; thread_index < num_threads; thread_index++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    std::ofstream output_file{ output_path, std::ios::binary };
+    if (!output_file.good()) {
+        fmt::print(stderr, "Failed to open zip file for writing: {}\n", output_path.string());
+        return false;
+    }
+
+    std::vector<uint8_t> header{};
+    size_t offset = 0;
+    for (size_t entry_index = 0; entry_index < entries.size(); entry_index++) {
+        const ZipEntry& entry = entries[entry_index];
+        CompressedEntry& compressed = compressed_entries[entry_index];
+
+        compressed.crc = crc32(entry.data);
+        compressed.flags = std::any_of(entry.name.begin(), entry.name.end(), [](char c) { return static_cast<uint8_t>(c) >= 0x80; }) ? flag_utf8_name : 0;
+        compressed.compressed_size = 0;
+        for (const auto& chunk : compressed.chunks) {
+            compressed.compressed_size += chunk.size();
+        }
+
+        // Store the entry instead if compressing it didn't help.
+        if (compressed.compressed_size >= entry.data.size()) {
+            compressed.method = method_stored;
+            compressed.compressed_size = entry.data.size();
+        }
+        else {
+            compressed.method = method_deflate;
+        }
+
+        if (offset > 0xFFFFFFFFU) {
+            fmt::print(stderr, "Zip file contents are too large\n");
+            return false;
+        }
+        compressed.local_header_offset = static_cast<uint32_t>(offset);
+
+        header.clear();
+        write_entry_header(header, entry, compressed, false);
+        output_file.write(reinterpret_cast<const char*>(header.data()), header.size());
+        if (compressed.method == method_stored) {
+            output_file.write(reinterpret_cast<const char*>(entry.data.data()), entry.data.size());
+        }
+        else {
+            for (const auto& chunk : compressed.chunks) {
+                output_file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+            }
+        }
+        offset += header.size() + compressed.compressed_size;
+    }
+
+    std::vector<uint8_t> central_directory{};
+    for (size_t entry_index = 0; entry_index < entries.size(); entry_index++) {
+        write_entry_header(central_directory, entries[entry_index], compressed_entries[entry_index], true);
+    }
+    size_t central_directory_size = central_directory.size();
+    if (offset + central_directory_size > 0xFFFFFFFFU) {
+        fmt::print(stderr, "Zip file contents are too large\n");
+        return false;
+    }
+
+    write_u32(central_directory, end_of_central_directory_signature);
+    write_u16(central_directory, 0); // Disk number
+    write_u16(central_directory, 0); // Disk with the central directory
+    write_u16(central_directory, static_cast<uint16_t>(entries.size()));
+    write_u16(central_directory, static_cast<uint16_t>(entries.size()));
+    write_u32(central_directory, static_cast<uint32_t>(central_directory_size));
+    write_u32(central_directory, static_cast<uint32_t>(offset));
+    write_u16(central_directory, 0); // Comment length
+    output_file.write(reinterpret_cast<const char*>(central_directory.data()), central_directory.size());
+
+    return output_file.good();
+}
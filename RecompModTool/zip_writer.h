@@ -0,0 +1,19 @@
+#ifndef __RECOMP_ZIP_WRITER_H__
+#define __RECOMP_ZIP_WRITER_H__
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+
+struct ZipEntry {
+    std::string name;
+    std::span<const uint8_t> data;
+};
+
+// Writes a zip archive containing the given entries straight to the output path without any intermediate files. Entries are compressed
+// with deflate in independent chunks of up to 128KB that get spread across the given number of threads, and are stored uncompressed
+// instead if compression doesn't make them any smaller. The archive is deterministic, as every entry gets the same fixed timestamp.
+bool write_zip_file(const std::filesystem::path& output_path, std::span<const ZipEntry> entries, size_t num_threads);
+
+#endif
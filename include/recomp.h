@@ -11,6 +11,8 @@
 #if defined(_MSC_VER) && !defined(__clang__) && !defined(__INTEL_COMPILER)
     // MSVC's __declspec(noinline) seems to disable inter-procedural optimization entirely, so it's all that's needed.
     #define RECOMP_FUNC __declspec(noinline)
+    // Static inline copies of small leaf functions that recompiled functions call directly, see the inline_leaf_functions option.
+    #define RECOMP_INLINE_FUNC static __inline
     
     // Use MSVC's fenv_access pragma.
     #define SET_FENV_ACCESS() _Pragma("fenv_access(on)")
@@ -20,6 +22,7 @@
     // Weak forces Clang to not perform any IPO as the symbol can be interposed, which prevents actual inlining due to the inline keyword.
     // Add noinline on for good measure, which doesn't conflict with the inline keyword as they have different meanings.
     #define RECOMP_FUNC extern inline __attribute__((weak,noinline))
+    #define RECOMP_INLINE_FUNC static inline
 
     // Use the standard STDC FENV_ACCESS pragma.
     #define SET_FENV_ACCESS() _Pragma("STDC FENV_ACCESS ON")
@@ -28,6 +31,8 @@
     // constant folding so that arithmetic respects the floating point environment. This is needed because gcc doesn't implement
     // any FENV_ACCESS pragma.
     #define RECOMP_FUNC __attribute__((noipa, optimize("rounding-math")))
+    // The copies need the same optimization attribute as the functions calling them, as gcc won't inline across mismatched attributes.
+    #define RECOMP_INLINE_FUNC static inline __attribute__((optimize("rounding-math")))
 
     // There's no FENV_ACCESS pragma in gcc, so this can be empty.
     #define SET_FENV_ACCESS()
@@ -447,8 +452,37 @@ typedef void (recomp_func_ext_t)(uint8_t* rdram, recomp_context* ctx, uintptr_t
 
 recomp_func_t* get_function(int32_t vram);
 
+// Dense table of a section's functions indexed by (vram - section vram) / 4, with null entries for addresses that don't start a function.
+// Emitted for every section when dispatch tables are enabled so that the runtime can copy them into its dispatch table when loading the section.
+typedef struct {
+    recomp_func_t** funcs;
+    size_t num_funcs;
+} SectionDispatchTable;
+
+#ifdef RECOMP_DISPATCH_TABLE
+// Dispatch table maintained by the runtime, indexed by (vram - recomp_dispatch_table_vram) / 4.
+// Null entries and addresses outside of the table fall back to get_function.
+extern recomp_func_t** recomp_dispatch_table;
+extern uint32_t recomp_dispatch_table_vram;
+extern uint32_t recomp_dispatch_table_count;
+
+static inline recomp_func_t* recomp_dispatch_lookup(int32_t vram) {
+    uint32_t offset = (uint32_t)vram - recomp_dispatch_table_vram;
+    if ((offset & 3) == 0 && (offset >> 2) < recomp_dispatch_table_count) {
+        recomp_func_t* func = recomp_dispatch_table[offset >> 2];
+        if (func != NULL) {
+            return func;
+        }
+    }
+    return get_function(vram);
+}
+
+#define LOOKUP_FUNC(val) \
+    recomp_dispatch_lookup((int32_t)(val))
+#else
 #define LOOKUP_FUNC(val) \
     get_function((int32_t)(val))
+#endif
 
 extern int32_t* section_addresses;
 
@@ -1,6 +1,7 @@
 #ifndef __RECOMP_PORT__
 #define __RECOMP_PORT__
 
+#include <algorithm>
 #include <span>
 #include <string_view>
 #include <cstdint>
@@ -10,6 +11,7 @@
 #include <unordered_set>
 #include <filesystem>
 #include <optional>
+#include <memory>
 
 #ifdef _MSC_VER
 inline uint32_t byteswap(uint32_t val) {
@@ -22,6 +24,67 @@ constexpr uint32_t byteswap(uint32_t val) {
 #endif
 
 namespace N64Recomp {
+    // Read-only ROM contents. Either owns its data or refers to memory owned by something else, such as a memory-mapped file.
+    // Copies share the same memory, which only gets copied if the contents are modified.
+    class RomBuffer {
+    public:
+        RomBuffer() = default;
+        RomBuffer(std::vector<uint8_t>&& data) { assign(std::move(data)); }
+        RomBuffer(std::shared_ptr<const void> owner, std::span<const uint8_t> contents) : external(std::move(owner)), contents(contents) {}
+        RomBuffer& operator=(std::vector<uint8_t>&& data) { assign(std::move(data)); return *this; }
+
+        const uint8_t* data() const { return contents.data(); }
+        size_t size() const { return contents.size(); }
+        bool empty() const { return contents.empty(); }
+        const uint8_t& operator[](size_t index) const { return contents[index]; }
+        std::span<const uint8_t>::iterator begin() const { return contents.begin(); }
+        std::span<const uint8_t>::iterator end() const { return contents.end(); }
+        std::span<const uint8_t> span() const { return contents; }
+        operator std::span<const uint8_t>() const { return contents; }
+        // Whether the contents refer to memory that isn't owned by this buffer.
+        bool is_external() const { return external != nullptr; }
+
+        // Returns a writable pointer to the contents, making a private copy of them first if they're shared.
+        uint8_t* mutable_data() {
+            make_unique();
+            return owned->data();
+        }
+        void resize(size_t new_size) {
+            make_unique();
+            owned->resize(new_size);
+            contents = *owned;
+        }
+        void reserve(size_t new_capacity) {
+            make_unique();
+            owned->reserve(new_capacity);
+            contents = *owned;
+        }
+        void append(std::span<const uint8_t> data) {
+            make_unique();
+            owned->insert(owned->end(), data.begin(), data.end());
+            contents = *owned;
+        }
+    private:
+        void assign(std::vector<uint8_t>&& data) {
+            owned = std::make_shared<std::vector<uint8_t>>(std::move(data));
+            external.reset();
+            contents = *owned;
+        }
+        void make_unique() {
+            if (owned == nullptr || owned.use_count() > 1) {
+                assign(std::vector<uint8_t>(contents.begin(), contents.end()));
+            }
+        }
+
+        std::shared_ptr<std::vector<uint8_t>> owned;
+        std::shared_ptr<const void> external;
+        std::span<const uint8_t> contents;
+    };
+
+    // Memory-maps the given file and creates a ROM buffer that refers to the mapping, which avoids reading the entire file up front.
+    // Returns false if the file couldn't be opened or mapped. An empty file results in an empty buffer, as with reading it.
+    bool map_file(const std::filesystem::path& path, RomBuffer& out);
+
     struct Function {
         uint32_t vram;
         uint32_t rom;
@@ -83,6 +146,8 @@ namespace N64Recomp {
     constexpr std::string_view ForcedPatchSectionName = ".recomp_force_patch";
     constexpr std::string_view ExportSectionName = ".recomp_export";
     constexpr std::string_view EventSectionName = ".recomp_event";
+    // Appended to the name of a function for its static inline copy, see Context::inlinable_functions.
+    constexpr std::string_view InlineFunctionSuffix = "_inlined";
     constexpr std::string_view ImportSectionPrefix = ".recomp_import.";
     constexpr std::string_view CallbackSectionPrefix = ".recomp_callback.";
     constexpr std::string_view HookSectionPrefix = ".recomp_hook.";
@@ -107,6 +172,75 @@ namespace N64Recomp {
         bool fixed_address = false; // Only used in mods, indicates that the section shouldn't be relocated or placed into mod memory.
         bool globally_loaded = false; // Only used in mods, indicates that the section's functions should be globally loaded. Does not actually load the section's contents into ram.
         std::optional<uint32_t> got_ram_addr = std::nullopt;
+
+        // Returns the index of the first reloc at or after the given address, or the number of relocs if there are none.
+        // Relocs are sorted by address, so this is a binary search instead of a scan from the start of the section.
+        size_t find_first_reloc(uint32_t vram) const {
+            auto find_it = std::lower_bound(relocs.begin(), relocs.end(), vram,
+                [](const Reloc& reloc, uint32_t vram) { return reloc.address < vram; });
+            return static_cast<size_t>(find_it - relocs.begin());
+        }
+    };
+
+    // Flat index of functions sorted by vram address, stored as parallel arrays. Looking up the functions at an address is a single
+    // binary search over contiguous memory instead of a hash lookup followed by a walk over a separately allocated vector.
+    // This is a snapshot, so it needs to be rebuilt after functions are added to a context.
+    class FunctionVramIndex {
+    public:
+        void build(const std::unordered_map<uint32_t, std::vector<size_t>>& functions_by_vram, const std::vector<Function>& functions) {
+            std::vector<std::pair<uint32_t, const std::vector<size_t>*>> sorted_vrams{};
+            sorted_vrams.reserve(functions_by_vram.size());
+            size_t num_entries = 0;
+            for (const auto& [vram, func_indices] : functions_by_vram) {
+                sorted_vrams.emplace_back(vram, &func_indices);
+                num_entries += func_indices.size();
+            }
+            std::sort(sorted_vrams.begin(), sorted_vrams.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+            vrams.clear();
+            section_indices.clear();
+            function_indices.clear();
+            vrams.reserve(num_entries);
+            section_indices.reserve(num_entries);
+            function_indices.reserve(num_entries);
+            // Functions that share an address keep the order they have in functions_by_vram.
+            for (const auto& [vram, func_indices] : sorted_vrams) {
+                for (size_t func_index : *func_indices) {
+                    vrams.push_back(vram);
+                    section_indices.push_back(functions[func_index].section_index);
+                    function_indices.push_back(func_index);
+                }
+            }
+            built = true;
+        }
+
+        bool is_built() const { return built; }
+
+        // Returns the indices of every function at the given vram address.
+        std::span<const size_t> find(uint32_t vram) const {
+            auto start_it = std::lower_bound(vrams.begin(), vrams.end(), vram);
+            auto end_it = start_it;
+            while (end_it != vrams.end() && *end_it == vram) {
+                ++end_it;
+            }
+            return { function_indices.data() + (start_it - vrams.begin()), static_cast<size_t>(end_it - start_it) };
+        }
+
+        // Returns the index of the function at the given vram address in the given section, or (size_t)-1 if there isn't one.
+        size_t find_in_section(uint32_t vram, uint16_t section_index) const {
+            auto find_it = std::lower_bound(vrams.begin(), vrams.end(), vram);
+            for (size_t entry = find_it - vrams.begin(); entry < vrams.size() && vrams[entry] == vram; entry++) {
+                if (section_indices[entry] == section_index) {
+                    return function_indices[entry];
+                }
+            }
+            return (size_t)-1;
+        }
+    private:
+        std::vector<uint32_t> vrams;
+        std::vector<uint16_t> section_indices;
+        std::vector<size_t> function_indices;
+        bool built = false;
     };
 
     struct ReferenceSection {
@@ -226,11 +360,13 @@ namespace N64Recomp {
         std::vector<std::vector<size_t>> section_functions;
         // A mapping of vram address to every function with that address.
         std::unordered_map<uint32_t, std::vector<size_t>> functions_by_vram;
+        // Sorted copy of functions_by_vram, used for lookups once it's been built with build_function_vram_index.
+        FunctionVramIndex function_vram_index;
         // A mapping of bss section index to the corresponding non-bss section index.
         std::unordered_map<uint16_t, uint16_t> bss_section_to_section;
-        // The target ROM being recompiled, TODO move this outside of the context to avoid making a copy for mod contexts.
+        // The target ROM being recompiled. Copying a context shares the ROM's memory instead of copying it.
         // Used for reading relocations and for the output binary feature.
-        std::vector<uint8_t> rom;
+        RomBuffer rom;
         // Whether reference symbols should be validated when emitting function calls during recompilation.
         bool skip_validating_reference_symbols = true;
         // Whether all function calls (excluding reference symbols) should go through lookup.
@@ -270,13 +406,31 @@ namespace N64Recomp {
 
         // Causes functions to print their name to the console the first time they're called.
         bool trace_mode;
+        // Emits a call counter increment at the start of every function and a cycle sample at every return, using the function's index
+        // as its counter slot. See recomp_profile.h in the output for the C generator and LiveGeneratorInputs::profile_counters for the live generator.
+        bool profile_mode = false;
+        // Runs an optimization pass on each function before generating code for it, see optimization.h.
+        bool optimize_codegen = false;
+        // Emits every FR mode and NaN check on float operands. When this isn't set, checks that an earlier instruction in the same basic
+        // block already performed are omitted, see FunctionStats::fpu_checks.
+        bool strict_fpu_checks = false;
+        // Loads the address of each section that a function's relocations refer to into a local once at the start of the function and again
+        // after every call, instead of reading section_addresses at every relocated instruction. Only used by the C generator.
+        bool hoist_section_addresses = false;
+        // Whether each function has a static inline copy that the C generator calls instead of the function itself, indexed by function index.
+        // Empty if inlining isn't enabled. See find_inlinable_functions.
+        std::vector<uint8_t> inlinable_functions;
 
         // Imports sections and function symbols from a provided context into this context's reference sections and reference functions.
         bool import_reference_context(const Context& reference_context);
         // Reads a data symbol file and adds its contents into this context's reference data symbols.
         bool read_data_reference_syms(const std::filesystem::path& data_syms_file_path);
 
-        static bool from_symbol_file(const std::filesystem::path& symbol_file_path, std::vector<uint8_t>&& rom, Context& out, bool with_relocs);
+        bool is_function_inlinable(size_t func_index) const {
+            return func_index < inlinable_functions.size() && inlinable_functions[func_index] != 0;
+        }
+
+        static bool from_symbol_file(const std::filesystem::path& symbol_file_path, RomBuffer&& rom, Context& out, bool with_relocs);
         static bool from_elf_file(const std::filesystem::path& elf_file_path, Context& out, const ElfParsingConfig& flags, bool for_dumping_context, DataSymbolMap& data_syms_out, bool& found_entrypoint_out);
 
         Context() = default;
@@ -335,7 +489,29 @@ namespace N64Recomp {
             return true;
         }
 
+        // Builds the flat vram index from functions_by_vram. Must be called again if functions_by_vram is modified afterwards.
+        void build_function_vram_index() {
+            function_vram_index.build(functions_by_vram, functions);
+        }
+
+        // Returns the indices of every function at the given vram address.
+        std::span<const size_t> get_functions_at_vram(uint32_t vram) const {
+            if (function_vram_index.is_built()) {
+                return function_vram_index.find(vram);
+            }
+
+            auto find_it = functions_by_vram.find(vram);
+            if (find_it == functions_by_vram.end()) {
+                return {};
+            }
+            return find_it->second;
+        }
+
         size_t find_function_by_vram_section(uint32_t vram, size_t section_index) const {
+            if (function_vram_index.is_built()) {
+                return function_vram_index.find_in_section(vram, static_cast<uint16_t>(section_index));
+            }
+
             auto find_it = functions_by_vram.find(vram);
             if (find_it == functions_by_vram.end()) {
                 return (size_t)-1;
@@ -590,8 +766,15 @@ namespace N64Recomp {
     };
 
     class Generator;
-    bool recompile_function(const Context& context, size_t function_index, std::ostream& output_file, std::span<std::vector<uint32_t>> static_funcs, bool tag_reference_relocs);
+    // If jump_tables_out is provided, it receives the jump tables that were found while analyzing the function.
+    bool recompile_function(const Context& context, size_t function_index, std::ostream& output_file, std::span<std::vector<uint32_t>> static_funcs, bool tag_reference_relocs, std::vector<JumpTable>* jump_tables_out = nullptr);
     bool recompile_function_custom(Generator& generator, const Context& context, size_t function_index, std::ostream& output_file, std::span<std::vector<uint32_t>> static_funcs_out, bool tag_reference_relocs);
+    // Builds the call graph of the context's functions and marks the leaf functions that are called directly and have at most the given number
+    // of instructions as inlinable. Functions that can be replaced or hooked at runtime through the context are never marked, and neither are
+    // stubbed, ignored or reimplemented functions, ones with function hooks and ones in the special patch, export and event sections.
+    // The functions in excluded_funcs are never marked either. Calls to an inlined function won't go through any replacement that a mod registers
+    // for it at runtime, so those have to include every function that mods need to be able to replace.
+    void find_inlinable_functions(Context& context, size_t max_instructions, std::span<const size_t> excluded_funcs);
 
     enum class ModSymbolsError {
         Good,
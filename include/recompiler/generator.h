@@ -1,6 +1,8 @@
 #ifndef __GENERATOR_H__
 #define __GENERATOR_H__
 
+#include "fmt/format.h"
+
 #include "recompiler/context.h"
 #include "operations.h"
 
@@ -23,6 +25,28 @@ namespace N64Recomp {
         RelocType reloc_type;
         uint32_t reloc_section_index;
         uint32_t reloc_target_section_offset;
+
+        // Whether this is a load or store that uses the same base register as the previous instruction, which was also a load or store.
+        bool reuse_base_address;
+    };
+
+    enum class LabelType : uint8_t {
+        // A branch target within the function.
+        Instruction,
+        // The end of a likely branch's delay slot.
+        LikelySkip,
+        // The return point of a linked branch.
+        LinkReturn,
+    };
+
+    // Identifies a label within the function being recompiled. Generators that need a name for the label can build it from these fields,
+    // while generators that don't can use the index to look the label up directly.
+    struct Label {
+        LabelType type;
+        // Index of the labeled instruction within the function for instruction labels, or the index of the branch for other label types.
+        uint32_t index;
+        // Address of the labeled instruction. Only used for instruction labels.
+        uint32_t vram;
     };
 
     class Generator {
@@ -32,6 +56,8 @@ namespace N64Recomp {
         virtual void process_store_op(const StoreOp& op, const InstructionContext& ctx) const = 0;
         virtual void emit_function_start(const std::string& function_name, size_t func_index) const = 0;
         virtual void emit_function_end() const = 0;
+        // Emits the profiling counter update at the start of a function when the context has profile_mode set.
+        virtual void emit_profile_entry(size_t func_index) const = 0;
         virtual void emit_function_call_lookup(uint32_t addr) const = 0;
         virtual void emit_function_call_by_register(int reg) const = 0;
         // target_section_offset can each be deduced from symbol_index if the full context is available,
@@ -39,13 +65,13 @@ namespace N64Recomp {
         virtual void emit_function_call_reference_symbol(const Context& context, uint16_t section_index, size_t symbol_index, uint32_t target_section_offset) const = 0;
         virtual void emit_function_call(const Context& context, size_t function_index) const = 0;
         virtual void emit_named_function_call(const std::string& function_name) const = 0;
-        virtual void emit_goto(const std::string& target) const = 0;
-        virtual void emit_label(const std::string& label_name) const = 0;
+        virtual void emit_goto(const Label& target) const = 0;
+        virtual void emit_label(const Label& label) const = 0;
         virtual void emit_jtbl_addend_declaration(const JumpTable& jtbl, int reg) const = 0;
         virtual void emit_branch_condition(const ConditionalBranchOp& op, const InstructionContext& ctx) const = 0;
         virtual void emit_branch_close() const = 0;
         virtual void emit_switch(const Context& recompiler_context, const JumpTable& jtbl, int reg) const = 0;
-        virtual void emit_case(int case_index, const std::string& target_label) const = 0;
+        virtual void emit_case(int case_index, const Label& target_label) const = 0;
         virtual void emit_switch_error(uint32_t instr_vram, uint32_t jtbl_vram) const = 0;
         virtual void emit_switch_close() const = 0;
         virtual void emit_return(const Context& context, size_t func_index) const = 0;
@@ -61,28 +87,38 @@ namespace N64Recomp {
         virtual void emit_pause_self() const = 0;
         virtual void emit_trigger_event(uint32_t event_index) const = 0;
         virtual void emit_comment(const std::string& comment) const = 0;
+        virtual void emit_load_constant(int reg, int32_t value) const = 0;
     };
 
     class CGenerator final : Generator {
     public:
-        CGenerator(std::ostream& output_file) : output_file(output_file) {};
+        CGenerator(std::ostream& output_file) : output_file(&output_file) {};
+        // Appends the output to the given buffer instead of writing it to a stream, which avoids the overhead of going through an ostream for every statement.
+        CGenerator(fmt::memory_buffer& output_buffer) : output_buffer(&output_buffer) {};
+        // Emits the function as its static inline copy instead, see Context::inlinable_functions.
+        CGenerator(fmt::memory_buffer& output_buffer, bool inline_copy) : output_buffer(&output_buffer), inline_copy(inline_copy) {};
+        // Also hoists section address loads if requested, see Context::hoist_section_addresses. This needs the output to be in a buffer,
+        // as the loads get inserted once the function is finished and the sections it uses are known.
+        CGenerator(fmt::memory_buffer& output_buffer, bool inline_copy, bool hoist_section_addresses) :
+            output_buffer(&output_buffer), inline_copy(inline_copy), hoist_section_addresses(hoist_section_addresses) {};
         void process_binary_op(const BinaryOp& op, const InstructionContext& ctx) const final;
         void process_unary_op(const UnaryOp& op, const InstructionContext& ctx) const final;
         void process_store_op(const StoreOp& op, const InstructionContext& ctx) const final;
         void emit_function_start(const std::string& function_name, size_t func_index) const final;
         void emit_function_end() const final;
+        void emit_profile_entry(size_t func_index) const final;
         void emit_function_call_lookup(uint32_t addr) const final;
         void emit_function_call_by_register(int reg) const final;
         void emit_function_call_reference_symbol(const Context& context, uint16_t section_index, size_t symbol_index, uint32_t target_section_offset) const final;
         void emit_function_call(const Context& context, size_t function_index) const final;
         void emit_named_function_call(const std::string& function_name) const final;
-        void emit_goto(const std::string& target) const final;
-        void emit_label(const std::string& label_name) const final;
+        void emit_goto(const Label& target) const final;
+        void emit_label(const Label& label) const final;
         void emit_jtbl_addend_declaration(const JumpTable& jtbl, int reg) const final;
         void emit_branch_condition(const ConditionalBranchOp& op, const InstructionContext& ctx) const final;
         void emit_branch_close() const final;
         void emit_switch(const Context& recompiler_context, const JumpTable& jtbl, int reg) const final;
-        void emit_case(int case_index, const std::string& target_label) const final;
+        void emit_case(int case_index, const Label& target_label) const final;
         void emit_switch_error(uint32_t instr_vram, uint32_t jtbl_vram) const final;
         void emit_switch_close() const final;
         void emit_return(const Context& context, size_t func_index) const final;
@@ -98,12 +134,31 @@ namespace N64Recomp {
         void emit_pause_self() const final;
         void emit_trigger_event(uint32_t event_index) const final;
         void emit_comment(const std::string& comment) const final;
+        void emit_load_constant(int reg, int32_t value) const final;
     private:
-        void get_operand_string(Operand operand, UnaryOpType operation, const InstructionContext& context, std::string& operand_string) const;
-        void get_binary_expr_string(BinaryOpType type, const BinaryOperands& operands, const InstructionContext& ctx, const std::string& output, std::string& expr_string) const;
-        void get_notation(BinaryOpType op_type, std::string& func_string, std::string& infix_string) const;
-        std::ostream& output_file;
+        template <typename... Ts>
+        void print(fmt::format_string<Ts...> fmt_str, Ts&&... args) const;
+        void get_operand_string(Operand operand, UnaryOpType operation, const InstructionContext& context, fmt::memory_buffer& operand_string) const;
+        void get_binary_expr_string(BinaryOpType type, const BinaryOperands& operands, const InstructionContext& ctx, std::string_view output, fmt::memory_buffer& expr_string) const;
+        void get_notation(BinaryOpType op_type, std::string_view& func_string, std::string_view& infix_string) const;
+        void append_reloc(const InstructionContext& context, fmt::memory_buffer& output) const;
+        // Marks the current position as being after a call, which is where the hoisted section addresses get reloaded.
+        void mark_after_call() const;
+        // Exactly one of these is set, depending on which constructor was used.
+        std::ostream* output_file = nullptr;
+        fmt::memory_buffer* output_buffer = nullptr;
+        bool inline_copy = false;
+        bool hoist_section_addresses = false;
+        // State of the current function for hoisting section addresses. The offsets are positions in the output buffer.
+        mutable size_t function_body_offset = 0;
+        mutable std::vector<uint32_t> hoisted_sections;
+        mutable std::vector<size_t> after_call_offsets;
     };
+
+    // Recompiles the function into C and appends the output to the given buffer.
+    bool recompile_function(const Context& context, size_t function_index, fmt::memory_buffer& output_buffer, std::span<std::vector<uint32_t>> static_funcs, bool tag_reference_relocs, std::vector<JumpTable>* jump_tables_out = nullptr);
+    // Recompiles an inlinable function into its static inline copy and appends the output to the given buffer.
+    bool recompile_function_inline_copy(const Context& context, size_t function_index, fmt::memory_buffer& output_buffer);
 }
 
 #endif
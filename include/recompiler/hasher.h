@@ -0,0 +1,55 @@
+#ifndef __RECOMP_HASHER_H__
+#define __RECOMP_HASHER_H__
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace N64Recomp {
+    // Simple streaming 64-bit hash. This is only used for cache keys and validating cached data, so it doesn't need to be cryptographically secure.
+    class Hasher {
+    public:
+        void add(uint64_t value) {
+            state = mix(state ^ value) + 0x9E3779B97F4A7C15ULL;
+        }
+
+        void add_bytes(const void* data, size_t size) {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+            add(size);
+            while (size >= sizeof(uint64_t)) {
+                uint64_t value;
+                memcpy(&value, bytes, sizeof(value));
+                add(value);
+                bytes += sizeof(uint64_t);
+                size -= sizeof(uint64_t);
+            }
+            if (size > 0) {
+                uint64_t value = 0;
+                memcpy(&value, bytes, size);
+                add(value);
+            }
+        }
+
+        void add_string(std::string_view str) {
+            add_bytes(str.data(), str.size());
+        }
+
+        uint64_t get() const {
+            return mix(state);
+        }
+    private:
+        // Finalizer from MurmurHash3.
+        static uint64_t mix(uint64_t x) {
+            x ^= x >> 33;
+            x *= 0xFF51AFD7ED558CCDULL;
+            x ^= x >> 33;
+            x *= 0xC4CEB9FE1A85EC53ULL;
+            x ^= x >> 33;
+            return x;
+        }
+
+        uint64_t state = 0x6E363452636F6D70ULL;
+    };
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __RECOMP_JSON_H__
+#define __RECOMP_JSON_H__
+
+#include <string>
+#include <string_view>
+
+#include "fmt/format.h"
+
+namespace N64Recomp {
+    // Escapes a string for use inside a quoted JSON string, including any control characters.
+    inline std::string escape_json_string(std::string_view str) {
+        std::string ret{};
+        ret.reserve(str.size());
+        for (char c : str) {
+            if (c == '"' || c == '\\') {
+                ret += '\\';
+                ret += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                ret += fmt::format("\\u{:04x}", static_cast<unsigned char>(c));
+            }
+            else {
+                ret += c;
+            }
+        }
+        return ret;
+    }
+}
+
+#endif
@@ -2,6 +2,10 @@
 #define __LIVE_RECOMPILER_H__
 
 #include <unordered_map>
+#include <functional>
+#include <span>
+#include <filesystem>
+#include <mutex>
 #include "recompiler/generator.h"
 #include "recomp.h"
 
@@ -9,6 +13,110 @@ struct sljit_compiler;
 
 namespace N64Recomp {
     struct LiveGeneratorContext;
+    struct LiveGeneratorInputs;
+    // What an absolute address in cacheable recompiled code refers to, which allows the code to be relocated when it's loaded in a later run.
+    enum class LiveAddressType : uint8_t {
+        // One of the callbacks in LiveGeneratorInputs. The index is a LiveInputCallback.
+        InputCallback,
+        // A helper function in the live recompiler itself. The index is the helper's index in the helper table.
+        RuntimeHelper,
+        // An entry in LiveGeneratorInputs::reference_section_addresses. The index is the section index.
+        ReferenceSectionAddress,
+        // An entry in LiveGeneratorInputs::local_section_addresses. The index is the section index.
+        LocalSectionAddress,
+        // One of the output's string literals. The index is the literal's index.
+        StringLiteral,
+        // One of the output's jump tables. The index is the jump table's index.
+        JumpTable,
+        // An entry in LiveGeneratorInputs::profile_counters. The index is the function index.
+        ProfileCounter,
+    };
+    enum class LiveInputCallback : uint8_t {
+        Cop0StatusWrite,
+        Cop0StatusRead,
+        SwitchError,
+        DoBreak,
+        GetFunction,
+        SyscallHandler,
+        PauseSelf,
+        TriggerEvent,
+        RunHook,
+    };
+    struct LiveAddressReloc {
+        LiveAddressType type;
+        // Whether this is a call, which gets patched as a rewritable jump instead of as a constant.
+        bool is_call;
+        uint32_t index;
+        // Address of the instruction to patch.
+        void* addr;
+    };
+    // Per call site cache of a function lookup by address. See LiveGeneratorInputs::lookup_cache_generation for info.
+    struct LiveLookupCacheEntry {
+        uint32_t vram;
+        uint32_t generation;
+        recomp_func_t* func;
+    };
+    // Per function profiling counter, see Context::profile_mode. Matches the layout of RecompProfileCounter in the C generator's recomp_profile.h.
+    struct LiveProfileCounter {
+        uint64_t calls;
+        uint64_t cycles;
+    };
+    // Memory usage of a LiveOutputArena, in bytes unless noted otherwise.
+    struct LiveOutputArenaStats {
+        // Executable memory allocated for code and how much of it is in use.
+        size_t code_reserved;
+        size_t code_used;
+        // Regular memory allocated for string literals, jump tables and lookup caches and how much of it is in use.
+        size_t data_reserved;
+        size_t data_used;
+        // Number of blocks of each kind of memory.
+        size_t num_code_blocks;
+        size_t num_data_blocks;
+    };
+    // Owns the memory of every output that was generated or loaded with it. Instead of each output allocating its own memory, their code is packed
+    // into shared blocks of executable memory and their string literals, jump tables and lookup caches are packed into shared blocks of regular memory.
+    // Everything is freed at once when the arena is reset or destroyed, which allows unloading all of the code recompiled for a mod together.
+    // Outputs that use an arena must not be used after it has been reset. Allocation is thread safe, so an arena can be used for a batch compilation.
+    class LiveOutputArena {
+    public:
+        // Size of each block unless an allocation needs a larger one. A block size of zero gives every allocation its own block.
+        // Code is only packed with sljit's default executable allocator, with other allocators every output's code gets its own block.
+        explicit LiveOutputArena(size_t block_size = default_block_size);
+        ~LiveOutputArena();
+        // Prevent moving or copying, as outputs refer to the arena that owns their memory.
+        LiveOutputArena(const LiveOutputArena& rhs) = delete;
+        LiveOutputArena(LiveOutputArena&& rhs) = delete;
+        LiveOutputArena& operator=(const LiveOutputArena& rhs) = delete;
+        LiveOutputArena& operator=(LiveOutputArena&& rhs) = delete;
+
+        // Frees all of the memory owned by the arena and returns unused executable memory to the system.
+        void reset();
+        LiveOutputArenaStats get_stats() const;
+        // Allocates executable memory, for use by sljit when generating code.
+        void* allocate_code(size_t size);
+        // Allocates zeroed memory for data referenced by recompiled code.
+        void* allocate_data(size_t size, size_t alignment);
+        template <typename T>
+        T* allocate_data_array(size_t count) {
+            return static_cast<T*>(allocate_data(sizeof(T) * count, alignof(T)));
+        }
+
+        static constexpr size_t default_block_size = 256 * 1024;
+    private:
+        struct Block {
+            void* memory;
+            size_t size;
+            size_t used;
+        };
+        // Allocates from the last block in the list, or from a new block if the last one doesn't have enough space left.
+        static void* allocate_from_blocks(std::vector<Block>& blocks, size_t block_size, size_t size, size_t alignment, void* (*allocate_block)(size_t size));
+        size_t block_size;
+        // Whether code can be packed into blocks, which depends on sljit's executable allocator.
+        bool pack_code;
+        std::vector<Block> code_blocks;
+        std::vector<Block> data_blocks;
+        mutable std::mutex mutex;
+    };
     struct ReferenceJumpDetails {
         uint16_t section;
         uint32_t section_offset;
@@ -22,37 +130,54 @@ namespace N64Recomp {
             good = rhs.good;
             string_literals = std::move(rhs.string_literals);
             jump_tables = std::move(rhs.jump_tables);
+            lookup_caches = std::move(rhs.lookup_caches);
             code = rhs.code;
             code_size = rhs.code_size;
+            arena = rhs.arena;
+            owned_arena = std::move(rhs.owned_arena);
             functions = std::move(rhs.functions);
             reference_symbol_jumps = std::move(rhs.reference_symbol_jumps);
             import_jumps_by_index = std::move(rhs.import_jumps_by_index);
+            inner_call_jumps = std::move(rhs.inner_call_jumps);
+            jump_table_sizes = std::move(rhs.jump_table_sizes);
+            address_relocs = std::move(rhs.address_relocs);
+            cacheable = rhs.cacheable;
             executable_offset = rhs.executable_offset;
 
             rhs.good = false;
             rhs.code = nullptr;
             rhs.code_size = 0;
+            rhs.arena = nullptr;
             rhs.reference_symbol_jumps.clear();
+            rhs.inner_call_jumps.clear();
+            rhs.address_relocs.clear();
+            rhs.cacheable = false;
             rhs.executable_offset = 0;
 
             return *this;
         }
-        ~LiveGeneratorOutput();
         size_t num_reference_symbol_jumps() const;
         void set_reference_symbol_jump(size_t jump_index, recomp_func_t* func);
         ReferenceJumpDetails get_reference_symbol_jump_details(size_t jump_index);
         void populate_import_symbol_jumps(size_t import_index, recomp_func_t* func);
+        // Populates the calls to functions that were recompiled by a different generator, using the given list of function pointers indexed by function index.
+        // Returns false if any of the called functions is missing from the list.
+        bool populate_inner_call_jumps(std::span<recomp_func_t* const> all_functions);
         bool good = false;
-        // Storage for string literals referenced by recompiled code. These are allocated as unique_ptr arrays
-        // to prevent them from moving, as the referenced address is baked into the recompiled code.
-        std::vector<std::unique_ptr<char[]>> string_literals;
-        // Storage for jump tables referenced by recompiled code (vector of arrays of pointers). These are also
-        // allocated as unique_ptr arrays for the same reason as strings.
-        std::vector<std::unique_ptr<void*[]>> jump_tables;
+        // String literals referenced by recompiled code. These are allocated from the output's arena to prevent them
+        // from moving, as the referenced address is baked into the recompiled code.
+        std::vector<char*> string_literals;
+        // Jump tables referenced by recompiled code (vector of arrays of pointers). These are also allocated from
+        // the output's arena for the same reason as strings.
+        std::vector<void**> jump_tables;
+        // Function lookup caches referenced by recompiled code, allocated in blocks from the output's arena for the same reason as strings.
+        std::vector<LiveLookupCacheEntry*> lookup_caches;
         // Recompiled code.
         void* code;
         // Size of the recompiled code.
         size_t code_size;
+        // The arena that owns the output's memory, which is either the one from LiveGeneratorInputs::arena or the output's own.
+        LiveOutputArena* arena = nullptr;
         // Pointers to each individual function within the recompiled code.
         std::vector<recomp_func_t*> functions;
     private:
@@ -61,10 +186,23 @@ namespace N64Recomp {
         std::vector<std::pair<ReferenceJumpDetails, void*>> reference_symbol_jumps;
         // Mapping of import symbol index to any jumps to that import symbol.
         std::unordered_multimap<size_t, void*> import_jumps_by_index;
+        // List of calls to functions that were recompiled by a different generator, as the target function index and the corresponding jump instruction address.
+        std::vector<std::pair<size_t, void*>> inner_call_jumps;
+        // Number of entries in each jump table.
+        std::vector<size_t> jump_table_sizes;
+        // Every absolute address in the recompiled code. Only populated for cacheable outputs.
+        std::vector<LiveAddressReloc> address_relocs;
+        // Whether the output was generated with LiveGeneratorInputs::cacheable_output set.
+        bool cacheable;
         // sljit executable offset.
         int64_t executable_offset;
+        // Arena for outputs that were generated or loaded without one in the inputs, which keeps every allocation separate.
+        std::unique_ptr<LiveOutputArena> owned_arena;
 
         friend class LiveGenerator;
+        friend bool save_live_output(const LiveGeneratorOutput& output, uint64_t key, const std::filesystem::path& path);
+        friend bool load_live_output(const std::filesystem::path& path, uint64_t key, const LiveGeneratorInputs& inputs, LiveGeneratorOutput& output_out);
+        friend class LiveLazyOutput;
     };
     struct LiveGeneratorInputs {
         uint32_t base_event_index;
@@ -86,10 +224,29 @@ namespace N64Recomp {
         // Maps section index in the generated code to original section index. Used by regenerated
         // code to relocate using the corresponding original section's address.
         std::vector<size_t> original_section_indices;
+        // Counter that the runtime increments whenever the result of get_function may change for an address that was already looked up,
+        // such as when a section is loaded or unloaded. If provided, every call by address caches the result of its lookup and only calls
+        // get_function again if the address or this counter changed. Not used for cacheable outputs.
+        const uint32_t* lookup_cache_generation = nullptr;
+        // Emits every absolute address in the recompiled code as a patchable value and records it, which allows the output to be
+        // saved with save_live_output and loaded in a later run. This makes calls to the callbacks above slightly slower.
+        bool cacheable_output = false;
+        // Counters that functions update when the context has profile_mode set, indexed by function index. Must have an entry for every
+        // function in the context. Counters are updated without any synchronization, so threads that run recompiled code at the same time
+        // may lose some counts.
+        LiveProfileCounter* profile_counters = nullptr;
+        // Also samples the host's cycle counter at the start of every function and at every return when profiling, which adds the elapsed
+        // cycles to the function's counter. Cycles spent in callees are included.
+        bool profile_cycles = false;
+        // Arena to allocate the output's memory from, which must outlive the output. Each output owns its own memory if this isn't provided.
+        LiveOutputArena* arena = nullptr;
     };
     class LiveGenerator final : public Generator {
     public:
         LiveGenerator(size_t num_funcs, const LiveGeneratorInputs& inputs);
+        // Creates a generator for a single compilation unit of a context. Calls to functions outside of the unit are emitted as jumps
+        // that get populated afterwards with LiveGeneratorOutput::populate_inner_call_jumps.
+        LiveGenerator(size_t num_funcs, const LiveGeneratorInputs& inputs, std::span<const size_t> unit_functions);
         ~LiveGenerator();
         // Prevent moving or copying.
         LiveGenerator(const LiveGenerator& rhs) = delete;
@@ -103,18 +260,19 @@ namespace N64Recomp {
         void process_store_op(const StoreOp& op, const InstructionContext& ctx) const final;
         void emit_function_start(const std::string& function_name, size_t func_index) const final;
         void emit_function_end() const final;
+        void emit_profile_entry(size_t func_index) const final;
         void emit_function_call_lookup(uint32_t addr) const final;
         void emit_function_call_by_register(int reg) const final;
         void emit_function_call_reference_symbol(const Context& context, uint16_t section_index, size_t symbol_index, uint32_t target_section_offset) const final;
         void emit_function_call(const Context& context, size_t function_index) const final;
         void emit_named_function_call(const std::string& function_name) const final;
-        void emit_goto(const std::string& target) const final;
-        void emit_label(const std::string& label_name) const final;
+        void emit_goto(const Label& target) const final;
+        void emit_label(const Label& label) const final;
         void emit_jtbl_addend_declaration(const JumpTable& jtbl, int reg) const final;
         void emit_branch_condition(const ConditionalBranchOp& op, const InstructionContext& ctx) const final;
         void emit_branch_close() const final;
         void emit_switch(const Context& recompiler_context, const JumpTable& jtbl, int reg) const final;
-        void emit_case(int case_index, const std::string& target_label) const final;
+        void emit_case(int case_index, const Label& target_label) const final;
         void emit_switch_error(uint32_t instr_vram, uint32_t jtbl_vram) const final;
         void emit_switch_close() const final;
         void emit_return(const Context& context, size_t func_index) const final;
@@ -130,20 +288,128 @@ namespace N64Recomp {
         void emit_pause_self() const final;
         void emit_trigger_event(uint32_t event_index) const final;
         void emit_comment(const std::string& comment) const final;
+        void emit_load_constant(int reg, int32_t value) const final;
     private:
         void get_operand_string(Operand operand, UnaryOpType operation, const InstructionContext& context, std::string& operand_string) const;
         void get_binary_expr_string(BinaryOpType type, const BinaryOperands& operands, const InstructionContext& ctx, const std::string& output, std::string& expr_string) const;
         void get_notation(BinaryOpType op_type, std::string& func_string, std::string& infix_string) const;
         // Loads the relocated address specified by the instruction context into the target register.
         void load_relocated_address(const InstructionContext& ctx, int reg) const;
+        // Emits a call to the function at the given address. The type and index describe the function for cacheable outputs.
+        void emit_absolute_call(int32_t arg_types, LiveAddressType type, uint32_t index, uintptr_t func) const;
+        // Emits a call to one of the callbacks provided in the inputs.
+        void emit_callback_call(int32_t arg_types, LiveInputCallback callback) const;
+        // Emits a call to one of the live recompiler's helper functions.
+        void emit_helper_call(int32_t arg_types, uintptr_t func) const;
+        // Emits a load of the given address into the target register. The type and index describe the address for cacheable outputs.
+        void emit_absolute_address(int reg, LiveAddressType type, uint32_t index, uintptr_t address) const;
+        // Emits a lookup of the function at the vram in the given operand and places the result in R3.
+        void emit_function_lookup(int32_t vram_src, intptr_t vram_srcw) const;
         sljit_compiler* compiler;
         LiveGeneratorInputs inputs;
         mutable std::unique_ptr<LiveGeneratorContext> context;
         mutable bool errored;
     };
 
+    // Output of a batch compilation, made up of one LiveGeneratorOutput per compilation unit. Reference symbol jumps are indexed
+    // across all of the units so that they can be populated the same way as a single output's.
+    struct LiveGeneratorBatchOutput {
+        size_t num_reference_symbol_jumps() const;
+        void set_reference_symbol_jump(size_t jump_index, recomp_func_t* func);
+        ReferenceJumpDetails get_reference_symbol_jump_details(size_t jump_index);
+        void populate_import_symbol_jumps(size_t import_index, recomp_func_t* func);
+        bool good = false;
+        // Outputs for each compilation unit, which own the recompiled code.
+        std::vector<LiveGeneratorOutput> unit_outputs;
+        // Pointers to each individual function within the recompiled code, indexed by function index.
+        std::vector<recomp_func_t*> functions;
+    private:
+        // Index of the first reference symbol jump of each unit, followed by the total number of reference symbol jumps.
+        std::vector<size_t> unit_reference_symbol_jump_starts;
+
+        friend LiveGeneratorBatchOutput recompile_functions_live_batch(const Context& context, const LiveGeneratorInputs& inputs, size_t num_threads, bool tag_reference_relocs);
+    };
+
+    // Sets up the global configuration that the live recompiler depends on. Only the first call does anything, so this is safe to call
+    // from multiple threads. recompile_functions_live_batch and LiveLazyOutput call it themselves.
     void live_recompiler_init();
     bool recompile_function_live(LiveGenerator& generator, const Context& context, size_t function_index, std::ostream& output_file, std::span<std::vector<uint32_t>> static_funcs_out, bool tag_reference_relocs);
+    // Recompiles all of the context's functions by splitting them into compilation units that are each compiled by their own generator
+    // on a separate thread. A thread count of 0 uses the number of hardware threads. Calls between units are populated before this returns.
+    LiveGeneratorBatchOutput recompile_functions_live_batch(const Context& context, const LiveGeneratorInputs& inputs, size_t num_threads, bool tag_reference_relocs);
+
+    // Recompiles a context's functions on demand instead of all up front. Each function starts out as a small stub that recompiles it the first
+    // time it gets called, after which the stub and any calls that went through it are patched to jump straight to the recompiled code. Every
+    // function is recompiled as its own compilation unit, so only the functions that actually run pay for code generation. The context and the
+    // arena in the inputs (if one is provided) must outlive the output. Functions are recompiled on whichever thread calls them first and a lock
+    // ensures each one is only recompiled once, but call sites get patched while other code may be running, so the recompiled code from a lazy
+    // output should only be run from one thread at a time. Calling a function that fails to recompile is a fatal error.
+    class LiveLazyOutput {
+    public:
+        LiveLazyOutput(const Context& context, const LiveGeneratorInputs& inputs, bool tag_reference_relocs);
+        ~LiveLazyOutput();
+        // Prevent moving or copying, as the stubs refer to the output.
+        LiveLazyOutput(const LiveLazyOutput& rhs) = delete;
+        LiveLazyOutput(LiveLazyOutput&& rhs) = delete;
+        LiveLazyOutput& operator=(const LiveLazyOutput& rhs) = delete;
+        LiveLazyOutput& operator=(LiveLazyOutput&& rhs) = delete;
+
+        // Sets the function used to resolve the reference symbol calls of each function as it gets recompiled. Must be set before any function
+        // that calls a reference symbol gets recompiled. Recompilation fails if this returns null, and this must not call back into the output.
+        void set_reference_symbol_resolver(std::function<recomp_func_t*(const ReferenceJumpDetails& details)> resolver);
+        // Populates the calls to the given import symbol in the functions that were already recompiled as well as in the ones that get recompiled later.
+        void populate_import_symbol_jumps(size_t import_index, recomp_func_t* func);
+        // Recompiles the function now if it hasn't been recompiled yet. Returns false if recompilation failed.
+        bool compile_function(size_t func_index);
+        size_t num_compiled_functions() const;
+        // Whether the stubs were generated successfully.
+        bool good = false;
+        // Entry points of each function, indexed by function index. These stay valid for the lifetime of the output.
+        std::vector<recomp_func_t*> functions;
+        // The arena that owns the stubs and the recompiled code, which is either the one from LiveGeneratorInputs::arena or the output's own.
+        LiveOutputArena* arena = nullptr;
+    private:
+        // The argument that each stub passes to compile_and_call.
+        struct StubArg {
+            LiveLazyOutput* output;
+            size_t func_index;
+        };
+        // Called by the stubs to recompile the function and then run it.
+        static void compile_and_call(uint8_t* rdram, recomp_context* ctx, uintptr_t arg);
+        // Same as compile_function, but requires the lock to be held.
+        bool compile_function_locked(size_t func_index);
+
+        const Context& context;
+        LiveGeneratorInputs inputs;
+        bool tag_reference_relocs;
+        // Arena for outputs that were created without one in the inputs.
+        std::unique_ptr<LiveOutputArena> owned_arena;
+        std::vector<StubArg> stub_args;
+        // Address of the rewritable tail call in each function's stub.
+        std::vector<void*> stub_jumps;
+        int64_t stub_executable_offset = 0;
+        // Recompiled code of each function, or null if it hasn't been recompiled yet.
+        std::vector<recomp_func_t*> compiled_functions;
+        // Outputs of each function that was recompiled, in the order they were recompiled.
+        std::vector<LiveGeneratorOutput> unit_outputs;
+        // Calls that go through the stub of each function that hasn't been recompiled yet, as the index of the unit output containing the call
+        // and the address of the jump instruction. These get patched to jump to the recompiled code once the function is recompiled.
+        std::vector<std::vector<std::pair<size_t, void*>>> stub_calls;
+        std::function<recomp_func_t*(const ReferenceJumpDetails& details)> reference_symbol_resolver;
+        std::unordered_map<size_t, recomp_func_t*> import_funcs;
+        size_t num_compiled = 0;
+        mutable std::mutex mutex;
+    };
+
+    // Calculates a key from everything that affects the output of recompiling the given context's functions with the given inputs,
+    // which is used to check that a saved output is still valid. The addresses in the inputs don't affect the key, as they're patched on load.
+    uint64_t get_live_output_key(const Context& context, const LiveGeneratorInputs& inputs);
+    // Saves the output to the given path along with the key. The output must be cacheable and its reference symbol,
+    // import and inner call jumps get saved with whatever targets they currently have, so they need to be populated again after loading.
+    bool save_live_output(const LiveGeneratorOutput& output, uint64_t key, const std::filesystem::path& path);
+    // Loads an output saved with save_live_output into executable memory and patches its addresses using the provided inputs.
+    // Returns false if the file doesn't exist, was saved with a different key or is invalid.
+    bool load_live_output(const std::filesystem::path& path, uint64_t key, const LiveGeneratorInputs& inputs, LiveGeneratorOutput& output_out);
 
     class ShimFunction {
     private:
@@ -5,6 +5,7 @@
 #include "fmt/format.h"
 
 #include "recompiler/context.h"
+#include "recompiler/operations.h"
 #include "analysis.h"
 
 extern "C" const char* RabbitizerRegister_getNameGpr(uint8_t regValue);
@@ -264,6 +265,179 @@ bool analyze_instruction(const rabbitizer::InstructionCpu& instr, const N64Recom
     return true;
 }
 
+// Returns the float register that an operand refers to, or -1 if the operand isn't a float register.
+int fpr_operand(const rabbitizer::InstructionCpu& instr, N64Recomp::Operand operand) {
+    using N64Recomp::Operand;
+    switch (operand) {
+        case Operand::Fd:
+        case Operand::FdDouble:
+        case Operand::FdU32L:
+        case Operand::FdU32H:
+        case Operand::FdU64:
+            return (int)instr.GetO32_fd();
+        case Operand::Fs:
+        case Operand::FsDouble:
+        case Operand::FsU32L:
+        case Operand::FsU32H:
+        case Operand::FsU64:
+            return (int)instr.GetO32_fs();
+        case Operand::Ft:
+        case Operand::FtDouble:
+        case Operand::FtU32L:
+        case Operand::FtU32H:
+        case Operand::FtU64:
+            return (int)instr.GetO32_ft();
+        default:
+            return -1;
+    }
+}
+
+bool is_double_operand(N64Recomp::Operand operand) {
+    return operand == N64Recomp::Operand::FdDouble || operand == N64Recomp::Operand::FsDouble || operand == N64Recomp::Operand::FtDouble;
+}
+
+// Mirrors the FR checks that process_instruction emits for an operand.
+void record_fr_check(N64Recomp::FpuCheckState& state, const rabbitizer::InstructionCpu& instr, N64Recomp::Operand operand) {
+    int reg = fpr_operand(instr, operand);
+    if (reg != -1 && (reg & 1) != 0) {
+        state.fr_checked = true;
+    }
+}
+
+// Mirrors the NaN checks that process_instruction emits for an operand, which are only done for float and double operands.
+void record_nan_check(N64Recomp::FpuCheckState& state, const rabbitizer::InstructionCpu& instr, N64Recomp::Operand operand) {
+    using N64Recomp::Operand;
+    switch (operand) {
+        case Operand::Fd:
+        case Operand::Fs:
+        case Operand::Ft:
+            state.nan_checked_float |= 1U << fpr_operand(instr, operand);
+            break;
+        case Operand::FdDouble:
+        case Operand::FsDouble:
+        case Operand::FtDouble:
+            state.nan_checked_double |= 1U << fpr_operand(instr, operand);
+            break;
+        default:
+            break;
+    }
+}
+
+void record_fpr_write(N64Recomp::FpuCheckState& state, const rabbitizer::InstructionCpu& instr, N64Recomp::Operand operand) {
+    int reg = fpr_operand(instr, operand);
+    if (reg != -1) {
+        // Writing either half of an even/odd register pair can change the value of a double in the pair when the FR bit isn't set.
+        uint32_t pair_mask = 3U << (reg & ~1);
+        state.nan_checked_float &= ~pair_mask;
+        state.nan_checked_double &= ~pair_mask;
+    }
+}
+
+// Determines which FPU checks each instruction can skip because an earlier instruction already performed them. The state is only carried
+// forward within a basic block, and is also cleared by anything that may change the FR bit or the float registers behind the function's back.
+void analyze_fpu_checks(const N64Recomp::Function& func, const std::vector<rabbitizer::InstructionCpu>& instructions, N64Recomp::FunctionStats& stats) {
+    std::vector<uint32_t> labels{};
+    for (const auto& instr : instructions) {
+        if (instr.isBranch() || instr.getUniqueId() == InstrId::cpu_j) {
+            labels.push_back((uint32_t)instr.getBranchVramGeneric());
+        }
+    }
+    for (const auto& jtbl : stats.jump_tables) {
+        labels.insert(labels.end(), jtbl.entries.begin(), jtbl.entries.end());
+    }
+    std::sort(labels.begin(), labels.end());
+
+    stats.fpu_checks.resize(instructions.size());
+    N64Recomp::FpuCheckState state{};
+    // Index of the first instruction that follows the delay slot of a block-ending branch, which starts a new block.
+    size_t block_end_index = (size_t)-1;
+
+    for (size_t instr_index = 0; instr_index < instructions.size(); instr_index++) {
+        const auto& instr = instructions[instr_index];
+        InstrId instr_id = instr.getUniqueId();
+
+        if (instr_index == block_end_index || std::binary_search(labels.begin(), labels.end(), instr.getVram()) || func.function_hooks.contains((int32_t)instr_index)) {
+            state = {};
+        }
+        stats.fpu_checks[instr_index] = state;
+
+        auto find_binary_it = N64Recomp::binary_ops.find(instr_id);
+        auto find_unary_it = N64Recomp::unary_ops.find(instr_id);
+        auto find_branch_it = N64Recomp::conditional_branch_ops.find(instr_id);
+        auto find_store_it = N64Recomp::store_ops.find(instr_id);
+
+        if (find_binary_it != N64Recomp::binary_ops.end()) {
+            const N64Recomp::BinaryOp& op = find_binary_it->second;
+            if (op.check_fr) {
+                record_fr_check(state, instr, op.output);
+                record_fr_check(state, instr, op.operands.operands[0]);
+                record_fr_check(state, instr, op.operands.operands[1]);
+            }
+            if (op.check_nan) {
+                record_nan_check(state, instr, op.operands.operands[0]);
+                record_nan_check(state, instr, op.operands.operands[1]);
+            }
+            record_fpr_write(state, instr, op.output);
+        }
+        else if (find_unary_it != N64Recomp::unary_ops.end()) {
+            const N64Recomp::UnaryOp& op = find_unary_it->second;
+            if (op.check_fr) {
+                record_fr_check(state, instr, op.output);
+                record_fr_check(state, instr, op.input);
+            }
+            if (op.check_nan) {
+                record_nan_check(state, instr, op.input);
+            }
+            record_fpr_write(state, instr, op.output);
+        }
+        else if (find_store_it != N64Recomp::store_ops.end()) {
+            const N64Recomp::StoreOp& op = find_store_it->second;
+            if (op.type == N64Recomp::StoreOpType::SDC1) {
+                record_fr_check(state, instr, op.value_input);
+            }
+        }
+        else if (find_branch_it != N64Recomp::conditional_branch_ops.end()) {
+            // The instruction after the delay slot of a likely branch can be reached without the delay slot running,
+            // and the instruction after the delay slot of a linked branch is reached after a function call.
+            if (find_branch_it->second.likely || find_branch_it->second.link) {
+                block_end_index = instr_index + 2;
+            }
+        }
+        else {
+            switch (instr_id) {
+                case InstrId::cpu_nop:
+                case InstrId::cpu_mfc0:
+                case InstrId::cpu_add:
+                case InstrId::cpu_addu:
+                case InstrId::cpu_mult:
+                case InstrId::cpu_dmult:
+                case InstrId::cpu_multu:
+                case InstrId::cpu_dmultu:
+                case InstrId::cpu_div:
+                case InstrId::cpu_ddiv:
+                case InstrId::cpu_divu:
+                case InstrId::cpu_ddivu:
+                case InstrId::cpu_ctc1:
+                case InstrId::cpu_cfc1:
+                    // These don't touch the FR bit or the float registers.
+                    break;
+                case InstrId::cpu_j:
+                case InstrId::cpu_b:
+                case InstrId::cpu_jal:
+                case InstrId::cpu_jalr:
+                case InstrId::cpu_jr:
+                    // Unconditional jumps and calls leave the block after their delay slot.
+                    block_end_index = instr_index + 2;
+                    break;
+                default:
+                    // Anything else (status register writes, syscalls, etc.) may change the FR bit, so start over.
+                    state = {};
+                    break;
+            }
+        }
+    }
+}
+
 bool N64Recomp::analyze_function(const N64Recomp::Context& context, const N64Recomp::Function& func,
     const std::vector<rabbitizer::InstructionCpu>& instructions, N64Recomp::FunctionStats& stats) {
     const Section* section = &context.sections[func.section_index];
@@ -347,5 +521,10 @@ bool N64Recomp::analyze_function(const N64Recomp::Context& context, const N64Rec
         //fmt::print("Jtbl at 0x{:08X} (rom 0x{:08X}) with {} entries used by instr at 0x{:08X}\n", cur_jtbl.vram, cur_jtbl.rom, cur_jtbl.entries.size(), cur_jtbl.jr_vram);
     }
 
+    // Find FPU checks that can be omitted, which needs the jump table entries to know where blocks start.
+    if (!context.strict_fpu_checks) {
+        analyze_fpu_checks(func, instructions, stats);
+    }
+
     return true;
 }
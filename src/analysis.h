@@ -14,8 +14,19 @@ namespace N64Recomp {
         AbsoluteJump(uint32_t jump_target, uint32_t instruction_vram) : jump_target(jump_target), instruction_vram(instruction_vram) {}
     };
 
+    // The FPU checks that are known to have been performed when an instruction is reached, which don't need to be emitted again.
+    struct FpuCheckState {
+        // Whether an odd float register has been checked against the FR bit since the FR bit last may have changed.
+        bool fr_checked = false;
+        // Bitmasks of the float registers that have been checked for NaN as a float or as a double since they were last written.
+        uint32_t nan_checked_float = 0;
+        uint32_t nan_checked_double = 0;
+    };
+
     struct FunctionStats {
         std::vector<JumpTable> jump_tables;
+        // The check state on entry to each instruction, indexed by instruction. Empty if the context has strict_fpu_checks set.
+        std::vector<FpuCheckState> fpu_checks;
     };
 
     bool analyze_function(const Context& context, const Function& function, const std::vector<rabbitizer::InstructionCpu>& instructions, FunctionStats& stats);
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <fstream>
 
@@ -78,315 +79,430 @@ static std::vector<BinaryOpFields> c_op_fields = []() {
     return ret;
 }();
 
-static std::string gpr_to_string(int gpr_index) {
-    if (gpr_index == 0) {
-        return "0";
+// Register names that get formatted directly into the output, which avoids creating a temporary string for every operand.
+struct GprName { int index; };
+struct FprName { int index; };
+struct FprDoubleName { int index; };
+struct FprU32LName { int index; };
+struct FprU64Name { int index; };
+
+// Base for the formatters below, none of which take a format spec.
+struct NoSpecFormatter {
+    constexpr auto parse(fmt::format_parse_context& ctx) {
+        return ctx.begin();
     }
-    return fmt::format("ctx->r{}", gpr_index);
-}
+};
+
+template <>
+struct fmt::formatter<GprName> : NoSpecFormatter {
+    template <typename FormatContext>
+    auto format(const GprName& reg, FormatContext& ctx) const {
+        if (reg.index == 0) {
+            return fmt::format_to(ctx.out(), "0");
+        }
+        return fmt::format_to(ctx.out(), "ctx->r{}", reg.index);
+    }
+};
 
-static std::string fpr_to_string(int fpr_index) {
-    return fmt::format("ctx->f{}.fl", fpr_index);
-}
+template <>
+struct fmt::formatter<FprName> : NoSpecFormatter {
+    template <typename FormatContext>
+    auto format(const FprName& reg, FormatContext& ctx) const {
+        return fmt::format_to(ctx.out(), "ctx->f{}.fl", reg.index);
+    }
+};
 
-static std::string fpr_double_to_string(int fpr_index) {
-    return fmt::format("ctx->f{}.d", fpr_index);
-}
+template <>
+struct fmt::formatter<FprDoubleName> : NoSpecFormatter {
+    template <typename FormatContext>
+    auto format(const FprDoubleName& reg, FormatContext& ctx) const {
+        return fmt::format_to(ctx.out(), "ctx->f{}.d", reg.index);
+    }
+};
+
+template <>
+struct fmt::formatter<FprU32LName> : NoSpecFormatter {
+    template <typename FormatContext>
+    auto format(const FprU32LName& reg, FormatContext& ctx) const {
+        if (reg.index & 1) {
+            return fmt::format_to(ctx.out(), "ctx->f_odd[({} - 1) * 2]", reg.index);
+        }
+        return fmt::format_to(ctx.out(), "ctx->f{}.u32l", reg.index);
+    }
+};
 
-static std::string fpr_u32l_to_string(int fpr_index) {
-    if (fpr_index & 1) {
-        return fmt::format("ctx->f_odd[({} - 1) * 2]", fpr_index);
+template <>
+struct fmt::formatter<FprU64Name> : NoSpecFormatter {
+    template <typename FormatContext>
+    auto format(const FprU64Name& reg, FormatContext& ctx) const {
+        return fmt::format_to(ctx.out(), "ctx->f{}.u64", reg.index);
     }
-    else {
-        return fmt::format("ctx->f{}.u32l", fpr_index);
+};
+
+template <>
+struct fmt::formatter<N64Recomp::Label> : NoSpecFormatter {
+    template <typename FormatContext>
+    auto format(const N64Recomp::Label& label, FormatContext& ctx) const {
+        switch (label.type) {
+            case N64Recomp::LabelType::Instruction:
+                return fmt::format_to(ctx.out(), "L_{:08X}", label.vram);
+            case N64Recomp::LabelType::LikelySkip:
+                return fmt::format_to(ctx.out(), "skip_{}", label.index);
+            case N64Recomp::LabelType::LinkReturn:
+                return fmt::format_to(ctx.out(), "after_{}", label.index);
+        }
+        return ctx.out();
     }
+};
+
+static std::string_view buffer_view(const fmt::memory_buffer& buffer) {
+    return std::string_view{ buffer.data(), buffer.size() };
 }
 
-static std::string fpr_u64_to_string(int fpr_index) {
-    return fmt::format("ctx->f{}.u64", fpr_index);
+static void append(fmt::memory_buffer& buffer, std::string_view text) {
+    buffer.append(text.data(), text.data() + text.size());
 }
 
-static std::string unsigned_reloc(const N64Recomp::InstructionContext& context) {
+static void append_unsigned_reloc(const N64Recomp::InstructionContext& context, fmt::memory_buffer& output) {
     switch (context.reloc_type) {
         case N64Recomp::RelocType::R_MIPS_HI16:
-            return fmt::format("{}RELOC_HI16({}, {:#X})",
+            fmt::format_to(std::back_inserter(output), "{}RELOC_HI16({}, {:#X})",
                 context.reloc_tag_as_reference ? "REF_" : "", context.reloc_section_index, context.reloc_target_section_offset);
+            break;
         case N64Recomp::RelocType::R_MIPS_LO16:
-            return fmt::format("{}RELOC_LO16({}, {:#X})",
+            fmt::format_to(std::back_inserter(output), "{}RELOC_LO16({}, {:#X})",
                 context.reloc_tag_as_reference ? "REF_" : "", context.reloc_section_index, context.reloc_target_section_offset);
+            break;
         default:
             throw std::runtime_error(fmt::format("Unexpected reloc type {}\n", static_cast<int>(context.reloc_type)));
     }
 }
 
-static std::string signed_reloc(const N64Recomp::InstructionContext& context) {
-    return "(int16_t)" + unsigned_reloc(context);
-}
+// Prefix of the locals that hold hoisted section addresses, which is followed by the section index.
+static constexpr std::string_view section_address_prefix = "section_addr_";
 
-void N64Recomp::CGenerator::get_operand_string(Operand operand, UnaryOpType operation, const InstructionContext& context, std::string& operand_string) const {
-    switch (operand) {
-        case Operand::Rd:
-            operand_string = gpr_to_string(context.rd);
-            break;
-        case Operand::Rs:
-            operand_string = gpr_to_string(context.rs);
-            break;
-        case Operand::Rt:
-            operand_string = gpr_to_string(context.rt);
-            break;
-        case Operand::Fd:
-            operand_string = fpr_to_string(context.fd);
-            break;
-        case Operand::Fs:
-            operand_string = fpr_to_string(context.fs);
-            break;
-        case Operand::Ft:
-            operand_string = fpr_to_string(context.ft);
-            break;
-        case Operand::FdDouble:
-            operand_string = fpr_double_to_string(context.fd);
-            break;
-        case Operand::FsDouble:
-            operand_string = fpr_double_to_string(context.fs);
-            break;
-        case Operand::FtDouble:
-            operand_string = fpr_double_to_string(context.ft);
-            break;
-        case Operand::FdU32L:
-            operand_string = fpr_u32l_to_string(context.fd);
-            break;
-        case Operand::FsU32L:
-            operand_string = fpr_u32l_to_string(context.fs);
-            break;
-        case Operand::FtU32L:
-            operand_string = fpr_u32l_to_string(context.ft);
-            break;
-        case Operand::FdU32H:
-            assert(false);
-            break;
-        case Operand::FsU32H:
-            assert(false);
-            break;
-        case Operand::FtU32H:
-            assert(false);
-            break;
-        case Operand::FdU64:
-            operand_string = fpr_u64_to_string(context.fd);
-            break;
-        case Operand::FsU64:
-            operand_string = fpr_u64_to_string(context.fs);
-            break;
-        case Operand::FtU64:
-            operand_string = fpr_u64_to_string(context.ft);
-            break;
-        case Operand::ImmU16:
-            if (context.reloc_type != N64Recomp::RelocType::R_MIPS_NONE) {
-                operand_string = unsigned_reloc(context);
-            }
-            else {
-                operand_string = fmt::format("{:#X}", context.imm16);
-            }
-            break;
-        case Operand::ImmS16:
-            if (context.reloc_type != N64Recomp::RelocType::R_MIPS_NONE) {
-                operand_string = signed_reloc(context);
-            }
-            else {
-                operand_string = fmt::format("{:#X}", (int16_t)context.imm16);
-            }
-            break;
-        case Operand::Sa:
-            operand_string = std::to_string(context.sa);
-            break;
-        case Operand::Sa32:
-            operand_string = fmt::format("({} + 32)", context.sa);
-            break;
-        case Operand::Cop1cs:
-            operand_string = fmt::format("c1cs");
-            break;
-        case Operand::Hi:
-            operand_string = "hi";
-            break;
-        case Operand::Lo:
-            operand_string = "lo";
+void N64Recomp::CGenerator::append_reloc(const InstructionContext& context, fmt::memory_buffer& output) const {
+    // Reference relocs go through a different table, so only local ones get hoisted.
+    if (!hoist_section_addresses || output_buffer == nullptr || context.reloc_tag_as_reference) {
+        append_unsigned_reloc(context, output);
+        return;
+    }
+
+    if (std::find(hoisted_sections.begin(), hoisted_sections.end(), context.reloc_section_index) == hoisted_sections.end()) {
+        hoisted_sections.push_back(context.reloc_section_index);
+    }
+
+    switch (context.reloc_type) {
+        case N64Recomp::RelocType::R_MIPS_HI16:
+            fmt::format_to(std::back_inserter(output), "HI16({}{} + {:#X})",
+                section_address_prefix, context.reloc_section_index, context.reloc_target_section_offset);
             break;
-        case Operand::Zero:
-            operand_string = "0";
+        case N64Recomp::RelocType::R_MIPS_LO16:
+            fmt::format_to(std::back_inserter(output), "LO16({}{} + {:#X})",
+                section_address_prefix, context.reloc_section_index, context.reloc_target_section_offset);
             break;
+        default:
+            throw std::runtime_error(fmt::format("Unexpected reloc type {}\n", static_cast<int>(context.reloc_type)));
     }
+}
+
+void N64Recomp::CGenerator::mark_after_call() const {
+    if (hoist_section_addresses && output_buffer != nullptr) {
+        after_call_offsets.push_back(output_buffer->size());
+    }
+}
+
+template <typename... Ts>
+void N64Recomp::CGenerator::print(fmt::format_string<Ts...> fmt_str, Ts&&... args) const {
+    if (output_buffer != nullptr) {
+        fmt::format_to(std::back_inserter(*output_buffer), fmt_str, std::forward<Ts>(args)...);
+    }
+    else {
+        fmt::print(*output_file, fmt_str, std::forward<Ts>(args)...);
+    }
+}
+
+void N64Recomp::CGenerator::get_operand_string(Operand operand, UnaryOpType operation, const InstructionContext& context, fmt::memory_buffer& operand_string) const {
+    operand_string.clear();
+    auto out = std::back_inserter(operand_string);
+
+    // Determine the text that wraps the operand for the given operation.
+    std::string_view prefix{};
+    std::string_view suffix{};
     switch (operation) {
         case UnaryOpType::None:
             break;
         case UnaryOpType::ToS32:
-            operand_string = "S32(" + operand_string + ")"; 
+            prefix = "S32("; suffix = ")";
             break;
         case UnaryOpType::ToU32:
-            operand_string = "U32(" + operand_string + ")"; 
+            prefix = "U32("; suffix = ")";
             break;
         case UnaryOpType::ToS64:
-            operand_string = "SIGNED(" + operand_string + ")"; 
+            prefix = "SIGNED("; suffix = ")";
             break;
         case UnaryOpType::ToU64:
             // Nothing to do here, they're already U64
             break;
         case UnaryOpType::Lui:
-            operand_string = "S32(" + operand_string + " << 16)"; 
+            prefix = "S32("; suffix = " << 16)";
             break;
         case UnaryOpType::Mask5:
-            operand_string = "(" + operand_string + " & 31)";
+            prefix = "("; suffix = " & 31)";
             break;
         case UnaryOpType::Mask6:
-            operand_string = "(" + operand_string + " & 63)";
+            prefix = "("; suffix = " & 63)";
             break;
         case UnaryOpType::ToInt32:
-            operand_string = "(int32_t)" + operand_string; 
+            prefix = "(int32_t)";
             break;
         case UnaryOpType::NegateFloat:
-            operand_string = "-" + operand_string;
+            prefix = "-";
             break;
         case UnaryOpType::NegateDouble:
-            operand_string = "-" + operand_string;
+            prefix = "-";
             break;
         case UnaryOpType::AbsFloat:
-            operand_string = "fabsf(" + operand_string + ")";
+            prefix = "fabsf("; suffix = ")";
             break;
         case UnaryOpType::AbsDouble:
-            operand_string = "fabs(" + operand_string + ")";
+            prefix = "fabs("; suffix = ")";
             break;
         case UnaryOpType::SqrtFloat:
-            operand_string = "sqrtf(" + operand_string + ")";
+            prefix = "sqrtf("; suffix = ")";
             break;
         case UnaryOpType::SqrtDouble:
-            operand_string = "sqrt(" + operand_string + ")";
+            prefix = "sqrt("; suffix = ")";
             break;
         case UnaryOpType::ConvertSFromW:
-            operand_string = "CVT_S_W(" + operand_string + ")";
+            prefix = "CVT_S_W("; suffix = ")";
             break;
         case UnaryOpType::ConvertWFromS:
-            operand_string = "CVT_W_S(" + operand_string + ")";
+            prefix = "CVT_W_S("; suffix = ")";
             break;
         case UnaryOpType::ConvertDFromW:
-            operand_string = "CVT_D_W(" + operand_string + ")";
+            prefix = "CVT_D_W("; suffix = ")";
             break;
         case UnaryOpType::ConvertWFromD:
-            operand_string = "CVT_W_D(" + operand_string + ")";
+            prefix = "CVT_W_D("; suffix = ")";
             break;
         case UnaryOpType::ConvertDFromS:
-            operand_string = "CVT_D_S(" + operand_string + ")";
+            prefix = "CVT_D_S("; suffix = ")";
             break;
         case UnaryOpType::ConvertSFromD:
-            operand_string = "CVT_S_D(" + operand_string + ")";
+            prefix = "CVT_S_D("; suffix = ")";
             break;
         case UnaryOpType::ConvertDFromL:
-            operand_string = "CVT_D_L(" + operand_string + ")";
+            prefix = "CVT_D_L("; suffix = ")";
             break;
         case UnaryOpType::ConvertLFromD:
-            operand_string = "CVT_L_D(" + operand_string + ")";
+            prefix = "CVT_L_D("; suffix = ")";
             break;
         case UnaryOpType::ConvertSFromL:
-            operand_string = "CVT_S_L(" + operand_string + ")";
+            prefix = "CVT_S_L("; suffix = ")";
             break;
         case UnaryOpType::ConvertLFromS:
-            operand_string = "CVT_L_S(" + operand_string + ")";
+            prefix = "CVT_L_S("; suffix = ")";
             break;
         case UnaryOpType::TruncateWFromS:
-            operand_string = "TRUNC_W_S(" + operand_string + ")";
+            prefix = "TRUNC_W_S("; suffix = ")";
             break;
         case UnaryOpType::TruncateWFromD:
-            operand_string = "TRUNC_W_D(" + operand_string + ")";
+            prefix = "TRUNC_W_D("; suffix = ")";
             break;
         case UnaryOpType::TruncateLFromS:
-            operand_string = "TRUNC_L_S(" + operand_string + ")";
+            prefix = "TRUNC_L_S("; suffix = ")";
             break;
         case UnaryOpType::TruncateLFromD:
-            operand_string = "TRUNC_L_D(" + operand_string + ")";
+            prefix = "TRUNC_L_D("; suffix = ")";
             break;
         // TODO these four operations should use banker's rounding, but roundeven is C23 so it's unavailable here.
         case UnaryOpType::RoundWFromS:
-            operand_string = "lroundf(" + operand_string + ")";
+            prefix = "lroundf("; suffix = ")";
             break;
         case UnaryOpType::RoundWFromD:
-            operand_string = "lround(" + operand_string + ")";
+            prefix = "lround("; suffix = ")";
             break;
         case UnaryOpType::RoundLFromS:
-            operand_string = "llroundf(" + operand_string + ")";
+            prefix = "llroundf("; suffix = ")";
             break;
         case UnaryOpType::RoundLFromD:
-            operand_string = "llround(" + operand_string + ")";
+            prefix = "llround("; suffix = ")";
             break;
         case UnaryOpType::CeilWFromS:
-            operand_string = "S32(ceilf(" + operand_string + "))";
+            prefix = "S32(ceilf("; suffix = "))";
             break;
         case UnaryOpType::CeilWFromD:
-            operand_string = "S32(ceil(" + operand_string + "))";
+            prefix = "S32(ceil("; suffix = "))";
             break;
         case UnaryOpType::CeilLFromS:
-            operand_string = "S64(ceilf(" + operand_string + "))";
+            prefix = "S64(ceilf("; suffix = "))";
             break;
         case UnaryOpType::CeilLFromD:
-            operand_string = "S64(ceil(" + operand_string + "))";
+            prefix = "S64(ceil("; suffix = "))";
             break;
         case UnaryOpType::FloorWFromS:
-            operand_string = "S32(floorf(" + operand_string + "))";
+            prefix = "S32(floorf("; suffix = "))";
             break;
         case UnaryOpType::FloorWFromD:
-            operand_string = "S32(floor(" + operand_string + "))";
+            prefix = "S32(floor("; suffix = "))";
             break;
         case UnaryOpType::FloorLFromS:
-            operand_string = "S64(floorf(" + operand_string + "))";
+            prefix = "S64(floorf("; suffix = "))";
             break;
         case UnaryOpType::FloorLFromD:
-            operand_string = "S64(floor(" + operand_string + "))";
+            prefix = "S64(floor("; suffix = "))";
+            break;
+    }
+
+    append(operand_string, prefix);
+
+    switch (operand) {
+        case Operand::Rd:
+            fmt::format_to(out, "{}", GprName{ context.rd });
+            break;
+        case Operand::Rs:
+            fmt::format_to(out, "{}", GprName{ context.rs });
+            break;
+        case Operand::Rt:
+            fmt::format_to(out, "{}", GprName{ context.rt });
+            break;
+        case Operand::Fd:
+            fmt::format_to(out, "{}", FprName{ context.fd });
+            break;
+        case Operand::Fs:
+            fmt::format_to(out, "{}", FprName{ context.fs });
+            break;
+        case Operand::Ft:
+            fmt::format_to(out, "{}", FprName{ context.ft });
+            break;
+        case Operand::FdDouble:
+            fmt::format_to(out, "{}", FprDoubleName{ context.fd });
+            break;
+        case Operand::FsDouble:
+            fmt::format_to(out, "{}", FprDoubleName{ context.fs });
+            break;
+        case Operand::FtDouble:
+            fmt::format_to(out, "{}", FprDoubleName{ context.ft });
+            break;
+        case Operand::FdU32L:
+            fmt::format_to(out, "{}", FprU32LName{ context.fd });
+            break;
+        case Operand::FsU32L:
+            fmt::format_to(out, "{}", FprU32LName{ context.fs });
+            break;
+        case Operand::FtU32L:
+            fmt::format_to(out, "{}", FprU32LName{ context.ft });
+            break;
+        case Operand::FdU32H:
+            assert(false);
+            break;
+        case Operand::FsU32H:
+            assert(false);
+            break;
+        case Operand::FtU32H:
+            assert(false);
+            break;
+        case Operand::FdU64:
+            fmt::format_to(out, "{}", FprU64Name{ context.fd });
+            break;
+        case Operand::FsU64:
+            fmt::format_to(out, "{}", FprU64Name{ context.fs });
+            break;
+        case Operand::FtU64:
+            fmt::format_to(out, "{}", FprU64Name{ context.ft });
+            break;
+        case Operand::ImmU16:
+            if (context.reloc_type != N64Recomp::RelocType::R_MIPS_NONE) {
+                append_reloc(context, operand_string);
+            }
+            else {
+                fmt::format_to(out, "{:#X}", context.imm16);
+            }
+            break;
+        case Operand::ImmS16:
+            if (context.reloc_type != N64Recomp::RelocType::R_MIPS_NONE) {
+                append(operand_string, "(int16_t)");
+                append_reloc(context, operand_string);
+            }
+            else {
+                fmt::format_to(out, "{:#X}", (int16_t)context.imm16);
+            }
+            break;
+        case Operand::Sa:
+            fmt::format_to(out, "{}", context.sa);
+            break;
+        case Operand::Sa32:
+            fmt::format_to(out, "({} + 32)", context.sa);
+            break;
+        case Operand::Cop1cs:
+            append(operand_string, "c1cs");
+            break;
+        case Operand::Hi:
+            append(operand_string, "hi");
+            break;
+        case Operand::Lo:
+            append(operand_string, "lo");
+            break;
+        case Operand::Zero:
+            append(operand_string, "0");
             break;
     }
+
+    append(operand_string, suffix);
 }
 
-void N64Recomp::CGenerator::get_notation(BinaryOpType op_type, std::string& func_string, std::string& infix_string) const {
+void N64Recomp::CGenerator::get_notation(BinaryOpType op_type, std::string_view& func_string, std::string_view& infix_string) const {
     func_string = c_op_fields[static_cast<size_t>(op_type)].func_string;
     infix_string = c_op_fields[static_cast<size_t>(op_type)].infix_string;
 }
 
-void N64Recomp::CGenerator::get_binary_expr_string(BinaryOpType type, const BinaryOperands& operands, const InstructionContext& ctx, const std::string& output, std::string& expr_string) const {
-    thread_local std::string input_a{};
-    thread_local std::string input_b{};
-    thread_local std::string func_string{};
-    thread_local std::string infix_string{};
-    get_operand_string(operands.operands[0], operands.operand_operations[0], ctx, input_a);
-    get_operand_string(operands.operands[1], operands.operand_operations[1], ctx, input_b);
+void N64Recomp::CGenerator::get_binary_expr_string(BinaryOpType type, const BinaryOperands& operands, const InstructionContext& ctx, std::string_view output, fmt::memory_buffer& expr_string) const {
+    fmt::memory_buffer input_a_buffer{};
+    fmt::memory_buffer input_b_buffer{};
+    std::string_view func_string{};
+    std::string_view infix_string{};
+    get_operand_string(operands.operands[0], operands.operand_operations[0], ctx, input_a_buffer);
+    get_operand_string(operands.operands[1], operands.operand_operations[1], ctx, input_b_buffer);
     get_notation(type, func_string, infix_string);
+    std::string_view input_a = buffer_view(input_a_buffer);
+    std::string_view input_b = buffer_view(input_b_buffer);
+
+    expr_string.clear();
+    auto out = std::back_inserter(expr_string);
     
     // These cases aren't strictly necessary and are just here for parity with the old recompiler output.
     if (type == BinaryOpType::Less && !((operands.operands[1] == Operand::Zero && operands.operand_operations[1] == UnaryOpType::None) || (operands.operands[0] == Operand::Fs || operands.operands[0] == Operand::FsDouble))) {
-        expr_string = fmt::format("{} {} {} ? 1 : 0", input_a, infix_string, input_b);
+        fmt::format_to(out, "{} {} {} ? 1 : 0", input_a, infix_string, input_b);
     }
     else if (type == BinaryOpType::Equal && operands.operands[1] == Operand::Zero && operands.operand_operations[1] == UnaryOpType::None) {
-        expr_string = "!" + input_a;
+        fmt::format_to(out, "!{}", input_a);
     }
     else if (type == BinaryOpType::NotEqual && operands.operands[1] == Operand::Zero && operands.operand_operations[1] == UnaryOpType::None) {
-        expr_string = input_a;
+        append(expr_string, input_a);
     }
     // End unnecessary cases.
 
     // TODO encode these ops to avoid needing special handling.
     else if (type == BinaryOpType::LWL || type == BinaryOpType::LWR || type == BinaryOpType::LDL || type == BinaryOpType::LDR) {
-        expr_string = fmt::format("{}(rdram, {}, {}, {})", func_string, output, input_a, input_b);
+        fmt::format_to(out, "{}(rdram, {}, {}, {})", func_string, output, input_a, input_b);
     }
     else if (!func_string.empty() && !infix_string.empty()) {
-        expr_string = fmt::format("{}({} {} {})", func_string, input_a, infix_string, input_b);
+        fmt::format_to(out, "{}({} {} {})", func_string, input_a, infix_string, input_b);
     }
     else if (!func_string.empty()) {
-        expr_string = fmt::format("{}({}, {})", func_string, input_a, input_b);
+        fmt::format_to(out, "{}({}, {})", func_string, input_a, input_b);
     }
     else if (!infix_string.empty()) {
-        expr_string = fmt::format("{} {} {}", input_a, infix_string, input_b);
+        fmt::format_to(out, "{} {} {}", input_a, infix_string, input_b);
     }
     else {
         // Handle special cases
         if (type == BinaryOpType::True) {
-            expr_string = "1";
+            append(expr_string, "1");
         }
         else if (type == BinaryOpType::False) {
-            expr_string = "0";
+            append(expr_string, "0");
         }
         assert(false && "Binary operation must have either a function or infix!");
     }
@@ -394,69 +510,108 @@ void N64Recomp::CGenerator::get_binary_expr_string(BinaryOpType type, const Bina
 
 void N64Recomp::CGenerator::emit_function_start(const std::string& function_name, size_t func_index) const {
     (void)func_index;
-    fmt::print(output_file,
-        "RECOMP_FUNC void {}(uint8_t* rdram, recomp_context* ctx) {{\n"
+    print(
+        "{} void {}{}(uint8_t* rdram, recomp_context* ctx) {{\n"
         // these variables shouldn't need to be preserved across function boundaries, so make them local for more efficient output
         "    uint64_t hi = 0, lo = 0, result = 0;\n"
         "    int c1cs = 0;\n", // cop1 conditional signal
-        function_name);
+        inline_copy ? "RECOMP_INLINE_FUNC" : "RECOMP_FUNC", function_name, inline_copy ? InlineFunctionSuffix : "");
+
+    if (output_buffer != nullptr) {
+        function_body_offset = output_buffer->size();
+    }
+    hoisted_sections.clear();
+    after_call_offsets.clear();
 }
 
 void N64Recomp::CGenerator::emit_function_end() const {
-    fmt::print(output_file, ";}}\n");
+    print(";}}\n");
+
+    if (hoisted_sections.empty()) {
+        return;
+    }
+
+    // Now that the function's sections are known, insert the loads of their addresses at the start of the body and after every call,
+    // as calls may load or unload sections. The locals can't be aliased by stores to rdram, unlike section_addresses, so the C compiler
+    // doesn't have to keep reloading them.
+    std::sort(hoisted_sections.begin(), hoisted_sections.end());
+    fmt::memory_buffer declarations{};
+    fmt::memory_buffer reloads{};
+    for (uint32_t section_index : hoisted_sections) {
+        fmt::format_to(std::back_inserter(declarations), "    int32_t {0}{1} = section_addresses[{1}];\n", section_address_prefix, section_index);
+        fmt::format_to(std::back_inserter(reloads), "    {0}{1} = section_addresses[{1}];\n", section_address_prefix, section_index);
+    }
+
+    std::string body{ output_buffer->data() + function_body_offset, output_buffer->size() - function_body_offset };
+    output_buffer->resize(function_body_offset);
+    append(*output_buffer, buffer_view(declarations));
+    size_t body_pos = 0;
+    for (size_t after_call_offset : after_call_offsets) {
+        size_t call_end = after_call_offset - function_body_offset;
+        append(*output_buffer, std::string_view{ body }.substr(body_pos, call_end - body_pos));
+        append(*output_buffer, buffer_view(reloads));
+        body_pos = call_end;
+    }
+    append(*output_buffer, std::string_view{ body }.substr(body_pos));
+}
+
+void N64Recomp::CGenerator::emit_profile_entry(size_t func_index) const {
+    print("    PROFILE_ENTRY({})\n", func_index);
 }
 
 void N64Recomp::CGenerator::emit_function_call_lookup(uint32_t addr) const {
-    fmt::print(output_file, "LOOKUP_FUNC(0x{:08X})(rdram, ctx);\n", addr);
+    print("LOOKUP_FUNC(0x{:08X})(rdram, ctx);\n", addr);
+    mark_after_call();
 }
 
 void N64Recomp::CGenerator::emit_function_call_by_register(int reg) const {
-    fmt::print(output_file, "LOOKUP_FUNC({})(rdram, ctx);\n", gpr_to_string(reg));
+    print("LOOKUP_FUNC({})(rdram, ctx);\n", GprName{ reg });
+    mark_after_call();
 }
 
 void N64Recomp::CGenerator::emit_function_call_reference_symbol(const Context& context, uint16_t section_index, size_t symbol_index, uint32_t target_section_offset) const {
     (void)target_section_offset;
     const N64Recomp::ReferenceSymbol& sym = context.get_reference_symbol(section_index, symbol_index);
-    fmt::print(output_file, "{}(rdram, ctx);\n", sym.name);
+    print("{}(rdram, ctx);\n", sym.name);
+    mark_after_call();
 }
 
 void N64Recomp::CGenerator::emit_function_call(const Context& context, size_t function_index) const {
-    fmt::print(output_file, "{}(rdram, ctx);\n", context.functions[function_index].name);
+    print("{}{}(rdram, ctx);\n", context.functions[function_index].name, context.is_function_inlinable(function_index) ? InlineFunctionSuffix : "");
+    mark_after_call();
 }
 
 void N64Recomp::CGenerator::emit_named_function_call(const std::string& function_name) const {
-    fmt::print(output_file, "{}(rdram, ctx);\n", function_name);
+    print("{}(rdram, ctx);\n", function_name);
+    mark_after_call();
 }
 
-void N64Recomp::CGenerator::emit_goto(const std::string& target) const {
-    fmt::print(output_file,
+void N64Recomp::CGenerator::emit_goto(const Label& target) const {
+    print(
         "    goto {};\n", target);
 }
 
-void N64Recomp::CGenerator::emit_label(const std::string& label_name) const {
-    fmt::print(output_file,
-        "{}:\n", label_name);
+void N64Recomp::CGenerator::emit_label(const Label& label) const {
+    print(
+        "{}:\n", label);
 }
 
 void N64Recomp::CGenerator::emit_jtbl_addend_declaration(const JumpTable& jtbl, int reg) const {
-    std::string jump_variable = fmt::format("jr_addend_{:08X}", jtbl.jr_vram);
-    fmt::print(output_file, "gpr {} = {};\n", jump_variable, gpr_to_string(reg));
+    print("gpr jr_addend_{:08X} = {};\n", jtbl.jr_vram, GprName{ reg });
 }
 
 void N64Recomp::CGenerator::emit_branch_condition(const ConditionalBranchOp& op, const InstructionContext& ctx) const {
-    // Thread local variables to prevent allocations when possible.
-    // TODO these thread locals probably don't actually help right now, so figure out a better way to prevent allocations.
-    thread_local std::string expr_string{};
+    fmt::memory_buffer expr_string{};
     get_binary_expr_string(op.comparison, op.operands, ctx, "", expr_string);
-    fmt::print(output_file, "if ({}) {{\n", expr_string);
+    print("if ({}) {{\n", buffer_view(expr_string));
 }
 
 void N64Recomp::CGenerator::emit_branch_close() const {
-    fmt::print(output_file, "}}\n");
+    print("}}\n");
 }
 
 void N64Recomp::CGenerator::emit_switch_close() const {
-    fmt::print(output_file, "}}\n");
+    print("}}\n");
 }
 
 void N64Recomp::CGenerator::emit_switch(const Context& recompiler_context, const JumpTable& jtbl, int reg) const {
@@ -464,77 +619,77 @@ void N64Recomp::CGenerator::emit_switch(const Context& recompiler_context, const
     (void)reg;
     // TODO generate code to subtract the jump table address from the register's value instead.
     // Once that's done, the addend temp can be deleted to simplify the generator interface.
-    std::string jump_variable = fmt::format("jr_addend_{:08X}", jtbl.jr_vram);
-
-    fmt::print(output_file, "switch ({} >> 2) {{\n", jump_variable);
+    print("switch (jr_addend_{:08X} >> 2) {{\n", jtbl.jr_vram);
 }
 
-void N64Recomp::CGenerator::emit_case(int case_index, const std::string& target_label) const {
-    fmt::print(output_file, "case {}: goto {}; break;\n", case_index, target_label);
+void N64Recomp::CGenerator::emit_case(int case_index, const Label& target_label) const {
+    print("case {}: goto {}; break;\n", case_index, target_label);
 }
 
 void N64Recomp::CGenerator::emit_switch_error(uint32_t instr_vram, uint32_t jtbl_vram) const {
-    fmt::print(output_file, "default: switch_error(__func__, 0x{:08X}, 0x{:08X});\n", instr_vram, jtbl_vram);
+    print("default: switch_error(__func__, 0x{:08X}, 0x{:08X});\n", instr_vram, jtbl_vram);
 }
 
 void N64Recomp::CGenerator::emit_return(const Context& context, size_t func_index) const {
-    (void)func_index;
     if (context.trace_mode) {
-        fmt::print(output_file, "TRACE_RETURN()\n    ");
+        print("TRACE_RETURN()\n    ");
+    }
+    if (context.profile_mode) {
+        print("PROFILE_RETURN({})\n    ", func_index);
     }
-    fmt::print(output_file, "return;\n");
+    print("return;\n");
 }
 
 void N64Recomp::CGenerator::emit_check_fr(int fpr) const {
-    fmt::print(output_file, "CHECK_FR(ctx, {});\n    ", fpr);
+    print("CHECK_FR(ctx, {});\n    ", fpr);
 }
 
 void N64Recomp::CGenerator::emit_check_nan(int fpr, bool is_double) const {
-    fmt::print(output_file, "NAN_CHECK(ctx->f{}.{}); ", fpr, is_double ? "d" : "fl");
+    print("NAN_CHECK(ctx->f{}.{}); ", fpr, is_double ? "d" : "fl");
 }
 
 void N64Recomp::CGenerator::emit_cop0_status_read(int reg) const {
-    fmt::print(output_file, "{} = cop0_status_read(ctx);\n", gpr_to_string(reg));
+    print("{} = cop0_status_read(ctx);\n", GprName{ reg });
 }
 
 void N64Recomp::CGenerator::emit_cop0_status_write(int reg) const {
-    fmt::print(output_file, "cop0_status_write(ctx, {});", gpr_to_string(reg));
+    print("cop0_status_write(ctx, {});", GprName{ reg });
 }
 
 void N64Recomp::CGenerator::emit_cop1_cs_read(int reg) const {
-    fmt::print(output_file, "{} = get_cop1_cs();\n", gpr_to_string(reg));
+    print("{} = get_cop1_cs();\n", GprName{ reg });
 }
 
 void N64Recomp::CGenerator::emit_cop1_cs_write(int reg) const {
-    fmt::print(output_file, "set_cop1_cs({});\n", gpr_to_string(reg));
+    print("set_cop1_cs({});\n", GprName{ reg });
 }
 
 void N64Recomp::CGenerator::emit_muldiv(InstrId instr_id, int reg1, int reg2) const {
     switch (instr_id) {
         case InstrId::cpu_mult:
-            fmt::print(output_file, "result = S64(S32({})) * S64(S32({})); lo = S32(result >> 0); hi = S32(result >> 32);\n", gpr_to_string(reg1), gpr_to_string(reg2));
+            print("result = S64(S32({})) * S64(S32({})); lo = S32(result >> 0); hi = S32(result >> 32);\n", GprName{ reg1 }, GprName{ reg2 });
             break;
         case InstrId::cpu_dmult:
-            fmt::print(output_file, "DMULT(S64({}), S64({}), &lo, &hi);\n", gpr_to_string(reg1), gpr_to_string(reg2));
+            print("DMULT(S64({}), S64({}), &lo, &hi);\n", GprName{ reg1 }, GprName{ reg2 });
             break;
         case InstrId::cpu_multu:
-            fmt::print(output_file, "result = U64(U32({})) * U64(U32({})); lo = S32(result >> 0); hi = S32(result >> 32);\n", gpr_to_string(reg1), gpr_to_string(reg2));
+            print("result = U64(U32({})) * U64(U32({})); lo = S32(result >> 0); hi = S32(result >> 32);\n", GprName{ reg1 }, GprName{ reg2 });
             break;
         case InstrId::cpu_dmultu:
-            fmt::print(output_file, "DMULTU(U64({}), U64({}), &lo, &hi);\n", gpr_to_string(reg1), gpr_to_string(reg2));
+            print("DMULTU(U64({}), U64({}), &lo, &hi);\n", GprName{ reg1 }, GprName{ reg2 });
             break;
         case InstrId::cpu_div:
             // Cast to 64-bits before division to prevent artihmetic exception for s32(0x80000000) / -1
-            fmt::print(output_file, "lo = S32(S64(S32({0})) / S64(S32({1}))); hi = S32(S64(S32({0})) % S64(S32({1})));\n", gpr_to_string(reg1), gpr_to_string(reg2));
+            print("lo = S32(S64(S32({0})) / S64(S32({1}))); hi = S32(S64(S32({0})) % S64(S32({1})));\n", GprName{ reg1 }, GprName{ reg2 });
             break;
         case InstrId::cpu_ddiv:
-            fmt::print(output_file, "DDIV(S64({}), S64({}), &lo, &hi);\n", gpr_to_string(reg1), gpr_to_string(reg2));
+            print("DDIV(S64({}), S64({}), &lo, &hi);\n", GprName{ reg1 }, GprName{ reg2 });
             break;
         case InstrId::cpu_divu:
-            fmt::print(output_file, "lo = S32(U32({0}) / U32({1})); hi = S32(U32({0}) % U32({1}));\n", gpr_to_string(reg1), gpr_to_string(reg2));
+            print("lo = S32(U32({0}) / U32({1})); hi = S32(U32({0}) % U32({1}));\n", GprName{ reg1 }, GprName{ reg2 });
             break;
         case InstrId::cpu_ddivu:
-            fmt::print(output_file, "DDIVU(U64({}), U64({}), &lo, &hi);\n", gpr_to_string(reg1), gpr_to_string(reg2));
+            print("DDIVU(U64({}), U64({}), &lo, &hi);\n", GprName{ reg1 }, GprName{ reg2 });
             break;
         default:
             assert(false);
@@ -543,54 +698,61 @@ void N64Recomp::CGenerator::emit_muldiv(InstrId instr_id, int reg1, int reg2) co
 }
 
 void N64Recomp::CGenerator::emit_syscall(uint32_t instr_vram) const {
-    fmt::print(output_file, "recomp_syscall_handler(rdram, ctx, 0x{:08X});\n", instr_vram);
+    print("recomp_syscall_handler(rdram, ctx, 0x{:08X});\n", instr_vram);
+    mark_after_call();
 }
 
 void N64Recomp::CGenerator::emit_do_break(uint32_t instr_vram) const {
-    fmt::print(output_file, "do_break({});\n", instr_vram);
+    print("do_break({});\n", instr_vram);
 }
 
 void N64Recomp::CGenerator::emit_pause_self() const {
-    fmt::print(output_file, "pause_self(rdram);\n");
+    print("pause_self(rdram);\n");
+    mark_after_call();
 }
 
 void N64Recomp::CGenerator::emit_trigger_event(uint32_t event_index) const {
-    fmt::print(output_file, "recomp_trigger_event(rdram, ctx, base_event_index + {});\n", event_index);
+    print("recomp_trigger_event(rdram, ctx, base_event_index + {});\n", event_index);
+    mark_after_call();
 }
 
 void N64Recomp::CGenerator::emit_comment(const std::string& comment) const {
-    fmt::print(output_file, "// {}\n", comment);
+    print("// {}\n", comment);
+}
+
+void N64Recomp::CGenerator::emit_load_constant(int reg, int32_t value) const {
+    print("{} = S32(0X{:08X});\n", GprName{ reg }, (uint32_t)value);
 }
 
 void N64Recomp::CGenerator::process_binary_op(const BinaryOp& op, const InstructionContext& ctx) const {
-    // Thread local variables to prevent allocations when possible.
-    // TODO these thread locals probably don't actually help right now, so figure out a better way to prevent allocations.
-    thread_local std::string output{};
-    thread_local std::string expression{};
+    // The operand strings are built in inline buffers to prevent allocations.
+    fmt::memory_buffer output{};
+    fmt::memory_buffer expression{};
     get_operand_string(op.output, UnaryOpType::None, ctx, output);
-    get_binary_expr_string(op.type, op.operands, ctx, output, expression);
-    fmt::print(output_file, "{} = {};\n", output, expression);
+    get_binary_expr_string(op.type, op.operands, ctx, buffer_view(output), expression);
+    print("{} = {};\n", buffer_view(output), buffer_view(expression));
 }
 
 void N64Recomp::CGenerator::process_unary_op(const UnaryOp& op, const InstructionContext& ctx) const {
-    // Thread local variables to prevent allocations when possible.
-    // TODO these thread locals probably don't actually help right now, so figure out a better way to prevent allocations.
-    thread_local std::string output{};
-    thread_local std::string input{};
+    // The operand strings are built in inline buffers to prevent allocations.
+    fmt::memory_buffer output{};
+    fmt::memory_buffer input{};
     get_operand_string(op.output, UnaryOpType::None, ctx, output);
     get_operand_string(op.input, op.operation, ctx, input);
-    fmt::print(output_file, "{} = {};\n", output, input);
+    print("{} = {};\n", buffer_view(output), buffer_view(input));
 }
 
 void N64Recomp::CGenerator::process_store_op(const StoreOp& op, const InstructionContext& ctx) const {
-    // Thread local variables to prevent allocations when possible.
-    // TODO these thread locals probably don't actually help right now, so figure out a better way to prevent allocations.
-    thread_local std::string base_str{};
-    thread_local std::string imm_str{};
-    thread_local std::string value_input{};
-    get_operand_string(Operand::Base, UnaryOpType::None, ctx, base_str);
-    get_operand_string(Operand::ImmS16, UnaryOpType::None, ctx, imm_str);
-    get_operand_string(op.value_input, UnaryOpType::None, ctx, value_input);
+    // The operand strings are built in inline buffers to prevent allocations.
+    fmt::memory_buffer base_buffer{};
+    fmt::memory_buffer imm_buffer{};
+    fmt::memory_buffer value_input_buffer{};
+    get_operand_string(Operand::Base, UnaryOpType::None, ctx, base_buffer);
+    get_operand_string(Operand::ImmS16, UnaryOpType::None, ctx, imm_buffer);
+    get_operand_string(op.value_input, UnaryOpType::None, ctx, value_input_buffer);
+    std::string_view base_str = buffer_view(base_buffer);
+    std::string_view imm_str = buffer_view(imm_buffer);
+    std::string_view value_input = buffer_view(value_input_buffer);
 
     enum class StoreSyntax {
         Func,
@@ -599,7 +761,7 @@ void N64Recomp::CGenerator::process_store_op(const StoreOp& op, const Instructio
     };
 
     StoreSyntax syntax;
-    std::string func_text;
+    std::string_view func_text;
 
     switch (op.type) {
         case StoreOpType::SD:
@@ -648,13 +810,13 @@ void N64Recomp::CGenerator::process_store_op(const StoreOp& op, const Instructio
 
     switch (syntax) {
         case StoreSyntax::Func:
-            fmt::print(output_file, "{}({}, {}, {});\n", func_text, value_input, imm_str, base_str);
+            print("{}({}, {}, {});\n", func_text, value_input, imm_str, base_str);
             break;
         case StoreSyntax::FuncWithRdram:
-            fmt::print(output_file, "{}(rdram, {}, {}, {});\n", func_text, imm_str, base_str, value_input);
+            print("{}(rdram, {}, {}, {});\n", func_text, imm_str, base_str, value_input);
             break;
         case StoreSyntax::Assignment:
-            fmt::print(output_file, "{}({}, {}) = {};\n", func_text, imm_str, base_str, value_input);
+            print("{}({}, {}) = {};\n", func_text, imm_str, base_str, value_input);
             break;
     }
 }
@@ -1,9 +1,11 @@
+#include <cstring>
 #include <iostream>
 
 #include <toml++/toml.hpp>
 #include "fmt/format.h"
 #include "config.h"
 #include "recompiler/context.h"
+#include "symbol_cache.h"
 
 std::filesystem::path concat_if_not_empty(const std::filesystem::path& parent, const std::filesystem::path& child) {
     if (!child.empty()) {
@@ -443,6 +445,27 @@ N64Recomp::Config::Config(const char* path) {
             functions_per_output_file = 50;
         }
 
+        // Split the output into files by instruction count instead of by function count, see plan_output_shards in main.cpp (optional)
+        std::optional<bool> balanced_output_files_opt = input_data["balanced_output_files"].value<bool>();
+        if (balanced_output_files_opt.has_value()) {
+            balanced_output_files = balanced_output_files_opt.value();
+        }
+        else {
+            balanced_output_files = false;
+        }
+
+        // Approximate number of instructions in each output file when balancing them (optional)
+        std::optional<int32_t> output_file_target_opt = input_data["output_file_target_instructions"].value<int32_t>();
+        if (output_file_target_opt.has_value()) {
+            output_file_target_instructions = output_file_target_opt.value();
+            if (output_file_target_instructions < 2) {
+                throw toml::parse_error("Invalid output_file_target_instructions value", input_data["output_file_target_instructions"].node()->source());
+            }
+        }
+        else {
+            output_file_target_instructions = 20000;
+        }
+
         // Patches section (optional)
         toml::node_view patches_data = config_data["patches"];
         if (patches_data.is_table()) {
@@ -476,6 +499,104 @@ N64Recomp::Config::Config(const char* path) {
             trace_mode = false;
         }
 
+        // Emit per-function call counters for profiling, along with recomp_profile.h and recomp_profile.c (optional)
+        std::optional<bool> profile_mode_opt = input_data["profile_mode"].value<bool>();
+        if (profile_mode_opt.has_value()) {
+            profile_mode = profile_mode_opt.value();
+            if (profile_mode) {
+                recomp_include += "\n#include \"recomp_profile.h\"";
+            }
+        }
+        else {
+            profile_mode = false;
+        }
+
+        // Also sample the cycles spent in each function when profiling (optional)
+        std::optional<bool> profile_cycles_opt = input_data["profile_cycles"].value<bool>();
+        if (profile_cycles_opt.has_value()) {
+            profile_cycles = profile_cycles_opt.value();
+        }
+        else {
+            profile_cycles = false;
+        }
+
+        // Emit dense per-section dispatch tables and use the runtime's inline dispatch table lookup (optional)
+        std::optional<bool> dispatch_tables_opt = input_data["dispatch_tables"].value<bool>();
+        if (dispatch_tables_opt.has_value()) {
+            dispatch_tables = dispatch_tables_opt.value();
+            if (dispatch_tables) {
+                recomp_include = "#define RECOMP_DISPATCH_TABLE\n" + recomp_include;
+            }
+        }
+        else {
+            dispatch_tables = false;
+        }
+
+        // Run the optimization pass on functions before generating code for them (optional)
+        std::optional<bool> optimize_output_opt = input_data["optimize_output"].value<bool>();
+        if (optimize_output_opt.has_value()) {
+            optimize_output = optimize_output_opt.value();
+        }
+        else {
+            optimize_output = false;
+        }
+
+        // Emit every FPU register mode and NaN check instead of omitting the ones that an earlier check in the same block already covers (optional)
+        std::optional<bool> strict_fpu_checks_opt = input_data["strict_fpu_checks"].value<bool>();
+        if (strict_fpu_checks_opt.has_value()) {
+            strict_fpu_checks = strict_fpu_checks_opt.value();
+        }
+        else {
+            strict_fpu_checks = false;
+        }
+
+        // Load the addresses of the sections that each function's relocations use into locals instead of reading them at every use (optional)
+        std::optional<bool> hoist_section_addresses_opt = input_data["hoist_section_addresses"].value<bool>();
+        if (hoist_section_addresses_opt.has_value()) {
+            hoist_section_addresses = hoist_section_addresses_opt.value();
+        }
+        else {
+            hoist_section_addresses = false;
+        }
+
+        // Emit static inline copies of small leaf functions and call those instead of the originals, along with funcs_inline.h (optional)
+        // Calls to an inlined function don't go through any replacement that a mod registers for it at runtime, so any function that mods
+        // need to be able to replace has to be listed in inline_excluded_funcs.
+        std::optional<bool> inline_leaf_functions_opt = input_data["inline_leaf_functions"].value<bool>();
+        if (inline_leaf_functions_opt.has_value()) {
+            inline_leaf_functions = inline_leaf_functions_opt.value();
+            if (inline_leaf_functions) {
+                recomp_include += "\n#include \"funcs_inline.h\"";
+            }
+        }
+        else {
+            inline_leaf_functions = false;
+        }
+
+        // Maximum number of instructions in a function that gets inlined (optional)
+        std::optional<int32_t> inline_leaf_max_instructions_opt = input_data["inline_leaf_max_instructions"].value<int32_t>();
+        if (inline_leaf_max_instructions_opt.has_value()) {
+            inline_leaf_max_instructions = inline_leaf_max_instructions_opt.value();
+            if (inline_leaf_max_instructions <= 0) {
+                throw toml::parse_error("Invalid inline_leaf_max_instructions value", input_data["inline_leaf_max_instructions"].node()->source());
+            }
+        }
+        else {
+            inline_leaf_max_instructions = 16;
+        }
+
+        // Functions that never get inlined, which keeps runtime replacements of them working (optional)
+        toml::node_view inline_excluded_funcs_data = input_data["inline_excluded_funcs"];
+        if (inline_excluded_funcs_data.is_array()) {
+            const toml::array* array = inline_excluded_funcs_data.as_array();
+            inline_excluded_funcs.reserve(array->size());
+            array->for_each([this](auto&& el) {
+                if constexpr (toml::is_string<decltype(el)>) {
+                    inline_excluded_funcs.push_back(*el);
+                }
+            });
+        }
+
         // Function reference symbols file (optional)
         std::optional<std::string> func_reference_syms_file_opt = input_data["func_reference_syms_file"].value<std::string>();
         if (func_reference_syms_file_opt.has_value()) {
@@ -545,158 +666,214 @@ N64Recomp::RelocType reloc_type_from_name(const std::string& reloc_type_name) {
     return N64Recomp::RelocType::R_MIPS_NONE;
 }
 
-bool N64Recomp::Context::from_symbol_file(const std::filesystem::path& symbol_file_path, std::vector<uint8_t>&& rom, N64Recomp::Context& out, bool with_relocs) {
-    N64Recomp::Context ret{};
+// Parses a function symbol file. Relocs are always read so that the symbol cache can be shared between loads with and without relocs.
+static bool parse_function_symbols_toml(std::string_view contents, const std::filesystem::path& symbol_file_path, N64Recomp::SymbolFile& out) {
+    const toml::table config_data = toml::parse(contents, symbol_file_path.string());
+    const toml::node_view config_sections_value = config_data["section"];
 
-    try {
-        const toml::table config_data = toml::parse_file(symbol_file_path.u8string());
-        const toml::node_view config_sections_value = config_data["section"];
-
-        if (!config_sections_value.is_array()) {
-            return false;
-        }
-
-        const toml::array* config_sections = config_sections_value.as_array();
-        ret.section_functions.resize(config_sections->size());
+    if (!config_sections_value.is_array()) {
+        return false;
+    }
 
-        config_sections->for_each([&ret, &rom, with_relocs](auto&& el) {
-            if constexpr (toml::is_table<decltype(el)>) {
-                std::optional<uint32_t> rom_addr = el["rom"].template value<uint32_t>();
-                std::optional<uint32_t> vram_addr = el["vram"].template value<uint32_t>();
-                std::optional<uint32_t> size = el["size"].template value<uint32_t>();
-                std::optional<std::string> name = el["name"].template value<std::string>();
-                std::optional<uint32_t> got_ram_addr = el["got_address"].template value<uint32_t>();
-
-                if (!rom_addr.has_value() || !vram_addr.has_value() || !size.has_value() || !name.has_value()) {
-                    throw toml::parse_error("Section entry missing required field(s)", el.source());
-                }
+    const toml::array* config_sections = config_sections_value.as_array();
+    out.sections.reserve(config_sections->size());
 
-                uint16_t section_index = (uint16_t)ret.sections.size();
+    config_sections->for_each([&out](auto&& el) {
+        if constexpr (toml::is_table<decltype(el)>) {
+            std::optional<uint32_t> rom_addr = el["rom"].template value<uint32_t>();
+            std::optional<uint32_t> vram_addr = el["vram"].template value<uint32_t>();
+            std::optional<uint32_t> size = el["size"].template value<uint32_t>();
+            std::optional<std::string> name = el["name"].template value<std::string>();
+            std::optional<uint32_t> got_ram_addr = el["got_address"].template value<uint32_t>();
 
-                Section& section = ret.sections.emplace_back(Section{});
-                section.rom_addr = rom_addr.value();
-                section.ram_addr = vram_addr.value();
-                section.size = size.value();
-                section.name = name.value();
-                section.got_ram_addr = got_ram_addr;
-                section.executable = true;
+            if (!rom_addr.has_value() || !vram_addr.has_value() || !size.has_value() || !name.has_value()) {
+                throw toml::parse_error("Section entry missing required field(s)", el.source());
+            }
 
-                // Read functions for the section.
-                const toml::node_view cur_functions_value = el["functions"];
-                if (!cur_functions_value.is_array()) {
-                    throw toml::parse_error("Invalid functions array", cur_functions_value.node()->source());
-                }
+            N64Recomp::SymbolFileSection& section = out.sections.emplace_back(N64Recomp::SymbolFileSection{});
+            section.rom_addr = rom_addr.value();
+            section.ram_addr = vram_addr.value();
+            section.size = size.value();
+            section.name = name.value();
+            section.got_ram_addr = got_ram_addr;
+
+            // Read functions for the section.
+            const toml::node_view cur_functions_value = el["functions"];
+            if (!cur_functions_value.is_array()) {
+                throw toml::parse_error("Invalid functions array", cur_functions_value.node()->source());
+            }
 
-                const toml::array* cur_functions = cur_functions_value.as_array();
-                cur_functions->for_each([&ret, &rom, &section, section_index](auto&& func_el) {
-                    size_t function_index = ret.functions.size();
+            const toml::array* cur_functions = cur_functions_value.as_array();
+            section.functions.reserve(cur_functions->size());
+            cur_functions->for_each([&section](auto&& func_el) {
+                if constexpr (toml::is_table<decltype(func_el)>) {
+                    std::optional<std::string> name = func_el["name"].template value<std::string>();
+                    std::optional<uint32_t> vram_addr = func_el["vram"].template value<uint32_t>();
+                    std::optional<uint32_t> func_size = func_el["size"].template value<uint32_t>();
 
-                    if constexpr (toml::is_table<decltype(func_el)>) {
-                        std::optional<std::string> name = func_el["name"].template value<std::string>();
-                        std::optional<uint32_t> vram_addr = func_el["vram"].template value<uint32_t>();
-                        std::optional<uint32_t> func_size_ = func_el["size"].template value<uint32_t>();
+                    if (!name.has_value() || !vram_addr.has_value() || !func_size.has_value()) {
+                        throw toml::parse_error("Function symbol entry is missing required field(s)", func_el.source());
+                    }
 
-                        if (!name.has_value() || !vram_addr.has_value() || !func_size_.has_value()) {
-                            throw toml::parse_error("Function symbol entry is missing required field(s)", func_el.source());
-                        }
+                    uint32_t func_vram = vram_addr.value();
+                    uint32_t func_rom = func_vram - section.ram_addr + section.rom_addr.value();
 
-                        uint32_t func_size = func_size_.value();
+                    if (func_vram & 0b11) {
+                        // Function isn't word aligned in vram.
+                        throw toml::parse_error("Function's vram address isn't word aligned", func_el.source());
+                    }
 
-                        Function cur_func{};
-                        cur_func.name = name.value();
-                        cur_func.vram = vram_addr.value();
-                        cur_func.rom = cur_func.vram - section.ram_addr + section.rom_addr;
-                        cur_func.section_index = section_index;
+                    if (func_rom & 0b11) {
+                        // Function isn't word aligned in rom.
+                        throw toml::parse_error("Function's rom address isn't word aligned", func_el.source());
+                    }
 
-                        if (cur_func.vram & 0b11) {
-                            // Function isn't word aligned in vram.
-                            throw toml::parse_error("Function's vram address isn't word aligned", func_el.source());
+                    section.functions.emplace_back(N64Recomp::SymbolFileFunction{
+                        .name = std::move(name.value()),
+                        .vram = func_vram,
+                        .size = func_size.value()
+                    });
+                }
+                else {
+                    throw toml::parse_error("Invalid function symbol entry", func_el.source());
+                }
+            });
+
+            // Check if relocs exist for the section and read them if so.
+            const toml::node_view relocs_value = el["relocs"];
+            if (relocs_value.is_array()) {
+                // Mark the section as relocatable, since it has relocs.
+                section.has_relocs = true;
+
+                const toml::array* relocs_array = relocs_value.as_array();
+                section.relocs.reserve(relocs_array->size());
+                relocs_array->for_each([&section](auto&& reloc_el) {
+                    if constexpr (toml::is_table<decltype(reloc_el)>) {
+                        std::optional<uint32_t> vram = reloc_el["vram"].template value<uint32_t>();
+                        std::optional<uint32_t> target_vram = reloc_el["target_vram"].template value<uint32_t>();
+                        std::optional<std::string> type_string = reloc_el["type"].template value<std::string>();
+
+                        if (!vram.has_value() || !target_vram.has_value() || !type_string.has_value()) {
+                            throw toml::parse_error("Reloc entry missing required field(s)", reloc_el.source());
                         }
 
-                        if (cur_func.rom & 0b11) {
-                            // Function isn't word aligned in rom.
-                            throw toml::parse_error("Function's rom address isn't word aligned", func_el.source());
-                        }
+                        N64Recomp::RelocType reloc_type = reloc_type_from_name(type_string.value());
 
-                        // Read the function's words if a rom was provided.
-                        if (!rom.empty()) {
-                            if (cur_func.rom + func_size > rom.size()) {
-                                // Function is out of bounds of the provided rom.
-                                throw toml::parse_error("Function is out of bounds of the provided rom", func_el.source());
-                            }
-
-                            // Get the function's words from the rom.
-                            cur_func.words.reserve(func_size / sizeof(uint32_t));
-                            for (size_t rom_addr = cur_func.rom; rom_addr < cur_func.rom + func_size; rom_addr += sizeof(uint32_t)) {
-                                cur_func.words.push_back(*reinterpret_cast<const uint32_t*>(rom.data() + rom_addr));
-                            }
+                        if (reloc_type != N64Recomp::RelocType::R_MIPS_HI16 && reloc_type != N64Recomp::RelocType::R_MIPS_LO16 &&
+                            reloc_type != N64Recomp::RelocType::R_MIPS_26 && reloc_type != N64Recomp::RelocType::R_MIPS_32)
+                        {
+                            throw toml::parse_error("Invalid reloc entry type", reloc_el.source());
                         }
 
-                        section.function_addrs.push_back(cur_func.vram);
-                        ret.functions_by_name[cur_func.name] = function_index;
-                        ret.functions_by_vram[cur_func.vram].push_back(function_index);
-                        ret.section_functions[section_index].push_back(function_index);
-
-                        ret.functions.emplace_back(std::move(cur_func));
+                        section.relocs.emplace_back(N64Recomp::SymbolFileReloc{
+                            .vram = vram.value(),
+                            .target_vram = target_vram.value(),
+                            .type = reloc_type
+                        });
                     }
                     else {
-                        throw toml::parse_error("Invalid function symbol entry", func_el.source());
+                        throw toml::parse_error("Invalid reloc entry", reloc_el.source());
                     }
                 });
-
-                // Check if relocs exist for the section and read them if so.
-                const toml::node_view relocs_value = el["relocs"];
-                if (relocs_value.is_array()) {
-                    // Mark the section as relocatable, since it has relocs.
-                    section.relocatable = true;
-
-                    if (with_relocs) {
-                        // Read relocs for the section.
-                        const toml::array* relocs_array = relocs_value.as_array();
-                        relocs_array->for_each([&ret, &rom, &section, section_index](auto&& reloc_el) {
-                            if constexpr (toml::is_table<decltype(reloc_el)>) {
-                                std::optional<uint32_t> vram = reloc_el["vram"].template value<uint32_t>();
-                                std::optional<uint32_t> target_vram = reloc_el["target_vram"].template value<uint32_t>();
-                                std::optional<std::string> type_string = reloc_el["type"].template value<std::string>();
-
-                                if (!vram.has_value() || !target_vram.has_value() || !type_string.has_value()) {
-                                    throw toml::parse_error("Reloc entry missing required field(s)", reloc_el.source());
-                                }
-
-                                RelocType reloc_type = reloc_type_from_name(type_string.value());
-
-                                if (reloc_type != RelocType::R_MIPS_HI16 && reloc_type != RelocType::R_MIPS_LO16 && reloc_type != RelocType::R_MIPS_26 && reloc_type != RelocType::R_MIPS_32) {
-                                    throw toml::parse_error("Invalid reloc entry type", reloc_el.source());
-                                }
-
-                                Reloc cur_reloc{};
-                                cur_reloc.address = vram.value();
-                                cur_reloc.target_section_offset = target_vram.value() - section.ram_addr;
-                                cur_reloc.symbol_index = (uint32_t)-1;
-                                cur_reloc.target_section = section_index;
-                                cur_reloc.type = reloc_type;
-
-                                section.relocs.emplace_back(cur_reloc);
-                            }
-                            else {
-                                throw toml::parse_error("Invalid reloc entry", reloc_el.source());
-                            }
-                        });
-                    }
-                }
-                else {
-                    section.relocatable = false;
-                }
-            } else {
-                throw toml::parse_error("Invalid section entry", el.source());
             }
-        });
+            else {
+                section.has_relocs = false;
+            }
+        } else {
+            throw toml::parse_error("Invalid section entry", el.source());
+        }
+    });
+
+    return true;
+}
+
+bool N64Recomp::Context::from_symbol_file(const std::filesystem::path& symbol_file_path, N64Recomp::RomBuffer&& rom, N64Recomp::Context& out, bool with_relocs) {
+    N64Recomp::Context ret{};
+    N64Recomp::SymbolFile symbol_file{};
+
+    try {
+        auto parse_toml = [&symbol_file_path](std::string_view contents, N64Recomp::SymbolFile& parsed) {
+            return parse_function_symbols_toml(contents, symbol_file_path, parsed);
+        };
+        if (!N64Recomp::read_symbol_file_cached(symbol_file_path, N64Recomp::SymbolFileKind::Functions, parse_toml, symbol_file)) {
+            return false;
+        }
     }
     catch (const toml::parse_error& err) {
         std::cerr << "Syntax error parsing toml: " << *err.source().path << " (" << err.source().begin <<  "):\n" << err.description() << std::endl;
         return false;
     }
 
+    size_t num_functions = 0;
+    for (const N64Recomp::SymbolFileSection& section_in : symbol_file.sections) {
+        num_functions += section_in.functions.size();
+    }
+
+    ret.sections.reserve(symbol_file.sections.size());
+    ret.section_functions.resize(symbol_file.sections.size());
+    ret.functions.reserve(num_functions);
+    ret.functions_by_name.reserve(num_functions);
+    ret.functions_by_vram.reserve(num_functions);
+
+    for (N64Recomp::SymbolFileSection& section_in : symbol_file.sections) {
+        uint16_t section_index = (uint16_t)ret.sections.size();
+
+        Section& section = ret.sections.emplace_back(Section{});
+        section.rom_addr = section_in.rom_addr.value();
+        section.ram_addr = section_in.ram_addr;
+        section.size = section_in.size;
+        section.name = std::move(section_in.name);
+        section.got_ram_addr = section_in.got_ram_addr;
+        section.executable = true;
+        section.relocatable = section_in.has_relocs;
+        section.function_addrs.reserve(section_in.functions.size());
+
+        for (N64Recomp::SymbolFileFunction& func_in : section_in.functions) {
+            size_t function_index = ret.functions.size();
+
+            Function cur_func{};
+            cur_func.name = std::move(func_in.name);
+            cur_func.vram = func_in.vram;
+            cur_func.rom = cur_func.vram - section.ram_addr + section.rom_addr;
+            cur_func.section_index = section_index;
+
+            // Read the function's words if a rom was provided.
+            if (!rom.empty()) {
+                size_t num_words = (func_in.size + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+                if ((uint64_t)cur_func.rom + num_words * sizeof(uint32_t) > rom.size()) {
+                    // Function is out of bounds of the provided rom.
+                    fmt::print(stderr, "Function {} in {} is out of bounds of the provided rom\n", cur_func.name, symbol_file_path.string());
+                    return false;
+                }
+
+                // Get the function's words from the rom.
+                cur_func.words.resize(num_words);
+                memcpy(cur_func.words.data(), rom.data() + cur_func.rom, cur_func.words.size() * sizeof(uint32_t));
+            }
+
+            section.function_addrs.push_back(cur_func.vram);
+            ret.functions_by_name[cur_func.name] = function_index;
+            ret.functions_by_vram[cur_func.vram].push_back(function_index);
+            ret.section_functions[section_index].push_back(function_index);
+
+            ret.functions.emplace_back(std::move(cur_func));
+        }
+
+        if (with_relocs) {
+            section.relocs.reserve(section_in.relocs.size());
+            for (const N64Recomp::SymbolFileReloc& reloc_in : section_in.relocs) {
+                Reloc cur_reloc{};
+                cur_reloc.address = reloc_in.vram;
+                cur_reloc.target_section_offset = reloc_in.target_vram - section.ram_addr;
+                cur_reloc.symbol_index = (uint32_t)-1;
+                cur_reloc.target_section = section_index;
+                cur_reloc.type = reloc_in.type;
+
+                section.relocs.emplace_back(cur_reloc);
+            }
+        }
+    }
+
     ret.rom = std::move(rom);
     out = std::move(ret);
     return true;
@@ -727,109 +904,141 @@ bool N64Recomp::Context::import_reference_context(const N64Recomp::Context& refe
     return true;
 }
 
-// Reads a data symbol file and adds its contents into this context's reference data symbols.
-bool N64Recomp::Context::read_data_reference_syms(const std::filesystem::path& data_syms_file_path) {
-    try {
-        const toml::table data_syms_file_data = toml::parse_file(data_syms_file_path.u8string());
-        const toml::node_view data_sections_value = data_syms_file_data["section"];
+// Parses a data symbol file. The section matching against the function reference symbols happens afterwards,
+// as it depends on the context rather than just the file's contents.
+static bool parse_data_symbols_toml(std::string_view contents, const std::filesystem::path& data_syms_file_path, N64Recomp::SymbolFile& out) {
+    const toml::table data_syms_file_data = toml::parse(contents, data_syms_file_path.string());
+    const toml::node_view data_sections_value = data_syms_file_data["section"];
 
-        if (!data_sections_value.is_array()) {
-            return false;
-        }
+    if (!data_sections_value.is_array()) {
+        return false;
+    }
 
-        // Create a mapping of rom address to section to ensure that the same section indexes are used for both function and data reference symbols.
-        std::unordered_map<uint32_t, uint16_t> ref_section_indices_by_vrom;
+    const toml::array* data_sections = data_sections_value.as_array();
+    out.sections.reserve(data_sections->size());
 
-        for (uint16_t section_index = 0; section_index < reference_sections.size(); section_index++) {
-            ref_section_indices_by_vrom.emplace(reference_sections[section_index].rom_addr, section_index);
-        }
-        
-        const toml::array* data_sections = data_sections_value.as_array();
-        
-        data_sections->for_each([this, &ref_section_indices_by_vrom](auto&& el) {
-            if constexpr (toml::is_table<decltype(el)>) {
-                std::optional<uint64_t> rom_addr = el["rom"].template value<uint64_t>();
-                std::optional<uint32_t> vram_addr = el["vram"].template value<uint32_t>();
-                std::optional<uint32_t> size = el["size"].template value<uint32_t>();
-                std::optional<std::string> name = el["name"].template value<std::string>();
+    data_sections->for_each([&out](auto&& el) {
+        if constexpr (toml::is_table<decltype(el)>) {
+            std::optional<uint64_t> rom_addr = el["rom"].template value<uint64_t>();
+            std::optional<uint32_t> vram_addr = el["vram"].template value<uint32_t>();
+            std::optional<uint32_t> size = el["size"].template value<uint32_t>();
+            std::optional<std::string> name = el["name"].template value<std::string>();
 
-                if (!vram_addr.has_value() || !size.has_value() || !name.has_value()) {
-                    throw toml::parse_error("Section entry missing required field(s)", el.source());
-                }
+            if (!vram_addr.has_value() || !size.has_value() || !name.has_value()) {
+                throw toml::parse_error("Section entry missing required field(s)", el.source());
+            }
 
-                uint16_t ref_section_index;
-                if (!rom_addr.has_value()) {
-                    ref_section_index = N64Recomp::SectionAbsolute; // Non-relocatable bss section or absolute symbols, mark this as an absolute symbol
-                }
-                else if (rom_addr.value() > 0xFFFFFFFF) {
-                    throw toml::parse_error("Section has invalid ROM address", el.source());
-                }
-                else {
-                    // Find the matching section from the function reference symbol file to ensure 
-                    auto find_section_it = ref_section_indices_by_vrom.find(rom_addr.value());
-                    if (find_section_it != ref_section_indices_by_vrom.end()) {
-                        ref_section_index = find_section_it->second;
-                    }
-                    else {
-                        ref_section_index = N64Recomp::SectionAbsolute; // Not in the function symbol reference file, so this section can be treated as non-relocatable.
-                    }
-                }
+            if (rom_addr.has_value() && rom_addr.value() > 0xFFFFFFFF) {
+                throw toml::parse_error("Section has invalid ROM address", el.source());
+            }
 
-                static ReferenceSection dummy_absolute_section {
-                    .rom_addr = 0,
-                    .ram_addr = 0,
-                    .size = 0,
-                    .relocatable = 0
-                };
-                const ReferenceSection& ref_section = ref_section_index == N64Recomp::SectionAbsolute ? dummy_absolute_section : this->reference_sections[ref_section_index];
-
-                // Sanity check this section against the matching one in the function reference symbol file if one exists.
-                if (ref_section_index != N64Recomp::SectionAbsolute) {
-                    if (ref_section.ram_addr != vram_addr.value()) {
-                        throw toml::parse_error("Section vram address differs from matching ROM address section in the function symbol reference file", el.source());
-                    }
+            N64Recomp::SymbolFileSection& section = out.sections.emplace_back(N64Recomp::SymbolFileSection{});
+            if (rom_addr.has_value()) {
+                section.rom_addr = static_cast<uint32_t>(rom_addr.value());
+            }
+            section.ram_addr = vram_addr.value();
+            section.size = size.value();
+            section.name = name.value();
+            section.has_relocs = false;
+
+            // Read functions for the section.
+            const toml::node_view cur_symbols_value = el["symbols"];
+            if (!cur_symbols_value.is_array()) {
+                throw toml::parse_error("Invalid symbols array", cur_symbols_value.node()->source());
+            }
+
+            const toml::array* cur_symbols = cur_symbols_value.as_array();
+            section.functions.reserve(cur_symbols->size());
+            cur_symbols->for_each([&section](auto&& data_sym_el) {
+                if constexpr (toml::is_table<decltype(data_sym_el)>) {
+                    std::optional<std::string> name = data_sym_el["name"].template value<std::string>();
+                    std::optional<uint32_t> vram_addr = data_sym_el["vram"].template value<uint32_t>();
 
-                    if (ref_section.size != size.value()) {
-                        throw toml::parse_error("Section size address differs from matching ROM address section in the function symbol reference file", el.source());
+                    if (!name.has_value() || !vram_addr.has_value()) {
+                        throw toml::parse_error("Reference data symbol entry is missing required field(s)", data_sym_el.source());
                     }
-                }
 
-                // Read functions for the section.
-                const toml::node_view cur_symbols_value = el["symbols"];
-                if (!cur_symbols_value.is_array()) {
-                    throw toml::parse_error("Invalid symbols array", cur_symbols_value.node()->source());
+                    section.functions.emplace_back(N64Recomp::SymbolFileFunction{
+                        .name = std::move(name.value()),
+                        .vram = vram_addr.value(),
+                        .size = 0
+                    });
                 }
+                else {
+                    throw toml::parse_error("Invalid data symbol entry", data_sym_el.source());
+                }
+            });
+        } else {
+            throw toml::parse_error("Invalid section entry", el.source());
+        }
+    });
 
-                uint32_t ref_section_vram = ref_section.ram_addr;
-                const toml::array* cur_symbols = cur_symbols_value.as_array();
-                cur_symbols->for_each([this, ref_section_index, ref_section_vram](auto&& data_sym_el) {
-                    
-                    if constexpr (toml::is_table<decltype(data_sym_el)>) {
-                        std::optional<std::string> name = data_sym_el["name"].template value<std::string>();
-                        std::optional<uint32_t> vram_addr = data_sym_el["vram"].template value<uint32_t>();
+    return true;
+}
 
-                        if (!name.has_value() || !vram_addr.has_value()) {
-                            throw toml::parse_error("Reference data symbol entry is missing required field(s)", data_sym_el.source());
-                        }
+// Reads a data symbol file and adds its contents into this context's reference data symbols.
+bool N64Recomp::Context::read_data_reference_syms(const std::filesystem::path& data_syms_file_path) {
+    N64Recomp::SymbolFile symbol_file{};
 
-                        if (!this->add_reference_symbol(name.value(), ref_section_index, vram_addr.value(), false)) {
-                            throw toml::parse_error("Internal error: Failed to add reference symbol to context. Please report this issue.", data_sym_el.source());
-                        }
-                    }
-                    else {
-                        throw toml::parse_error("Invalid data symbol entry", data_sym_el.source());
-                    }
-                });
-            } else {
-                throw toml::parse_error("Invalid section entry", el.source());
-            }
-        });
+    try {
+        auto parse_toml = [&data_syms_file_path](std::string_view contents, N64Recomp::SymbolFile& parsed) {
+            return parse_data_symbols_toml(contents, data_syms_file_path, parsed);
+        };
+        if (!N64Recomp::read_symbol_file_cached(data_syms_file_path, N64Recomp::SymbolFileKind::Data, parse_toml, symbol_file)) {
+            return false;
+        }
     }
     catch (const toml::parse_error& err) {
         std::cerr << "Syntax error parsing toml: " << *err.source().path << " (" << err.source().begin <<  "):\n" << err.description() << std::endl;
         return false;
     }
 
+    // Create a mapping of rom address to section to ensure that the same section indexes are used for both function and data reference symbols.
+    std::unordered_map<uint32_t, uint16_t> ref_section_indices_by_vrom;
+
+    for (uint16_t section_index = 0; section_index < reference_sections.size(); section_index++) {
+        ref_section_indices_by_vrom.emplace(reference_sections[section_index].rom_addr, section_index);
+    }
+
+    for (const N64Recomp::SymbolFileSection& section : symbol_file.sections) {
+        uint16_t ref_section_index;
+        if (!section.rom_addr.has_value()) {
+            ref_section_index = N64Recomp::SectionAbsolute; // Non-relocatable bss section or absolute symbols, mark this as an absolute symbol
+        }
+        else {
+            // Find the matching section from the function reference symbol file to ensure 
+            auto find_section_it = ref_section_indices_by_vrom.find(section.rom_addr.value());
+            if (find_section_it != ref_section_indices_by_vrom.end()) {
+                ref_section_index = find_section_it->second;
+            }
+            else {
+                ref_section_index = N64Recomp::SectionAbsolute; // Not in the function symbol reference file, so this section can be treated as non-relocatable.
+            }
+        }
+
+        // Sanity check this section against the matching one in the function reference symbol file if one exists.
+        if (ref_section_index != N64Recomp::SectionAbsolute) {
+            const ReferenceSection& ref_section = reference_sections[ref_section_index];
+            if (ref_section.ram_addr != section.ram_addr) {
+                fmt::print(stderr, "Section {} in {}: Section vram address differs from matching ROM address section in the function symbol reference file\n",
+                    section.name, data_syms_file_path.string());
+                return false;
+            }
+
+            if (ref_section.size != section.size) {
+                fmt::print(stderr, "Section {} in {}: Section size address differs from matching ROM address section in the function symbol reference file\n",
+                    section.name, data_syms_file_path.string());
+                return false;
+            }
+        }
+
+        for (const N64Recomp::SymbolFileFunction& data_sym : section.functions) {
+            if (!add_reference_symbol(data_sym.name, ref_section_index, data_sym.vram, false)) {
+                fmt::print(stderr, "Internal error: Failed to add reference symbol {} to context. Please report this issue.\n", data_sym.name);
+                return false;
+            }
+        }
+    }
+
     return true;
 }
-
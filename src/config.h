@@ -38,6 +38,8 @@ namespace N64Recomp {
     struct Config {
         int32_t entrypoint;
         int32_t functions_per_output_file;
+        bool balanced_output_files;
+        int32_t output_file_target_instructions;
         bool has_entrypoint;
         bool uses_mips3_float_mode;
         bool single_file_output;
@@ -45,8 +47,17 @@ namespace N64Recomp {
         bool unpaired_lo16_warnings;
         bool use_mdebug;
         bool trace_mode;
+        bool profile_mode;
+        bool profile_cycles;
         bool allow_exports;
         bool strict_patch_mode;
+        bool dispatch_tables;
+        bool optimize_output;
+        bool strict_fpu_checks;
+        bool hoist_section_addresses;
+        bool inline_leaf_functions;
+        int32_t inline_leaf_max_instructions;
+        std::vector<std::string> inline_excluded_funcs;
         std::filesystem::path elf_path;
         std::filesystem::path symbols_file_path;
         std::filesystem::path func_reference_syms_file_path;
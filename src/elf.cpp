@@ -335,7 +335,7 @@ ELFIO::section* read_sections(N64Recomp::Context& context, ELFIO::section*& mdeb
                 context.rom.resize(required_rom_size);
             }
             // Copy this section's data into the rom.
-            std::copy(section->get_data(), section->get_data() + section->get_size(), &context.rom[section_out.rom_addr]);
+            std::copy(section->get_data(), section->get_data() + section->get_size(), context.rom.mutable_data() + section_out.rom_addr);
         }
         // Check if this section is marked as executable, which means it has code in it
         if (section->get_flags() & ELFIO::SHF_EXECINSTR) {
@@ -554,7 +554,7 @@ ELFIO::section* read_sections(N64Recomp::Context& context, ELFIO::section*& mdeb
                             uint32_t reloc_target_section_addr = context.get_reference_section_vram(reloc_out.target_section);
                             // Patch the word in the ROM to incorporate the symbol's value.
                             uint32_t updated_reloc_word = reloc_rom_word + reloc_target_section_addr + reloc_out.target_section_offset;
-                            *reinterpret_cast<uint32_t*>(context.rom.data() + reloc_rom_addr) = byteswap(updated_reloc_word);
+                            *reinterpret_cast<uint32_t*>(context.rom.mutable_data() + reloc_rom_addr) = byteswap(updated_reloc_word);
                         }
                     }
 
@@ -602,7 +602,7 @@ ELFIO::section* read_sections(N64Recomp::Context& context, ELFIO::section*& mdeb
                             imm = full_immediate & 0xFFFF;
                         }
 
-                        *reinterpret_cast<uint32_t*>(context.rom.data() + reloc_rom_addr) = byteswap(reloc_rom_word | imm);
+                        *reinterpret_cast<uint32_t*>(context.rom.mutable_data() + reloc_rom_addr) = byteswap(reloc_rom_word | imm);
                         // Remove the reloc by setting it to a type of NONE.
                         reloc.type = N64Recomp::RelocType::R_MIPS_NONE;
                         reloc.reference_symbol = false;
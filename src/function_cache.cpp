@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+
+#include "fmt/format.h"
+
+#include "function_cache.h"
+#include "recompiler/hasher.h"
+
+// Set by the build from the git revision, see CMakeLists.txt.
+#ifndef N64RECOMP_BUILD_ID
+#define N64RECOMP_BUILD_ID "unknown"
+#endif
+
+struct CacheEntryHeader {
+    char magic[8]; // N64RCACH
+    uint32_t version;
+    uint32_t num_static_funcs;
+    uint64_t key;
+    uint32_t num_data_ranges;
+    uint32_t padding;
+    uint64_t data_hash;
+    uint64_t text_size;
+};
+
+struct CacheDataRange {
+    uint32_t rom_addr;
+    uint32_t size;
+};
+
+static const char cache_entry_magic[] = {'N','6','4','R','C','A','C','H'};
+static_assert(sizeof(cache_entry_magic) == sizeof(CacheEntryHeader::magic));
+
+// Hashes the ROM contents of the given ranges. Returns false if any range is out of bounds.
+static bool hash_data_ranges(std::span<const uint8_t> rom, std::span<const CacheDataRange> ranges, uint64_t& hash_out) {
+    N64Recomp::Hasher hasher{};
+    for (const CacheDataRange& range : ranges) {
+        if ((uint64_t)range.rom_addr + range.size > rom.size()) {
+            return false;
+        }
+        hasher.add(range.rom_addr);
+        hasher.add_bytes(rom.data() + range.rom_addr, range.size);
+    }
+    hash_out = hasher.get();
+    return true;
+}
+
+N64Recomp::FunctionCache::FunctionCache(const std::filesystem::path& cache_dir, const Context& context, const Config& config) : cache_dir(cache_dir), context(context) {
+    std::error_code ec;
+    std::filesystem::create_directories(cache_dir, ec);
+    if (ec) {
+        fmt::print(stderr, "Failed to create cache directory {}: {}\n", cache_dir.string(), ec.message());
+        return;
+    }
+
+    Hasher hasher{};
+    hasher.add(cache_version);
+    hasher.add_string(N64RECOMP_BUILD_ID);
+    hasher.add(context.trace_mode);
+    hasher.add(context.profile_mode);
+    hasher.add(context.optimize_codegen);
+    hasher.add(context.strict_fpu_checks);
+    hasher.add(context.hoist_section_addresses);
+    hasher.add(context.use_lookup_for_all_function_calls);
+    hasher.add(context.skip_validating_reference_symbols);
+    hasher.add(config.uses_mips3_float_mode);
+    base_hash = hasher.get();
+
+    bad = false;
+}
+
+uint64_t N64Recomp::FunctionCache::get_function_key(size_t func_index) const {
+    const Function& func = context.functions[func_index];
+    const Section& section = context.sections[func.section_index];
+    uint32_t func_vram_end = func.vram + func.words.size() * sizeof(func.words[0]);
+
+    Hasher hasher{};
+    hasher.add(base_hash);
+
+    // The function itself.
+    hasher.add_string(func.name);
+    hasher.add(func.vram);
+    hasher.add(func.rom);
+    hasher.add(func.section_index);
+    hasher.add(func.stubbed);
+    hasher.add_bytes(func.words.data(), func.words.size() * sizeof(func.words[0]));
+
+    // Hooks, sorted by instruction index so the key doesn't depend on the map's iteration order.
+    std::vector<std::pair<int32_t, const std::string*>> hooks{};
+    hooks.reserve(func.function_hooks.size());
+    for (const auto& [instruction_index, text] : func.function_hooks) {
+        hooks.emplace_back(instruction_index, &text);
+    }
+    std::sort(hooks.begin(), hooks.end());
+    for (const auto& [instruction_index, text] : hooks) {
+        hasher.add((uint32_t)instruction_index);
+        hasher.add_string(*text);
+    }
+
+    // The parts of the section that analysis and reloc handling depend on.
+    hasher.add(section.ram_addr);
+    hasher.add(section.got_ram_addr.has_value());
+    hasher.add(section.got_ram_addr.value_or(0));
+
+    // Relocs that fall inside the function, along with the properties of their targets that affect codegen.
+    auto reloc_it = section.relocs.begin() + section.find_first_reloc(func.vram);
+    for (; reloc_it != section.relocs.end() && reloc_it->address < func_vram_end; ++reloc_it) {
+        const Reloc& reloc = *reloc_it;
+        hasher.add(reloc.address);
+        hasher.add(reloc.target_section_offset);
+        hasher.add(reloc.symbol_index);
+        hasher.add(reloc.target_section);
+        hasher.add((uint8_t)reloc.type);
+        hasher.add(reloc.reference_symbol);
+
+        if (reloc.reference_symbol) {
+            hasher.add(context.is_reference_section_relocatable(reloc.target_section));
+            if (context.is_regular_reference_section(reloc.target_section) && reloc.symbol_index < context.num_regular_reference_symbols()) {
+                const ReferenceSymbol& sym = context.get_regular_reference_symbol(reloc.symbol_index);
+                hasher.add_string(sym.name);
+                hasher.add(sym.section_offset);
+            }
+        }
+        else if (reloc.target_section < context.sections.size()) {
+            const Section& target_section = context.sections[reloc.target_section];
+            hasher.add(target_section.relocatable);
+            // Jal resolution for R_MIPS_26 relocs happens relative to the target section.
+            if (reloc.type == RelocType::R_MIPS_26) {
+                hasher.add(target_section.ram_addr);
+                hasher.add(target_section.size);
+            }
+            auto find_bss_it = context.bss_section_to_section.find(reloc.target_section);
+            if (find_bss_it != context.bss_section_to_section.end()) {
+                hasher.add(find_bss_it->second);
+            }
+        }
+    }
+
+    // Every function that this one can call or branch to. The instructions are decoded directly from the words instead of being
+    // disassembled, as only the jump and branch targets are needed.
+    auto hash_target = [&](uint32_t target_vram) {
+        hasher.add(target_vram);
+        hasher.add(target_vram >= section.ram_addr && target_vram < section.ram_addr + section.size);
+        for (size_t target_func_index : context.get_functions_at_vram(target_vram)) {
+            const Function& target_func = context.functions[target_func_index];
+            hasher.add_string(target_func.name);
+            hasher.add(target_func.section_index);
+            hasher.add(target_func.words.empty());
+            hasher.add(context.sections[target_func.section_index].relocatable);
+            hasher.add(context.is_function_inlinable(target_func_index));
+        }
+    };
+
+    uint32_t vram = func.vram;
+    for (uint32_t word : func.words) {
+        uint32_t instr = byteswap(word);
+        uint32_t opcode = instr >> 26;
+        uint32_t rs = (instr >> 21) & 0x1F;
+
+        // j and jal
+        if (opcode == 0x02 || opcode == 0x03) {
+            hash_target((vram & 0xF0000000) | ((instr & 0x03FFFFFF) << 2));
+        }
+        // regimm branches, beq/bne/blez/bgtz and their likely variants, bc1 branches
+        else if (opcode == 0x01 || (opcode >= 0x04 && opcode <= 0x07) || (opcode >= 0x14 && opcode <= 0x17) || (opcode == 0x11 && rs == 0x08)) {
+            uint32_t target_vram = vram + 4 + ((int32_t)(int16_t)(instr & 0xFFFF) << 2);
+            if (target_vram < func.vram || target_vram >= func_vram_end) {
+                hash_target(target_vram);
+            }
+        }
+
+        vram += 4;
+    }
+
+    return hasher.get();
+}
+
+std::filesystem::path N64Recomp::FunctionCache::get_entry_path(uint64_t key) const {
+    return cache_dir / fmt::format("{:016X}.bin", key);
+}
+
+void N64Recomp::FunctionCache::mark_used(uint64_t key) {
+    std::lock_guard lock{ mutex };
+    used_keys.emplace(key);
+}
+
+bool N64Recomp::FunctionCache::load(uint64_t key, std::string& text_out, std::vector<uint32_t>& static_funcs_out) {
+    auto miss = [this]() {
+        std::lock_guard lock{ mutex };
+        misses++;
+        return false;
+    };
+
+    std::ifstream entry_file{ get_entry_path(key), std::ios::binary };
+    if (!entry_file.good()) {
+        return miss();
+    }
+
+    CacheEntryHeader header{};
+    entry_file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!entry_file.good() || memcmp(header.magic, cache_entry_magic, sizeof(cache_entry_magic)) != 0 ||
+        header.version != cache_version || header.key != key)
+    {
+        return miss();
+    }
+
+    std::vector<uint32_t> static_funcs(header.num_static_funcs);
+    std::vector<CacheDataRange> data_ranges(header.num_data_ranges);
+    std::string text(header.text_size, '\0');
+    entry_file.read(reinterpret_cast<char*>(static_funcs.data()), static_funcs.size() * sizeof(static_funcs[0]));
+    entry_file.read(reinterpret_cast<char*>(data_ranges.data()), data_ranges.size() * sizeof(data_ranges[0]));
+    entry_file.read(text.data(), text.size());
+    if (!entry_file.good()) {
+        return miss();
+    }
+
+    // Make sure the data that the function's jump tables were read from hasn't changed.
+    uint64_t data_hash;
+    if (!hash_data_ranges(context.rom, data_ranges, data_hash) || data_hash != header.data_hash) {
+        return miss();
+    }
+
+    text_out = std::move(text);
+    static_funcs_out = std::move(static_funcs);
+
+    std::lock_guard lock{ mutex };
+    used_keys.emplace(key);
+    hits++;
+    return true;
+}
+
+bool N64Recomp::FunctionCache::store(uint64_t key, size_t func_index, std::string_view text, std::span<const uint32_t> static_funcs, std::span<const JumpTable> jump_tables) {
+    mark_used(key);
+
+    const Function& func = context.functions[func_index];
+    const Section& section = context.sections[func.section_index];
+
+    // Record the ROM ranges that analysis read while finding the jump tables. This covers each table's entries, the word after
+    // the last entry since that's what ended the table, and the GOT entry for position independent jump tables.
+    std::vector<CacheDataRange> data_ranges{};
+    for (const JumpTable& jtbl : jump_tables) {
+        uint64_t jtbl_size = (jtbl.entries.size() + 1) * sizeof(uint32_t);
+        jtbl_size = std::min<uint64_t>(jtbl_size, context.rom.size() - std::min<uint64_t>(jtbl.rom, context.rom.size()));
+        data_ranges.emplace_back(CacheDataRange{ .rom_addr = jtbl.rom, .size = (uint32_t)jtbl_size });
+        if (jtbl.got_offset.has_value() && section.got_ram_addr.has_value()) {
+            uint32_t got_rom_addr = section.got_ram_addr.value() + func.rom - func.vram;
+            data_ranges.emplace_back(CacheDataRange{ .rom_addr = got_rom_addr + jtbl.got_offset.value(), .size = sizeof(uint32_t) });
+        }
+    }
+
+    CacheEntryHeader header{};
+    memcpy(header.magic, cache_entry_magic, sizeof(cache_entry_magic));
+    header.version = cache_version;
+    header.num_static_funcs = (uint32_t)static_funcs.size();
+    header.key = key;
+    header.num_data_ranges = (uint32_t)data_ranges.size();
+    header.text_size = text.size();
+    if (!hash_data_ranges(context.rom, data_ranges, header.data_hash)) {
+        return false;
+    }
+
+    // Write to a temporary file and then rename it so that an interrupted run can't leave a partial entry behind.
+    std::filesystem::path entry_path = get_entry_path(key);
+    std::filesystem::path temp_path = entry_path;
+    temp_path.replace_extension(".tmp");
+    {
+        std::ofstream entry_file{ temp_path, std::ios::binary };
+        if (!entry_file.good()) {
+            return false;
+        }
+        entry_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        entry_file.write(reinterpret_cast<const char*>(static_funcs.data()), static_funcs.size() * sizeof(static_funcs[0]));
+        entry_file.write(reinterpret_cast<const char*>(data_ranges.data()), data_ranges.size() * sizeof(data_ranges[0]));
+        entry_file.write(text.data(), text.size());
+        if (!entry_file.good()) {
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, entry_path, ec);
+    return !ec;
+}
+
+void N64Recomp::FunctionCache::remove_unused_entries() {
+    std::error_code ec;
+    for (const auto& dir_entry : std::filesystem::directory_iterator{ cache_dir, ec }) {
+        const std::filesystem::path& entry_path = dir_entry.path();
+        uint64_t key;
+        std::string stem = entry_path.stem().string();
+        auto parse_result = std::from_chars(stem.data(), stem.data() + stem.size(), key, 16);
+        bool is_entry = entry_path.extension() == ".bin" && parse_result.ec == std::errc{} && parse_result.ptr == stem.data() + stem.size();
+        if (is_entry && !used_keys.contains(key)) {
+            std::filesystem::remove(entry_path, ec);
+        }
+    }
+}
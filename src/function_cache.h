@@ -0,0 +1,62 @@
+#ifndef __RECOMP_FUNCTION_CACHE_H__
+#define __RECOMP_FUNCTION_CACHE_H__
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "recompiler/context.h"
+#include "config.h"
+
+namespace N64Recomp {
+    // Persistent on-disk cache of recompiled function output, used to skip recompiling functions that haven't changed since the last run.
+    // Each entry is keyed by a hash of everything that affects the function's generated code: its words, hooks, the relocs that fall inside it,
+    // the functions it can call or branch to, the codegen-related config flags, the cache version and the build identifier (N64RECOMP_BUILD_ID
+    // from CMakeLists.txt, which is derived from the git revision the recompiler was built from). Jump tables are read from ROM data outside
+    // of the function, so entries also record the ranges they were read from along with a hash of that data.
+    // Entries also store the static functions discovered while recompiling so that a cache hit can report them like a real recompilation would.
+    class FunctionCache {
+    public:
+        // Bump this whenever the format of the cache entries changes. Changes to the generated output are covered by the build identifier,
+        // except in builds from outside of a git checkout or from uncommitted changes.
+        static constexpr uint32_t cache_version = 1;
+
+        // Must be created after the context is finalized, as the keys are based on its contents. The context must outlive the cache.
+        FunctionCache(const std::filesystem::path& cache_dir, const Context& context, const Config& config);
+        bool good() const { return !bad; }
+
+        // Calculates the cache key for the given function. Safe to call from multiple threads.
+        uint64_t get_function_key(size_t func_index) const;
+        // Looks up the output for the given key and marks the entry as used. Returns false if there's no entry or if the ROM data
+        // that the function's jump tables were read from has changed. Safe to call from multiple threads.
+        bool load(uint64_t key, std::string& text_out, std::vector<uint32_t>& static_funcs_out);
+        // Writes an entry for the given function and key and marks it as used. The jump tables are the ones found while recompiling the function,
+        // which are used to validate the entry against the ROM contents in later runs. Safe to call from multiple threads.
+        bool store(uint64_t key, size_t func_index, std::string_view text, std::span<const uint32_t> static_funcs, std::span<const JumpTable> jump_tables);
+        // Deletes all entries that weren't used during this run.
+        void remove_unused_entries();
+
+        size_t num_hits() const { return hits; }
+        size_t num_misses() const { return misses; }
+    private:
+        std::filesystem::path get_entry_path(uint64_t key) const;
+        void mark_used(uint64_t key);
+
+        std::filesystem::path cache_dir;
+        const Context& context;
+        // Hash of everything that's shared between all functions.
+        uint64_t base_hash = 0;
+        std::mutex mutex;
+        std::unordered_set<uint64_t> used_keys;
+        size_t hits = 0;
+        size_t misses = 0;
+        bool bad = true;
+    };
+}
+
+#endif
@@ -5,21 +5,32 @@
 #include <span>
 #include <filesystem>
 #include <optional>
+#include <atomic>
+#include <thread>
+#include <charconv>
+#include <chrono>
 
 #include "rabbitizer.hpp"
 #include "fmt/format.h"
 #include "fmt/ostream.h"
 
 #include "recompiler/context.h"
+#include "recompiler/generator.h"
 #include "config.h"
+#include "function_cache.h"
+#include "recompiler/hasher.h"
+#include "phase_stats.h"
 #include <set>
 
-void add_manual_functions(N64Recomp::Context& context, const std::vector<N64Recomp::ManualFunction>& manual_funcs) {
-    auto exit_failure = [](const std::string& error_str) {
-        fmt::vprint(stderr, error_str, fmt::make_format_args());
-        std::exit(EXIT_FAILURE);
-    };
+// Thrown by fail_run to abandon the current run. A normal run then exits with a failure code, while watch mode waits for the next change.
+struct RunFailure {};
 
+[[noreturn]] void fail_run(const std::string& error_str) {
+    fmt::vprint(stderr, error_str, fmt::make_format_args());
+    throw RunFailure{};
+}
+
+void add_manual_functions(N64Recomp::Context& context, const std::vector<N64Recomp::ManualFunction>& manual_funcs) {
     // Build a lookup from section name to section index.
     std::unordered_map<std::string, size_t> section_indices_by_name{};
     section_indices_by_name.reserve(context.sections.size());
@@ -31,17 +42,17 @@ void add_manual_functions(N64Recomp::Context& context, const std::vector<N64Reco
     for (const N64Recomp::ManualFunction& cur_func_def : manual_funcs) {
         const auto section_find_it = section_indices_by_name.find(cur_func_def.section_name);
         if (section_find_it == section_indices_by_name.end()) {
-            exit_failure(fmt::format("Manual function {} specified with section {}, which doesn't exist!\n", cur_func_def.func_name, cur_func_def.section_name));
+            fail_run(fmt::format("Manual function {} specified with section {}, which doesn't exist!\n", cur_func_def.func_name, cur_func_def.section_name));
         }
         size_t section_index = section_find_it->second;
 
         const auto func_find_it = context.functions_by_name.find(cur_func_def.func_name);
         if (func_find_it != context.functions_by_name.end()) {
-            exit_failure(fmt::format("Manual function {} already exists!\n", cur_func_def.func_name));
+            fail_run(fmt::format("Manual function {} already exists!\n", cur_func_def.func_name));
         }
 
         if ((cur_func_def.size & 0b11) != 0) {
-            exit_failure(fmt::format("Manual function {} has a size that isn't divisible by 4!\n", cur_func_def.func_name));
+            fail_run(fmt::format("Manual function {} has a size that isn't divisible by 4!\n", cur_func_def.func_name));
         }
 
         auto& section = context.sections[section_index];
@@ -89,8 +100,8 @@ bool read_list_file(const std::filesystem::path& filename, std::vector<std::stri
 }
 
 bool compare_files(const std::filesystem::path& file1_path, const std::filesystem::path& file2_path) {
-    static std::vector<char> file1_buf(65536);
-    static std::vector<char> file2_buf(65536);
+    thread_local std::vector<char> file1_buf(65536);
+    thread_local std::vector<char> file2_buf(65536);
 
     std::ifstream file1(file1_path, std::ifstream::ate | std::ifstream::binary); //open file at the end
     std::ifstream file2(file2_path, std::ifstream::ate | std::ifstream::binary); //open file at the end
@@ -112,7 +123,7 @@ bool compare_files(const std::filesystem::path& file1_path, const std::filesyste
     return std::equal(begin1, std::istreambuf_iterator<char>(), begin2); //Second argument is end-of-range iterator
 }
 
-bool recompile_single_function(const N64Recomp::Context& context, size_t func_index, const std::string& recomp_include, const std::filesystem::path& output_path, std::span<std::vector<uint32_t>> static_funcs_out) {
+bool write_single_function_file(const std::string& recomp_include, const std::filesystem::path& output_path, std::string_view func_text) {
     // Open the temporary output file
     std::filesystem::path temp_path = output_path;
     temp_path.replace_extension(".tmp");
@@ -128,9 +139,7 @@ bool recompile_single_function(const N64Recomp::Context& context, size_t func_in
         "\n",
         recomp_include);
 
-    if (!N64Recomp::recompile_function(context, func_index, output_file, static_funcs_out, false)) {
-        return false;
-    }
+    output_file.write(func_text.data(), func_text.size());
     
     output_file.close();
 
@@ -147,6 +156,272 @@ bool recompile_single_function(const N64Recomp::Context& context, size_t func_in
     return true;
 }
 
+// Writes recomp_profile.h, which defines the PROFILE_ENTRY and PROFILE_RETURN macros used by functions when profile mode is enabled,
+// and recomp_profile.c, which holds the counters and a table mapping each counter slot to its function for the runtime's reports.
+bool write_profile_files(const N64Recomp::Config& config, const N64Recomp::Context& context) {
+    // C doesn't allow empty arrays, so always have at least one slot.
+    size_t num_slots = std::max<size_t>(context.functions.size(), 1);
+
+    std::ofstream header_file{ config.output_func_path / "recomp_profile.h" };
+    if (!header_file.good()) {
+        fmt::print(stderr, "Failed to open file for writing: {}\n", (config.output_func_path / "recomp_profile.h").string());
+        return false;
+    }
+
+    fmt::print(header_file,
+        "#ifndef __RECOMP_PROFILE_H__\n"
+        "#define __RECOMP_PROFILE_H__\n"
+        "\n"
+        "#include <stdint.h>\n"
+        "\n"
+        "#define RECOMP_PROFILE_NUM_SLOTS {}\n"
+        "{}"
+        "\n"
+        "typedef struct {{\n"
+        "    uint64_t calls;\n"
+        "    uint64_t cycles;\n"
+        "}} RecompProfileCounter;\n"
+        "\n"
+        "typedef struct {{\n"
+        "    const char* name;\n"
+        "    uint32_t vram;\n"
+        "    uint32_t rom;\n"
+        "    uint32_t size;\n"
+        "}} RecompProfileSymbol;\n"
+        "\n"
+        "#if defined(__cplusplus)\n"
+        "    #define RECOMP_PROFILE_THREAD_LOCAL thread_local\n"
+        "#elif defined(_MSC_VER)\n"
+        "    #define RECOMP_PROFILE_THREAD_LOCAL __declspec(thread)\n"
+        "#else\n"
+        "    #define RECOMP_PROFILE_THREAD_LOCAL _Thread_local\n"
+        "#endif\n"
+        "\n"
+        "#ifdef __cplusplus\n"
+        "extern \"C\" {{\n"
+        "#endif\n"
+        "\n"
+        "// The counters that functions on the current thread update, indexed by counter slot. Each thread starts out using\n"
+        "// recomp_profile_shared_counters, and the runtime can point this at a separate array of RECOMP_PROFILE_NUM_SLOTS counters\n"
+        "// to give a thread its own counters. Counters are updated without any synchronization.\n"
+        "extern RECOMP_PROFILE_THREAD_LOCAL RecompProfileCounter* recomp_profile_counters;\n"
+        "extern RecompProfileCounter recomp_profile_shared_counters[RECOMP_PROFILE_NUM_SLOTS];\n"
+        "// The function that each counter slot belongs to.\n"
+        "extern const RecompProfileSymbol recomp_profile_symbols[RECOMP_PROFILE_NUM_SLOTS];\n"
+        "\n"
+        "#ifdef __cplusplus\n"
+        "}}\n"
+        "#endif\n"
+        "\n"
+        "#ifdef RECOMP_PROFILE_CYCLES\n"
+        "    // The runtime can provide its own timestamp source by defining this before the header is included.\n"
+        "    #ifndef RECOMP_PROFILE_TIMESTAMP\n"
+        "        #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))\n"
+        "            #include <intrin.h>\n"
+        "            #define RECOMP_PROFILE_TIMESTAMP() __rdtsc()\n"
+        "        #elif defined(_MSC_VER) && defined(_M_ARM64)\n"
+        "            #include <intrin.h>\n"
+        "            #define RECOMP_PROFILE_TIMESTAMP() _ReadStatusReg(ARM64_CNTVCT)\n"
+        "        #elif defined(__x86_64__) || defined(__i386__)\n"
+        "            #include <x86intrin.h>\n"
+        "            #define RECOMP_PROFILE_TIMESTAMP() __rdtsc()\n"
+        "        #elif defined(__aarch64__)\n"
+        "            static inline uint64_t recomp_profile_timestamp(void) {{\n"
+        "                uint64_t ret;\n"
+        "                __asm__ volatile(\"mrs %0, cntvct_el0\" : \"=r\"(ret));\n"
+        "                return ret;\n"
+        "            }}\n"
+        "            #define RECOMP_PROFILE_TIMESTAMP() recomp_profile_timestamp()\n"
+        "        #else\n"
+        "            #error \"No RECOMP_PROFILE_TIMESTAMP definition for this platform\"\n"
+        "        #endif\n"
+        "    #endif\n"
+        "\n"
+        "    #define PROFILE_ENTRY(slot) recomp_profile_counters[slot].calls++; uint64_t profile_start = RECOMP_PROFILE_TIMESTAMP();\n"
+        "    #define PROFILE_RETURN(slot) recomp_profile_counters[slot].cycles += RECOMP_PROFILE_TIMESTAMP() - profile_start;\n"
+        "#else\n"
+        "    #define PROFILE_ENTRY(slot) recomp_profile_counters[slot].calls++;\n"
+        "    #define PROFILE_RETURN(slot)\n"
+        "#endif\n"
+        "\n"
+        "#endif\n",
+        num_slots,
+        config.profile_cycles ? "#define RECOMP_PROFILE_CYCLES\n" : ""
+    );
+
+    std::ofstream source_file{ config.output_func_path / "recomp_profile.c" };
+    if (!source_file.good()) {
+        fmt::print(stderr, "Failed to open file for writing: {}\n", (config.output_func_path / "recomp_profile.c").string());
+        return false;
+    }
+
+    fmt::print(source_file,
+        "#include \"recomp_profile.h\"\n"
+        "\n"
+        "RecompProfileCounter recomp_profile_shared_counters[RECOMP_PROFILE_NUM_SLOTS];\n"
+        "RECOMP_PROFILE_THREAD_LOCAL RecompProfileCounter* recomp_profile_counters = recomp_profile_shared_counters;\n"
+        "\n"
+        "const RecompProfileSymbol recomp_profile_symbols[RECOMP_PROFILE_NUM_SLOTS] = {{\n");
+
+    for (const N64Recomp::Function& func : context.functions) {
+        fmt::print(source_file, "    {{ \"{}\", 0x{:08X}, 0x{:08X}, 0x{:08X} }},\n",
+            func.name, func.vram, func.rom, func.words.size() * sizeof(func.words[0]));
+    }
+
+    // Fill in the placeholder slot if there are no functions.
+    if (context.functions.empty()) {
+        fmt::print(source_file, "    {{ \"\", 0, 0, 0 }},\n");
+    }
+
+    fmt::print(source_file, "}};\n");
+
+    return true;
+}
+
+// Writes the file unless it already has the given contents, which keeps its timestamp so that it doesn't get rebuilt.
+bool write_file_if_changed(const std::filesystem::path& path, std::string_view contents) {
+    std::error_code ec;
+    if (std::filesystem::file_size(path, ec) == contents.size() && !ec) {
+        std::ifstream existing_file{ path, std::ios::binary };
+        std::string existing_contents(contents.size(), '\0');
+        if (existing_file.read(existing_contents.data(), existing_contents.size()) && existing_contents == contents) {
+            return true;
+        }
+    }
+
+    std::ofstream output_file{ path, std::ios::binary };
+    if (!output_file.good()) {
+        fmt::print(stderr, "Failed to open file for writing: {}\n", path.string());
+        return false;
+    }
+    output_file.write(contents.data(), contents.size());
+    return output_file.good();
+}
+
+// Writes funcs_inline.h, which holds the static inline copies of every inlinable function. It gets included after recomp.h by every
+// output file, so calls to those functions from any recompiled function can be inlined. The body is skipped in C++ files.
+bool write_inline_functions_file(const N64Recomp::Config& config, const N64Recomp::Context& context) {
+    fmt::memory_buffer output{};
+    fmt::format_to(std::back_inserter(output),
+        "#ifndef __RECOMP_FUNCS_INLINE_H__\n"
+        "#define __RECOMP_FUNCS_INLINE_H__\n"
+        "\n"
+        "#ifndef __cplusplus\n"
+        "\n");
+
+    for (size_t func_index = 0; func_index < context.functions.size(); func_index++) {
+        if (!context.is_function_inlinable(func_index)) {
+            continue;
+        }
+        if (!N64Recomp::recompile_function_inline_copy(context, func_index, output)) {
+            fmt::print(stderr, "Error recompiling the inline copy of {}\n", context.functions[func_index].name);
+            return false;
+        }
+        fmt::format_to(std::back_inserter(output), "\n");
+    }
+
+    fmt::format_to(std::back_inserter(output),
+        "#endif\n"
+        "\n"
+        "#endif\n");
+
+    // Every output file includes this header, so only write it if it changed to avoid rebuilding all of them.
+    return write_file_if_changed(config.output_func_path / "funcs_inline.h", std::string_view{ output.data(), output.size() });
+}
+
+// An output file in balanced output mode, which holds the functions from its first function up to the next file's first function
+// in (section, vram) order. Files are named after their first function so that a file's name doesn't change when others are split or merged.
+struct OutputShard {
+    uint16_t section_index;
+    uint32_t first_vram;
+    std::string text;
+};
+
+// Splits the functions into output files of roughly the target number of instructions each. Functions stay in vram order within each section,
+// which keeps functions from the same source file and the calls between them together, and a file only spans multiple sections if they're small.
+// The boundaries are content-defined so that they stay stable across runs: once a file has half of the target size, each function ends it with
+// a probability proportional to its size, decided by a hash of its address. A change to one function therefore moves at most the boundaries
+// around it, instead of shifting every file that comes after it like splitting by a running count would.
+std::vector<OutputShard> plan_output_shards(const N64Recomp::Context& context, std::span<const size_t> func_indices, size_t target_instructions) {
+    std::vector<size_t> sorted_indices{ func_indices.begin(), func_indices.end() };
+    std::sort(sorted_indices.begin(), sorted_indices.end(), [&context](size_t a, size_t b) {
+        const N64Recomp::Function& func_a = context.functions[a];
+        const N64Recomp::Function& func_b = context.functions[b];
+        return std::tie(func_a.section_index, func_a.vram, a) < std::tie(func_b.section_index, func_b.vram, b);
+    });
+
+    size_t min_instructions = target_instructions / 2;
+    size_t max_instructions = target_instructions * 2;
+    std::vector<OutputShard> ret{};
+    size_t cur_instructions = 0;
+    bool shard_ended = true;
+
+    for (size_t func_index : sorted_indices) {
+        const N64Recomp::Function& func = context.functions[func_index];
+        size_t num_instructions = func.words.size();
+        // Functions at the same address have to share a file, as files are looked up by address.
+        bool same_address = !ret.empty() && ret.back().section_index == func.section_index && ret.back().first_vram == func.vram;
+        bool new_section = !ret.empty() && ret.back().section_index != func.section_index;
+
+        if (!same_address && (ret.empty() || shard_ended || (new_section && cur_instructions >= min_instructions) ||
+            (cur_instructions + num_instructions > max_instructions && cur_instructions != 0)))
+        {
+            ret.emplace_back(OutputShard{ .section_index = func.section_index, .first_vram = func.vram, .text = {} });
+            cur_instructions = 0;
+        }
+        shard_ended = false;
+        cur_instructions += num_instructions;
+
+        if (cur_instructions >= min_instructions) {
+            N64Recomp::Hasher hasher{};
+            hasher.add(func.section_index);
+            hasher.add(func.vram);
+            shard_ended = hasher.get() % (target_instructions - min_instructions) < num_instructions;
+        }
+    }
+
+    return ret;
+}
+
+// Returns the index of the balanced output file that the given function belongs in, which is the last one starting at or before the function.
+size_t find_output_shard(std::span<const OutputShard> shards, uint16_t section_index, uint32_t vram) {
+    auto it = std::upper_bound(shards.begin(), shards.end(), std::make_pair(section_index, vram),
+        [](const std::pair<uint16_t, uint32_t>& key, const OutputShard& shard) {
+            return key < std::make_pair(shard.section_index, shard.first_vram);
+        });
+    return it == shards.begin() ? 0 : static_cast<size_t>(it - shards.begin() - 1);
+}
+
+// Calls the provided callback for every index in [0, count) across the given number of threads. Indices are handed out one at a time
+// from a shared counter, so a thread that finishes a cheap function moves on to the next one instead of waiting on a fixed partition.
+// The callback also receives the index of the thread running it so it can use per-thread state without locking.
+template <typename F>
+void run_parallel(size_t count, size_t num_threads, F&& callback) {
+    std::atomic<size_t> next_index = 0;
+
+    auto worker = [&next_index, &callback, count](size_t thread_index) {
+        while (true) {
+            size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+            if (index >= count) {
+                break;
+            }
+            callback(index, thread_index);
+        }
+    };
+
+    // The calling thread acts as the first worker.
+    std::vector<std::thread> threads{};
+    threads.reserve(num_threads - 1);
+    for (size_t thread_index = 1; thread_index < num_threads; thread_index++) {
+        threads.emplace_back(worker, thread_index);
+    }
+    worker(0);
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
 std::vector<std::string> reloc_names {
     "R_MIPS_NONE ",
     "R_MIPS_16",
@@ -275,52 +550,75 @@ void dump_context(const N64Recomp::Context& context, const std::unordered_map<ui
     }
 }
 
-static std::vector<uint8_t> read_file(const std::filesystem::path& path) {
-    std::vector<uint8_t> ret;
-
-    std::ifstream file{ path, std::ios::binary};
-
-    if (file.good()) {
-        file.seekg(0, std::ios::end);
-        ret.resize(file.tellg());
-        file.seekg(0, std::ios::beg);
+struct RunOptions {
+    bool dumping_context = false;
+    bool incremental = false;
+    bool print_stats = false;
+    std::filesystem::path stats_json_path{};
+    size_t num_jobs = 1;
+};
 
-        file.read(reinterpret_cast<char*>(ret.data()), ret.size());
-    }
+// A file that a run read, along with its modification time from before it was read.
+struct WatchedFile {
+    std::filesystem::path path;
+    std::filesystem::file_time_type write_time;
+};
 
-    return ret;
+std::filesystem::file_time_type get_write_time(const std::filesystem::path& path) {
+    std::error_code ec;
+    std::filesystem::file_time_type ret = std::filesystem::last_write_time(path, ec);
+    return ec ? std::filesystem::file_time_type::min() : ret;
 }
 
-int main(int argc, char** argv) {
-    auto exit_failure = [] (const std::string& error_str) {
-        fmt::vprint(stderr, error_str, fmt::make_format_args());
-        std::exit(EXIT_FAILURE);
-    };
-
-    bool dumping_context = false;
-
-    if (argc < 2) {
-        fmt::print("Usage: {} <config file> [--dump-context]\n", argv[0]);
-        return EXIT_SUCCESS;
-    }
+bool watched_files_changed(std::span<const WatchedFile> files) {
+    return std::any_of(files.begin(), files.end(), [](const WatchedFile& file) { return get_write_time(file.path) != file.write_time; });
+}
 
-    const char* config_path = argv[1];
+// Contexts that watch mode keeps between runs, which get reused as long as the files they were built from haven't changed.
+struct ResidentContexts {
+    bool enabled = false;
+    // The context after importing the reference symbols files, before the elf is read.
+    std::vector<WatchedFile> reference_files;
+    std::optional<N64Recomp::Context> reference_context;
+    // The context right after reading the symbols file and ROM, for configs that use those instead of an elf.
+    std::vector<WatchedFile> symbols_files;
+    std::optional<N64Recomp::Context> symbols_context;
+};
 
-    for (size_t i = 2; i < argc; i++) {
-        std::string_view cur_arg = argv[i];
-        if (cur_arg == "--dump-context") {
-            dumping_context = true;
+// Runs the recompiler once with the given config. Every input file is added to watched_files_out before it gets read.
+// Throws RunFailure if the run fails.
+int run_recompiler(const char* config_path, const RunOptions& options, ResidentContexts& resident, std::vector<WatchedFile>& watched_files_out) {
+    bool dumping_context = options.dumping_context;
+    bool incremental = options.incremental;
+    bool print_stats = options.print_stats;
+    const std::filesystem::path& stats_json_path = options.stats_json_path;
+    size_t num_jobs = options.num_jobs;
+    // Number of slowest functions to list in the stats.
+    constexpr size_t num_slowest_funcs = 20;
+
+    N64Recomp::PhaseStats stats{ print_stats || !stats_json_path.empty() };
+    stats.begin_phase("load_config");
+
+    auto watch_file = [&watched_files_out](const std::filesystem::path& path) {
+        if (!path.empty()) {
+            watched_files_out.emplace_back(WatchedFile{ .path = path, .write_time = get_write_time(path) });
         }
-        else {
-            fmt::print("Unknown argument \"{}\"\n", cur_arg);
-            return EXIT_FAILURE;
-        }
-    }
+    };
 
+    watch_file(config_path);
     N64Recomp::Config config{ config_path };
     if (!config.good()) {
-        exit_failure(fmt::format("Failed to load config file: {}\n", config_path));
+        fail_run(fmt::format("Failed to load config file: {}\n", config_path));
+    }
+
+    watch_file(config.elf_path);
+    watch_file(config.symbols_file_path);
+    watch_file(config.rom_file_path);
+    watch_file(config.func_reference_syms_file_path);
+    for (const std::filesystem::path& cur_data_sym_path : config.data_reference_syms_file_paths) {
+        watch_file(cur_data_sym_path);
     }
+    watch_file(config.relocatable_sections_path);
 
     RabbitizerConfig_Cfg.pseudos.pseudoMove = false;
     RabbitizerConfig_Cfg.pseudos.pseudoBeqz = false;
@@ -332,7 +630,7 @@ int main(int argc, char** argv) {
 
     if (!config.relocatable_sections_path.empty()) {
         if (!read_list_file(config.relocatable_sections_path, relocatable_sections_ordered)) {
-            exit_failure(fmt::format("Failed to load the relocatable section list file: {}\n", (const char*)config.relocatable_sections_path.u8string().c_str()));
+            fail_run(fmt::format("Failed to load the relocatable section list file: {}\n", (const char*)config.relocatable_sections_path.u8string().c_str()));
         }
     }
 
@@ -345,7 +643,7 @@ int main(int argc, char** argv) {
     N64Recomp::Context context{};
     
     if (!config.elf_path.empty() && !config.symbols_file_path.empty()) {
-        exit_failure("Config file cannot provide both an elf and a symbols file\n");
+        fail_run("Config file cannot provide both an elf and a symbols file\n");
     }
 
     // Build a context from the provided elf file.
@@ -354,26 +652,51 @@ int main(int argc, char** argv) {
         std::unordered_map<uint16_t, std::vector<N64Recomp::DataSymbol>> data_syms;
 
         // Import symbols from any reference symbols files that were provided.
-        if (!config.func_reference_syms_file_path.empty()) {
+        // Reuse the reference symbols from the previous run in watch mode if none of their files changed.
+        std::vector<WatchedFile> reference_files{};
+        if (resident.enabled && !config.func_reference_syms_file_path.empty()) {
+            reference_files.emplace_back(WatchedFile{ .path = config.func_reference_syms_file_path, .write_time = get_write_time(config.func_reference_syms_file_path) });
+            for (const std::filesystem::path& cur_data_sym_path : config.data_reference_syms_file_paths) {
+                reference_files.emplace_back(WatchedFile{ .path = cur_data_sym_path, .write_time = get_write_time(cur_data_sym_path) });
+            }
+        }
+        bool reuse_reference_context = !reference_files.empty() && resident.reference_context.has_value() &&
+            std::equal(reference_files.begin(), reference_files.end(), resident.reference_files.begin(), resident.reference_files.end(),
+                [](const WatchedFile& a, const WatchedFile& b) { return a.path == b.path && a.write_time == b.write_time; });
+
+        if (reuse_reference_context) {
+            stats.begin_phase("import_reference_context");
+            context = *resident.reference_context;
+            stats.add_counter("reused", 1);
+        }
+        else if (!config.func_reference_syms_file_path.empty()) {
+            stats.begin_phase("import_reference_context");
             {
                 // Create a new temporary context to read the function reference symbol file into, since it's the same format as the recompilation symbol file.
                 std::vector<uint8_t> dummy_rom{};
                 N64Recomp::Context reference_context{};
                 if (!N64Recomp::Context::from_symbol_file(config.func_reference_syms_file_path, std::move(dummy_rom), reference_context, false)) {
-                    exit_failure("Failed to load provided function reference symbol file\n");
+                    fail_run("Failed to load provided function reference symbol file\n");
                 }
 
                 // Use the reference context to build a reference symbol list for the actual context.
                 if (!context.import_reference_context(reference_context)) {
-                    exit_failure("Internal error: Failed to import reference context. Please report this issue.\n");
+                    fail_run("Internal error: Failed to import reference context. Please report this issue.\n");
                 }
+                stats.add_counter("functions", reference_context.functions.size());
+                stats.add_counter("sections", reference_context.sections.size());
             }
 
             for (const std::filesystem::path& cur_data_sym_path : config.data_reference_syms_file_paths) {
                 if (!context.read_data_reference_syms(cur_data_sym_path)) {
-                    exit_failure(fmt::format("Failed to load provided data reference symbol file: {}\n", cur_data_sym_path.string()));
+                    fail_run(fmt::format("Failed to load provided data reference symbol file: {}\n", cur_data_sym_path.string()));
                 }
             }
+
+            if (!reference_files.empty()) {
+                resident.reference_files = std::move(reference_files);
+                resident.reference_context = context;
+            }
         }
 
         N64Recomp::ElfParsingConfig elf_config {
@@ -396,16 +719,17 @@ int main(int argc, char** argv) {
             elf_config.manually_sized_funcs.emplace(func_size.func_name, func_size.size_bytes);
         }
 
+        stats.begin_phase("from_elf_file");
         bool found_entrypoint_func;
         if (!N64Recomp::Context::from_elf_file(config.elf_path, context, elf_config, dumping_context, data_syms, found_entrypoint_func)) {
-            exit_failure("Failed to parse elf\n");
+            fail_run("Failed to parse elf\n");
         }
 
         // Add any manual functions
         add_manual_functions(context, config.manual_functions);
 
         if (config.has_entrypoint && !found_entrypoint_func) {
-            exit_failure("Could not find entrypoint function\n");
+            fail_run("Could not find entrypoint function\n");
         }
         
         if (dumping_context) {
@@ -426,20 +750,44 @@ int main(int argc, char** argv) {
     // Build a context from the provided symbols file.
     else if (!config.symbols_file_path.empty()) {
         if (config.rom_file_path.empty()) {
-            exit_failure("A ROM file must be provided when using a symbols file\n");
+            fail_run("A ROM file must be provided when using a symbols file\n");
         }
 
         if (dumping_context) {
-            exit_failure("Cannot dump context when using a symbols file\n");
+            fail_run("Cannot dump context when using a symbols file\n");
         }
 
-        std::vector<uint8_t> rom = read_file(config.rom_file_path);
-        if (rom.empty()) {
-            exit_failure("Failed to load ROM file: " + config.rom_file_path.string() + "\n");
+        // Reuse the context from the previous run in watch mode if neither the symbols file nor the ROM changed.
+        std::vector<WatchedFile> symbols_files{};
+        if (resident.enabled) {
+            symbols_files.emplace_back(WatchedFile{ .path = config.symbols_file_path, .write_time = get_write_time(config.symbols_file_path) });
+            symbols_files.emplace_back(WatchedFile{ .path = config.rom_file_path, .write_time = get_write_time(config.rom_file_path) });
         }
-        
-        if (!N64Recomp::Context::from_symbol_file(config.symbols_file_path, std::move(rom), context, true)) {
-            exit_failure("Failed to load symbols file\n");
+        bool reuse_symbols_context = !symbols_files.empty() && resident.symbols_context.has_value() &&
+            std::equal(symbols_files.begin(), symbols_files.end(), resident.symbols_files.begin(), resident.symbols_files.end(),
+                [](const WatchedFile& a, const WatchedFile& b) { return a.path == b.path && a.write_time == b.write_time; });
+
+        if (reuse_symbols_context) {
+            stats.begin_phase("from_symbol_file");
+            context = *resident.symbols_context;
+            stats.add_counter("reused", 1);
+        }
+        else {
+            // Map the ROM instead of reading it so that it doesn't need to be loaded into memory up front.
+            N64Recomp::RomBuffer rom{};
+            if (!N64Recomp::map_file(config.rom_file_path, rom)) {
+                fail_run("Failed to load ROM file: " + config.rom_file_path.string() + "\n");
+            }
+            
+            stats.begin_phase("from_symbol_file");
+            if (!N64Recomp::Context::from_symbol_file(config.symbols_file_path, std::move(rom), context, true)) {
+                fail_run("Failed to load symbols file\n");
+            }
+
+            if (!symbols_files.empty()) {
+                resident.symbols_files = std::move(symbols_files);
+                resident.symbols_context = context;
+            }
         }
 
         auto rename_function = [&context](size_t func_index, const std::string& new_name) {
@@ -479,18 +827,29 @@ int main(int argc, char** argv) {
             }
 
             if (!found_entrypoint) {
-                exit_failure("No entrypoint provided in symbol file\n");
+                fail_run("No entrypoint provided in symbol file\n");
             }
         }
 
     }
     else {
-        exit_failure("Config file must provide either an elf or a symbols file\n");
+        fail_run("Config file must provide either an elf or a symbols file\n");
     }
 
 
     fmt::print("Function count: {}\n", context.functions.size());
 
+    if (stats.is_enabled()) {
+        size_t num_relocs = 0;
+        for (const auto& section : context.sections) {
+            num_relocs += section.relocs.size();
+        }
+        stats.add_counter("functions", context.functions.size());
+        stats.add_counter("sections", context.sections.size());
+        stats.add_counter("relocs", num_relocs);
+    }
+    stats.begin_phase("prepare");
+
     std::filesystem::create_directories(config.output_func_path);
 
     std::ofstream func_header_file{ config.output_func_path / "funcs.h" };
@@ -516,7 +875,7 @@ int main(int argc, char** argv) {
         if (func_find == context.functions_by_name.end()) {
             // Function doesn't exist, present an error to the user instead of silently failing to stub it out.
             // This helps prevent typos in the config file or functions renamed between versions from causing issues.
-            exit_failure(fmt::format("Function {} is stubbed out in the config file but does not exist!", stubbed_func));
+            fail_run(fmt::format("Function {} is stubbed out in the config file but does not exist!", stubbed_func));
         }
         // Mark the function as stubbed.
         context.functions[func_find->second].stubbed = true;
@@ -529,7 +888,7 @@ int main(int argc, char** argv) {
         if (func_find == context.functions_by_name.end()) {
             // Function doesn't exist, present an error to the user instead of silently failing to mark it as ignored.
             // This helps prevent typos in the config file or functions renamed between versions from causing issues.
-            exit_failure(fmt::format("Function {} is set as ignored in the config file but does not exist!", ignored_func));
+            fail_run(fmt::format("Function {} is set as ignored in the config file but does not exist!", ignored_func));
         }
         // Mark the function as ignored.
         context.functions[func_find->second].ignored = true;
@@ -542,7 +901,7 @@ int main(int argc, char** argv) {
         if (func_find == context.functions_by_name.end()) {
             // Function doesn't exist, present an error to the user instead of silently failing to rename it.
             // This helps prevent typos in the config file or functions renamed between versions from causing issues.
-            exit_failure(fmt::format("Function {} is set as renamed in the config file but does not exist!", renamed_func));
+            fail_run(fmt::format("Function {} is set as renamed in the config file but does not exist!", renamed_func));
         }
         // Rename the function.
         N64Recomp::Function* func = &context.functions[func_find->second];
@@ -551,6 +910,10 @@ int main(int argc, char** argv) {
 
     // Propogate the trace mode parameter.
     context.trace_mode = config.trace_mode;
+    context.profile_mode = config.profile_mode;
+    context.optimize_codegen = config.optimize_output;
+    context.strict_fpu_checks = config.strict_fpu_checks;
+    context.hoist_section_addresses = config.hoist_section_addresses;
 
     // Apply any single-instruction patches.
     for (const N64Recomp::InstructionPatch& patch : config.instruction_patches) {
@@ -559,7 +922,7 @@ int main(int argc, char** argv) {
         if (func_find == context.functions_by_name.end()) {
             // Function doesn't exist, present an error to the user instead of silently failing to stub it out.
             // This helps prevent typos in the config file or functions renamed between versions from causing issues.
-            exit_failure(fmt::format("Function {} has an instruction patch but does not exist!", patch.func_name));
+            fail_run(fmt::format("Function {} has an instruction patch but does not exist!", patch.func_name));
         }
 
         N64Recomp::Function& func = context.functions[func_find->second];
@@ -567,7 +930,7 @@ int main(int argc, char** argv) {
 
         // Check that the function actually contains this vram address.
         if (patch.vram < func_vram || patch.vram >= func_vram + func.words.size() * sizeof(func.words[0])) {
-            exit_failure(fmt::format("Function {} has an instruction patch for vram 0x{:08X} but doesn't contain that vram address!", patch.func_name, (uint32_t)patch.vram));
+            fail_run(fmt::format("Function {} has an instruction patch for vram 0x{:08X} but doesn't contain that vram address!", patch.func_name, (uint32_t)patch.vram));
         }
 
         // Calculate the instruction index and modify the instruction.
@@ -582,7 +945,7 @@ int main(int argc, char** argv) {
         if (func_find == context.functions_by_name.end()) {
             // Function doesn't exist, present an error to the user instead of silently failing to stub it out.
             // This helps prevent typos in the config file or functions renamed between versions from causing issues.
-            exit_failure(fmt::format("Function {} has a function hook but does not exist!", patch.func_name));
+            fail_run(fmt::format("Function {} has a function hook but does not exist!", patch.func_name));
         }
 
         N64Recomp::Function& func = context.functions[func_find->second];
@@ -590,7 +953,7 @@ int main(int argc, char** argv) {
 
         // Check that the function actually contains this vram address.
         if (patch.before_vram < func_vram || patch.before_vram >= func_vram + func.words.size() * sizeof(func.words[0])) {
-            exit_failure(fmt::format("Function {} has a function hook for vram 0x{:08X} but doesn't contain that vram address!", patch.func_name, (uint32_t)patch.before_vram));
+            fail_run(fmt::format("Function {} has a function hook for vram 0x{:08X} but doesn't contain that vram address!", patch.func_name, (uint32_t)patch.before_vram));
         }
 
         // No after_vram means this will be placed at the start of the function
@@ -604,7 +967,7 @@ int main(int argc, char** argv) {
         // Check if a function hook already exits for that instruction index.
         auto hook_find = func.function_hooks.find(instruction_index);
         if (hook_find != func.function_hooks.end()) {
-            exit_failure(fmt::format("Function {} already has a function hook for vram 0x{:08X}!", patch.func_name, (uint32_t)patch.before_vram));
+            fail_run(fmt::format("Function {} already has a function hook for vram 0x{:08X}!", patch.func_name, (uint32_t)patch.before_vram));
         }
 
         func.function_hooks[instruction_index] = patch.text;
@@ -613,24 +976,26 @@ int main(int argc, char** argv) {
     std::ofstream current_output_file;
     size_t output_file_count = 0;
     size_t cur_file_function_count = 0;
+    bool balanced_output = config.balanced_output_files && !config.single_file_output;
+
+    // Header for files that contain multiple functions.
+    std::string grouped_file_header = fmt::format(
+        "{}\n"
+        "#include \"funcs.h\"\n"
+        "\n",
+        config.recomp_include);
+
+    // Add the extern for the base event index and the define to rename it if exports are allowed.
+    if (config.allow_exports) {
+        grouped_file_header +=
+            "extern uint32_t builtin_base_event_index;\n"
+            "#define base_event_index builtin_base_event_index\n"
+            "\n";
+    }
     
-    auto open_new_output_file = [&config, &current_output_file, &output_file_count, &cur_file_function_count]() {
+    auto open_new_output_file = [&config, &current_output_file, &output_file_count, &cur_file_function_count, &grouped_file_header]() {
         current_output_file = std::ofstream{config.output_func_path / fmt::format("funcs_{}.c", output_file_count)};
-        // Write the file header
-        fmt::print(current_output_file,
-            "{}\n"
-            "#include \"funcs.h\"\n"
-            "\n",
-            config.recomp_include);
-
-        // Print the extern for the base event index and the define to rename it if exports are allowed.
-        if (config.allow_exports) {
-            fmt::print(current_output_file,
-                "extern uint32_t builtin_base_event_index;\n"
-                "#define base_event_index builtin_base_event_index\n"
-                "\n"
-            );
-        }
+        current_output_file.write(grouped_file_header.data(), grouped_file_header.size());
 
         cur_file_function_count = 0;
         output_file_count++;
@@ -638,23 +1003,9 @@ int main(int argc, char** argv) {
 
     if (config.single_file_output) {
         current_output_file.open(config.output_func_path / config.elf_path.stem().replace_extension(".c"));
-        // Write the file header
-        fmt::print(current_output_file,
-            "{}\n"
-            "#include \"funcs.h\"\n"
-            "\n",
-            config.recomp_include);
-
-        // Print the extern for the base event index and the define to rename it if exports are allowed.
-        if (config.allow_exports) {
-            fmt::print(current_output_file,
-                "extern uint32_t builtin_base_event_index;\n"
-                "#define base_event_index builtin_base_event_index\n"
-                "\n"
-            );
-        }
+        current_output_file.write(grouped_file_header.data(), grouped_file_header.size());
     }
-    else if (config.functions_per_output_file > 1) {
+    else if (config.functions_per_output_file > 1 && !balanced_output) {
         open_new_output_file();
     }
 
@@ -697,13 +1048,13 @@ int main(int argc, char** argv) {
                         size_t func_index = context.find_function_by_vram_section(reloc.target_section_offset + event_section_vram, event_section_index);
 
                         if (func_index == (size_t)-1) {
-                            exit_failure(fmt::format("Failed to find event function with vram {}.\n", reloc.target_section_offset + event_section_vram));
+                            fail_run(fmt::format("Failed to find event function with vram {}.\n", reloc.target_section_offset + event_section_vram));
                         }
 
                         // Ensure the reloc is a MIPS_R_26 one before modifying it, since those are the only type allowed to reference
                         if (reloc.type != N64Recomp::RelocType::R_MIPS_26) {
                             const auto& function = context.functions[func_index];
-                            exit_failure(fmt::format("Function {} is an import and cannot have its address taken.\n",
+                            fail_run(fmt::format("Function {} is an import and cannot have its address taken.\n",
                                 function.name));
                         }
 
@@ -731,16 +1082,17 @@ int main(int argc, char** argv) {
 
     std::vector<size_t> export_function_indices{};
 
+    // Indices of the functions to recompile, in the order their output gets written.
+    std::vector<size_t> recompiled_function_indices{};
+
     bool failed_strict_mode = false;
 
-    //#pragma omp parallel for
     for (size_t i = 0; i < context.functions.size(); i++) {
         const auto& func = context.functions[i];
 
         if (!func.ignored && func.words.size() != 0) {
             fmt::print(func_header_file,
                 "void {}(uint8_t* rdram, recomp_context* ctx);\n", func.name);
-            bool result;
             const auto& func_section = context.sections[func.section_index];
             // Apply strict patch mode validation if enabled.
             if (config.strict_patch_mode) {
@@ -768,23 +1120,7 @@ int main(int argc, char** argv) {
                 export_function_indices.push_back(i);
             }
 
-            // Recompile the function.
-            if (config.single_file_output || config.functions_per_output_file > 1) {
-                result = N64Recomp::recompile_function(context, i, current_output_file, static_funcs_by_section, false);
-                if (!config.single_file_output) {
-                    cur_file_function_count++;
-                    if (cur_file_function_count >= config.functions_per_output_file) {
-                        open_new_output_file();
-                    }
-                }
-            }
-            else {
-                result = recompile_single_function(context, i, config.recomp_include, config.output_func_path / (func.name + ".c"), static_funcs_by_section);
-            }
-            if (result == false) {
-                fmt::print(stderr, "Error recompiling {}\n", func.name);
-                std::exit(EXIT_FAILURE);
-            }
+            recompiled_function_indices.push_back(i);
         } else if (func.reimplemented) {
             fmt::print(func_header_file,
                        "void {}(uint8_t* rdram, recomp_context* ctx);\n", func.name);
@@ -797,8 +1133,196 @@ int main(int argc, char** argv) {
             std::error_code ec;
             std::filesystem::remove(config.output_func_path / config.elf_path.stem().replace_extension(".c"), ec);
         }
-        exit_failure("Strict mode validation failed!\n");
+        fail_run("Strict mode validation failed!\n");
+    }
+
+    bool grouped_output = config.single_file_output || config.functions_per_output_file > 1 || balanced_output;
+
+    // Plan the balanced output files now that the set of functions is known. Static functions found during recompilation go in the file
+    // that covers their address.
+    std::vector<OutputShard> output_shards{};
+    if (balanced_output) {
+        output_shards = plan_output_shards(context, recompiled_function_indices, config.output_file_target_instructions);
+    }
+
+    // Build the sorted vram index used for JAL resolution now that no more functions will be added to functions_by_vram.
+    // Static functions created during recompilation aren't added to functions_by_vram, so they don't invalidate it.
+    context.build_function_vram_index();
+
+    // Find the functions that get inlined into their callers, which needs the vram index to resolve calls.
+    if (config.inline_leaf_functions) {
+        std::vector<size_t> inline_excluded_func_indices{};
+        inline_excluded_func_indices.reserve(config.inline_excluded_funcs.size());
+        for (const std::string& excluded_func : config.inline_excluded_funcs) {
+            // Check if the specified function exists, for the same reasons as with stubbed functions.
+            auto func_find = context.functions_by_name.find(excluded_func);
+            if (func_find == context.functions_by_name.end()) {
+                fail_run(fmt::format("Function {} is excluded from inlining in the config file but does not exist!", excluded_func));
+            }
+            inline_excluded_func_indices.emplace_back(func_find->second);
+        }
+        N64Recomp::find_inlinable_functions(context, config.inline_leaf_max_instructions, inline_excluded_func_indices);
+        if (!write_inline_functions_file(config, context)) {
+            fail_run("Failed to write the inline functions file\n");
+        }
+        fmt::print("Inlining {} leaf functions\n", std::count(context.inlinable_functions.begin(), context.inlinable_functions.end(), uint8_t{1}));
+        fmt::print("Warning: calls to inlined functions won't go through function replacements that mods register at runtime. "
+            "Add any function that mods need to replace to inline_excluded_funcs.\n");
+    }
+
+    // Set up the incremental cache if enabled. This has to happen after all modifications to the context's functions and relocs.
+    std::optional<N64Recomp::FunctionCache> function_cache{};
+    if (incremental) {
+        function_cache.emplace(config.output_func_path / ".recomp_cache", context, config);
+        if (!function_cache->good()) {
+            fail_run("Failed to set up the incremental recompilation cache\n");
+        }
+    }
+
+    // Produces the output for a single function, either by reusing it from the cache or by recompiling it.
+    // Static functions found while recompiling it are added to the provided list.
+    auto render_function_impl = [&context, &function_cache, &stats](size_t func_index, std::vector<std::vector<uint32_t>>& static_funcs, std::string& output) {
+        const auto& func = context.functions[func_index];
+        std::vector<uint32_t>& section_statics = static_funcs[func.section_index];
+        uint64_t cache_key = 0;
+
+        if (function_cache) {
+            cache_key = function_cache->get_function_key(func_index);
+            std::vector<uint32_t> cached_statics{};
+            if (function_cache->load(cache_key, output, cached_statics)) {
+                section_statics.insert(section_statics.end(), cached_statics.begin(), cached_statics.end());
+                stats.add_counter("cache_hits", 1);
+                return true;
+            }
+        }
+
+        // Use a thread local buffer so that each thread reuses its allocation across functions.
+        thread_local fmt::memory_buffer func_output{};
+        func_output.clear();
+        std::vector<N64Recomp::JumpTable> jump_tables{};
+        size_t prev_num_statics = section_statics.size();
+        if (!N64Recomp::recompile_function(context, func_index, func_output, static_funcs, false, &jump_tables)) {
+            return false;
+        }
+        output.assign(func_output.data(), func_output.size());
+        stats.add_counter("jump_tables", jump_tables.size());
+
+        // Failing to store the entry isn't an error, it just means the function will get recompiled again next time.
+        if (function_cache) {
+            std::span<const uint32_t> new_statics{ section_statics.begin() + prev_num_statics, section_statics.end() };
+            function_cache->store(cache_key, func_index, output, new_statics, jump_tables);
+        }
+        return true;
+    };
+
+    // Wraps render_function_impl to record the function's timing and counters when stats are enabled.
+    auto render_function = [&context, &stats, &render_function_impl](size_t func_index, std::vector<std::vector<uint32_t>>& static_funcs, std::string& output) {
+        if (!stats.is_enabled()) {
+            return render_function_impl(func_index, static_funcs, output);
+        }
+        auto start_time = std::chrono::steady_clock::now();
+        bool result = render_function_impl(func_index, static_funcs, output);
+        stats.record_function(func_index, std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
+        stats.add_counter("functions", 1);
+        stats.add_counter("instructions", context.functions[func_index].words.size());
+        stats.add_counter("bytes", output.size());
+        return result;
+    };
+
+    // Tracks the number of functions in the current grouped output file and starts a new one once it's full.
+    auto finish_grouped_function = [&config, &cur_file_function_count, &open_new_output_file]() {
+        if (!config.single_file_output) {
+            cur_file_function_count++;
+            if (cur_file_function_count >= config.functions_per_output_file) {
+                open_new_output_file();
+            }
+        }
+    };
+
+    // Adds a function's output to the grouped output, which is either its balanced output file or the current output file.
+    auto write_grouped_function = [&](size_t func_index, std::string_view func_text) {
+        if (balanced_output) {
+            const auto& func = context.functions[func_index];
+            if (output_shards.empty()) {
+                output_shards.emplace_back(OutputShard{ .section_index = func.section_index, .first_vram = func.vram, .text = {} });
+            }
+            output_shards[find_output_shard(output_shards, func.section_index, func.vram)].text.append(func_text);
+        }
+        else {
+            current_output_file.write(func_text.data(), func_text.size());
+            finish_grouped_function();
+        }
+    };
+
+    // Recompile the functions.
+    stats.begin_phase("recompile");
+    if (num_jobs <= 1) {
+        std::string func_text{};
+        for (size_t func_index : recompiled_function_indices) {
+            const auto& func = context.functions[func_index];
+            bool result = render_function(func_index, static_funcs_by_section, func_text);
+            if (result) {
+                if (grouped_output) {
+                    write_grouped_function(func_index, func_text);
+                }
+                else {
+                    result = write_single_function_file(config.recomp_include, config.output_func_path / (func.name + ".c"), func_text);
+                }
+            }
+            if (result == false) {
+                fmt::print(stderr, "Error recompiling {}\n", func.name);
+                throw RunFailure{};
+            }
+        }
     }
+    else {
+        size_t num_functions = recompiled_function_indices.size();
+        size_t num_threads = std::min(num_jobs, std::max(num_functions, size_t{1}));
+
+        // Each function is rendered into its own buffer so the grouped output files can be written afterwards in the same order as the serial path.
+        // Per-function output files don't share anything, so those are written directly by the worker threads instead.
+        std::vector<std::string> function_outputs(grouped_output ? num_functions : 0);
+        std::vector<uint8_t> function_results(num_functions);
+        // Each thread gets its own static function lists to avoid locking. Their order doesn't matter, as they get sorted and deduplicated before use.
+        std::vector<std::vector<std::vector<uint32_t>>> thread_static_funcs(num_threads, std::vector<std::vector<uint32_t>>(context.sections.size()));
+
+        run_parallel(num_functions, num_threads, [&](size_t work_index, size_t thread_index) {
+            size_t func_index = recompiled_function_indices[work_index];
+            std::vector<std::vector<uint32_t>>& static_funcs = thread_static_funcs[thread_index];
+            if (grouped_output) {
+                function_results[work_index] = render_function(func_index, static_funcs, function_outputs[work_index]);
+            }
+            else {
+                const auto& func = context.functions[func_index];
+                std::string func_text{};
+                function_results[work_index] = render_function(func_index, static_funcs, func_text) &&
+                    write_single_function_file(config.recomp_include, config.output_func_path / (func.name + ".c"), func_text);
+            }
+        });
+
+        // Merge the static functions found by each thread.
+        for (const std::vector<std::vector<uint32_t>>& cur_static_funcs : thread_static_funcs) {
+            for (size_t section_index = 0; section_index < cur_static_funcs.size(); section_index++) {
+                static_funcs_by_section[section_index].insert(static_funcs_by_section[section_index].end(),
+                    cur_static_funcs[section_index].begin(), cur_static_funcs[section_index].end());
+            }
+        }
+
+        // Write the outputs in function order, stopping at the first function that failed like the serial path does.
+        for (size_t work_index = 0; work_index < num_functions; work_index++) {
+            if (grouped_output && function_results[work_index]) {
+                write_grouped_function(recompiled_function_indices[work_index], function_outputs[work_index]);
+                // Free the buffer now that it's been written.
+                std::string{}.swap(function_outputs[work_index]);
+            }
+            if (!function_results[work_index]) {
+                fmt::print(stderr, "Error recompiling {}\n", context.functions[recompiled_function_indices[work_index]].name);
+                throw RunFailure{};
+            }
+        }
+    }
+
+    stats.begin_phase("static_functions");
 
     for (size_t section_index = 0; section_index < context.sections.size(); section_index++) {
         auto& section = context.sections[section_index];
@@ -818,22 +1342,18 @@ int main(int argc, char** argv) {
             uint32_t cur_func_end = static_cast<uint32_t>(section.size + section.ram_addr);
 
             // Search for the closest function 
-            size_t closest_func_index = 0;
-            while (closest_func_index < section_funcs.size() && section_funcs[closest_func_index] < static_func_addr) {
-                closest_func_index++;
-            }
+            auto closest_func_it = std::lower_bound(section_funcs.begin(), section_funcs.end(), static_func_addr);
 
             // Check if there's a nonstatic function after this one
-            if (closest_func_index < section_funcs.size()) {
+            if (closest_func_it != section_funcs.end()) {
                 // If so, use that function's address as the end of this one
-                cur_func_end = section_funcs[closest_func_index];
+                cur_func_end = *closest_func_it;
             }
 
             // Check for any known statics after this function and truncate this function's size to make sure it doesn't overlap.
-            for (uint32_t checked_func : statics_set) {
-                if (checked_func > static_func_addr && checked_func < cur_func_end) {
-                    cur_func_end = checked_func;
-                }
+            auto next_static_it = statics_set.upper_bound(static_func_addr);
+            if (next_static_it != statics_set.end() && *next_static_it < cur_func_end) {
+                cur_func_end = *next_static_it;
             }
 
             uint32_t rom_addr = static_cast<uint32_t>(static_func_addr - section.ram_addr + section.rom_addr);
@@ -857,19 +1377,16 @@ int main(int argc, char** argv) {
             fmt::print(func_header_file,
                        "void {}(uint8_t* rdram, recomp_context* ctx);\n", new_func.name);
 
-            bool result;
             size_t prev_num_statics = static_funcs_by_section[new_func.section_index].size();
-            if (config.single_file_output || config.functions_per_output_file > 1) {
-                result = N64Recomp::recompile_function(context, new_func_index, current_output_file, static_funcs_by_section, false);
-                if (!config.single_file_output) {
-                    cur_file_function_count++;
-                    if (cur_file_function_count >= config.functions_per_output_file) {
-                        open_new_output_file();
-                    }
+            std::string func_text{};
+            bool result = render_function(new_func_index, static_funcs_by_section, func_text);
+            if (result) {
+                if (grouped_output) {
+                    write_grouped_function(new_func_index, func_text);
+                }
+                else {
+                    result = write_single_function_file(config.recomp_include, config.output_func_path / (new_func.name + ".c"), func_text);
                 }
-            }
-            else {
-                result = recompile_single_function(context, new_func_index, config.recomp_include, config.output_func_path / (new_func.name + ".c"), static_funcs_by_section);
             }
 
             // Add any new static functions that were found while recompiling this one.
@@ -887,11 +1404,65 @@ int main(int argc, char** argv) {
 
             if (result == false) {
                 fmt::print(stderr, "Error recompiling {}\n", new_func.name);
-                std::exit(EXIT_FAILURE);
+                throw RunFailure{};
             }
         }
     }
 
+    if (balanced_output) {
+        stats.begin_phase("write_output_files");
+        std::unordered_set<std::string> shard_file_names{};
+        for (const OutputShard& shard : output_shards) {
+            std::string file_name = fmt::format("funcs_{}_{:08X}.c", shard.section_index, shard.first_vram);
+            if (!write_file_if_changed(config.output_func_path / file_name, grouped_file_header + shard.text)) {
+                fail_run("Failed to write output file " + file_name + "\n");
+            }
+            stats.add_counter("files", 1);
+            stats.add_counter("bytes", grouped_file_header.size() + shard.text.size());
+            shard_file_names.emplace(std::move(file_name));
+        }
+
+        // Remove grouped output files from previous runs that aren't part of the output anymore so that they don't get built.
+        auto is_grouped_file_name = [](std::string_view name) {
+            auto is_digits = [](std::string_view str, bool hex) {
+                return !str.empty() && std::all_of(str.begin(), str.end(), [hex](char c) {
+                    return (c >= '0' && c <= '9') || (hex && c >= 'A' && c <= 'F');
+                });
+            };
+            if (!name.starts_with("funcs_") || !name.ends_with(".c")) {
+                return false;
+            }
+            name = name.substr(6, name.size() - 8);
+            size_t separator = name.find('_');
+            if (separator == std::string_view::npos) {
+                return is_digits(name, false);
+            }
+            return is_digits(name.substr(0, separator), false) && name.size() - separator - 1 == 8 && is_digits(name.substr(separator + 1), true);
+        };
+
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator{ config.output_func_path, ec }) {
+            std::string file_name = entry.path().filename().string();
+            if (entry.is_regular_file() && is_grouped_file_name(file_name) && !shard_file_names.contains(file_name)) {
+                std::filesystem::remove(entry.path(), ec);
+            }
+        }
+    }
+
+    if (function_cache) {
+        fmt::print("Reused {} of {} functions from the cache\n", function_cache->num_hits(), function_cache->num_hits() + function_cache->num_misses());
+        // Remove the entries for functions that no longer exist or have changed so the cache doesn't grow forever.
+        function_cache->remove_unused_entries();
+    }
+
+    stats.begin_phase("write_tables");
+
+    if (config.profile_mode) {
+        if (!write_profile_files(config, context)) {
+            fail_run("Failed to write the profiling files\n");
+        }
+    }
+
     if (config.has_entrypoint) {
         std::ofstream lookup_file{ config.output_func_path / "lookup.cpp" };
         
@@ -909,11 +1480,13 @@ int main(int argc, char** argv) {
             static_cast<uint32_t>(config.entrypoint),
             config.elf_path.filename().replace_extension(".z64").string()
         );
+        stats.add_counter("bytes", static_cast<uint64_t>(lookup_file.tellp()));
     }
 
     {
         std::ofstream overlay_file(config.output_func_path / "recomp_overlays.inl");
         std::string section_load_table = "static SectionTableEntry section_table[] = {\n";
+        std::string section_dispatch_table = "static SectionDispatchTable section_dispatch_table[] = {\n";
 
         fmt::print(overlay_file, 
             "{}\n"
@@ -966,6 +1539,35 @@ int main(int argc, char** argv) {
 
                 fmt::print(overlay_file, "}};\n");
 
+                // Write the section's dispatch table, which has an entry for every word in the section plus a trailing null entry
+                // so that the array is never empty.
+                if (config.dispatch_tables) {
+                    std::string section_dispatch_array_name = fmt::format("section_{}_{}_dispatch", section_index, section_name_trimmed);
+                    std::vector<const N64Recomp::Function*> dispatch_entries((section.size + 3) / 4 + 1, nullptr);
+
+                    for (size_t func_index : section_funcs) {
+                        const auto& func = context.functions[func_index];
+                        uint32_t func_offset = func.vram - section.ram_addr;
+
+                        if ((func.reimplemented || (!func.name.empty() && !func.ignored && func.words.size() != 0)) &&
+                            (func_offset & 3) == 0 && func_offset / 4 < dispatch_entries.size()) {
+                            dispatch_entries[func_offset / 4] = &func;
+                        }
+                    }
+
+                    fmt::print(overlay_file, "static recomp_func_t* {}[] = {{\n", section_dispatch_array_name);
+                    for (size_t entry_index = 0; entry_index < dispatch_entries.size(); entry_index++) {
+                        const N64Recomp::Function* func = dispatch_entries[entry_index];
+                        // Put runs of empty entries on a single line to keep the output size down.
+                        bool line_start = entry_index == 0 || func != nullptr || dispatch_entries[entry_index - 1] != nullptr;
+                        bool line_end = entry_index + 1 == dispatch_entries.size() || func != nullptr || dispatch_entries[entry_index + 1] != nullptr;
+                        fmt::print(overlay_file, "{}{},{}", line_start ? "    " : " ", func == nullptr ? "nullptr" : func->name, line_end ? "\n" : "");
+                    }
+                    fmt::print(overlay_file, "}};\n");
+
+                    section_dispatch_table += fmt::format("    {{ .funcs = {0}, .num_funcs = ARRLEN({0}) }},\n", section_dispatch_array_name);
+                }
+
                 // Write the section's relocations.
                 if (!section_relocs.empty()) {
                     // Determine if reference symbols are being used.
@@ -1010,6 +1612,12 @@ int main(int argc, char** argv) {
 
         fmt::print(overlay_file, "{}", section_load_table);
 
+        // Write the dispatch tables for each section, in the same order as the section table.
+        if (config.dispatch_tables) {
+            section_dispatch_table += "};\n";
+            fmt::print(overlay_file, "{}", section_dispatch_table);
+        }
+
         fmt::print(overlay_file, "const size_t num_sections = {};\n", context.sections.size());
 
 
@@ -1026,7 +1634,7 @@ int main(int argc, char** argv) {
                     auto find_it = relocatable_section_indices.find(section);
                     if (find_it == relocatable_section_indices.end()) {
                         fmt::print(stderr, "Failed to find written section index of relocatable section: {}\n", section);
-                        std::exit(EXIT_FAILURE);
+                        throw RunFailure{};
                     }
                     fmt::print(overlay_file, "    {},\n", relocatable_section_indices[section]);
                 }
@@ -1096,6 +1704,7 @@ int main(int argc, char** argv) {
             fmt::print(overlay_file, "    {{ 0, NULL }}\n");
             fmt::print(overlay_file, "}};\n");
         }
+        stats.add_counter("bytes", static_cast<uint64_t>(overlay_file.tellp()));
     }
 
     fmt::print(func_header_file,
@@ -1108,7 +1717,128 @@ int main(int argc, char** argv) {
     if (!config.output_binary_path.empty()) {
         std::ofstream output_binary{config.output_binary_path, std::ios::binary};
         output_binary.write(reinterpret_cast<const char*>(context.rom.data()), context.rom.size());
+        stats.add_counter("bytes", context.rom.size());
+    }
+
+    stats.end_phase();
+    if (print_stats) {
+        stats.print(context, num_slowest_funcs);
+    }
+    if (!stats_json_path.empty() && !stats.write_json(stats_json_path, context, num_slowest_funcs)) {
+        fail_run("Failed to write the stats file\n");
     }
 
     return 0;
 }
+
+int main(int argc, char** argv) {
+    RunOptions options{};
+    bool watch = false;
+
+    if (argc < 2) {
+        fmt::print("Usage: {} <config file> [--dump-context] [--jobs <count>] [--incremental] [--stats] [--stats-json <path>] [--watch]\n", argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    const char* config_path = argv[1];
+
+    for (size_t i = 2; i < argc; i++) {
+        std::string_view cur_arg = argv[i];
+        if (cur_arg == "--dump-context") {
+            options.dumping_context = true;
+        }
+        else if (cur_arg == "--incremental") {
+            options.incremental = true;
+        }
+        else if (cur_arg == "--stats") {
+            options.print_stats = true;
+        }
+        else if (cur_arg == "--watch") {
+            watch = true;
+        }
+        else if (cur_arg == "--stats-json") {
+            if (i + 1 >= argc) {
+                fmt::print("Missing value for argument \"{}\"\n", cur_arg);
+                return EXIT_FAILURE;
+            }
+            options.stats_json_path = argv[++i];
+        }
+        else if (cur_arg == "--jobs") {
+            if (i + 1 >= argc) {
+                fmt::print("Missing value for argument \"{}\"\n", cur_arg);
+                return EXIT_FAILURE;
+            }
+            std::string_view jobs_arg = argv[++i];
+            auto parse_result = std::from_chars(jobs_arg.data(), jobs_arg.data() + jobs_arg.size(), options.num_jobs);
+            if (parse_result.ec != std::errc{} || parse_result.ptr != jobs_arg.data() + jobs_arg.size()) {
+                fmt::print("Invalid job count \"{}\"\n", jobs_arg);
+                return EXIT_FAILURE;
+            }
+            // A job count of 0 means one job per hardware thread.
+            if (options.num_jobs == 0) {
+                options.num_jobs = std::max(1U, std::thread::hardware_concurrency());
+            }
+        }
+        else {
+            fmt::print("Unknown argument \"{}\"\n", cur_arg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    ResidentContexts resident{};
+    std::vector<WatchedFile> watched_files{};
+
+    if (!watch) {
+        try {
+            return run_recompiler(config_path, options, resident, watched_files);
+        }
+        catch (const RunFailure&) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.dumping_context) {
+        fmt::print(stderr, "Cannot use --watch with --dump-context\n");
+        return EXIT_FAILURE;
+    }
+
+    // Watch mode always uses the function cache so that a rerun only recompiles the functions that changed, and keeps the contexts
+    // built from files that rarely change (the reference symbols, or the symbols file and ROM) in memory between runs.
+    options.incremental = true;
+    resident.enabled = true;
+
+    // How often to check the input files for changes.
+    constexpr auto poll_interval = std::chrono::milliseconds{200};
+
+    while (true) {
+        watched_files.clear();
+        auto run_start = std::chrono::steady_clock::now();
+        try {
+            run_recompiler(config_path, options, resident, watched_files);
+            fmt::print("Recompiled in {:.3f} s\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count());
+        }
+        catch (const RunFailure&) {
+            fmt::print(stderr, "Recompilation failed\n");
+        }
+        catch (const std::exception& e) {
+            fmt::print(stderr, "Recompilation failed: {}\n", e.what());
+        }
+        fmt::print("Watching {} files for changes\n", watched_files.size());
+        std::fflush(stdout);
+
+        while (!watched_files_changed(watched_files)) {
+            std::this_thread::sleep_for(poll_interval);
+        }
+
+        // Wait for the files to stop changing so that a rerun doesn't start while a build is still writing them.
+        while (true) {
+            for (WatchedFile& file : watched_files) {
+                file.write_time = get_write_time(file.path);
+            }
+            std::this_thread::sleep_for(poll_interval);
+            if (!watched_files_changed(watched_files)) {
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "recompiler/context.h"
+
+// Read-only mapping of an entire file, which gets unmapped when the last ROM buffer referring to it is destroyed.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+#ifdef _WIN32
+        if (view != nullptr) {
+            UnmapViewOfFile(view);
+        }
+#else
+        if (view != nullptr) {
+            munmap(view, size);
+        }
+#endif
+    }
+
+    bool map(const std::filesystem::path& path) {
+#ifdef _WIN32
+        HANDLE file_handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_handle, &file_size)) {
+            CloseHandle(file_handle);
+            return false;
+        }
+
+        // Empty files can't be mapped, so they're left without a view.
+        if (file_size.QuadPart == 0) {
+            CloseHandle(file_handle);
+            return true;
+        }
+
+        HANDLE mapping_handle = CreateFileMappingW(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file_handle);
+        if (mapping_handle == nullptr) {
+            return false;
+        }
+
+        // The view keeps the mapping alive, so the mapping handle can be closed right away.
+        view = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping_handle);
+        if (view == nullptr) {
+            return false;
+        }
+        size = static_cast<size_t>(file_size.QuadPart);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0) {
+            close(fd);
+            return false;
+        }
+
+        // Empty files can't be mapped, so they're left without a view.
+        if (file_stat.st_size == 0) {
+            close(fd);
+            return true;
+        }
+
+        // The mapping stays valid after the file descriptor is closed.
+        void* mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        view = mapping;
+        size = static_cast<size_t>(file_stat.st_size);
+#endif
+        return true;
+    }
+
+    std::span<const uint8_t> contents() const {
+        return { reinterpret_cast<const uint8_t*>(view), size };
+    }
+private:
+    void* view = nullptr;
+    size_t size = 0;
+};
+
+bool N64Recomp::map_file(const std::filesystem::path& path, RomBuffer& out) {
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    if (!file->map(path)) {
+        return false;
+    }
+
+    std::span<const uint8_t> contents = file->contents();
+    out = RomBuffer{ std::move(file), contents };
+    return true;
+}
@@ -520,6 +520,9 @@ N64Recomp::ModSymbolsError N64Recomp::parse_mod_symbols(std::span<const char> da
         }
     }
 
+    // Build the vram index for JAL resolution, as the mod's functions are all known at this point.
+    mod_context_out.build_function_vram_index();
+
     return ModSymbolsError::Good;
 }
 
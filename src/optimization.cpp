@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <unordered_set>
+
+#include "rabbitizer.hpp"
+
+#include "recompiler/context.h"
+#include "recompiler/operations.h"
+#include "optimization.h"
+
+using InstrId = rabbitizer::InstrId::UniqueId;
+
+// GPRs that an instruction reads and writes as bitmasks, along with whether the instruction ends the current block.
+struct InstructionEffects {
+    uint32_t reads = 0;
+    uint32_t writes = 0;
+    bool barrier = false;
+};
+
+static uint32_t gpr_bit(int gpr) {
+    return gpr == 0 ? 0 : (1u << gpr);
+}
+
+static int get_operand_gpr(N64Recomp::Operand operand, const rabbitizer::InstructionCpu& instr) {
+    switch (operand) {
+        case N64Recomp::Operand::Rd:
+            return (int)instr.GetO32_rd();
+        case N64Recomp::Operand::Rs:
+            return (int)instr.GetO32_rs();
+        case N64Recomp::Operand::Rt:
+            return (int)instr.GetO32_rt();
+        default:
+            return -1;
+    }
+}
+
+static uint32_t get_operand_mask(N64Recomp::Operand operand, const rabbitizer::InstructionCpu& instr) {
+    int gpr = get_operand_gpr(operand, instr);
+    return gpr == -1 ? 0 : gpr_bit(gpr);
+}
+
+// Checks if an operand always evaluates to zero.
+static bool is_zero_operand(N64Recomp::Operand operand, const rabbitizer::InstructionCpu& instr) {
+    switch (operand) {
+        case N64Recomp::Operand::Zero:
+            return true;
+        case N64Recomp::Operand::ImmU16:
+        case N64Recomp::Operand::ImmS16:
+            return instr.Get_immediate() == 0;
+        case N64Recomp::Operand::Sa:
+            return instr.Get_sa() == 0;
+        default:
+            return get_operand_gpr(operand, instr) == 0;
+    }
+}
+
+static bool is_unaligned_load(N64Recomp::BinaryOpType type) {
+    using N64Recomp::BinaryOpType;
+    return type == BinaryOpType::LDL || type == BinaryOpType::LDR || type == BinaryOpType::LWL || type == BinaryOpType::LWR;
+}
+
+static InstructionEffects get_instruction_effects(const rabbitizer::InstructionCpu& instr, InstrId instr_id) {
+    InstructionEffects ret{};
+
+    if (instr_id == InstrId::cpu_nop) {
+        return ret;
+    }
+
+    auto find_binary_it = N64Recomp::binary_ops.find(instr_id);
+    if (find_binary_it != N64Recomp::binary_ops.end()) {
+        const N64Recomp::BinaryOp& op = find_binary_it->second;
+        ret.reads = get_operand_mask(op.operands.operands[0], instr) | get_operand_mask(op.operands.operands[1], instr);
+        ret.writes = get_operand_mask(op.output, instr);
+        // Unaligned loads merge into the output's existing value.
+        if (is_unaligned_load(op.type)) {
+            ret.reads |= ret.writes;
+        }
+        return ret;
+    }
+
+    auto find_unary_it = N64Recomp::unary_ops.find(instr_id);
+    if (find_unary_it != N64Recomp::unary_ops.end()) {
+        const N64Recomp::UnaryOp& op = find_unary_it->second;
+        ret.reads = get_operand_mask(op.input, instr);
+        ret.writes = get_operand_mask(op.output, instr);
+        return ret;
+    }
+
+    auto find_store_it = N64Recomp::store_ops.find(instr_id);
+    if (find_store_it != N64Recomp::store_ops.end()) {
+        const N64Recomp::StoreOp& op = find_store_it->second;
+        ret.reads = get_operand_mask(op.value_input, instr) | gpr_bit((int)instr.GetO32_rs());
+        return ret;
+    }
+
+    // Everything else gets handled specially by the recompiler, so treat it as the end of the block.
+    ret.barrier = true;
+    return ret;
+}
+
+// Checks if the output of an instruction is known to be a sign extended 32-bit value, given the registers that are known to be sign extended before it.
+static bool produces_sign_extended(const rabbitizer::InstructionCpu& instr, InstrId instr_id, uint32_t sign_extended) {
+    using N64Recomp::BinaryOpType;
+    using N64Recomp::UnaryOpType;
+    using N64Recomp::Operand;
+
+    auto operand_sign_extended = [&](Operand operand, UnaryOpType operation) {
+        if (operation != UnaryOpType::None) {
+            return false;
+        }
+        switch (operand) {
+            case Operand::ImmU16:
+            case Operand::ImmS16:
+            case Operand::Zero:
+                return true;
+            default:
+                break;
+        }
+        int gpr = get_operand_gpr(operand, instr);
+        return gpr == 0 || (gpr != -1 && (sign_extended & gpr_bit(gpr)) != 0);
+    };
+
+    auto find_binary_it = N64Recomp::binary_ops.find(instr_id);
+    if (find_binary_it != N64Recomp::binary_ops.end()) {
+        const N64Recomp::BinaryOp& op = find_binary_it->second;
+        switch (op.type) {
+            case BinaryOpType::Add32:
+            case BinaryOpType::Sub32:
+            case BinaryOpType::Sll32:
+            case BinaryOpType::Srl32:
+            case BinaryOpType::Sra32:
+            case BinaryOpType::Equal:
+            case BinaryOpType::NotEqual:
+            case BinaryOpType::Less:
+            case BinaryOpType::LessEq:
+            case BinaryOpType::Greater:
+            case BinaryOpType::GreaterEq:
+            case BinaryOpType::LW:
+            case BinaryOpType::LH:
+            case BinaryOpType::LHU:
+            case BinaryOpType::LB:
+            case BinaryOpType::LBU:
+            case BinaryOpType::True:
+            case BinaryOpType::False:
+                return true;
+            // Bitwise operations on two sign extended values produce a sign extended value, as the upper 32 bits of each input match bit 31.
+            case BinaryOpType::And64:
+            case BinaryOpType::Or64:
+            case BinaryOpType::Nor64:
+            case BinaryOpType::Xor64:
+                return operand_sign_extended(op.operands.operands[0], op.operands.operand_operations[0]) &&
+                    operand_sign_extended(op.operands.operands[1], op.operands.operand_operations[1]);
+            default:
+                return false;
+        }
+    }
+
+    auto find_unary_it = N64Recomp::unary_ops.find(instr_id);
+    if (find_unary_it != N64Recomp::unary_ops.end()) {
+        const N64Recomp::UnaryOp& op = find_unary_it->second;
+        switch (op.operation) {
+            case UnaryOpType::Lui:
+            case UnaryOpType::ToS32:
+            case UnaryOpType::ToInt32:
+                return true;
+            case UnaryOpType::None:
+                return operand_sign_extended(op.input, UnaryOpType::None);
+            default:
+                return false;
+        }
+    }
+
+    return false;
+}
+
+// Checks if an instruction leaves its output unchanged when the output is already sign extended, such as sll x, x, 0 or addiu x, x, 0.
+// Also returns the register in question.
+static bool is_sign_extension_noop(const rabbitizer::InstructionCpu& instr, InstrId instr_id, int& reg_out) {
+    using N64Recomp::BinaryOpType;
+
+    auto find_binary_it = N64Recomp::binary_ops.find(instr_id);
+    if (find_binary_it == N64Recomp::binary_ops.end()) {
+        return false;
+    }
+    const N64Recomp::BinaryOp& op = find_binary_it->second;
+    if (op.operands.operand_operations[0] != N64Recomp::UnaryOpType::None || op.operands.operand_operations[1] != N64Recomp::UnaryOpType::None) {
+        return false;
+    }
+
+    int output = get_operand_gpr(op.output, instr);
+    if (output <= 0) {
+        return false;
+    }
+
+    switch (op.type) {
+        // x = x + 0 and x = 0 + x.
+        case BinaryOpType::Add32:
+            if (get_operand_gpr(op.operands.operands[0], instr) == output && is_zero_operand(op.operands.operands[1], instr)) {
+                reg_out = output;
+                return true;
+            }
+            if (get_operand_gpr(op.operands.operands[1], instr) == output && is_zero_operand(op.operands.operands[0], instr)) {
+                reg_out = output;
+                return true;
+            }
+            return false;
+        // x = x - 0 and x = x shifted by 0.
+        case BinaryOpType::Sub32:
+        case BinaryOpType::Sll32:
+        case BinaryOpType::Srl32:
+        case BinaryOpType::Sra32:
+            if (get_operand_gpr(op.operands.operands[0], instr) == output && is_zero_operand(op.operands.operands[1], instr)) {
+                reg_out = output;
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+// Checks if the given instruction has a reloc that the recompiler will process.
+static bool has_processed_reloc(const N64Recomp::Context& context, const N64Recomp::Section& section, uint32_t vram) {
+    auto find_it = section.relocs.begin() + section.find_first_reloc(vram);
+    for (; find_it != section.relocs.end() && find_it->address == vram; ++find_it) {
+        if (find_it->reference_symbol) {
+            return true;
+        }
+        if (find_it->target_section != N64Recomp::SectionAbsolute && context.sections[find_it->target_section].relocatable) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void N64Recomp::optimize_function(const Context& context, const Function& function, const std::vector<rabbitizer::InstructionCpu>& instructions,
+    const FunctionStats& stats, std::span<const uint32_t> branch_labels, std::vector<OptimizedInstruction>& instructions_out)
+{
+    const Section& section = context.sections[function.section_index];
+
+    instructions_out.clear();
+    instructions_out.resize(instructions.size());
+
+    std::unordered_set<uint32_t> jtbl_instructions{};
+    for (const JumpTable& jtbl : stats.jump_tables) {
+        jtbl_instructions.insert(jtbl.lw_vram);
+        jtbl_instructions.insert(jtbl.addu_vram);
+    }
+
+    // Gather the effects of each instruction. Use thread locals to prevent reallocation across functions.
+    thread_local std::vector<InstructionEffects> effects{};
+    thread_local std::vector<bool> block_starts{};
+    effects.clear();
+    block_starts.clear();
+    effects.resize(instructions.size());
+    block_starts.resize(instructions.size());
+    for (size_t instr_index = 0; instr_index < instructions.size(); instr_index++) {
+        const auto& instr = instructions[instr_index];
+        uint32_t vram = instr.getVram();
+        InstructionEffects& cur_effects = effects[instr_index];
+        cur_effects = get_instruction_effects(instr, instr.getUniqueId());
+
+        // Instructions in delay slots are generated in more than one place, so leave them and the instruction with the delay slot alone.
+        bool in_delay_slot = instr_index > 0 && instructions[instr_index - 1].hasDelaySlot();
+        if (in_delay_slot || instr.hasDelaySlot() || jtbl_instructions.contains(vram) || has_processed_reloc(context, section, vram) ||
+            function.function_hooks.contains(static_cast<int32_t>(instr_index)))
+        {
+            cur_effects.barrier = true;
+        }
+
+        block_starts[instr_index] = instr_index == 0 || std::binary_search(branch_labels.begin(), branch_labels.end(), vram);
+    }
+
+    // Fold lui/addiu and lui/ori pairs and remove redundant sign extensions.
+    uint32_t sign_extended = 0;
+    for (size_t instr_index = 0; instr_index < instructions.size(); instr_index++) {
+        const auto& instr = instructions[instr_index];
+        InstrId instr_id = instr.getUniqueId();
+        const InstructionEffects& cur_effects = effects[instr_index];
+
+        if (block_starts[instr_index]) {
+            sign_extended = 0;
+        }
+        if (cur_effects.barrier) {
+            sign_extended = 0;
+            continue;
+        }
+
+        // Instructions that were already folded into a lui pair are kept, as the lui may have been removed.
+        int noop_reg;
+        if (instructions_out[instr_index].action == InstructionAction::Emit && is_sign_extension_noop(instr, instr_id, noop_reg) && (sign_extended & gpr_bit(noop_reg)) != 0) {
+            instructions_out[instr_index].action = InstructionAction::Skip;
+            continue;
+        }
+
+        if (instr_id == InstrId::cpu_lui && instr_index + 1 < instructions.size() &&
+            !block_starts[instr_index + 1] && !effects[instr_index + 1].barrier)
+        {
+            const auto& next_instr = instructions[instr_index + 1];
+            InstrId next_id = next_instr.getUniqueId();
+            int lui_reg = (int)instr.GetO32_rt();
+            if (lui_reg != 0 && (next_id == InstrId::cpu_addiu || next_id == InstrId::cpu_ori) && (int)next_instr.GetO32_rs() == lui_reg) {
+                uint32_t hi = uint32_t(instr.Get_immediate()) << 16;
+                uint16_t lo = next_instr.Get_immediate();
+                uint32_t value = next_id == InstrId::cpu_addiu ? hi + uint32_t(int32_t(int16_t(lo))) : (hi | lo);
+                int output_reg = (int)next_instr.GetO32_rt();
+
+                // The lui's result is only used by the next instruction if that instruction overwrites it.
+                if (output_reg == lui_reg) {
+                    instructions_out[instr_index].action = InstructionAction::Skip;
+                }
+                if (output_reg != 0) {
+                    instructions_out[instr_index + 1] = OptimizedInstruction{ .action = InstructionAction::LoadConstant, .reg = uint8_t(output_reg), .constant = int32_t(value) };
+                }
+            }
+        }
+
+        if (produces_sign_extended(instr, instr_id, sign_extended)) {
+            sign_extended |= cur_effects.writes;
+        }
+        else {
+            sign_extended &= ~cur_effects.writes;
+        }
+    }
+
+    // Remove writes that are overwritten later in the same block without being read first.
+    for (size_t instr_index = 0; instr_index < instructions.size(); instr_index++) {
+        const InstructionEffects& cur_effects = effects[instr_index];
+        if (cur_effects.barrier || cur_effects.writes == 0 || instructions_out[instr_index].action == InstructionAction::Skip) {
+            continue;
+        }
+
+        bool dead = false;
+        for (size_t next_index = instr_index + 1; next_index < instructions.size(); next_index++) {
+            const InstructionEffects& next_effects = effects[next_index];
+            if (block_starts[next_index] || next_effects.barrier || (next_effects.reads & cur_effects.writes) != 0) {
+                break;
+            }
+            if ((next_effects.writes & cur_effects.writes) != 0) {
+                dead = true;
+                break;
+            }
+        }
+
+        if (dead) {
+            instructions_out[instr_index].action = InstructionAction::Skip;
+        }
+    }
+}
+
+void N64Recomp::find_memory_runs(const Context& context, const Function& function, const std::vector<rabbitizer::InstructionCpu>& instructions,
+    const FunctionStats& stats, std::span<const uint32_t> branch_labels, std::vector<OptimizedInstruction>& instructions_out)
+{
+    const Section& section = context.sections[function.section_index];
+
+    if (instructions_out.empty()) {
+        instructions_out.resize(instructions.size());
+    }
+
+    std::unordered_set<uint32_t> jtbl_instructions{};
+    for (const JumpTable& jtbl : stats.jump_tables) {
+        jtbl_instructions.insert(jtbl.lw_vram);
+    }
+
+    // Base register of the access that the current run continues from, or -1 if there's no run.
+    int run_base = -1;
+    for (size_t instr_index = 0; instr_index < instructions.size(); instr_index++) {
+        const auto& instr = instructions[instr_index];
+        uint32_t vram = instr.getVram();
+        OptimizedInstruction& cur_optimized = instructions_out[instr_index];
+        cur_optimized.reuse_base_address = false;
+
+        bool is_access = false;
+        bool writes_base = false;
+        switch (instr.getUniqueId()) {
+            case InstrId::cpu_lw:
+            case InstrId::cpu_lwu:
+            case InstrId::cpu_ld:
+                // Loads into $zero get skipped by the generators without calculating the base address, so they can't start or continue a run.
+                is_access = instr.GetO32_rt() != rabbitizer::Registers::Cpu::GprO32::GPR_O32_zero;
+                writes_base = instr.GetO32_rt() == instr.GetO32_rs();
+                break;
+            case InstrId::cpu_sw:
+            case InstrId::cpu_sd:
+                is_access = true;
+                break;
+            default:
+                break;
+        }
+
+        bool in_delay_slot = instr_index > 0 && instructions[instr_index - 1].hasDelaySlot();
+        if (!is_access || cur_optimized.action != InstructionAction::Emit || in_delay_slot || jtbl_instructions.contains(vram) ||
+            has_processed_reloc(context, section, vram) || function.function_hooks.contains(static_cast<int32_t>(instr_index)))
+        {
+            run_base = -1;
+            continue;
+        }
+
+        int base = (int)instr.GetO32_rs();
+        bool block_start = std::binary_search(branch_labels.begin(), branch_labels.end(), vram);
+        cur_optimized.reuse_base_address = !block_start && base != 0 && base == run_base;
+        run_base = (base == 0 || writes_base) ? -1 : base;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef __RECOMP_OPTIMIZATION_H__
+#define __RECOMP_OPTIMIZATION_H__
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "recompiler/context.h"
+#include "analysis.h"
+
+namespace N64Recomp {
+    // What to generate for an instruction after the optimization pass has run.
+    enum class InstructionAction : uint8_t {
+        // Generate the instruction as normal.
+        Emit,
+        // Don't generate anything, as the instruction has no effect on the rest of the function.
+        Skip,
+        // Load a 32-bit constant (sign extended to 64 bits) into a register instead. Used for lui pairs that were folded together.
+        LoadConstant,
+    };
+
+    struct OptimizedInstruction {
+        InstructionAction action = InstructionAction::Emit;
+        uint8_t reg = 0;
+        int32_t constant = 0;
+        // Set for loads and stores that use the same base register as the previous instruction, which is also a load or store.
+        // Generators can keep the address of the base register in rdram from the previous instruction and reuse it. See find_memory_runs.
+        bool reuse_base_address = false;
+    };
+
+    // Optimizes a function's instructions within each basic block. This folds lui/addiu and lui/ori pairs without relocations into constants,
+    // removes writes to registers that get overwritten in the same block before being read, and removes 32-bit no-ops (such as sll x, x, 0)
+    // that only sign extend a register that's already known to be sign extended. Instructions that get handled specially by the recompiler
+    // (calls, branches and their delay slots, jump table instructions, hooks and relocated instructions) are never changed and end the block.
+    // The branch labels must be sorted. Populates one entry per instruction in the function.
+    void optimize_function(const Context& context, const Function& function, const std::vector<rabbitizer::InstructionCpu>& instructions,
+        const FunctionStats& stats, std::span<const uint32_t> branch_labels, std::vector<OptimizedInstruction>& instructions_out);
+
+    // Finds runs of aligned word and doubleword loads and stores through the same base register, such as a function's stack frame saves
+    // and restores, and marks every access after the first in each run with reuse_base_address. A run ends at anything that may change
+    // the base register or that gets generated out of order, which is the same set of instructions optimize_function leaves alone.
+    // Doesn't change the action of any instruction, but only accesses whose action is Emit take part in runs. Populates one entry per
+    // instruction if instructions_out is empty, so it can be used without running optimize_function first.
+    void find_memory_runs(const Context& context, const Function& function, const std::vector<rabbitizer::InstructionCpu>& instructions,
+        const FunctionStats& stats, std::span<const uint32_t> branch_labels, std::vector<OptimizedInstruction>& instructions_out);
+}
+
+#endif
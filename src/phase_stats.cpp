@@ -0,0 +1,198 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+
+#include "fmt/format.h"
+#include "fmt/ostream.h"
+
+#include "recompiler/json.h"
+#include "phase_stats.h"
+
+namespace {
+    // Returns the user and kernel CPU time used by the process so far, in seconds.
+    double get_process_cpu_seconds() {
+#ifdef _WIN32
+        FILETIME creation_time, exit_time, kernel_time, user_time;
+        if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+            return 0.0;
+        }
+        auto to_seconds = [](const FILETIME& time) {
+            // FILETIME is in 100 nanosecond units.
+            return static_cast<double>((uint64_t{time.dwHighDateTime} << 32) | time.dwLowDateTime) * 1e-7;
+        };
+        return to_seconds(kernel_time) + to_seconds(user_time);
+#else
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0.0;
+        }
+        auto to_seconds = [](const timeval& time) {
+            return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_usec) * 1e-6;
+        };
+        return to_seconds(usage.ru_utime) + to_seconds(usage.ru_stime);
+#endif
+    }
+
+    // Returns the peak resident memory of the process so far, in bytes.
+    uint64_t get_peak_rss_bytes() {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return 0;
+        }
+        return counters.PeakWorkingSetSize;
+#else
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+#ifdef __APPLE__
+        // macOS reports this in bytes instead of kilobytes.
+        return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    }
+}
+
+void N64Recomp::PhaseStats::begin_phase(std::string_view name) {
+    if (!enabled) {
+        return;
+    }
+    end_phase();
+
+    std::lock_guard lock{ mutex };
+    phases.emplace_back(Phase{ .name = std::string{name} });
+    in_phase = true;
+    phase_cpu_start = get_process_cpu_seconds();
+    phase_wall_start = std::chrono::steady_clock::now();
+}
+
+void N64Recomp::PhaseStats::end_phase() {
+    if (!enabled || !in_phase) {
+        return;
+    }
+
+    std::lock_guard lock{ mutex };
+    Phase& phase = phases.back();
+    phase.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - phase_wall_start).count();
+    phase.cpu_seconds = get_process_cpu_seconds() - phase_cpu_start;
+    phase.peak_rss_bytes = get_peak_rss_bytes();
+    in_phase = false;
+}
+
+void N64Recomp::PhaseStats::add_counter(std::string_view name, uint64_t value) {
+    if (!enabled) {
+        return;
+    }
+
+    std::lock_guard lock{ mutex };
+    if (!in_phase) {
+        return;
+    }
+    auto& counters = phases.back().counters;
+    auto find_it = std::find_if(counters.begin(), counters.end(), [name](const auto& counter) { return counter.first == name; });
+    if (find_it == counters.end()) {
+        counters.emplace_back(std::string{name}, value);
+    }
+    else {
+        find_it->second += value;
+    }
+}
+
+void N64Recomp::PhaseStats::record_function(size_t func_index, double seconds) {
+    if (!enabled) {
+        return;
+    }
+
+    std::lock_guard lock{ mutex };
+    function_times.emplace_back(func_index, seconds);
+}
+
+std::vector<std::pair<size_t, double>> N64Recomp::PhaseStats::get_slowest_functions(size_t count) {
+    std::lock_guard lock{ mutex };
+    std::vector<std::pair<size_t, double>> ret = function_times;
+    count = std::min(count, ret.size());
+    std::partial_sort(ret.begin(), ret.begin() + count, ret.end(), [](const auto& a, const auto& b) {
+        return a.second > b.second;
+    });
+    ret.resize(count);
+    return ret;
+}
+
+void N64Recomp::PhaseStats::print(const Context& context, size_t num_slowest_funcs) {
+    if (!enabled) {
+        return;
+    }
+    end_phase();
+
+    fmt::print("\n{:<24} {:>10} {:>10} {:>12}  {}\n", "Phase", "Wall (s)", "CPU (s)", "Peak RSS", "Counters");
+    double total_wall = 0.0;
+    double total_cpu = 0.0;
+    for (const Phase& phase : phases) {
+        std::string counters_str{};
+        for (const auto& [counter_name, counter_value] : phase.counters) {
+            counters_str += fmt::format("{}{}={}", counters_str.empty() ? "" : " ", counter_name, counter_value);
+        }
+        fmt::print("{:<24} {:>10.3f} {:>10.3f} {:>9.1f} MB  {}\n", phase.name, phase.wall_seconds, phase.cpu_seconds,
+            static_cast<double>(phase.peak_rss_bytes) / (1024.0 * 1024.0), counters_str);
+        total_wall += phase.wall_seconds;
+        total_cpu += phase.cpu_seconds;
+    }
+    fmt::print("{:<24} {:>10.3f} {:>10.3f}\n", "Total", total_wall, total_cpu);
+
+    std::vector<std::pair<size_t, double>> slowest_funcs = get_slowest_functions(num_slowest_funcs);
+    if (!slowest_funcs.empty()) {
+        fmt::print("\nSlowest functions:\n");
+        for (const auto& [func_index, seconds] : slowest_funcs) {
+            const Function& func = context.functions[func_index];
+            fmt::print("  {:>10.3f} ms  {} ({} instructions)\n", seconds * 1000.0, func.name, func.words.size());
+        }
+    }
+}
+
+bool N64Recomp::PhaseStats::write_json(const std::filesystem::path& path, const Context& context, size_t num_slowest_funcs) {
+    if (!enabled) {
+        return true;
+    }
+    end_phase();
+
+    std::ofstream output_file{ path };
+    if (!output_file.good()) {
+        fmt::print(stderr, "Failed to open file for writing: {}\n", path.string());
+        return false;
+    }
+
+    fmt::print(output_file, "{{\n  \"phases\": [\n");
+    for (size_t phase_index = 0; phase_index < phases.size(); phase_index++) {
+        const Phase& phase = phases[phase_index];
+        fmt::print(output_file, "    {{ \"name\": \"{}\", \"wall_seconds\": {:.6f}, \"cpu_seconds\": {:.6f}, \"peak_rss_bytes\": {}, \"counters\": {{",
+            escape_json_string(phase.name), phase.wall_seconds, phase.cpu_seconds, phase.peak_rss_bytes);
+        for (size_t counter_index = 0; counter_index < phase.counters.size(); counter_index++) {
+            const auto& [counter_name, counter_value] = phase.counters[counter_index];
+            fmt::print(output_file, "{} \"{}\": {}", counter_index == 0 ? "" : ",", escape_json_string(counter_name), counter_value);
+        }
+        fmt::print(output_file, " }} }}{}\n", phase_index + 1 == phases.size() ? "" : ",");
+    }
+    fmt::print(output_file, "  ],\n  \"slowest_functions\": [\n");
+
+    std::vector<std::pair<size_t, double>> slowest_funcs = get_slowest_functions(num_slowest_funcs);
+    for (size_t i = 0; i < slowest_funcs.size(); i++) {
+        const auto& [func_index, seconds] = slowest_funcs[i];
+        const Function& func = context.functions[func_index];
+        fmt::print(output_file, "    {{ \"name\": \"{}\", \"vram\": {}, \"section_index\": {}, \"instructions\": {}, \"seconds\": {:.6f} }}{}\n",
+            escape_json_string(func.name), func.vram, func.section_index, func.words.size(), seconds, i + 1 == slowest_funcs.size() ? "" : ",");
+    }
+    fmt::print(output_file, "  ]\n}}\n");
+
+    return output_file.good();
+}
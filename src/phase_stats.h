@@ -0,0 +1,59 @@
+#ifndef __RECOMP_PHASE_STATS_H__
+#define __RECOMP_PHASE_STATS_H__
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "recompiler/context.h"
+
+namespace N64Recomp {
+    // Collects the wall time, CPU time and peak memory usage of each phase of a run, along with counters for the amount of work done in each one
+    // and the time taken to produce each function's output. All methods do nothing if the stats aren't enabled, so the calls can be left in place.
+    class PhaseStats {
+    public:
+        struct Phase {
+            std::string name;
+            double wall_seconds = 0.0;
+            double cpu_seconds = 0.0;
+            // Peak resident memory of the process as of the end of the phase.
+            uint64_t peak_rss_bytes = 0;
+            std::vector<std::pair<std::string, uint64_t>> counters;
+        };
+
+        PhaseStats(bool enabled) : enabled(enabled) {}
+        bool is_enabled() const { return enabled; }
+
+        // Ends the current phase if there is one and starts a new one with the given name.
+        void begin_phase(std::string_view name);
+        // Ends the current phase, if there is one.
+        void end_phase();
+        // Adds the value to a counter of the current phase. Safe to call from multiple threads.
+        void add_counter(std::string_view name, uint64_t value);
+        // Records the time taken to produce the output of the given function, which covers both analysis and emission.
+        // Safe to call from multiple threads.
+        void record_function(size_t func_index, double seconds);
+
+        // Prints every phase as a table followed by the given number of slowest functions.
+        void print(const Context& context, size_t num_slowest_funcs);
+        // Writes the same information as print to the given path as JSON.
+        bool write_json(const std::filesystem::path& path, const Context& context, size_t num_slowest_funcs);
+    private:
+        std::vector<std::pair<size_t, double>> get_slowest_functions(size_t count);
+
+        bool enabled;
+        bool in_phase = false;
+        std::chrono::steady_clock::time_point phase_wall_start;
+        double phase_cpu_start = 0.0;
+        std::mutex mutex;
+        std::vector<Phase> phases;
+        std::vector<std::pair<size_t, double>> function_times;
+    };
+}
+
+#endif
@@ -1,8 +1,9 @@
 #include <vector>
-#include <set>
-#include <unordered_set>
+#include <algorithm>
 #include <unordered_map>
 #include <cassert>
+#include <streambuf>
+#include <ostream>
 
 #include "rabbitizer.hpp"
 #include "fmt/format.h"
@@ -12,6 +13,7 @@
 #include "analysis.h"
 #include "recompiler/operations.h"
 #include "recompiler/generator.h"
+#include "optimization.h"
 
 enum class JalResolutionResult {
     NoMatch,
@@ -21,6 +23,18 @@ enum class JalResolutionResult {
     Error
 };
 
+N64Recomp::Label instruction_label(const N64Recomp::Function& func, uint32_t vram) {
+    return N64Recomp::Label{ N64Recomp::LabelType::Instruction, (vram - func.vram) / 4, vram };
+}
+
+N64Recomp::Label likely_skip_label(int likely_branch_index) {
+    return N64Recomp::Label{ N64Recomp::LabelType::LikelySkip, static_cast<uint32_t>(likely_branch_index), 0 };
+}
+
+N64Recomp::Label link_return_label(int link_branch_index) {
+    return N64Recomp::Label{ N64Recomp::LabelType::LinkReturn, static_cast<uint32_t>(link_branch_index), 0 };
+}
+
 JalResolutionResult resolve_jal(const N64Recomp::Context& context, size_t cur_section_index, uint32_t target_func_vram, size_t& matched_function_index) {
     // Skip resolution if all function calls should use lookup and just return Ambiguous.
     if (context.use_lookup_for_all_function_calls) {
@@ -29,7 +43,7 @@ JalResolutionResult resolve_jal(const N64Recomp::Context& context, size_t cur_se
 
     // Look for symbols with the target vram address
     const N64Recomp::Section& cur_section = context.sections[cur_section_index];
-    const auto matching_funcs_find = context.functions_by_vram.find(target_func_vram);
+    std::span<const size_t> matching_funcs = context.get_functions_at_vram(target_func_vram);
     uint32_t section_vram_start = cur_section.ram_addr;
     uint32_t section_vram_end = cur_section.ram_addr + cur_section.size;
     bool in_current_section = target_func_vram >= section_vram_start && target_func_vram < section_vram_end;
@@ -40,30 +54,28 @@ JalResolutionResult resolve_jal(const N64Recomp::Context& context, size_t cur_se
     matched_funcs.clear();
 
     // Evaluate any functions with the target address to see if they're potential candidates for JAL resolution.
-    if (matching_funcs_find != context.functions_by_vram.end()) {
-        for (size_t target_func_index : matching_funcs_find->second) {
-            const auto& target_func = context.functions[target_func_index];
-
-            // Zero-sized symbol handling. unless there's only one matching target.
-            if (target_func.words.empty()) {
-                if (!N64Recomp::is_manual_patch_symbol(target_func.vram)) {
-                    continue;
-                }
-            }
+    for (size_t target_func_index : matching_funcs) {
+        const auto& target_func = context.functions[target_func_index];
 
-            // Immediately accept a function in the same section as this one, since it must also be loaded if the current function is.
-            if (target_func.section_index == cur_section_index) {
-                exact_match_found = true;
-                matched_funcs.clear();
-                matched_funcs.push_back(target_func_index);
-                break;
+        // Zero-sized symbol handling. unless there's only one matching target.
+        if (target_func.words.empty()) {
+            if (!N64Recomp::is_manual_patch_symbol(target_func.vram)) {
+                continue;
             }
+        }
 
-            // If the function's section isn't relocatable, add the function as a candidate.
-            const auto& target_func_section = context.sections[target_func.section_index];
-            if (!target_func_section.relocatable) {
-                matched_funcs.push_back(target_func_index);
-            }
+        // Immediately accept a function in the same section as this one, since it must also be loaded if the current function is.
+        if (target_func.section_index == cur_section_index) {
+            exact_match_found = true;
+            matched_funcs.clear();
+            matched_funcs.push_back(target_func_index);
+            break;
+        }
+
+        // If the function's section isn't relocatable, add the function as a candidate.
+        const auto& target_func_section = context.sections[target_func.section_index];
+        if (!target_func_section.relocatable) {
+            matched_funcs.push_back(target_func_index);
         }
     }
 
@@ -112,7 +124,7 @@ std::string_view ctx_gpr_prefix(int reg) {
 }
 
 template <typename GeneratorType>
-bool process_instruction(GeneratorType& generator, const N64Recomp::Context& context, const N64Recomp::Function& func, size_t func_index, const N64Recomp::FunctionStats& stats, const std::unordered_set<uint32_t>& jtbl_lw_instructions, size_t instr_index, const std::vector<rabbitizer::InstructionCpu>& instructions, std::ostream& output_file, bool indent, bool emit_link_branch, int link_branch_index, size_t reloc_index, bool& needs_link_branch, bool& is_branch_likely, bool tag_reference_relocs, std::span<std::vector<uint32_t>> static_funcs_out) {
+bool process_instruction(GeneratorType& generator, const N64Recomp::Context& context, const N64Recomp::Function& func, size_t func_index, const N64Recomp::FunctionStats& stats, std::span<const uint32_t> jtbl_lw_instructions, size_t instr_index, const std::vector<rabbitizer::InstructionCpu>& instructions, std::ostream& output_file, bool indent, bool emit_link_branch, int link_branch_index, size_t reloc_index, bool& needs_link_branch, bool& is_branch_likely, bool tag_reference_relocs, std::span<std::vector<uint32_t>> static_funcs_out, std::span<const N64Recomp::OptimizedInstruction> optimized_instructions) {
     using namespace N64Recomp;
 
     const auto& section = context.sections[func.section_index];
@@ -144,9 +156,25 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
         generator.emit_comment(fmt::format("0x{:08X}: {}", instr_vram, instr.disassemble(0)));
     }
 
+    // Apply the result of the optimization pass if this instruction was changed by it.
+    if (!optimized_instructions.empty() && optimized_instructions[instr_index].action != InstructionAction::Emit) {
+        const OptimizedInstruction& optimized = optimized_instructions[instr_index];
+        if (optimized.action == InstructionAction::LoadConstant) {
+            print_indent();
+            generator.emit_load_constant(optimized.reg, optimized.constant);
+        }
+
+        if (emit_link_branch) {
+            print_indent();
+            generator.emit_label(link_return_label(link_branch_index));
+        }
+
+        return true;
+    }
+
     // Replace loads for jump table entries into addiu. This leaves the jump table entry's address in the output register
     // instead of the entry's value, which can then be used to determine the offset from the start of the jump table.
-    if (jtbl_lw_instructions.contains(instr_vram)) {
+    if (std::binary_search(jtbl_lw_instructions.begin(), jtbl_lw_instructions.end(), instr_vram)) {
         assert(instr_id == InstrId::cpu_lw);
         instr_id = InstrId::cpu_addiu;
     }
@@ -215,7 +243,7 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
             if (reloc_index + 1 < section.relocs.size() && next_vram > section.relocs[reloc_index].address) {
                 next_reloc_index++;
             }
-            if (!process_instruction(generator, context, func, func_index, stats, jtbl_lw_instructions, instr_index + 1, instructions, output_file, use_indent, false, link_branch_index, next_reloc_index, dummy_needs_link_branch, dummy_is_branch_likely, tag_reference_relocs, static_funcs_out)) {
+            if (!process_instruction(generator, context, func, func_index, stats, jtbl_lw_instructions, instr_index + 1, instructions, output_file, use_indent, false, link_branch_index, next_reloc_index, dummy_needs_link_branch, dummy_is_branch_likely, tag_reference_relocs, static_funcs_out, optimized_instructions)) {
                 return false;
             }
         }
@@ -225,7 +253,7 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
     auto print_link_branch = [&]() {
         if (needs_link_branch) {
             print_indent();
-            generator.emit_goto(fmt::format("after_{}", link_branch_index));
+            generator.emit_goto(link_return_label(link_branch_index));
         }
     };
 
@@ -239,7 +267,7 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
         return true;
     };
 
-    auto print_goto_with_delay_slot = [&](const std::string& target) {
+    auto print_goto_with_delay_slot = [&](const N64Recomp::Label& target) {
         if (!process_delay_slot(false)) {
             return false;
         }
@@ -361,7 +389,7 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
         if (branch_target < func.vram || branch_target >= func_vram_end) {
             // If the branch target is the start of some known function, this can be handled as a tail call.
             // FIXME: how to deal with static functions?
-            if (context.functions_by_vram.find(branch_target) != context.functions_by_vram.end()) {
+            if (!context.get_functions_at_vram(branch_target).empty()) {
                 fmt::print("Tail call in {} to 0x{:08X}\n", func.name, branch_target);
                 if (!print_func_call_by_address(branch_target, true, true)) {
                     return false;
@@ -383,12 +411,12 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
 
         print_indent();
         print_indent();
-        generator.emit_goto(fmt::format("L_{:08X}", branch_target));
+        generator.emit_goto(instruction_label(func, branch_target));
         // TODO check if this link branch ever exists.
         if (needs_link_branch) {
             print_indent();
             print_indent();
-            generator.emit_goto(fmt::format("after_{}", link_branch_index));
+            generator.emit_goto(link_return_label(link_branch_index));
         }
         return true;
     };
@@ -496,7 +524,7 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
             }
             // Check if the branch is within this function
             else if (branch_target >= func.vram && branch_target < func_vram_end) {
-                print_goto_with_delay_slot(fmt::format("L_{:08X}", branch_target));
+                print_goto_with_delay_slot(instruction_label(func, branch_target));
             }
             // This may be a tail call in the middle of the control flow due to a previous check
             // For example:
@@ -510,7 +538,7 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
             // }
             // ```
             // FIXME: how to deal with static functions?
-            else if (context.functions_by_vram.find(branch_target) != context.functions_by_vram.end()) {
+            else if (!context.get_functions_at_vram(branch_target).empty()) {
                 fmt::print("[Info] Tail call in {} to 0x{:08X}\n", func.name, branch_target);
                 if (!print_func_call_by_address(branch_target, true)) {
                     return false;
@@ -543,7 +571,7 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
                 for (size_t entry_index = 0; entry_index < cur_jtbl.entries.size(); entry_index++) {
                     print_indent();
                     print_indent();
-                    generator.emit_case(entry_index, fmt::format("L_{:08X}", cur_jtbl.entries[entry_index]));
+                    generator.emit_case(entry_index, instruction_label(func, cur_jtbl.entries[entry_index]));
                 }
                 print_indent();
                 print_indent();
@@ -608,29 +636,54 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
     instruction_context.reloc_type = reloc_type;
     instruction_context.reloc_section_index = reloc_section;
     instruction_context.reloc_target_section_offset = reloc_target_section_offset;
+    instruction_context.reuse_base_address = !optimized_instructions.empty() && optimized_instructions[instr_index].reuse_base_address;
     
-    auto do_check_fr = [](const GeneratorType& generator, const InstructionContext& ctx, Operand operand) {
+    // Start from the checks that earlier instructions in this block are known to have done, unless the analysis was skipped for strict checks.
+    bool elide_fpu_checks = !stats.fpu_checks.empty();
+    N64Recomp::FpuCheckState fpu_checks = elide_fpu_checks ? stats.fpu_checks[instr_index] : N64Recomp::FpuCheckState{};
+
+    auto check_fr = [&](int reg) {
+        // Even registers always pass the check, and odd registers only need to be checked once as the FR bit can't change within a block.
+        if (elide_fpu_checks && ((reg & 1) == 0 || fpu_checks.fr_checked)) {
+            return;
+        }
+        generator.emit_check_fr(reg);
+        if ((reg & 1) != 0) {
+            fpu_checks.fr_checked = true;
+        }
+    };
+
+    auto check_nan = [&](int reg, bool is_double) {
+        uint32_t& checked = is_double ? fpu_checks.nan_checked_double : fpu_checks.nan_checked_float;
+        if (elide_fpu_checks && (checked & (1U << reg)) != 0) {
+            return;
+        }
+        generator.emit_check_nan(reg, is_double);
+        checked |= 1U << reg;
+    };
+
+    auto do_check_fr = [&check_fr](const InstructionContext& ctx, Operand operand) {
         switch (operand) {
             case Operand::Fd:
             case Operand::FdDouble:
             case Operand::FdU32L:
             case Operand::FdU32H:
             case Operand::FdU64:
-                generator.emit_check_fr(ctx.fd);
+                check_fr(ctx.fd);
                 break;
             case Operand::Fs:
             case Operand::FsDouble:
             case Operand::FsU32L:
             case Operand::FsU32H:
             case Operand::FsU64:
-                generator.emit_check_fr(ctx.fs);
+                check_fr(ctx.fs);
                 break;
             case Operand::Ft:
             case Operand::FtDouble:
             case Operand::FtU32L:
             case Operand::FtU32H:
             case Operand::FtU64:
-                generator.emit_check_fr(ctx.ft);
+                check_fr(ctx.ft);
                 break;
             default:
                 // No MIPS3 float check needed for non-float operands.
@@ -638,25 +691,25 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
         }
     };
     
-    auto do_check_nan = [](const GeneratorType& generator, const InstructionContext& ctx, Operand operand) {
+    auto do_check_nan = [&check_nan](const InstructionContext& ctx, Operand operand) {
         switch (operand) {
             case Operand::Fd:
-                generator.emit_check_nan(ctx.fd, false);
+                check_nan(ctx.fd, false);
                 break;
             case Operand::Fs:
-                generator.emit_check_nan(ctx.fs, false);
+                check_nan(ctx.fs, false);
                 break;
             case Operand::Ft:
-                generator.emit_check_nan(ctx.ft, false);
+                check_nan(ctx.ft, false);
                 break;
             case Operand::FdDouble:
-                generator.emit_check_nan(ctx.fd, true);
+                check_nan(ctx.fd, true);
                 break;
             case Operand::FsDouble:
-                generator.emit_check_nan(ctx.fs, true);
+                check_nan(ctx.fs, true);
                 break;
             case Operand::FtDouble:
-                generator.emit_check_nan(ctx.ft, true);
+                check_nan(ctx.ft, true);
                 break;
             default:
                 // No NaN checks needed for non-float operands.
@@ -670,14 +723,14 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
         const BinaryOp& op = find_binary_it->second;
         
         if (op.check_fr) {
-            do_check_fr(generator, instruction_context, op.output);
-            do_check_fr(generator, instruction_context, op.operands.operands[0]);
-            do_check_fr(generator, instruction_context, op.operands.operands[1]);
+            do_check_fr(instruction_context, op.output);
+            do_check_fr(instruction_context, op.operands.operands[0]);
+            do_check_fr(instruction_context, op.operands.operands[1]);
         }
 
         if (op.check_nan) {
-            do_check_nan(generator, instruction_context, op.operands.operands[0]);
-            do_check_nan(generator, instruction_context, op.operands.operands[1]);
+            do_check_nan(instruction_context, op.operands.operands[0]);
+            do_check_nan(instruction_context, op.operands.operands[1]);
             fmt::print(output_file, "\n");
             print_indent();
         }
@@ -692,12 +745,12 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
         const UnaryOp& op = find_unary_it->second;
         
         if (op.check_fr) {
-            do_check_fr(generator, instruction_context, op.output);
-            do_check_fr(generator, instruction_context, op.input);
+            do_check_fr(instruction_context, op.output);
+            do_check_fr(instruction_context, op.input);
         }
 
         if (op.check_nan) {
-            do_check_nan(generator, instruction_context, op.input);
+            do_check_nan(instruction_context, op.input);
             fmt::print(output_file, "\n");
             print_indent();
         }
@@ -738,7 +791,7 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
         const StoreOp& op = find_store_it->second;
 
         if (op.type == StoreOpType::SDC1) {
-            do_check_fr(generator, instruction_context, op.value_input);
+            do_check_fr(instruction_context, op.value_input);
         }
 
         generator.process_store_op(op, instruction_context);
@@ -753,17 +806,29 @@ bool process_instruction(GeneratorType& generator, const N64Recomp::Context& con
     // TODO is this used?
     if (emit_link_branch) {
         print_indent();
-        generator.emit_label(fmt::format("after_{}", link_branch_index));
+        generator.emit_label(link_return_label(link_branch_index));
     }
 
     return true;
 }
 
+// Buffers used while recompiling a function. These are kept per thread and reused for every function to avoid reallocating them each time.
+struct RecompilationWorkspace {
+    std::vector<rabbitizer::InstructionCpu> instructions;
+    // Sorted and deduplicated after all labels have been collected.
+    std::vector<uint32_t> branch_labels;
+    // Sorted so that it can be binary searched.
+    std::vector<uint32_t> jtbl_lw_instructions;
+    std::vector<N64Recomp::OptimizedInstruction> optimized_instructions;
+};
+
 template <typename GeneratorType>
-bool recompile_function_impl(GeneratorType& generator, const N64Recomp::Context& context, size_t func_index, std::ostream& output_file, std::span<std::vector<uint32_t>> static_funcs_out, bool tag_reference_relocs) {
+bool recompile_function_impl(GeneratorType& generator, const N64Recomp::Context& context, size_t func_index, std::ostream& output_file, std::span<std::vector<uint32_t>> static_funcs_out, bool tag_reference_relocs, std::vector<N64Recomp::JumpTable>* jump_tables_out) {
     const N64Recomp::Function& func = context.functions[func_index];
     //fmt::print("Recompiling {}\n", func.name);
-    std::vector<rabbitizer::InstructionCpu> instructions;
+    thread_local RecompilationWorkspace workspace{};
+    std::vector<rabbitizer::InstructionCpu>& instructions = workspace.instructions;
+    instructions.clear();
 
     generator.emit_function_start(func.name, func_index);
 
@@ -773,10 +838,14 @@ bool recompile_function_impl(GeneratorType& generator, const N64Recomp::Context&
             func.name);
     }
 
+    if (context.profile_mode) {
+        generator.emit_profile_entry(func_index);
+    }
+
     // Skip analysis and recompilation of this function is stubbed.
     if (!func.stubbed) {
-        // Use a set to sort and deduplicate labels
-        std::set<uint32_t> branch_labels;
+        std::vector<uint32_t>& branch_labels = workspace.branch_labels;
+        branch_labels.clear();
         instructions.reserve(func.words.size());
 
         auto hook_find = func.function_hooks.find(-1);
@@ -791,7 +860,7 @@ bool recompile_function_impl(GeneratorType& generator, const N64Recomp::Context&
 
             // If this is a branch or a direct jump, add it to the local label list
             if (instr.isBranch() || instr.getUniqueId() == rabbitizer::InstrId::UniqueId::cpu_j) {
-                branch_labels.insert((uint32_t)instr.getBranchVramGeneric());
+                branch_labels.push_back((uint32_t)instr.getBranchVramGeneric());
             }
 
             // Advance the vram address by the size of one instruction
@@ -806,15 +875,28 @@ bool recompile_function_impl(GeneratorType& generator, const N64Recomp::Context&
             return false;
         }
 
-        std::unordered_set<uint32_t> jtbl_lw_instructions{};
+        std::vector<uint32_t>& jtbl_lw_instructions = workspace.jtbl_lw_instructions;
+        jtbl_lw_instructions.clear();
 
         // Add jump table labels into function
         for (const auto& jtbl : stats.jump_tables) {
-            jtbl_lw_instructions.insert(jtbl.lw_vram);
-            for (uint32_t jtbl_entry : jtbl.entries) {
-                branch_labels.insert(jtbl_entry);
-            }
+            jtbl_lw_instructions.push_back(jtbl.lw_vram);
+            branch_labels.insert(branch_labels.end(), jtbl.entries.begin(), jtbl.entries.end());
+        }
+        std::sort(jtbl_lw_instructions.begin(), jtbl_lw_instructions.end());
+
+        // Sort and deduplicate labels
+        std::sort(branch_labels.begin(), branch_labels.end());
+        branch_labels.erase(std::unique(branch_labels.begin(), branch_labels.end()), branch_labels.end());
+
+        // Run the optimization pass if it's enabled.
+        std::vector<N64Recomp::OptimizedInstruction>& optimized_instructions = workspace.optimized_instructions;
+        optimized_instructions.clear();
+        if (context.optimize_codegen) {
+            N64Recomp::optimize_function(context, func, instructions, stats, branch_labels, optimized_instructions);
         }
+        // This doesn't change the generated instructions, so it runs even if the optimization pass is disabled.
+        N64Recomp::find_memory_runs(context, func, instructions, stats, branch_labels, optimized_instructions);
 
         // Second pass, emit code for each instruction and emit labels
         auto cur_label = branch_labels.cbegin();
@@ -824,17 +906,18 @@ bool recompile_function_impl(GeneratorType& generator, const N64Recomp::Context&
         bool needs_link_branch = false;
         bool in_likely_delay_slot = false;
         const auto& section = context.sections[func.section_index];
-        size_t reloc_index = 0;
+        // Start at the function's first reloc instead of walking the section's relocs from the beginning.
+        size_t reloc_index = std::min(section.find_first_reloc(func.vram), section.relocs.empty() ? 0 : section.relocs.size() - 1);
         for (size_t instr_index = 0; instr_index < instructions.size(); ++instr_index) {
             bool had_link_branch = needs_link_branch;
             bool is_branch_likely = false;
             // If we're in the delay slot of a likely instruction, emit a goto to skip the instruction before any labels
             if (in_likely_delay_slot) {
-                generator.emit_goto(fmt::format("skip_{}", num_likely_branches));
+                generator.emit_goto(likely_skip_label(num_likely_branches));
             }
             // If there are any other branch labels to insert and we're at the next one, insert it
             if (cur_label != branch_labels.end() && vram >= *cur_label) {
-                generator.emit_label(fmt::format("L_{:08X}", *cur_label));
+                generator.emit_label(instruction_label(func, *cur_label));
                 ++cur_label;
             }
 
@@ -844,7 +927,7 @@ bool recompile_function_impl(GeneratorType& generator, const N64Recomp::Context&
             }
 
             // Process the current instruction and check for errors
-            if (process_instruction(generator, context, func, func_index, stats, jtbl_lw_instructions, instr_index, instructions, output_file, false, needs_link_branch, num_link_branches, reloc_index, needs_link_branch, is_branch_likely, tag_reference_relocs, static_funcs_out) == false) {
+            if (process_instruction(generator, context, func, func_index, stats, jtbl_lw_instructions, instr_index, instructions, output_file, false, needs_link_branch, num_link_branches, reloc_index, needs_link_branch, is_branch_likely, tag_reference_relocs, static_funcs_out, optimized_instructions) == false) {
                 fmt::print(stderr, "Error in recompiling {}, clearing output file\n", func.name);
                 output_file.clear();
                 return false;
@@ -856,7 +939,7 @@ bool recompile_function_impl(GeneratorType& generator, const N64Recomp::Context&
             // Now that the instruction has been processed, emit a skip label for the likely branch if needed
             if (in_likely_delay_slot) {
                 fmt::print(output_file, "    ");
-                generator.emit_label(fmt::format("skip_{}", num_likely_branches));
+                generator.emit_label(likely_skip_label(num_likely_branches));
                 num_likely_branches++;
             }
             // Mark the next instruction as being in a likely delay slot if the 
@@ -864,6 +947,10 @@ bool recompile_function_impl(GeneratorType& generator, const N64Recomp::Context&
             // Advance the vram address by the size of one instruction
             vram += 4;
         }
+
+        if (jump_tables_out != nullptr) {
+            *jump_tables_out = std::move(stats.jump_tables);
+        }
     }
 
     // Terminate the function
@@ -872,12 +959,138 @@ bool recompile_function_impl(GeneratorType& generator, const N64Recomp::Context&
     return true;
 }
 
+// Stream buffer that appends everything written to it to a memory buffer. There's no put area, so every write goes straight
+// to the memory buffer and stays ordered with the output that the generator appends to it directly.
+class MemoryBufferStreambuf : public std::streambuf {
+public:
+    MemoryBufferStreambuf(fmt::memory_buffer& buffer) : buffer(buffer) {}
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize count) override {
+        buffer.append(s, s + count);
+        return count;
+    }
+    int_type overflow(int_type ch) override {
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            buffer.push_back(traits_type::to_char_type(ch));
+        }
+        return traits_type::not_eof(ch);
+    }
+private:
+    fmt::memory_buffer& buffer;
+};
+
 // Wrap the templated function with CGenerator as the template parameter.
-bool N64Recomp::recompile_function(const N64Recomp::Context& context, size_t function_index, std::ostream& output_file, std::span<std::vector<uint32_t>> static_funcs_out, bool tag_reference_relocs) {
-    CGenerator generator{output_file};
-    return recompile_function_impl(generator, context, function_index, output_file, static_funcs_out, tag_reference_relocs);
+bool N64Recomp::recompile_function(const N64Recomp::Context& context, size_t function_index, fmt::memory_buffer& output_buffer, std::span<std::vector<uint32_t>> static_funcs_out, bool tag_reference_relocs, std::vector<JumpTable>* jump_tables_out) {
+    MemoryBufferStreambuf output_streambuf{output_buffer};
+    std::ostream output_file{&output_streambuf};
+    CGenerator generator{output_buffer, false, context.hoist_section_addresses};
+    return recompile_function_impl(generator, context, function_index, output_file, static_funcs_out, tag_reference_relocs, jump_tables_out);
+}
+
+bool N64Recomp::recompile_function(const N64Recomp::Context& context, size_t function_index, std::ostream& output_file, std::span<std::vector<uint32_t>> static_funcs_out, bool tag_reference_relocs, std::vector<JumpTable>* jump_tables_out) {
+    // Render the function into memory and write it out in one go. Use a thread local to reuse the buffer's allocation across functions.
+    thread_local fmt::memory_buffer output_buffer{};
+    output_buffer.clear();
+    bool result = recompile_function(context, function_index, output_buffer, static_funcs_out, tag_reference_relocs, jump_tables_out);
+    output_file.write(output_buffer.data(), output_buffer.size());
+    return result;
+}
+
+bool N64Recomp::recompile_function_inline_copy(const N64Recomp::Context& context, size_t function_index, fmt::memory_buffer& output_buffer) {
+    MemoryBufferStreambuf output_streambuf{output_buffer};
+    std::ostream output_file{&output_streambuf};
+    CGenerator generator{output_buffer, true, context.hoist_section_addresses};
+    // Inlinable functions don't call anything, so they can't produce any static functions.
+    std::vector<std::vector<uint32_t>> static_funcs{};
+    static_funcs.resize(context.sections.size());
+    return recompile_function_impl(generator, context, function_index, output_file, static_funcs, false, nullptr);
+}
+
+void N64Recomp::find_inlinable_functions(Context& context, size_t max_instructions, std::span<const size_t> excluded_funcs) {
+    using InstrId = rabbitizer::InstrId::UniqueId;
+
+    // Functions that the runtime can redirect calls to or from need to keep every call going through the original function.
+    std::vector<uint8_t> excluded(context.functions.size(), false);
+    for (const FunctionReplacement& replacement : context.replacements) {
+        excluded[replacement.func_index] = true;
+    }
+    for (const FunctionHook& hook : context.hooks) {
+        excluded[hook.func_index] = true;
+    }
+    for (size_t func_index : context.exported_funcs) {
+        excluded[func_index] = true;
+    }
+    for (const Callback& callback : context.callbacks) {
+        excluded[callback.function_index] = true;
+    }
+    for (size_t func_index : excluded_funcs) {
+        excluded[func_index] = true;
+    }
+
+    // Walk every function to find the leaves and the functions that get called directly.
+    std::vector<uint8_t> leaf(context.functions.size(), false);
+    std::vector<uint8_t> called(context.functions.size(), false);
+    for (size_t func_index = 0; func_index < context.functions.size(); func_index++) {
+        const Function& func = context.functions[func_index];
+        if (func.ignored || func.words.empty()) {
+            continue;
+        }
+        uint32_t func_vram_end = func.vram + func.words.size() * sizeof(func.words[0]);
+        bool is_leaf = true;
+
+        // Resolves a call or tail call in the same way as process_instruction and adds it to the call graph.
+        auto add_call = [&](uint32_t target_vram) {
+            size_t matched_func_index = 0;
+            if (resolve_jal(context, func.section_index, target_vram, matched_func_index) == JalResolutionResult::Match) {
+                called[matched_func_index] = true;
+            }
+            is_leaf = false;
+        };
+
+        uint32_t vram = func.vram;
+        for (uint32_t word : func.words) {
+            rabbitizer::InstructionCpu instr{ byteswap(word), vram };
+            InstrId instr_id = instr.getUniqueId();
+            if (instr_id == InstrId::cpu_jal) {
+                add_call((uint32_t)instr.getBranchVramGeneric());
+            }
+            else if (instr_id == InstrId::cpu_j || instr.isBranch()) {
+                uint32_t target_vram = (uint32_t)instr.getBranchVramGeneric();
+                auto find_branch_it = conditional_branch_ops.find(instr_id);
+                if (find_branch_it != conditional_branch_ops.end() && find_branch_it->second.link) {
+                    add_call(target_vram);
+                }
+                else if (target_vram < func.vram || target_vram >= func_vram_end) {
+                    add_call(target_vram);
+                }
+            }
+            else if (instr_id == InstrId::cpu_jr) {
+                // Anything other than a return is either a jump table or a tail call, so only allow returns to keep the analysis simple.
+                if ((int)instr.GetO32_rs() != (int)rabbitizer::Registers::Cpu::GprO32::GPR_O32_ra) {
+                    is_leaf = false;
+                }
+            }
+            else if (instr_id == InstrId::cpu_jalr || instr_id == InstrId::cpu_syscall || instr_id == InstrId::cpu_break) {
+                is_leaf = false;
+            }
+            vram += 4;
+        }
+        leaf[func_index] = is_leaf;
+    }
+
+    context.inlinable_functions.assign(context.functions.size(), false);
+    for (size_t func_index = 0; func_index < context.functions.size(); func_index++) {
+        const Function& func = context.functions[func_index];
+        const std::string& section_name = context.sections[func.section_index].name;
+        bool special_section = section_name == PatchSectionName || section_name == ForcedPatchSectionName ||
+            section_name == ExportSectionName || section_name == EventSectionName;
+
+        context.inlinable_functions[func_index] = leaf[func_index] && called[func_index] && !excluded[func_index] &&
+            !func.stubbed && !func.reimplemented && func.function_hooks.empty() && !special_section &&
+            func.words.size() <= max_instructions;
+    }
 }
 
 bool N64Recomp::recompile_function_custom(Generator& generator, const Context& context, size_t function_index, std::ostream& output_file, std::span<std::vector<uint32_t>> static_funcs_out, bool tag_reference_relocs) {
-    return recompile_function_impl(generator, context, function_index, output_file, static_funcs_out, tag_reference_relocs);
+    return recompile_function_impl(generator, context, function_index, output_file, static_funcs_out, tag_reference_relocs, nullptr);
 }
@@ -0,0 +1,324 @@
+#include <cstring>
+#include <fstream>
+
+#include "fmt/format.h"
+
+#include "symbol_cache.h"
+#include "recompiler/hasher.h"
+
+struct SymbolCacheHeader {
+    char magic[8]; // N64RSYMC
+    uint32_t version;
+    uint32_t kind;
+    uint64_t source_hash;
+    uint64_t source_size;
+    // Hash of everything after the header, used to detect a corrupt cache.
+    uint64_t data_hash;
+    uint32_t num_sections;
+    uint32_t num_functions;
+    uint32_t num_relocs;
+    uint32_t string_data_size;
+};
+
+enum class SymbolCacheSectionFlags : uint32_t {
+    HasRomAddr = 1 << 0,
+    HasGotAddr = 1 << 1,
+    HasRelocs = 1 << 2,
+};
+
+struct SymbolCacheSectionV1 {
+    uint32_t flags;
+    uint32_t rom_addr;
+    uint32_t ram_addr;
+    uint32_t size;
+    uint32_t got_ram_addr;
+    uint32_t name_start;
+    uint32_t name_size;
+    uint32_t num_functions;
+    uint32_t num_relocs;
+};
+
+struct SymbolCacheFunctionV1 {
+    uint32_t name_start;
+    uint32_t name_size;
+    uint32_t vram;
+    uint32_t size;
+};
+
+struct SymbolCacheRelocV1 {
+    uint32_t vram;
+    uint32_t target_vram;
+    uint32_t type;
+};
+
+// Bump this whenever the cache layout or the contents of a parsed symbol file change, which invalidates all existing caches.
+constexpr uint32_t symbol_cache_version = 1;
+
+static const char symbol_cache_magic[] = {'N','6','4','R','S','Y','M','C'};
+static_assert(sizeof(symbol_cache_magic) == sizeof(SymbolCacheHeader::magic));
+
+static bool has_flag(uint32_t flags, SymbolCacheSectionFlags flag) {
+    return (flags & static_cast<uint32_t>(flag)) != 0;
+}
+
+static std::filesystem::path get_cache_path(const std::filesystem::path& symbol_file_path) {
+    std::filesystem::path ret = symbol_file_path;
+    ret += ".symcache";
+    return ret;
+}
+
+template <typename T>
+static std::span<const T> get_cache_array(std::span<const uint8_t> data, size_t& offset, size_t count) {
+    if (offset + sizeof(T) * count > data.size()) {
+        return {};
+    }
+    std::span<const T> ret{ reinterpret_cast<const T*>(data.data() + offset), count };
+    offset += sizeof(T) * count;
+    return ret;
+}
+
+// Parses a symbol cache. Returns false if the cache is malformed or doesn't match the given symbol file contents.
+static bool parse_symbol_cache(std::span<const uint8_t> data, N64Recomp::SymbolFileKind kind, uint64_t source_hash, uint64_t source_size, N64Recomp::SymbolFile& out) {
+    if (data.size() < sizeof(SymbolCacheHeader)) {
+        return false;
+    }
+
+    const SymbolCacheHeader* header = reinterpret_cast<const SymbolCacheHeader*>(data.data());
+    if (memcmp(header->magic, symbol_cache_magic, sizeof(symbol_cache_magic)) != 0 ||
+        header->version != symbol_cache_version ||
+        header->kind != static_cast<uint32_t>(kind) ||
+        header->source_hash != source_hash ||
+        header->source_size != source_size)
+    {
+        return false;
+    }
+
+    N64Recomp::Hasher hasher{};
+    hasher.add_bytes(data.data() + sizeof(SymbolCacheHeader), data.size() - sizeof(SymbolCacheHeader));
+    if (hasher.get() != header->data_hash) {
+        return false;
+    }
+
+    size_t offset = sizeof(SymbolCacheHeader);
+    std::span<const SymbolCacheSectionV1> sections = get_cache_array<SymbolCacheSectionV1>(data, offset, header->num_sections);
+    std::span<const SymbolCacheFunctionV1> functions = get_cache_array<SymbolCacheFunctionV1>(data, offset, header->num_functions);
+    std::span<const SymbolCacheRelocV1> relocs = get_cache_array<SymbolCacheRelocV1>(data, offset, header->num_relocs);
+    std::span<const uint8_t> string_data = get_cache_array<uint8_t>(data, offset, header->string_data_size);
+
+    if (sections.size() != header->num_sections || functions.size() != header->num_functions ||
+        relocs.size() != header->num_relocs || string_data.size() != header->string_data_size || offset != data.size())
+    {
+        return false;
+    }
+
+    auto get_string = [string_data](uint32_t start, uint32_t size, std::string& str_out) {
+        if ((uint64_t)start + size > string_data.size()) {
+            return false;
+        }
+        str_out.assign(reinterpret_cast<const char*>(string_data.data()) + start, size);
+        return true;
+    };
+
+    N64Recomp::SymbolFile ret{};
+    ret.sections.resize(sections.size());
+
+    size_t function_index = 0;
+    size_t reloc_index = 0;
+    for (size_t section_index = 0; section_index < sections.size(); section_index++) {
+        const SymbolCacheSectionV1& section_in = sections[section_index];
+        N64Recomp::SymbolFileSection& section_out = ret.sections[section_index];
+
+        if (section_in.num_functions > functions.size() - function_index || section_in.num_relocs > relocs.size() - reloc_index) {
+            return false;
+        }
+
+        if (!get_string(section_in.name_start, section_in.name_size, section_out.name)) {
+            return false;
+        }
+        if (has_flag(section_in.flags, SymbolCacheSectionFlags::HasRomAddr)) {
+            section_out.rom_addr = section_in.rom_addr;
+        }
+        if (has_flag(section_in.flags, SymbolCacheSectionFlags::HasGotAddr)) {
+            section_out.got_ram_addr = section_in.got_ram_addr;
+        }
+        section_out.has_relocs = has_flag(section_in.flags, SymbolCacheSectionFlags::HasRelocs);
+        section_out.ram_addr = section_in.ram_addr;
+        section_out.size = section_in.size;
+
+        section_out.functions.resize(section_in.num_functions);
+        for (N64Recomp::SymbolFileFunction& func_out : section_out.functions) {
+            const SymbolCacheFunctionV1& func_in = functions[function_index++];
+            if (!get_string(func_in.name_start, func_in.name_size, func_out.name)) {
+                return false;
+            }
+            func_out.vram = func_in.vram;
+            func_out.size = func_in.size;
+        }
+
+        section_out.relocs.resize(section_in.num_relocs);
+        for (N64Recomp::SymbolFileReloc& reloc_out : section_out.relocs) {
+            const SymbolCacheRelocV1& reloc_in = relocs[reloc_index++];
+            reloc_out.vram = reloc_in.vram;
+            reloc_out.target_vram = reloc_in.target_vram;
+            reloc_out.type = static_cast<N64Recomp::RelocType>(reloc_in.type);
+        }
+    }
+
+    if (function_index != functions.size() || reloc_index != relocs.size()) {
+        return false;
+    }
+
+    out = std::move(ret);
+    return true;
+}
+
+template <typename T>
+static void append_cache_data(std::vector<uint8_t>& output, const T& value) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    output.insert(output.end(), bytes, bytes + sizeof(T));
+}
+
+static std::vector<uint8_t> symbol_cache_to_bin(const N64Recomp::SymbolFile& symbol_file, N64Recomp::SymbolFileKind kind, uint64_t source_hash, uint64_t source_size) {
+    size_t num_functions = 0;
+    size_t num_relocs = 0;
+    for (const N64Recomp::SymbolFileSection& section : symbol_file.sections) {
+        num_functions += section.functions.size();
+        num_relocs += section.relocs.size();
+    }
+
+    std::vector<SymbolCacheSectionV1> sections_out{};
+    std::vector<SymbolCacheFunctionV1> functions_out{};
+    std::vector<SymbolCacheRelocV1> relocs_out{};
+    std::string string_data{};
+    sections_out.reserve(symbol_file.sections.size());
+    functions_out.reserve(num_functions);
+    relocs_out.reserve(num_relocs);
+
+    auto add_string = [&string_data](const std::string& str, uint32_t& start_out, uint32_t& size_out) {
+        start_out = static_cast<uint32_t>(string_data.size());
+        size_out = static_cast<uint32_t>(str.size());
+        string_data += str;
+    };
+
+    for (const N64Recomp::SymbolFileSection& section : symbol_file.sections) {
+        SymbolCacheSectionV1& section_out = sections_out.emplace_back();
+        section_out.flags =
+            (section.rom_addr.has_value() ? static_cast<uint32_t>(SymbolCacheSectionFlags::HasRomAddr) : 0) |
+            (section.got_ram_addr.has_value() ? static_cast<uint32_t>(SymbolCacheSectionFlags::HasGotAddr) : 0) |
+            (section.has_relocs ? static_cast<uint32_t>(SymbolCacheSectionFlags::HasRelocs) : 0);
+        section_out.rom_addr = section.rom_addr.value_or(0);
+        section_out.ram_addr = section.ram_addr;
+        section_out.size = section.size;
+        section_out.got_ram_addr = section.got_ram_addr.value_or(0);
+        add_string(section.name, section_out.name_start, section_out.name_size);
+        section_out.num_functions = static_cast<uint32_t>(section.functions.size());
+        section_out.num_relocs = static_cast<uint32_t>(section.relocs.size());
+
+        for (const N64Recomp::SymbolFileFunction& func : section.functions) {
+            SymbolCacheFunctionV1& func_out = functions_out.emplace_back();
+            add_string(func.name, func_out.name_start, func_out.name_size);
+            func_out.vram = func.vram;
+            func_out.size = func.size;
+        }
+
+        for (const N64Recomp::SymbolFileReloc& reloc : section.relocs) {
+            relocs_out.emplace_back(SymbolCacheRelocV1{
+                .vram = reloc.vram,
+                .target_vram = reloc.target_vram,
+                .type = static_cast<uint32_t>(reloc.type)
+            });
+        }
+    }
+
+    SymbolCacheHeader header{};
+    memcpy(header.magic, symbol_cache_magic, sizeof(symbol_cache_magic));
+    header.version = symbol_cache_version;
+    header.kind = static_cast<uint32_t>(kind);
+    header.source_hash = source_hash;
+    header.source_size = source_size;
+    header.num_sections = static_cast<uint32_t>(sections_out.size());
+    header.num_functions = static_cast<uint32_t>(functions_out.size());
+    header.num_relocs = static_cast<uint32_t>(relocs_out.size());
+    header.string_data_size = static_cast<uint32_t>(string_data.size());
+
+    std::vector<uint8_t> ret{};
+    ret.reserve(sizeof(header) + sections_out.size() * sizeof(SymbolCacheSectionV1) + functions_out.size() * sizeof(SymbolCacheFunctionV1) +
+        relocs_out.size() * sizeof(SymbolCacheRelocV1) + string_data.size());
+    append_cache_data(ret, header);
+    for (const SymbolCacheSectionV1& section : sections_out) {
+        append_cache_data(ret, section);
+    }
+    for (const SymbolCacheFunctionV1& func : functions_out) {
+        append_cache_data(ret, func);
+    }
+    for (const SymbolCacheRelocV1& reloc : relocs_out) {
+        append_cache_data(ret, reloc);
+    }
+    ret.insert(ret.end(), string_data.begin(), string_data.end());
+
+    N64Recomp::Hasher hasher{};
+    hasher.add_bytes(ret.data() + sizeof(header), ret.size() - sizeof(header));
+    reinterpret_cast<SymbolCacheHeader*>(ret.data())->data_hash = hasher.get();
+
+    return ret;
+}
+
+// Writes the cache to a temporary file first and then moves it into place, so a partially written cache can never be picked up.
+static bool write_symbol_cache(const std::filesystem::path& cache_path, std::span<const uint8_t> data) {
+    std::filesystem::path temp_path = cache_path;
+    temp_path += ".tmp";
+
+    {
+        std::ofstream output_file{ temp_path, std::ios::binary };
+        if (!output_file.good()) {
+            return false;
+        }
+        output_file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!output_file.good()) {
+            output_file.close();
+            std::error_code ec;
+            std::filesystem::remove(temp_path, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, cache_path, ec);
+    if (ec) {
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool N64Recomp::read_symbol_file_cached(const std::filesystem::path& symbol_file_path, SymbolFileKind kind,
+    const std::function<bool(std::string_view contents, SymbolFile& out)>& parse, SymbolFile& out)
+{
+    RomBuffer source{};
+    if (!map_file(symbol_file_path, source)) {
+        fmt::print(stderr, "Failed to open symbol file: {}\n", symbol_file_path.string());
+        return false;
+    }
+
+    Hasher hasher{};
+    hasher.add_bytes(source.data(), source.size());
+    uint64_t source_hash = hasher.get();
+
+    std::filesystem::path cache_path = get_cache_path(symbol_file_path);
+    RomBuffer cache{};
+    if (map_file(cache_path, cache) && parse_symbol_cache(cache.span(), kind, source_hash, source.size(), out)) {
+        return true;
+    }
+
+    SymbolFile parsed{};
+    if (!parse(std::string_view{ reinterpret_cast<const char*>(source.data()), source.size() }, parsed)) {
+        return false;
+    }
+
+    if (!write_symbol_cache(cache_path, symbol_cache_to_bin(parsed, kind, source_hash, source.size()))) {
+        fmt::print(stderr, "Warning: failed to write symbol cache {}\n", cache_path.string());
+    }
+
+    out = std::move(parsed);
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef __RECOMP_SYMBOL_CACHE_H__
+#define __RECOMP_SYMBOL_CACHE_H__
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "recompiler/context.h"
+
+namespace N64Recomp {
+    struct SymbolFileFunction {
+        std::string name;
+        uint32_t vram;
+        // Always zero for data symbols.
+        uint32_t size;
+    };
+
+    struct SymbolFileReloc {
+        uint32_t vram;
+        uint32_t target_vram;
+        RelocType type;
+    };
+
+    struct SymbolFileSection {
+        std::string name;
+        std::optional<uint32_t> rom_addr;
+        uint32_t ram_addr;
+        uint32_t size;
+        std::optional<uint32_t> got_ram_addr;
+        // Whether the section had a relocs array, which marks it as relocatable even if the array is empty.
+        bool has_relocs;
+        // Functions for function symbol files, or symbols for data symbol files.
+        std::vector<SymbolFileFunction> functions;
+        std::vector<SymbolFileReloc> relocs;
+    };
+
+    // The contents of a symbol file after parsing, before they get applied to a context.
+    struct SymbolFile {
+        std::vector<SymbolFileSection> sections;
+    };
+
+    enum class SymbolFileKind : uint32_t {
+        Functions,
+        Data,
+    };
+
+    // Reads a symbol file through its binary cache, which is stored next to it with a ".symcache" extension appended to the file name.
+    // The cache is keyed by a hash of the symbol file's contents, so a stale or corrupt cache is never used. If the cache can't be used
+    // then the symbol file is parsed with the provided callback and the cache is regenerated from the result. The callback receives the
+    // file's contents and returns false if they're invalid, and may also throw a toml::parse_error which is passed through to the caller.
+    // Failing to write the cache isn't an error and only means the next load will need to parse the symbol file again.
+    // Returns false if the symbol file couldn't be read or the callback failed.
+    bool read_symbol_file_cached(const std::filesystem::path& symbol_file_path, SymbolFileKind kind,
+        const std::function<bool(std::string_view contents, SymbolFile& out)>& parse, SymbolFile& out);
+}
+
+#endif